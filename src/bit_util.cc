@@ -0,0 +1,263 @@
+#include "bit_util.h"
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define BIT_UTIL_X86_DISPATCH
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace BitUtil {
+
+static const uint8_t kBitsInByte[256] = {
+    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
+    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
+    4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
+};
+
+static inline uint64_t loadWord(const uint8_t *p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+/* Count the bits 8 bytes at a time with the SWAR algorithm,
+ * the same as the popcount in the redis project:
+ * https://github.com/antirez/redis/blob/94f2e7f/src/bitops.c#L40
+ * */
+uint64_t PopcountScalar(const uint8_t *p, size_t count) {
+  uint64_t bits = 0;
+  for (; count >= 8; p += 8, count -= 8) {
+    uint64_t word = loadWord(p);
+    word = word - ((word >> 1) & 0x5555555555555555ULL);
+    word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+    word = (word + (word >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    bits += (word * 0x0101010101010101ULL) >> 56;
+  }
+  while (count--) bits += kBitsInByte[*p++];
+  return bits;
+}
+
+#ifdef BIT_UTIL_X86_DISPATCH
+__attribute__((target("popcnt")))
+static uint64_t popcountPOPCNT(const uint8_t *p, size_t count) {
+  uint64_t bits = 0;
+  // use multiple accumulators to break the dependency between the popcnt instructions
+  uint64_t bits1 = 0, bits2 = 0, bits3 = 0;
+  for (; count >= 32; p += 32, count -= 32) {
+    bits += _mm_popcnt_u64(loadWord(p));
+    bits1 += _mm_popcnt_u64(loadWord(p + 8));
+    bits2 += _mm_popcnt_u64(loadWord(p + 16));
+    bits3 += _mm_popcnt_u64(loadWord(p + 24));
+  }
+  for (; count >= 8; p += 8, count -= 8) {
+    bits += _mm_popcnt_u64(loadWord(p));
+  }
+  while (count--) bits += kBitsInByte[*p++];
+  return bits + bits1 + bits2 + bits3;
+}
+
+// Count the bits of 32 bytes at a time by looking up the nibbles with the PSHUFB,
+// the per-byte counters were summed into 64bit lanes with the PSADBW before overflow.
+__attribute__((target("avx2,popcnt")))
+static uint64_t popcountAVX2(const uint8_t *p, size_t count) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  while (count >= 32) {
+    // each round adds at most 8 to a byte counter, so 31 rounds won't overflow
+    __m256i local = _mm256_setzero_si256();
+    for (int i = 0; i < 31 && count >= 32; i++, p += 32, count -= 32) {
+      __m256i vec = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      __m256i lo = _mm256_and_si256(vec, low_mask);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(vec, 4), low_mask);
+      local = _mm256_add_epi8(local, _mm256_shuffle_epi8(lookup, lo));
+      local = _mm256_add_epi8(local, _mm256_shuffle_epi8(lookup, hi));
+    }
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(local, _mm256_setzero_si256()));
+  }
+  uint64_t bits = static_cast<uint64_t>(_mm256_extract_epi64(total, 0))
+      + static_cast<uint64_t>(_mm256_extract_epi64(total, 1))
+      + static_cast<uint64_t>(_mm256_extract_epi64(total, 2))
+      + static_cast<uint64_t>(_mm256_extract_epi64(total, 3));
+  return bits + popcountPOPCNT(p, count);
+}
+#endif
+
+template <BitOpFlags op>
+static inline uint64_t applyWordOp(uint64_t dst, uint64_t src) {
+  switch (op) {
+    case kBitOpAnd: return dst & src;
+    case kBitOpOr: return dst | src;
+    case kBitOpXor: return dst ^ src;
+    default: return ~dst;
+  }
+}
+
+template <BitOpFlags op>
+static void bitwiseOpScalar(uint8_t *dst, const uint8_t *src, size_t count) {
+  for (; count >= 8; dst += 8, src += 8, count -= 8) {
+    uint64_t word = applyWordOp<op>(loadWord(dst), op == kBitOpNot ? 0 : loadWord(src));
+    memcpy(dst, &word, sizeof(word));
+  }
+  for (; count > 0; dst++, src++, count--) {
+    *dst = static_cast<uint8_t>(applyWordOp<op>(*dst, op == kBitOpNot ? 0 : *src));
+  }
+}
+
+#ifdef BIT_UTIL_X86_DISPATCH
+template <BitOpFlags op>
+__attribute__((target("avx2")))
+static void bitwiseOpAVX2(uint8_t *dst, const uint8_t *src, size_t count) {
+  const __m256i all_ones = _mm256_set1_epi8(static_cast<char>(0xff));
+  for (; count >= 32; dst += 32, src += 32, count -= 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst));
+    __m256i b = op == kBitOpNot ? all_ones : _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    switch (op) {
+      case kBitOpAnd: a = _mm256_and_si256(a, b); break;
+      case kBitOpOr: a = _mm256_or_si256(a, b); break;
+      default: a = _mm256_xor_si256(a, b); break;  // NOT was XOR with all ones
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), a);
+  }
+  bitwiseOpScalar<op>(dst, src, count);
+}
+#endif
+
+static bool supportAVX2() {
+#ifdef BIT_UTIL_X86_DISPATCH
+  static bool supported = []() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+template <BitOpFlags op>
+static void bitwiseOp(uint8_t *dst, const uint8_t *src, size_t count) {
+#ifdef BIT_UTIL_X86_DISPATCH
+  if (supportAVX2()) return bitwiseOpAVX2<op>(dst, src, count);
+#endif
+  bitwiseOpScalar<op>(dst, src, count);
+}
+
+void BitwiseOp(BitOpFlags op, uint8_t *dst, const uint8_t *src, size_t count) {
+  switch (op) {
+    case kBitOpAnd: return bitwiseOp<kBitOpAnd>(dst, src, count);
+    case kBitOpOr: return bitwiseOp<kBitOpOr>(dst, src, count);
+    case kBitOpXor: return bitwiseOp<kBitOpXor>(dst, src, count);
+    case kBitOpNot: return bitwiseOp<kBitOpNot>(dst, src, count);
+  }
+}
+
+static void maxBytesScalar(uint8_t *dst, const uint8_t *src, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (src[i] > dst[i]) dst[i] = src[i];
+  }
+}
+
+#ifdef BIT_UTIL_X86_DISPATCH
+__attribute__((target("avx2")))
+static void maxBytesAVX2(uint8_t *dst, const uint8_t *src, size_t count) {
+  for (; count >= 32; dst += 32, src += 32, count -= 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), _mm256_max_epu8(a, b));
+  }
+  maxBytesScalar(dst, src, count);
+}
+#endif
+
+void MaxBytes(uint8_t *dst, const uint8_t *src, size_t count) {
+#ifdef BIT_UTIL_X86_DISPATCH
+  if (supportAVX2()) return maxBytesAVX2(dst, src, count);
+#endif
+#if defined(__SSE2__)
+  for (; count >= 16; dst += 16, src += 16, count -= 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_max_epu8(a, b));
+  }
+#endif
+  maxBytesScalar(dst, src, count);
+}
+
+void ReverseBitsInBytes(uint8_t *p, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    uint8_t b = p[i];
+    b = static_cast<uint8_t>((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+    b = static_cast<uint8_t>((b & 0xCC) >> 2 | (b & 0x33) << 2);
+    p[i] = static_cast<uint8_t>((b & 0xAA) >> 1 | (b & 0x55) << 1);
+  }
+}
+
+typedef uint64_t (*PopcountFunc)(const uint8_t *, size_t);
+
+struct PopcountDispatcher {
+  PopcountFunc func = PopcountScalar;
+  const char *name = "scalar";
+
+  PopcountDispatcher() {
+#ifdef BIT_UTIL_X86_DISPATCH
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+      func = popcountAVX2;
+      name = "avx2";
+    } else if (__builtin_cpu_supports("popcnt")) {
+      func = popcountPOPCNT;
+      name = "popcnt";
+    }
+#endif
+  }
+};
+
+static const PopcountDispatcher &dispatcher() {
+  static PopcountDispatcher dispatcher;
+  return dispatcher;
+}
+
+uint64_t Popcount(const uint8_t *p, size_t count) {
+  return dispatcher().func(p, count);
+}
+
+const char *PopcountImpl() {
+  return dispatcher().name;
+}
+
+int64_t FindFirstBitLSB(const uint8_t *p, size_t count, bool bit) {
+  size_t i = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  // skip the word which was all zeros or all ones with full word step,
+  // the lowest bit of the word was the lowest bit of the first byte in little endian.
+  for (; i + 8 <= count; i += 8) {
+    uint64_t word = loadWord(p + i);
+    if (!bit) word = ~word;
+    if (word != 0) return static_cast<int64_t>(i * 8 + __builtin_ctzll(word));
+  }
+#endif
+  for (; i < count; i++) {
+    uint8_t byte = bit ? p[i] : static_cast<uint8_t>(~p[i]);
+    if (byte != 0) return static_cast<int64_t>(i * 8 + __builtin_ctz(byte));
+  }
+  return -1;
+}
+
+}  // namespace BitUtil
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+namespace BitUtil {
+
+// Count the number of set bits in the byte array, the best implementation
+// (AVX2/POPCNT/scalar) was picked by the cpu features at runtime.
+uint64_t Popcount(const uint8_t *p, size_t count);
+// The portable implementation, it's also used to verify the other implementations.
+uint64_t PopcountScalar(const uint8_t *p, size_t count);
+// Return the name of the popcount implementation picked at runtime
+const char *PopcountImpl();
+
+// Return the position of the first bit which equals to the `bit` in the byte array,
+// the bits were numbered from the least significant bit in each byte, which was
+// used by the bitmap segments. Return -1 if not found.
+int64_t FindFirstBitLSB(const uint8_t *p, size_t count, bool bit);
+
+enum BitOpFlags {
+  kBitOpAnd,
+  kBitOpOr,
+  kBitOpXor,
+  kBitOpNot,
+};
+
+// Apply the bitwise operation to the byte arrays word by word: dst = dst op src,
+// NOT only uses the dst. The AVX2 implementation was picked if it's supported.
+void BitwiseOp(BitOpFlags op, uint8_t *dst, const uint8_t *src, size_t count);
+
+// dst[i] = max(dst[i], src[i]) for each byte, it's used to merge the HyperLogLog registers.
+void MaxBytes(uint8_t *dst, const uint8_t *src, size_t count);
+
+// Reverse the order of bits in each byte, it's used to convert between the string
+// (most significant bit first) and bitmap segment (least significant bit first) layout.
+void ReverseBitsInBytes(uint8_t *p, size_t count);
+
+}  // namespace BitUtil
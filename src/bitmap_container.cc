@@ -0,0 +1,172 @@
+#include "bitmap_container.h"
+
+#include <string.h>
+
+#include "bit_util.h"
+
+namespace BitmapContainer {
+
+// the bit positions were stored in 16 bits
+const size_t kMaxEncodedRawSize = 65536 / 8;
+const size_t kHeaderSize = 3;
+
+namespace {
+
+void putUint16(std::string *dst, uint16_t value) {
+  dst->push_back(static_cast<char>(value & 0xff));
+  dst->push_back(static_cast<char>(value >> 8));
+}
+
+uint16_t getUint16(const char *p) {
+  return static_cast<uint16_t>(static_cast<uint8_t>(p[0]) | (static_cast<uint8_t>(p[1]) << 8));
+}
+
+bool testBit(const char *raw, uint32_t offset) {
+  return (raw[offset / 8] >> (offset % 8)) & 1;
+}
+
+}  // namespace
+
+void Encode(const char *raw, size_t raw_size, std::string *out) {
+  out->clear();
+  uint64_t num_bits = 0, num_runs = 0;
+  if (raw_size <= kMaxEncodedRawSize) {
+    num_bits = BitUtil::Popcount(reinterpret_cast<const uint8_t *>(raw), raw_size);
+    bool prev = false;
+    for (uint32_t i = 0; i < raw_size * 8; i++) {
+      // skip the zero bytes quickly, it's common in the sparse segments
+      if (!prev && i % 8 == 0 && raw[i / 8] == 0) {
+        i += 7;
+        continue;
+      }
+      bool bit = testBit(raw, i);
+      if (bit && !prev) num_runs++;
+      prev = bit;
+    }
+  }
+  size_t bitmap_size = 1 + raw_size;
+  size_t array_size = kHeaderSize + 2 * num_bits;
+  size_t run_size = kHeaderSize + 4 * num_runs;
+  if (raw_size > kMaxEncodedRawSize || (bitmap_size <= array_size && bitmap_size <= run_size)) {
+    out->reserve(bitmap_size);
+    out->push_back(static_cast<char>(kBitmap));
+    out->append(raw, raw_size);
+    return;
+  }
+
+  bool use_array = array_size <= run_size;
+  out->reserve(use_array ? array_size : run_size);
+  out->push_back(static_cast<char>(use_array ? kArray : kRun));
+  putUint16(out, static_cast<uint16_t>(raw_size));
+  uint32_t run_start = 0;
+  bool prev = false;
+  for (uint32_t i = 0; i < raw_size * 8; i++) {
+    if (!prev && i % 8 == 0 && raw[i / 8] == 0) {
+      i += 7;
+      continue;
+    }
+    bool bit = testBit(raw, i);
+    if (use_array) {
+      if (bit) putUint16(out, static_cast<uint16_t>(i));
+    } else if (bit && !prev) {
+      run_start = i;
+    } else if (!bit && prev) {
+      putUint16(out, static_cast<uint16_t>(run_start));
+      putUint16(out, static_cast<uint16_t>(i - run_start - 1));
+    }
+    prev = bit;
+  }
+  if (!use_array && prev) {
+    putUint16(out, static_cast<uint16_t>(run_start));
+    putUint16(out, static_cast<uint16_t>(raw_size * 8 - run_start - 1));
+  }
+}
+
+bool Decode(const char *data, size_t size, std::string *raw) {
+  raw->clear();
+  if (size == 0) return true;
+  Type type = static_cast<Type>(data[0]);
+  if (type == kBitmap) {
+    raw->assign(data + 1, size - 1);
+    return true;
+  }
+  if ((type != kArray && type != kRun) || size < kHeaderSize) return false;
+  size_t raw_size = getUint16(data + 1);
+  size_t entry_size = type == kArray ? 2 : 4;
+  if ((size - kHeaderSize) % entry_size != 0) return false;
+
+  raw->assign(raw_size, 0);
+  uint32_t next = 0;  // the entries should be sorted and not overlapped
+  for (const char *p = data + kHeaderSize; p < data + size; p += entry_size) {
+    uint32_t start = getUint16(p);
+    uint32_t end = type == kArray ? start : start + getUint16(p + 2);
+    if (start < next || end >= raw_size * 8) return false;
+    for (uint32_t i = start; i <= end; i++) {
+      (*raw)[i / 8] |= static_cast<char>(1 << (i % 8));
+    }
+    next = end + 1;
+  }
+  return true;
+}
+
+Type GetType(const char *data, size_t size) {
+  return size == 0 ? kBitmap : static_cast<Type>(data[0]);
+}
+
+size_t RawSize(const char *data, size_t size) {
+  if (size == 0) return 0;
+  if (GetType(data, size) == kBitmap) return size - 1;
+  return getUint16(data + 1);
+}
+
+bool GetBit(const char *data, size_t size, uint32_t offset) {
+  if (offset >= RawSize(data, size) * 8) return false;
+  Type type = GetType(data, size);
+  if (type == kBitmap) return testBit(data + 1, offset);
+
+  // binary search the last entry which starts before or at the offset
+  size_t entry_size = type == kArray ? 2 : 4;
+  const char *entries = data + kHeaderSize;
+  size_t lo = 0, hi = (size - kHeaderSize) / entry_size;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (getUint16(entries + mid * entry_size) <= offset) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo == 0) return false;
+  const char *entry = entries + (lo - 1) * entry_size;
+  uint32_t start = getUint16(entry);
+  if (type == kArray) return start == offset;
+  return offset <= start + getUint16(entry + 2);
+}
+
+uint64_t Count(const char *data, size_t size) {
+  if (size == 0) return 0;
+  switch (GetType(data, size)) {
+    case kArray:
+      return (size - kHeaderSize) / 2;
+    case kRun: {
+      uint64_t cnt = 0;
+      for (const char *p = data + kHeaderSize; p + 4 <= data + size; p += 4) {
+        cnt += getUint16(p + 2) + 1;
+      }
+      return cnt;
+    }
+    default:
+      return BitUtil::Popcount(reinterpret_cast<const uint8_t *>(data) + 1, size - 1);
+  }
+}
+
+bool IsEmpty(const char *data, size_t size) {
+  if (size == 0) return true;
+  if (GetType(data, size) != kBitmap) return size == kHeaderSize;
+  for (size_t i = 1; i < size; i++) {
+    if (data[i] != 0) return false;
+  }
+  return true;
+}
+
+}  // namespace BitmapContainer
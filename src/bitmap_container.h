@@ -0,0 +1,37 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+
+// The bitmap segment was encoded as one of the roaring-style containers, and the
+// smallest one was picked by the density of the segment:
+//
+// bitmap container: type(1byte) + raw bytes, it's used by the dense segments
+// array container: type(1byte) + raw size(2byte) + sorted set bit positions(2byte each)
+// run container: type(1byte) + raw size(2byte) + [run start(2byte) + run length - 1(2byte)]...
+//
+// The raw size was kept in the containers, since the length of the segment was
+// used to calculate the size of the bitmap.
+namespace BitmapContainer {
+
+enum Type {
+  kBitmap = 0,
+  kArray = 1,
+  kRun = 2,
+};
+
+// Encode the raw segment into the smallest container
+void Encode(const char *raw, size_t raw_size, std::string *out);
+// Decode the container into the raw segment, return false if the container was corrupted.
+bool Decode(const char *data, size_t size, std::string *raw);
+
+// The following functions read the container without decoding it, the container
+// should be produced by Encode(), the result of a corrupted container was undefined.
+Type GetType(const char *data, size_t size);
+size_t RawSize(const char *data, size_t size);
+bool GetBit(const char *data, size_t size, uint32_t offset);
+uint64_t Count(const char *data, size_t size);
+bool IsEmpty(const char *data, size_t size);
+
+}  // namespace BitmapContainer
@@ -31,59 +31,116 @@ bool MetadataFilter::Filter(int level,
   return metadata.Expired();
 }
 
+// The max steps to move the metadata iterator forward before seeking
+const int kMaxMetadataIterSteps = 8;
+// The max lookups and lifetime of the metadata iterator before it was recreated
+const int kMaxMetadataIterLookups = 10000;
+const std::chrono::milliseconds kMaxMetadataIterLifetime(1000);
+
+SubKeyFilter::~SubKeyFilter() {
+  releaseMetadataIterator();
+}
+
+void SubKeyFilter::releaseMetadataIterator() const {
+  if (!metadata_iter_) return;
+  metadata_iter_.reset();
+  stor_->DecrDBRefs();
+}
+
+rocksdb::Status SubKeyFilter::fetchMetadata(const std::string &metadata_key, std::string *bytes) const {
+  if (stor_->IsClosing()) {
+    // release the iterator as soon as possible, or the db can't be closed
+    releaseMetadataIterator();
+    return rocksdb::Status::Aborted("db is closing");
+  }
+  if (metadata_iter_ && (metadata_iter_lookups_ >= kMaxMetadataIterLookups
+      || std::chrono::steady_clock::now() - metadata_iter_create_time_ >= kMaxMetadataIterLifetime)) {
+    // release the db reference and the pinned version between the refreshes
+    releaseMetadataIterator();
+  }
+  if (!metadata_iter_) {
+    auto db = stor_->GetDB();
+    const auto cf_handles = stor_->GetCFHandles();
+    // storage close the would delete the column familiy handler and DB
+    if (!db || cf_handles->size() < 2) return rocksdb::Status::Aborted("db is closing");
+    if (!stor_->IncrDBRefs().IsOK()) {  // the db is closing, don't use DB and cf_handles
+      return rocksdb::Status::Aborted("db is closing");
+    }
+    rocksdb::ReadOptions read_options;
+    read_options.fill_cache = false;
+    metadata_iter_ = std::unique_ptr<rocksdb::Iterator>(db->NewIterator(read_options, (*cf_handles)[1]));
+    metadata_iter_lookups_ = 0;
+    metadata_iter_create_time_ = std::chrono::steady_clock::now();
+  }
+  metadata_iter_lookups_++;
+  // The subkeys were sorted by the namespace, key size and key, so the metadata keys of
+  // the adjacent subkeys with the same key size are ascending and usually close to each
+  // other in the metadata column family. Try to move forward a few steps before seeking,
+  // which is much cheaper than the point lookup for each key transition.
+  bool positioned = false;
+  if (metadata_iter_->Valid() && metadata_iter_->key().compare(metadata_key) <= 0) {
+    for (int steps = 0; steps < kMaxMetadataIterSteps && metadata_iter_->Valid(); steps++) {
+      if (metadata_iter_->key().compare(metadata_key) >= 0) {
+        positioned = true;
+        break;
+      }
+      metadata_iter_->Next();
+    }
+  }
+  if (!positioned) metadata_iter_->Seek(metadata_key);
+  stor_->IncrCompactionFilterLookups(!positioned);
+  if (!metadata_iter_->status().ok()) return metadata_iter_->status();
+  if (!metadata_iter_->Valid() || metadata_iter_->key() != metadata_key) {
+    return rocksdb::Status::NotFound();
+  }
+  *bytes = metadata_iter_->value().ToString();
+  return rocksdb::Status::OK();
+}
+
 bool SubKeyFilter::IsKeyExpired(const InternalKey &ikey, const Slice &value) const {
   std::string metadata_key;
 
-  auto db = stor_->GetDB();
-  const auto cf_handles = stor_->GetCFHandles();
-  // storage close the would delete the column familiy handler and DB
-  if (!db || cf_handles->size() < 2)  return false;
-
   ComposeNamespaceKey(ikey.GetNamespace(), ikey.GetKey(), &metadata_key);
   if (cached_key_.empty() || metadata_key != cached_key_) {
     std::string bytes;
-    if (!stor_->IncrDBRefs().IsOK()) {  // the db is closing, don't use DB and cf_handles
+    rocksdb::Status s = fetchMetadata(metadata_key, &bytes);
+    if (s.IsAborted()) {
+      cached_key_.clear();
       return false;
     }
-    rocksdb::Status s = db->Get(rocksdb::ReadOptions(), (*cf_handles)[1], metadata_key, &bytes);
-    stor_->DecrDBRefs();
     cached_key_ = std::move(metadata_key);
-    if (s.ok()) {
-      cached_metadata_ = std::move(bytes);
-    } else if (s.IsNotFound()) {
+    if (s.IsNotFound()) {
       // metadata was deleted(perhaps compaction or manual)
-      // clear the metadata
-      cached_metadata_.clear();
+      cached_metadata_found_ = false;
       return true;
-    } else {
+    } else if (!s.ok()) {
       LOG(ERROR) << "[compact_filter/subkey] Failed to fetch metadata"
                  << ", namespace: " << ikey.GetNamespace().ToString()
                  << ", key: " << ikey.GetKey().ToString()
                  << ", err: " << s.ToString();
       cached_key_.clear();
-      cached_metadata_.clear();
       return false;
     }
+    // decode the metadata once for all the subkeys of the same key
+    s = cached_metadata_.Decode(bytes);
+    if (!s.ok()) {
+      cached_key_.clear();
+      LOG(ERROR) << "[compact_filter/subkey] Failed to decode metadata"
+                 << ", namespace: " << ikey.GetNamespace().ToString()
+                 << ", key: " << ikey.GetKey().ToString()
+                 << ", err: " << s.ToString();
+      return false;
+    }
+    cached_metadata_found_ = true;
   }
   // the metadata was not found
-  if (cached_metadata_.empty()) return true;
-  // the metadata is cached
-  Metadata metadata(kRedisNone, false);
-  rocksdb::Status s = metadata.Decode(cached_metadata_);
-  if (!s.ok()) {
-    cached_key_.clear();
-    LOG(ERROR) << "[compact_filter/subkey] Failed to decode metadata"
-               << ", namespace: " << ikey.GetNamespace().ToString()
-               << ", key: " << ikey.GetKey().ToString()
-               << ", err: " << s.ToString();
-    return false;
-  }
-  if (metadata.Type() == kRedisString  // metadata key was overwrite by set command
-      || metadata.Expired()
-      || ikey.GetVersion() != metadata.version) {
+  if (!cached_metadata_found_) return true;
+  if (cached_metadata_.Type() == kRedisString  // metadata key was overwrite by set command
+      || cached_metadata_.Expired()
+      || ikey.GetVersion() != cached_metadata_.version) {
     return true;
   }
-  return metadata.Type() == kRedisBitmap && Redis::Bitmap::IsEmptySegment(value);
+  return cached_metadata_.Type() == kRedisBitmap && Redis::Bitmap::IsEmptySegment(cached_metadata_, value);
 }
 
 bool SubKeyFilter::Filter(int level,
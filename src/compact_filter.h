@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <vector>
 #include <memory>
 #include <string>
@@ -33,8 +34,9 @@ class SubKeyFilter : public rocksdb::CompactionFilter {
  public:
   explicit SubKeyFilter(Storage *storage)
       : cached_key_(""),
-        cached_metadata_(""),
+        cached_metadata_(kRedisNone, false),
         stor_(storage) {}
+  ~SubKeyFilter() override;
 
   const char *Name() const override { return "SubkeyFilter"; }
   bool IsKeyExpired(const InternalKey &ikey, const Slice &value) const;
@@ -43,8 +45,18 @@ class SubKeyFilter : public rocksdb::CompactionFilter {
 
  protected:
   mutable std::string cached_key_;
-  mutable std::string cached_metadata_;
+  mutable Metadata cached_metadata_;
+  mutable bool cached_metadata_found_ = false;
   Engine::Storage *stor_;
+  // The metadata iterator was shared by the subkeys in a compaction, and it
+  // holds the db reference. It would be recreated after a number of lookups or
+  // a time budget, so a long compaction won't pin the old version or block the db close.
+  mutable std::unique_ptr<rocksdb::Iterator> metadata_iter_;
+  mutable int metadata_iter_lookups_ = 0;
+  mutable std::chrono::steady_clock::time_point metadata_iter_create_time_;
+
+  rocksdb::Status fetchMetadata(const std::string &metadata_key, std::string *bytes) const;
+  void releaseMetadataIterator() const;
 };
 
 class SubKeyFilterFactory : public rocksdb::CompactionFilterFactory {
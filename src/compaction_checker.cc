@@ -1,27 +1,26 @@
 #include "compaction_checker.h"
+#include <algorithm>
+#include <future>
 #include <glog/logging.h>
 #include "storage.h"
 
 void CompactionChecker::CompactPubsubAndSlotFiles() {
-  rocksdb::CompactRangeOptions compact_opts;
-  compact_opts.change_level = true;
   std::vector<std::string> cf_names = {Engine::kPubSubColumnFamilyName};
   if (storage_->CodisEnabled()) {
     cf_names.emplace_back(Engine::kSlotColumnFamilyName);
     cf_names.emplace_back(Engine::kSlotMetadataColumnFamilyName);
   }
   for (const auto &cf_name : cf_names) {
-    // the db is closing, don't use DB and cf_handles
-    if (!storage_->IncrDBRefs().IsOK()) return;
     LOG(INFO) << "[compaction checker] Start the compact the column family: " << cf_name;
-    auto cf_handle = storage_->GetCFHandle(cf_name);
-    auto s = storage_->GetDB()->CompactRange(compact_opts, cf_handle, nullptr, nullptr);
-    storage_->DecrDBRefs();
+    auto s = storage_->Compact(cf_name, nullptr, nullptr);
+    // the db is closing
+    if (s.IsAborted()) return;
     LOG(INFO) << "[compaction checker] Compact the column family: "<< cf_name <<" finished, result: " << s.ToString();
   }
 }
 
-void CompactionChecker::PickCompactionFiles(const std::string &cf_name) {
+void CompactionChecker::collectCandidateRanges(const std::string &cf_name,
+                                               std::vector<CandidateRange> *candidates) {
   rocksdb::TablePropertiesCollection props;
   // the db is closing, don't use DB and cf_handles
   if (!storage_->IncrDBRefs().IsOK()) return;
@@ -37,19 +36,12 @@ void CompactionChecker::PickCompactionFiles(const std::string &cf_name) {
   // the live files was too few, Hard code to 1 here.
   if (props.size() <= 1) return;
 
-  size_t maxFilesToCompact = 1;
-  if (props.size()/360 > maxFilesToCompact) {
-    maxFilesToCompact = props.size()/360;
-  }
-  int64_t now, forceCompactSeconds = 2 * 24 * 3600;
+  int64_t now;
   rocksdb::Env::Default()->GetCurrentTime(&now);
-  std::string best_filename;
-  double best_delete_ratio = 0;
-  int64_t total_keys = 0, deleted_keys = 0;
-  rocksdb::Slice start_key, stop_key, best_start_key, best_stop_key;
+  int64_t min_file_age = config_->compaction_checker_min_file_age;
+  int64_t force_compact_seconds = config_->compaction_checker_force_compact_seconds;
+  double delete_ratio_threshold = config_->compaction_checker_delete_ratio_threshold / 100.0;
   for (const auto &iter : props) {
-    if (maxFilesToCompact == 0) return;
-
     uint64_t file_creation_time = iter.second->file_creation_time;
     if (file_creation_time == 0) {
       // Fallback to the file Modification time to prevent repeatedly compacting the same file,
@@ -61,15 +53,17 @@ void CompactionChecker::PickCompactionFiles(const std::string &cf_name) {
         continue;
       }
     }
+    // don't compact the SST which was created recently
+    if (file_creation_time > static_cast<uint64_t>(now-min_file_age)) continue;
 
-    // don't compact the SST created in 1 hour
-    if (file_creation_time > static_cast<uint64_t>(now-3600)) continue;
+    int64_t total_keys = 0, deleted_keys = 0;
+    std::string start_key, stop_key;
     for (const auto &property_iter : iter.second->user_collected_properties) {
       if (property_iter.first == "total_keys") {
-        total_keys = std::atoi(property_iter.second.data());
+        total_keys = std::atoll(property_iter.second.data());
       }
       if (property_iter.first == "deleted_keys") {
-        deleted_keys = std::atoi(property_iter.second.data());
+        deleted_keys = std::atoll(property_iter.second.data());
       }
       if (property_iter.first == "start_key") {
         start_key = property_iter.second;
@@ -78,34 +72,119 @@ void CompactionChecker::PickCompactionFiles(const std::string &cf_name) {
         stop_key = property_iter.second;
       }
     }
-
     if (start_key.empty() || stop_key.empty()) continue;
-    // pick the file which was created more than 2 days
-    if (file_creation_time < static_cast<uint64_t>(now-forceCompactSeconds)) {
-      // the db is closing, don't use DB and cf_handles
-      if (!storage_->IncrDBRefs().IsOK()) return;
-      LOG(INFO) << "[compaction checker] Going to compact the key in file(created more than 2 days): " << iter.first;
-      auto s = storage_->Compact(&start_key, &stop_key);
-      storage_->DecrDBRefs();
-      LOG(INFO) << "[compaction checker] Compact the key in file(created more than 2 days): " << iter.first
-                << " finished, result: " << s.ToString();
-      maxFilesToCompact--;
+
+    double delete_ratio = 0;
+    if (total_keys > 0) {
+      delete_ratio = std::min(1.0, static_cast<double>(deleted_keys)/static_cast<double>(total_keys));
     }
-    // pick the file which has highest delete ratio
-    double delete_ratio = static_cast<double>(deleted_keys)/static_cast<double>(total_keys);
-    if (total_keys != 0 && delete_ratio > best_delete_ratio) {
-      best_delete_ratio = delete_ratio;
-      best_filename = iter.first;
-      best_start_key = std::move(start_key);
-      best_stop_key = std::move(stop_key);
+    bool force_compact = force_compact_seconds > 0
+        && file_creation_time < static_cast<uint64_t>(now-force_compact_seconds);
+    if (!force_compact && (delete_ratio <= delete_ratio_threshold)) continue;
+
+    CandidateRange candidate;
+    candidate.cf_name = cf_name;
+    candidate.filename = iter.first;
+    candidate.start_key = std::move(start_key);
+    candidate.stop_key = std::move(stop_key);
+    candidate.file_size = iter.second->data_size + iter.second->index_size + iter.second->filter_size;
+    candidate.reclaimable_bytes = static_cast<uint64_t>(candidate.file_size * delete_ratio);
+    // The force compacted file got the age bonus from half of its size (just reached
+    // the force compact age) up to its full size (twice the force compact age), so the
+    // very old files were picked in the end, but the delete-heavy ranges still won the
+    // files which were just old.
+    uint64_t age_bonus = 0;
+    if (force_compact) {
+      double age = static_cast<double>(now - static_cast<int64_t>(file_creation_time)) / (2.0 * force_compact_seconds);
+      age_bonus = static_cast<uint64_t>(candidate.file_size * std::min(1.0, age));
     }
+    candidate.score = candidate.reclaimable_bytes + age_bonus;
+    candidate.delete_ratio = delete_ratio;
+    candidate.force_compact = force_compact;
+    candidate.file_creation_time = file_creation_time;
+    candidates->emplace_back(std::move(candidate));
   }
-  if (best_delete_ratio > 0.1 && !best_start_key.empty() && !best_stop_key.empty()) {
-    // the db is closing, don't use DB and cf_handles
-    if (!storage_->IncrDBRefs().IsOK()) return;
-    LOG(INFO) << "[compaction checker] Going to compact the key in file: " << best_filename
-              << ", delete ratio: " << best_delete_ratio;
-    storage_->Compact(&best_start_key, &best_stop_key);
-    storage_->DecrDBRefs();
+}
+
+bool CompactionChecker::isOverlapped(const CandidateRange &a, const CandidateRange &b) {
+  if (a.cf_name != b.cf_name) return false;
+  return !(a.stop_key < b.start_key || b.stop_key < a.start_key);
+}
+
+rocksdb::Status CompactionChecker::compactRange(const CandidateRange &range) {
+  rocksdb::Slice start_key(range.start_key), stop_key(range.stop_key);
+  // allow the picked ranges to be compacted in parallel
+  return storage_->Compact(range.cf_name, &start_key, &stop_key, false);
+}
+
+void CompactionChecker::PickCompactionFiles(const std::vector<std::string> &cf_names) {
+  std::vector<CandidateRange> candidates;
+  for (const auto &cf_name : cf_names) {
+    collectCandidateRanges(cf_name, &candidates);
   }
+  // The ranges were ranked by the estimated reclaimable bytes plus the age bonus,
+  // the force compacted ranges may have few deleted keys but still got picked.
+  std::sort(candidates.begin(), candidates.end(), [](const CandidateRange &a, const CandidateRange &b) {
+    if (a.score != b.score) return a.score > b.score;
+    return a.file_creation_time < b.file_creation_time;
+  });
+
+  uint64_t io_budget = static_cast<uint64_t>(config_->compaction_checker_max_io_mb) * MiB;
+  size_t max_parallel_ranges = static_cast<size_t>(config_->compaction_checker_max_parallel_ranges);
+  uint64_t picked_bytes = 0, reclaimable_bytes = 0;
+  std::vector<CandidateRange> picked_ranges;
+  for (const auto &candidate : candidates) {
+    if (picked_ranges.size() >= max_parallel_ranges) break;
+    // always pick the first range even if it exceeds the io budget, or the big file
+    // would never be compacted.
+    if (!picked_ranges.empty() && io_budget > 0 && picked_bytes + candidate.file_size > io_budget) continue;
+    bool overlapped = false;
+    for (const auto &picked : picked_ranges) {
+      if (isOverlapped(candidate, picked)) {
+        overlapped = true;
+        break;
+      }
+    }
+    if (overlapped) continue;
+    picked_bytes += candidate.file_size;
+    reclaimable_bytes += candidate.reclaimable_bytes;
+    picked_ranges.emplace_back(candidate);
+  }
+
+  std::vector<std::future<rocksdb::Status>> results;
+  for (const auto &range : picked_ranges) {
+    LOG(INFO) << "[compaction checker] Going to compact the key range in file: " << range.filename
+              << ", column family: " << range.cf_name
+              << ", delete ratio: " << range.delete_ratio
+              << ", file size: " << range.file_size
+              << ", estimated reclaimable bytes: " << range.reclaimable_bytes
+              << ", force compact: " << (range.force_compact ? "yes" : "no");
+    results.emplace_back(std::async(std::launch::async, [this, &range]() {
+      return compactRange(range);
+    }));
+  }
+  uint64_t compacted_ranges = 0, reclaimed_bytes = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    auto s = results[i].get();
+    if (s.ok()) {
+      compacted_ranges++;
+      reclaimed_bytes += picked_ranges[i].reclaimable_bytes;
+    }
+    LOG(INFO) << "[compaction checker] Compact the key range in file: " << picked_ranges[i].filename
+              << " finished, result: " << s.ToString();
+  }
+
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  time(&stats_.last_check_time);
+  stats_.last_candidate_ranges = candidates.size();
+  stats_.last_picked_ranges = picked_ranges.size();
+  stats_.last_picked_bytes = picked_bytes;
+  stats_.last_reclaimable_bytes = reclaimable_bytes;
+  stats_.total_compacted_ranges += compacted_ranges;
+  stats_.total_reclaimable_bytes += reclaimed_bytes;
+}
+
+void CompactionChecker::GetStats(CompactionCheckerStats *stats) {
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  *stats = stats_;
 }
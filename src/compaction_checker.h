@@ -1,16 +1,55 @@
 #pragma once
 
+#include <ctime>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
+#include "config.h"
 #include "storage.h"
 
+struct CompactionCheckerStats {
+  time_t last_check_time = 0;
+  uint64_t last_candidate_ranges = 0;
+  uint64_t last_picked_ranges = 0;
+  uint64_t last_picked_bytes = 0;
+  uint64_t last_reclaimable_bytes = 0;
+  uint64_t total_compacted_ranges = 0;
+  uint64_t total_reclaimable_bytes = 0;
+};
+
 class CompactionChecker {
  public:
-  explicit CompactionChecker(Engine::Storage *storage):storage_(storage) {}
+  explicit CompactionChecker(Engine::Storage *storage, Config *config)
+      : storage_(storage), config_(config) {}
   ~CompactionChecker() {}
-  void PickCompactionFiles(const std::string &cf_name);
+  void PickCompactionFiles(const std::vector<std::string> &cf_names);
   void CompactPubsubAndSlotFiles();
+  void GetStats(CompactionCheckerStats *stats);
+
  private:
+  // The key range of a SST file which may be worth to compact,
+  // the reclaimable bytes was estimated by the delete ratio of the file,
+  // and the score was the reclaimable bytes plus the age bonus.
+  struct CandidateRange {
+    std::string cf_name;
+    std::string filename;
+    std::string start_key;
+    std::string stop_key;
+    uint64_t file_size;
+    uint64_t reclaimable_bytes;
+    uint64_t score;
+    double delete_ratio;
+    bool force_compact;
+    uint64_t file_creation_time;
+  };
+
   Engine::Storage *storage_ = nullptr;
+  Config *config_ = nullptr;
+  std::mutex stats_mu_;
+  CompactionCheckerStats stats_;
+
+  void collectCandidateRanges(const std::string &cf_name, std::vector<CandidateRange> *candidates);
+  static bool isOverlapped(const CandidateRange &a, const CandidateRange &b);
+  rocksdb::Status compactRange(const CandidateRange &range);
 };
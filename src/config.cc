@@ -23,6 +23,11 @@ configEnum compression_type_enum[] = {
     {"snappy", rocksdb::CompressionType::kSnappyCompression},
     {nullptr, 0}
 };
+configEnum compaction_style_enum[] = {
+    {"level", rocksdb::CompactionStyle::kCompactionStyleLevel},
+    {"universal", rocksdb::CompactionStyle::kCompactionStyleUniversal},
+    {nullptr, 0}
+};
 configEnum supervised_mode_enum[] = {
     {"no", SUPERVISED_NONE},
     {"auto", SUPERVISED_AUTODETECT},
@@ -65,6 +70,7 @@ Config::Config() {
       {"bind", true, new StringField(&binds_, "127.0.0.1")},
       {"repl-bind", true, new StringField(&repl_binds_, "127.0.0.1")},
       {"port", true, new IntField(&port, 6666, 1, 65535)},
+      {"metrics-port", true, new IntField(&metrics_port, 0, 0, 65535)},
       {"workers", true, new IntField(&workers, 8, 1, 256)},
       {"repl-workers", true, new IntField(&repl_workers, 4, 1, 256)},
       {"timeout", false, new IntField(&timeout, 0, 0, INT_MAX)},
@@ -78,7 +84,24 @@ Config::Config() {
       {"slaveof", true, new StringField(&slaveof_, "")},
       {"compact-cron", false, new StringField(&compact_cron_, "")},
       {"bgsave-cron", false, new StringField(&bgsave_cron_, "")},
+      {"wal-archive-dir", true, new StringField(&wal_archive_dir, "")},
+      {"wal-archive-checkpoint-cron", false, new StringField(&wal_archive_checkpoint_cron_, "")},
+      {"wal-archive-keep-checkpoints", false, new IntField(&wal_archive_keep_checkpoints, 3, 1, 1024)},
       {"compaction-checker-range", false, new StringField(&compaction_checker_range_, "")},
+      {"compaction-checker-min-file-age",
+       false, new IntField(&compaction_checker_min_file_age, 3600, 0, INT_MAX)},
+      {"compaction-checker-force-compact-seconds",
+       false, new IntField(&compaction_checker_force_compact_seconds, 2 * 24 * 3600, 0, INT_MAX)},
+      {"compaction-checker-delete-ratio-threshold",
+       false, new IntField(&compaction_checker_delete_ratio_threshold, 10, 0, 100)},
+      {"compaction-checker-max-parallel-ranges",
+       false, new IntField(&compaction_checker_max_parallel_ranges, 4, 1, 64)},
+      {"compaction-checker-max-io-mb", false, new IntField(&compaction_checker_max_io_mb, 1024, 0, INT_MAX)},
+      {"active-expire-keys-per-sec", false, new IntField(&active_expire_keys_per_sec, 1000, 0, INT_MAX)},
+      {"active-expire-max-delete-subkeys",
+       false, new IntField(&active_expire_max_delete_subkeys, 128, 0, 1000000)},
+      {"bitmap-container-encoding", false, new YesNoField(&bitmap_container_encoding, false)},
+      {"hll-sparse-max-bytes", false, new IntField(&hll_sparse_max_bytes, 3000, 0, INT_MAX)},
       {"db-name", true, new StringField(&db_name, "changeme.name")},
       {"dir", true, new StringField(&dir, "/tmp/kvrocks")},
       {"backup-dir", true, new StringField(&backup_dir, "")},
@@ -89,6 +112,9 @@ Config::Config() {
       {"max-replication-mb", false, new IntField(&max_replication_mb, 0, 0, INT_MAX)},
       {"supervised", true, new EnumField(&supervised_mode, supervised_mode_enum, SUPERVISED_NONE)},
       {"slave-serve-stale-data", false, new YesNoField(&slave_serve_stale_data, true)},
+      {"slave-fullsync-checkpoint", false, new YesNoField(&slave_fullsync_checkpoint, false)},
+      {"slave-replication-compression", false, new YesNoField(&slave_replication_compression, false)},
+      {"slave-snapshot-read", false, new YesNoField(&slave_snapshot_read, true)},
       {"slave-priority", false, new IntField(&slave_priority, 100, 0, INT_MAX)},
       {"slave-read-only", false, new YesNoField(&slave_readonly, true)},
       {"profiling-sample-ratio", false, new IntField(&profiling_sample_ratio, 0, 0, 100)},
@@ -124,6 +150,24 @@ Config::Config() {
        false, new IntField(&RocksDB.level0_slowdown_writes_trigger, 20, 1, 1024)},
       {"rocksdb.level0_stop_writes_trigger",
        false, new IntField(&RocksDB.level0_stop_writes_trigger, 40, 1, 1024)},
+      {"rocksdb.metadata_compaction_style", true, new EnumField(&RocksDB.metadata_compaction.compaction_style,
+          compaction_style_enum, rocksdb::CompactionStyle::kCompactionStyleLevel)},
+      {"rocksdb.metadata_max_bytes_for_level_multiplier",
+       false, new IntField(&RocksDB.metadata_compaction.max_bytes_for_level_multiplier, 10, 1, 100)},
+      {"rocksdb.metadata_level_compaction_dynamic_level_bytes",
+       true, new YesNoField(&RocksDB.metadata_compaction.level_compaction_dynamic_level_bytes, false)},
+      {"rocksdb.subkey_compaction_style", true, new EnumField(&RocksDB.subkey_compaction.compaction_style,
+          compaction_style_enum, rocksdb::CompactionStyle::kCompactionStyleLevel)},
+      {"rocksdb.subkey_max_bytes_for_level_multiplier",
+       false, new IntField(&RocksDB.subkey_compaction.max_bytes_for_level_multiplier, 10, 1, 100)},
+      {"rocksdb.subkey_level_compaction_dynamic_level_bytes",
+       true, new YesNoField(&RocksDB.subkey_compaction.level_compaction_dynamic_level_bytes, false)},
+      {"rocksdb.pubsub_compaction_style", true, new EnumField(&RocksDB.pubsub_compaction.compaction_style,
+          compaction_style_enum, rocksdb::CompactionStyle::kCompactionStyleLevel)},
+      {"rocksdb.pubsub_max_bytes_for_level_multiplier",
+       false, new IntField(&RocksDB.pubsub_compaction.max_bytes_for_level_multiplier, 10, 1, 100)},
+      {"rocksdb.pubsub_level_compaction_dynamic_level_bytes",
+       true, new YesNoField(&RocksDB.pubsub_compaction.level_compaction_dynamic_level_bytes, false)},
   };
   for (const auto &wrapper : fields) {
     auto field = wrapper.field;
@@ -154,6 +198,11 @@ void Config::initFieldValidator() {
         Util::Split(v, " \t", &args);
         return bgsave_cron.SetScheduleTime(args);
       }},
+      {"wal-archive-checkpoint-cron", [this](const std::string& k, const std::string& v)->Status {
+        std::vector<std::string> args;
+        Util::Split(v, " \t", &args);
+        return wal_archive_checkpoint_cron.SetScheduleTime(args);
+      }},
       {"compaction-checker-range", [this](const std::string& k, const std::string& v)->Status {
         std::vector<std::string> args;
         if (v.empty()) {
@@ -196,9 +245,29 @@ void Config::initFieldCallback() {
     if (!srv) return Status::OK();  // srv is nullptr when load config from file
     return srv->storage_->SetColumnFamilyOption(trimRocksDBPrefix(k), v);
   };
+  auto set_cf_multiplier_cb = [](Server* srv,  const std::string &k, const std::string& v)->Status {
+    if (!srv) return Status::OK();  // srv is nullptr when load config from file
+    // the key was formatted as 'rocksdb.<cf group>_max_bytes_for_level_multiplier'
+    std::string cf_group = trimRocksDBPrefix(k);
+    cf_group = cf_group.substr(0, cf_group.find('_'));
+    std::vector<std::string> cf_names;
+    if (cf_group == "metadata") {
+      cf_names = {Engine::kMetadataColumnFamilyName};
+    } else if (cf_group == "subkey") {
+      cf_names = {Engine::kSubkeyColumnFamilyName, Engine::kZSetScoreColumnFamilyName};
+    } else {
+      cf_names = {Engine::kPubSubColumnFamilyName};
+    }
+    for (const auto &cf_name : cf_names) {
+      auto s = srv->storage_->SetColumnFamilyOption(cf_name, "max_bytes_for_level_multiplier", v);
+      if (!s.IsOK()) return s;
+    }
+    return Status::OK();
+  };
   std::map<std::string, callback_fn> callbacks = {
       {"dir", [this](Server* srv,  const std::string &k, const std::string& v)->Status {
         db_dir = dir + "/db";
+        sync_checkpoint_dir = dir + "/sync_checkpoint";
         if (backup_dir.empty()) backup_dir = dir + "/backup";
         if (log_dir.empty()) log_dir = dir;
         return Status::OK();
@@ -258,11 +327,6 @@ void Config::initFieldCallback() {
         srv->storage_->CheckDBSizeLimit();
         return Status::OK();
       }},
-      {"max-replication-mb", [this](Server* srv, const std::string &k, const std::string& v)->Status {
-        if (!srv) return Status::OK();
-        srv->SetReplicationRateLimit(static_cast<uint64_t>(max_replication_mb));
-        return Status::OK();
-      }},
       {"max-io-mb", [this](Server* srv, const std::string &k, const std::string& v)->Status {
         if (!srv) return Status::OK();
         srv->storage_->SetIORateLimit(static_cast<uint64_t>(max_io_mb));
@@ -299,6 +363,9 @@ void Config::initFieldCallback() {
       {"rocksdb.max_write_buffer_number", set_cf_option_cb},
       {"rocksdb.level0_slowdown_writes_trigger", set_cf_option_cb},
       {"rocksdb.level0_stop_writes_trigger", set_cf_option_cb},
+      {"rocksdb.metadata_max_bytes_for_level_multiplier", set_cf_multiplier_cb},
+      {"rocksdb.subkey_max_bytes_for_level_multiplier", set_cf_multiplier_cb},
+      {"rocksdb.pubsub_max_bytes_for_level_multiplier", set_cf_multiplier_cb},
   };
   for (const auto& iter : callbacks) {
     auto field_iter = fields_.find(iter.first);
@@ -370,6 +437,7 @@ Status Config::finish() {
     return Status(Status::NotOK, "enabled codis wasn't allowed while the namespace exists");
   }
   if (db_dir.empty()) db_dir = dir + "/db";
+  if (sync_checkpoint_dir.empty()) sync_checkpoint_dir = dir + "/sync_checkpoint";
   if (backup_dir.empty()) backup_dir = dir + "/backup";
   if (log_dir.empty()) log_dir = dir;
   if (pidfile.empty()) pidfile = dir + "/kvrocks.pid";
@@ -411,6 +479,11 @@ void Config::Get(std::string key, std::vector<std::string> *values) {
   }
 }
 
+void Config::SetFieldCallback(const std::string &key, callback_fn callback) {
+  auto iter = fields_.find(key);
+  if (iter != fields_.end()) iter->second->callback = std::move(callback);
+}
+
 Status Config::Set(Server *svr, std::string key, const std::string &value) {
   key = Util::ToLower(key);
   auto iter = fields_.find(key);
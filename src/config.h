@@ -39,12 +39,19 @@ struct CompactionCheckerRange {
   }
 };
 
+struct ColumnFamilyCompaction {
+  int compaction_style;
+  int max_bytes_for_level_multiplier;
+  bool level_compaction_dynamic_level_bytes;
+};
+
 struct Config{
  public:
   Config();
   ~Config();
   int port = 6666;
   int repl_port = 66667;
+  int metrics_port = 0;
   int workers = 0;
   int repl_workers = 1;
   int timeout = 0;
@@ -59,6 +66,9 @@ struct Config{
   int supervised_mode = SUPERVISED_NONE;
   bool slave_readonly = true;
   bool slave_serve_stale_data = true;
+  bool slave_fullsync_checkpoint = false;
+  bool slave_replication_compression = false;
+  bool slave_snapshot_read = true;
   int slave_priority = 100;
   int max_db_size = 0;
   int max_replication_mb = 0;
@@ -71,6 +81,7 @@ struct Config{
   std::string dir;
   std::string db_dir;
   std::string backup_dir;
+  std::string sync_checkpoint_dir;
   std::string log_dir;
   std::string pidfile;
   std::string db_name;
@@ -80,7 +91,19 @@ struct Config{
   int master_port = 0;
   Cron compact_cron;
   Cron bgsave_cron;
+  std::string wal_archive_dir;
+  Cron wal_archive_checkpoint_cron;
+  int wal_archive_keep_checkpoints = 3;
   CompactionCheckerRange compaction_checker_range{-1, -1};
+  int compaction_checker_min_file_age = 3600;
+  int compaction_checker_force_compact_seconds = 2 * 24 * 3600;
+  int compaction_checker_delete_ratio_threshold = 10;
+  int compaction_checker_max_parallel_ranges = 4;
+  int compaction_checker_max_io_mb = 1024;
+  int active_expire_keys_per_sec = 1000;
+  int active_expire_max_delete_subkeys = 128;
+  bool bitmap_container_encoding = false;
+  int hll_sparse_max_bytes = 3000;
   std::map<std::string, std::string> tokens;
 
   // profiling
@@ -113,6 +136,9 @@ struct Config{
     int level0_stop_writes_trigger;
     int compression;
     bool disable_auto_compactions;
+    ColumnFamilyCompaction metadata_compaction;
+    ColumnFamilyCompaction subkey_compaction;
+    ColumnFamilyCompaction pubsub_compaction;
   } RocksDB;
 
  public:
@@ -120,6 +146,9 @@ struct Config{
   Status Load(std::string path);
   void Get(std::string key, std::vector<std::string> *values);
   Status Set(Server *svr, std::string key, const std::string &value);
+  // The options applied by the server-only components were hooked by the server,
+  // so the tools sharing the config needn't link the server.
+  void SetFieldCallback(const std::string &key, callback_fn callback);
   void SetMaster(const std::string &host, int port);
   void ClearMaster();
   Status GetNamespace(const std::string &ns, std::string *token);
@@ -134,6 +163,7 @@ struct Config{
   std::string slaveof_;
   std::string compact_cron_;
   std::string bgsave_cron_;
+  std::string wal_archive_checkpoint_cron_;
   std::string compaction_checker_range_;
   std::string profiling_sample_commands_;
   std::map<std::string, ConfigField*> fields_;
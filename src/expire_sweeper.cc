@@ -0,0 +1,111 @@
+#include "expire_sweeper.h"
+#include <memory>
+#include <vector>
+#include <glog/logging.h>
+#include "lock_manager.h"
+#include "redis_metadata.h"
+
+void ExpireSweeper::Sweep(int max_scan_keys) {
+  if (max_scan_keys <= 0) return;
+  // the db is closing, don't use DB and cf_handles
+  if (!storage_->IncrDBRefs().IsOK()) return;
+
+  rocksdb::DB *db = storage_->GetDB();
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(db->NewIterator(read_options, storage_->GetCFHandle("metadata")));
+  // the cursor is the first key which wasn't scanned in the last sweep
+  iter->Seek(cursor_);
+
+  int scanned = 0;
+  std::vector<std::string> expired_keys;
+  for (; iter->Valid() && scanned < max_scan_keys; iter->Next(), scanned++) {
+    Metadata metadata(kRedisNone, false);
+    if (!metadata.Decode(iter->value().ToString()).ok()) continue;
+    if (metadata.Expired()) expired_keys.emplace_back(iter->key().ToString());
+  }
+  bool round_finished = !iter->Valid();
+  if (!iter->status().ok()) {
+    LOG(WARNING) << "[expire sweeper] Failed to scan the metadata, err: " << iter->status().ToString();
+  }
+  cursor_ = round_finished ? "" : iter->key().ToString();
+  iter.reset();
+
+  uint64_t expired = 0, deleted_subkeys = 0;
+  for (const auto &ns_key : expired_keys) {
+    auto s = deleteExpiredKey(ns_key, &deleted_subkeys);
+    if (s.ok()) {
+      expired++;
+    } else if (!s.IsNotFound()) {
+      LOG(WARNING) << "[expire sweeper] Failed to delete the expired key, err: " << s.ToString();
+      break;
+    }
+  }
+  storage_->DecrDBRefs();
+
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  stats_.scanned_keys += scanned;
+  stats_.expired_keys += expired;
+  stats_.deleted_subkeys += deleted_subkeys;
+  if (round_finished) {
+    stats_.rounds++;
+    stats_.last_round_time = std::time(nullptr);
+  }
+}
+
+rocksdb::Status ExpireSweeper::deleteExpiredKey(const std::string &ns_key, uint64_t *deleted_subkeys) {
+  rocksdb::DB *db = storage_->GetDB();
+  auto metadata_cf_handle = storage_->GetCFHandle("metadata");
+  std::string value;
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  // the key may be overwritten before holding the lock, so check it again
+  auto s = db->Get(rocksdb::ReadOptions(), metadata_cf_handle, ns_key, &value);
+  if (!s.ok()) return s;
+  Metadata metadata(kRedisNone, false);
+  s = metadata.Decode(value);
+  if (!s.ok()) return s;
+  if (!metadata.Expired()) return rocksdb::Status::NotFound("the key was not expired");
+
+  rocksdb::WriteBatch batch;
+  uint64_t subkeys = 0;
+  batch.Delete(metadata_cf_handle, ns_key);
+  // The subkeys would be dropped by the subkey compaction filter after the metadata
+  // was deleted, but deleting them here also makes the compaction checker aware
+  // of the dead data. Skip the large keys to bound the cost of each sweep.
+  int max_delete_subkeys = config_->active_expire_max_delete_subkeys;
+  if (metadata.Type() != kRedisString && metadata.size <= static_cast<uint32_t>(max_delete_subkeys)) {
+    std::string prefix;
+    InternalKey(ns_key, "", metadata.version).Encode(&prefix);
+    // the limit is only used to protect against the wrong size in metadata
+    int limit = max_delete_subkeys * 2 + 1;
+    s = deleteSubKeys(storage_->GetCFHandle("subkey"), prefix, limit, &batch, &subkeys);
+    if (!s.ok()) return s;
+    if (metadata.Type() == kRedisZSet) {
+      s = deleteSubKeys(storage_->GetCFHandle("zset_score"), prefix, limit, &batch, &subkeys);
+      if (!s.ok()) return s;
+    }
+  }
+  s = storage_->Write(rocksdb::WriteOptions(), &batch);
+  if (s.ok()) *deleted_subkeys += subkeys;
+  return s;
+}
+
+rocksdb::Status ExpireSweeper::deleteSubKeys(rocksdb::ColumnFamilyHandle *cf_handle,
+                                             const std::string &prefix,
+                                             int limit,
+                                             rocksdb::WriteBatch *batch,
+                                             uint64_t *deleted_subkeys) {
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(storage_->GetDB()->NewIterator(read_options, cf_handle));
+  for (iter->Seek(prefix); iter->Valid() && iter->key().starts_with(prefix) && limit > 0; iter->Next(), limit--) {
+    batch->Delete(cf_handle, iter->key());
+    (*deleted_subkeys)++;
+  }
+  return iter->status();
+}
+
+void ExpireSweeper::GetStats(ExpireSweeperStats *stats) {
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  *stats = stats_;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <ctime>
+#include <mutex>
+#include <string>
+#include "config.h"
+#include "storage.h"
+
+struct ExpireSweeperStats {
+  time_t last_round_time = 0;
+  uint64_t rounds = 0;
+  uint64_t scanned_keys = 0;
+  uint64_t expired_keys = 0;
+  uint64_t deleted_subkeys = 0;
+};
+
+// ExpireSweeper scans the metadata column family incrementally and deletes
+// the expired keys, so the dead keys won't stay in the db until the compaction
+// reaches them. It remembers the position of the last scan and would continue
+// from there in the next round.
+class ExpireSweeper {
+ public:
+  explicit ExpireSweeper(Engine::Storage *storage, Config *config)
+      : storage_(storage), config_(config) {}
+  ~ExpireSweeper() {}
+  void Sweep(int max_scan_keys);
+  void GetStats(ExpireSweeperStats *stats);
+
+ private:
+  Engine::Storage *storage_ = nullptr;
+  Config *config_ = nullptr;
+  std::string cursor_;
+  std::mutex stats_mu_;
+  ExpireSweeperStats stats_;
+
+  rocksdb::Status deleteExpiredKey(const std::string &ns_key, uint64_t *deleted_subkeys);
+  rocksdb::Status deleteSubKeys(rocksdb::ColumnFamilyHandle *cf_handle, const std::string &prefix,
+                                int limit, rocksdb::WriteBatch *batch, uint64_t *deleted_subkeys);
+};
@@ -37,6 +37,7 @@
 
 #include "geohash.h"
 #include <math.h>
+#include <algorithm>
 
 #define D_R (M_PI / 180.0)
 #define R_MAJOR 6378137.0
@@ -506,3 +507,74 @@ int GeoHashHelper::GetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                               double *distance) {
   return GetDistanceIfInRadius(x1, y1, x2, y2, radius, distance);
 }
+
+/* The batch version of GetDistanceIfInRadius, the distance of the point (xs[i], ys[i])
+ * was set to -1 if it's out of the radius. The points were rejected by the latitude
+ * difference and the haversine of the radius first, so the asin/sqrt were only
+ * computed for the points within the radius, and the distances were the same as
+ * GetDistance. Return the number of points within the radius. */
+size_t GeoHashHelper::GetDistancesIfInRadius(double x1, double y1, double radius, const double *xs,
+                                             const double *ys, size_t n, double *distances) {
+  double lat1r = deg_rad(y1), lon1r = deg_rad(x1);
+  double cos_lat1 = cos(lat1r);
+  // The central angle of the radius, the latitude difference can't be larger than it
+  double max_angle = radius / EARTH_RADIUS_IN_METERS;
+  double max_hav = max_angle >= M_PI ? 1 : sin(max_angle / 2) * sin(max_angle / 2);
+  // Tolerate the rounding errors, the exact distance was checked at last
+  max_angle *= 1 + 1e-9;
+  max_hav *= 1 + 1e-9;
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    distances[i] = -1;
+    double lat2r = deg_rad(ys[i]);
+    if (fabs(lat2r - lat1r) > max_angle) continue;
+    double u = sin((lat2r - lat1r) / 2);
+    double v = sin((deg_rad(xs[i]) - lon1r) / 2);
+    double a = u * u + cos_lat1 * cos(lat2r) * v * v;
+    if (a > max_hav) continue;
+    double distance = 2.0 * EARTH_RADIUS_IN_METERS * asin(sqrt(a));
+    if (distance > radius) continue;
+    distances[i] = distance;
+    count++;
+  }
+  return count;
+}
+
+/* Calculate the distance between two latitudes on the same meridian. */
+double GeoHashHelper::GetLatDistance(double lat1d, double lat2d) {
+  return EARTH_RADIUS_IN_METERS * fabs(deg_rad(lat2d) - deg_rad(lat1d));
+}
+
+/* Judge whether the point (x2, y2) is in the rectangle centered at (x1, y1),
+ * the height was measured along the meridian and the width was measured along
+ * the parallel at the latitude of the point, which is the same as Redis BYBOX.
+ * Return 1 and the distance to the center if the point was in the rectangle. */
+int GeoHashHelper::GetDistanceIfInRectangle(double width_m, double height_m, double x1, double y1,
+                                            double x2, double y2, double *distance) {
+  double lat_distance = GetLatDistance(y2, y1);
+  if (lat_distance > height_m / 2) return 0;
+  double lon_distance = GetDistance(x2, y2, x1, y2);
+  if (lon_distance > width_m / 2) return 0;
+  *distance = GetDistance(x1, y1, x2, y2);
+  return 1;
+}
+
+/* Return the lower bound of the distance from the point to any point in the area,
+ * it's 0 if the point was in the area. Since the distance to the points on the
+ * same parallel grows with the longitude difference, the nearest point was on
+ * the nearer meridian edge when the point wasn't between the edges, and the
+ * nearest latitude on that edge was atan(tan(lat) / cos(delta lon)). */
+double GeoHashHelper::GetMinDistanceToArea(double longitude, double latitude, const GeoHashArea &area) {
+  double nearest_lat = std::max(area.latitude.min, std::min(latitude, area.latitude.max));
+  if (longitude >= area.longitude.min && longitude <= area.longitude.max) {
+    return GetLatDistance(latitude, nearest_lat);
+  }
+  double delta_min = fabs(remainder(longitude - area.longitude.min, 360));
+  double delta_max = fabs(remainder(longitude - area.longitude.max, 360));
+  double delta = std::min(delta_min, delta_max);
+  if (delta >= 90) return GetLatDistance(latitude, nearest_lat);
+  double edge_lon = delta_min < delta_max ? area.longitude.min : area.longitude.max;
+  nearest_lat = rad_deg(atan(tan(deg_rad(latitude)) / cos(deg_rad(delta))));
+  nearest_lat = std::max(area.latitude.min, std::min(nearest_lat, area.latitude.max));
+  return GetDistance(longitude, latitude, edge_lon, nearest_lat);
+}
@@ -140,5 +140,11 @@ class GeoHashHelper {
   static int GetDistanceIfInRadiusWGS84(double x1, double y1, double x2,
                                         double y2, double radius,
                                         double *distance);
+  static size_t GetDistancesIfInRadius(double x1, double y1, double radius, const double *xs,
+                                       const double *ys, size_t n, double *distances);
+  static double GetLatDistance(double lat1d, double lat2d);
+  static int GetDistanceIfInRectangle(double width_m, double height_m, double x1, double y1,
+                                      double x2, double y2, double *distance);
+  static double GetMinDistanceToArea(double longitude, double latitude, const GeoHashArea &area);
 };
 
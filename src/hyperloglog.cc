@@ -0,0 +1,327 @@
+#include "hyperloglog.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#include "bit_util.h"
+
+// The algorithm and the encodings were ported from the Redis hyperloglog.c
+namespace HLL {
+
+const int kQ = 64 - kPrecision;
+const double kAlphaInf = 0.721347520444481703680;
+const char kMagic[] = "HYLL";
+
+// the sparse opcodes
+const uint8_t kSparseXZeroBit = 0x40;
+const uint8_t kSparseValBit = 0x80;
+const int kSparseZeroMaxLen = 64;
+const int kSparseXZeroMaxLen = 16384;
+const int kSparseValMaxValue = 32;
+const int kSparseValMaxLen = 4;
+
+namespace {
+
+uint64_t murmurHash64A(const void *key, int len, unsigned int seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const uint8_t *data = static_cast<const uint8_t *>(key);
+  const uint8_t *end = data + (len - (len & 7));
+
+  while (data != end) {
+    uint64_t k = 0;
+    // the hash was defined on the little endian words
+    for (int i = 7; i >= 0; i--) k = (k << 8) | data[i];
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+    data += 8;
+  }
+
+  switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(data[6]) << 48;  // fall through
+    case 6: h ^= static_cast<uint64_t>(data[5]) << 40;  // fall through
+    case 5: h ^= static_cast<uint64_t>(data[4]) << 32;  // fall through
+    case 4: h ^= static_cast<uint64_t>(data[3]) << 24;  // fall through
+    case 3: h ^= static_cast<uint64_t>(data[2]) << 16;  // fall through
+    case 2: h ^= static_cast<uint64_t>(data[1]) << 8;  // fall through
+    case 1:
+      h ^= static_cast<uint64_t>(data[0]);
+      h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Return the register index of the element and the length of the 000..1 pattern
+// after the index bits, which was the value of the register.
+uint8_t patternLength(const std::string &element, int *index) {
+  uint64_t hash = murmurHash64A(element.data(), static_cast<int>(element.size()), 0xadc83b19ULL);
+  *index = static_cast<int>(hash & (kRegisters - 1));
+  hash >>= kPrecision;
+  hash |= 1ULL << kQ;  // make sure the loop terminates
+  uint8_t count = 1;
+  for (uint64_t bit = 1; (hash & bit) == 0; bit <<= 1) count++;
+  return count;
+}
+
+uint8_t *denseRegisters(std::string *hll) {
+  return reinterpret_cast<uint8_t *>(&(*hll)[kHeaderSize]);
+}
+
+const uint8_t *denseRegisters(const std::string &hll) {
+  return reinterpret_cast<const uint8_t *>(hll.data() + kHeaderSize);
+}
+
+uint8_t getDenseRegister(const uint8_t *p, int index) {
+  size_t byte = index * kRegisterBits / 8;
+  unsigned fb = index * kRegisterBits & 7;
+  unsigned value = p[byte] >> fb;
+  // the register may be across the byte boundary
+  if (fb + kRegisterBits > 8) value |= p[byte + 1] << (8 - fb);
+  return static_cast<uint8_t>(value & kRegisterMax);
+}
+
+void setDenseRegister(uint8_t *p, int index, uint8_t value) {
+  size_t byte = index * kRegisterBits / 8;
+  unsigned fb = index * kRegisterBits & 7;
+  p[byte] = static_cast<uint8_t>((p[byte] & ~(kRegisterMax << fb)) | (value << fb));
+  if (fb + kRegisterBits > 8) {
+    unsigned fb8 = 8 - fb;
+    p[byte + 1] = static_cast<uint8_t>((p[byte + 1] & ~(kRegisterMax >> fb8)) | (value >> fb8));
+  }
+}
+
+// Unpack the dense registers, every 3 bytes hold 4 registers
+void unpackDense(const uint8_t *p, uint8_t *registers) {
+  for (int i = 0; i < kRegisters; i += 4, p += 3) {
+    registers[i] = p[0] & kRegisterMax;
+    registers[i + 1] = ((p[0] >> 6) | (p[1] << 2)) & kRegisterMax;
+    registers[i + 2] = ((p[1] >> 4) | (p[2] << 4)) & kRegisterMax;
+    registers[i + 3] = p[2] >> 2;
+  }
+}
+
+// Decode the sparse opcodes into the registers, return false if the opcodes were corrupted
+bool unpackSparse(const std::string &hll, uint8_t *registers) {
+  memset(registers, 0, kRegisters);
+  auto p = reinterpret_cast<const uint8_t *>(hll.data()) + kHeaderSize;
+  auto end = reinterpret_cast<const uint8_t *>(hll.data()) + hll.size();
+  int index = 0;
+  while (p < end) {
+    int len;
+    if (!(*p & kSparseValBit) && !(*p & kSparseXZeroBit)) {  // ZERO
+      len = (*p & 0x3f) + 1;
+      p++;
+    } else if (!(*p & kSparseValBit)) {  // XZERO
+      if (p + 1 >= end) return false;
+      len = (((*p & 0x3f) << 8) | p[1]) + 1;
+      p += 2;
+    } else {  // VAL
+      len = (*p & 0x3) + 1;
+      uint8_t value = ((*p >> 2) & 0x1f) + 1;
+      if (index + len > kRegisters) return false;
+      memset(registers + index, value, len);
+      p++;
+    }
+    index += len;
+    if (index > kRegisters) return false;
+  }
+  return index == kRegisters;
+}
+
+void packSparse(const uint8_t *registers, std::string *hll) {
+  hll->resize(kHeaderSize);
+  (*hll)[4] = kSparse;
+  for (int i = 0; i < kRegisters;) {
+    uint8_t value = registers[i];
+    int run = 1;
+    while (i + run < kRegisters && registers[i + run] == value) run++;
+    i += run;
+    while (run > 0) {
+      int len;
+      if (value == 0 && run > kSparseZeroMaxLen) {
+        len = std::min(run, kSparseXZeroMaxLen);
+        hll->push_back(static_cast<char>(kSparseXZeroBit | ((len - 1) >> 8)));
+        hll->push_back(static_cast<char>((len - 1) & 0xff));
+      } else if (value == 0) {
+        len = run;
+        hll->push_back(static_cast<char>(len - 1));
+      } else {
+        len = std::min(run, kSparseValMaxLen);
+        hll->push_back(static_cast<char>(kSparseValBit | ((value - 1) << 2) | (len - 1)));
+      }
+      run -= len;
+    }
+  }
+}
+
+void invalidateCache(std::string *hll) {
+  (*hll)[15] = static_cast<char>((*hll)[15] | (1 << 7));
+}
+
+double tau(double x) {
+  if (x == 0. || x == 1.) return 0.;
+  double z_prime;
+  double y = 1.0;
+  double z = 1 - x;
+  do {
+    x = sqrt(x);
+    z_prime = z;
+    y *= 0.5;
+    z -= pow(1 - x, 2) * y;
+  } while (z_prime != z);
+  return z / 3;
+}
+
+double sigma(double x) {
+  if (x == 1.) return INFINITY;
+  double z_prime;
+  double y = 1;
+  double z = x;
+  do {
+    x *= x;
+    z_prime = z;
+    z += x * y;
+    y += y;
+  } while (z_prime != z);
+  return z;
+}
+
+// The improved estimator from "New cardinality estimation algorithms for HyperLogLog sketches"
+uint64_t estimate(const int *histogram) {
+  double m = kRegisters;
+  double z = m * tau((m - histogram[kQ + 1]) / m);
+  for (int j = kQ; j >= 1; --j) {
+    z += histogram[j];
+    z *= 0.5;
+  }
+  z += m * sigma(histogram[0] / m);
+  return static_cast<uint64_t>(llroundl(kAlphaInf * m * m / z));
+}
+
+}  // namespace
+
+void CreateEmpty(std::string *hll) {
+  hll->assign(kHeaderSize, 0);
+  memcpy(&(*hll)[0], kMagic, 4);
+  (*hll)[4] = kSparse;
+  hll->push_back(static_cast<char>(kSparseXZeroBit | ((kSparseXZeroMaxLen - 1) >> 8)));
+  hll->push_back(static_cast<char>((kSparseXZeroMaxLen - 1) & 0xff));
+}
+
+bool IsValid(const std::string &hll) {
+  if (hll.size() < kHeaderSize || memcmp(hll.data(), kMagic, 4) != 0) return false;
+  if (hll[4] == kDense) return hll.size() == kDenseSize;
+  return hll[4] == kSparse;
+}
+
+Encoding GetEncoding(const std::string &hll) {
+  return static_cast<Encoding>(hll[4]);
+}
+
+bool Add(std::string *hll, const std::vector<std::string> &elements, size_t sparse_max_bytes, bool *corrupted) {
+  *corrupted = false;
+  bool updated = false;
+  int index;
+  if (GetEncoding(*hll) == kDense) {
+    uint8_t *p = denseRegisters(hll);
+    for (const auto &element : elements) {
+      uint8_t count = patternLength(element, &index);
+      if (count > getDenseRegister(p, index)) {
+        setDenseRegister(p, index, count);
+        updated = true;
+      }
+    }
+    if (updated) invalidateCache(hll);
+    return updated;
+  }
+
+  // The sparse registers were unpacked and packed again after all elements were
+  // added, so the cost was amortized when adding many elements at once.
+  std::vector<uint8_t> registers(kRegisters);
+  if (!unpackSparse(*hll, registers.data())) {
+    *corrupted = true;
+    return false;
+  }
+  uint8_t max_value = 0;
+  for (const auto &element : elements) {
+    uint8_t count = patternLength(element, &index);
+    if (count > registers[index]) {
+      registers[index] = count;
+      max_value = std::max(max_value, count);
+      updated = true;
+    }
+  }
+  if (!updated) return false;
+
+  std::string header = hll->substr(0, kHeaderSize);
+  if (max_value <= kSparseValMaxValue) {
+    packSparse(registers.data(), hll);
+    memcpy(&(*hll)[0], header.data(), kHeaderSize);
+  }
+  if (max_value > kSparseValMaxValue || hll->size() > sparse_max_bytes) {
+    DenseFromRegisters(registers.data(), hll);
+  }
+  invalidateCache(hll);
+  return true;
+}
+
+bool Count(std::string *hll, uint64_t *card) {
+  auto cache = reinterpret_cast<uint8_t *>(&(*hll)[8]);
+  if (!(cache[7] & (1 << 7))) {
+    *card = 0;
+    for (int i = 7; i >= 0; i--) *card = (*card << 8) | cache[i];
+    return true;
+  }
+
+  int histogram[64] = {0};
+  if (GetEncoding(*hll) == kDense) {
+    const uint8_t *p = denseRegisters(*hll);
+    for (int i = 0; i < kRegisters; i++) histogram[getDenseRegister(p, i)]++;
+  } else {
+    std::vector<uint8_t> registers(kRegisters);
+    if (!unpackSparse(*hll, registers.data())) return false;
+    for (const auto reg : registers) histogram[reg]++;
+  }
+  *card = estimate(histogram);
+  for (int i = 0; i < 8; i++) cache[i] = static_cast<uint8_t>(*card >> (i * 8));
+  return true;
+}
+
+bool MergeRegisters(const std::string &hll, uint8_t *max) {
+  std::vector<uint8_t> registers(kRegisters);
+  if (GetEncoding(hll) == kDense) {
+    unpackDense(denseRegisters(hll), registers.data());
+  } else if (!unpackSparse(hll, registers.data())) {
+    return false;
+  }
+  BitUtil::MaxBytes(max, registers.data(), kRegisters);
+  return true;
+}
+
+uint64_t CountRegisters(const uint8_t *registers) {
+  int histogram[64] = {0};
+  for (int i = 0; i < kRegisters; i++) histogram[registers[i] & kRegisterMax]++;
+  return estimate(histogram);
+}
+
+void DenseFromRegisters(const uint8_t *registers, std::string *hll) {
+  hll->assign(kDenseSize, 0);
+  memcpy(&(*hll)[0], kMagic, 4);
+  (*hll)[4] = kDense;
+  uint8_t *p = denseRegisters(hll);
+  for (int i = 0; i < kRegisters; i++) {
+    if (registers[i]) setDenseRegister(p, i, registers[i]);
+  }
+  invalidateCache(hll);
+}
+
+}  // namespace HLL
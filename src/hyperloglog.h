@@ -0,0 +1,57 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// The HyperLogLog was stored as the string value with the same layout as Redis,
+// so the value can be dumped/synced to Redis and used as the HyperLogLog there.
+//
+// +------+----------+---------+-----------------------+-----------
+// | HYLL | E(1byte) | N N N   | cached cardinality(8) | registers
+// +------+----------+---------+-----------------------+-----------
+//
+// E was the encoding(0: dense, 1: sparse), the dense registers were 16384 6-bit
+// integers, and the sparse registers were encoded with the ZERO/XZERO/VAL opcodes.
+// The most significant bit of the last cardinality byte was set when the cached
+// cardinality was invalid.
+namespace HLL {
+
+const int kPrecision = 14;
+const int kRegisters = 1 << kPrecision;
+const int kRegisterBits = 6;
+const int kRegisterMax = (1 << kRegisterBits) - 1;
+const size_t kHeaderSize = 16;
+const size_t kDenseSize = kHeaderSize + (kRegisters * kRegisterBits + 7) / 8;
+
+enum Encoding {
+  kDense = 0,
+  kSparse = 1,
+};
+
+// Create an empty HyperLogLog in the sparse encoding
+void CreateEmpty(std::string *hll);
+// Check the header and the size of the HyperLogLog value
+bool IsValid(const std::string &hll);
+Encoding GetEncoding(const std::string &hll);
+
+// Add the elements into the HyperLogLog, the sparse encoding was promoted to dense
+// when any register was too large for the sparse encoding or the size exceeded the
+// sparse_max_bytes. Return true if any register was modified, and return false with
+// *corrupted set if the sparse registers were corrupted.
+bool Add(std::string *hll, const std::vector<std::string> &elements, size_t sparse_max_bytes, bool *corrupted);
+
+// Return the estimated cardinality, the cached cardinality was used if it's valid,
+// and the cache was updated otherwise. Return false if the registers were corrupted.
+bool Count(std::string *hll, uint64_t *card);
+
+// Unpack the registers into one byte per register and merge them into the max
+// registers, the max registers should have kRegisters bytes.
+bool MergeRegisters(const std::string &hll, uint8_t *max);
+// Estimate the cardinality of the unpacked registers
+uint64_t CountRegisters(const uint8_t *registers);
+// Pack the unpacked registers into the dense HyperLogLog
+void DenseFromRegisters(const uint8_t *registers, std::string *hll);
+
+}  // namespace HLL
@@ -0,0 +1,42 @@
+#include "metrics_exporter.h"
+
+#include <string.h>
+#include <event2/buffer.h>
+#include <event2/keyvalq_struct.h>
+
+#include "server.h"
+
+MetricsExporter::~MetricsExporter() {
+  if (http_) evhttp_free(http_);
+}
+
+Status MetricsExporter::Listen(event_base *base, const std::vector<std::string> &binds, int port) {
+  http_ = evhttp_new(base);
+  if (!http_) return Status(Status::NotOK, "failed to create the http server");
+  evhttp_set_allowed_methods(http_, EVHTTP_REQ_GET | EVHTTP_REQ_HEAD);
+  evhttp_set_gencb(http_, handleRequest, this);
+  for (const auto &bind : binds) {
+    if (evhttp_bind_socket(http_, bind.c_str(), static_cast<uint16_t>(port)) != 0) {
+      return Status(Status::NotOK, "failed to listen on " + bind + ":" + std::to_string(port));
+    }
+  }
+  return Status::OK();
+}
+
+void MetricsExporter::handleRequest(evhttp_request *req, void *ctx) {
+  auto exporter = static_cast<MetricsExporter *>(ctx);
+  const char *path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+  if (!path || strcmp(path, "/metrics") != 0) {
+    evhttp_send_error(req, HTTP_NOTFOUND, "Not Found");
+    return;
+  }
+
+  std::string metrics;
+  exporter->svr_->GetMetrics(&metrics);
+  evkeyvalq *headers = evhttp_request_get_output_headers(req);
+  evhttp_add_header(headers, "Content-Type", "application/openmetrics-text; version=1.0.0; charset=utf-8");
+  evbuffer *body = evbuffer_new();
+  evbuffer_add(body, metrics.data(), metrics.size());
+  evhttp_send_reply(req, HTTP_OK, "OK", body);
+  evbuffer_free(body);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <event2/event.h>
+#include <event2/http.h>
+
+#include "status.h"
+
+class Server;
+
+// Serve the metrics of the server in the OpenMetrics text format on the
+// `metrics-port`, the HTTP listener was attached to the event base of
+// a worker, so no extra thread was needed.
+class MetricsExporter {
+ public:
+  explicit MetricsExporter(Server *svr) : svr_(svr) {}
+  ~MetricsExporter();
+  MetricsExporter(const MetricsExporter &) = delete;
+  MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+  Status Listen(event_base *base, const std::vector<std::string> &binds, int port);
+
+ private:
+  static void handleRequest(evhttp_request *req, void *ctx);
+
+  Server *svr_ = nullptr;
+  evhttp *http_ = nullptr;
+};
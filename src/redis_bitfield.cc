@@ -0,0 +1,169 @@
+#include "redis_bitfield.h"
+#include <limits>
+
+namespace Redis {
+
+// The max bit offset of the bitfield, it's limited by the uint32 offset of SETBIT/GETBIT
+const uint64_t kMaxBitfieldOffset = std::numeric_limits<uint32_t>::max();
+
+Status ParseBitfieldType(const std::string &type, bool *is_signed, uint8_t *bits) {
+  const char *err = "Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.";
+  if (type.size() < 2 || (type[0] != 'i' && type[0] != 'I' && type[0] != 'u' && type[0] != 'U')) {
+    return Status(Status::RedisParseErr, err);
+  }
+  *is_signed = type[0] == 'i' || type[0] == 'I';
+  int n = 0;
+  try {
+    size_t pos = 0;
+    n = std::stoi(type.substr(1), &pos);
+    if (pos != type.size() - 1) return Status(Status::RedisParseErr, err);
+  } catch (std::exception &e) {
+    return Status(Status::RedisParseErr, err);
+  }
+  if (n < 1 || (*is_signed && n > 64) || (!*is_signed && n > 63)) {
+    return Status(Status::RedisParseErr, err);
+  }
+  *bits = static_cast<uint8_t>(n);
+  return Status::OK();
+}
+
+Status ParseBitfieldOffset(const std::string &offset, uint8_t bits, uint64_t *result) {
+  const char *err = "bit offset is not an integer or out of range";
+  bool multiply = !offset.empty() && offset[0] == '#';
+  int64_t n = 0;
+  try {
+    size_t pos = 0;
+    std::string number = multiply ? offset.substr(1) : offset;
+    n = std::stoll(number, &pos);
+    if (pos != number.size()) return Status(Status::RedisParseErr, err);
+  } catch (std::exception &e) {
+    return Status(Status::RedisParseErr, err);
+  }
+  if (n < 0 || (multiply && static_cast<uint64_t>(n) > kMaxBitfieldOffset / bits)) {
+    return Status(Status::RedisParseErr, err);
+  }
+  uint64_t bit_offset = multiply ? static_cast<uint64_t>(n) * bits : static_cast<uint64_t>(n);
+  if (bit_offset + bits - 1 > kMaxBitfieldOffset) return Status(Status::RedisParseErr, err);
+  *result = bit_offset;
+  return Status::OK();
+}
+
+std::vector<std::string> BitfieldOperationArgs(const std::vector<BitfieldOperation> &ops) {
+  static const char *overflow_names[] = {"WRAP", "SAT", "FAIL"};
+  static const char *type_names[] = {"GET", "SET", "INCRBY"};
+  std::vector<std::string> args;
+  for (const auto &op : ops) {
+    if (op.type == kBitfieldGet) continue;
+    args.emplace_back("OVERFLOW");
+    args.emplace_back(overflow_names[op.overflow]);
+    args.emplace_back(type_names[op.type]);
+    args.emplace_back((op.is_signed ? "i" : "u") + std::to_string(op.bits));
+    args.emplace_back(std::to_string(op.offset));
+    args.emplace_back(std::to_string(op.value));
+  }
+  return args;
+}
+
+int64_t DecodeBitfieldValue(uint64_t raw, uint8_t bits, bool is_signed) {
+  if (!is_signed || bits == 64) return static_cast<int64_t>(raw);
+  // propagate the sign bit to the higher bits
+  if (raw & (static_cast<uint64_t>(1) << (bits - 1))) raw |= UINT64_MAX << bits;
+  return static_cast<int64_t>(raw);
+}
+
+/* The overflow checks were from the redis project:
+ * https://github.com/antirez/redis/blob/6.0/src/bitops.c#L270
+ *
+ * Return 1 or -1 if the value + incr was overflow or underflow, and the limit
+ * would be set to the wrapped or saturated value, otherwise 0 was returned. */
+static int checkUnsignedBitfieldOverflow(uint64_t value, int64_t incr, uint8_t bits,
+                                         BitfieldOverflow overflow, uint64_t *limit) {
+  uint64_t max = (bits == 64) ? UINT64_MAX : ((static_cast<uint64_t>(1) << bits) - 1);
+  int64_t maxincr = static_cast<int64_t>(max - value);
+  int64_t minincr = -static_cast<int64_t>(value);
+  auto wrap = [&]() {
+    uint64_t mask = UINT64_MAX << bits;
+    *limit = (value + static_cast<uint64_t>(incr)) & ~mask;
+  };
+
+  if (value > max || (incr > 0 && incr > maxincr)) {
+    if (overflow == kBitfieldOverflowWrap) {
+      wrap();
+    } else if (overflow == kBitfieldOverflowSat) {
+      *limit = max;
+    }
+    return 1;
+  } else if (incr < 0 && incr < minincr) {
+    if (overflow == kBitfieldOverflowWrap) {
+      wrap();
+      return 1;
+    } else if (overflow == kBitfieldOverflowSat) {
+      *limit = 0;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+static int checkSignedBitfieldOverflow(int64_t value, int64_t incr, uint8_t bits,
+                                       BitfieldOverflow overflow, int64_t *limit) {
+  int64_t max = (bits == 64) ? INT64_MAX : ((static_cast<int64_t>(1) << (bits - 1)) - 1);
+  int64_t min = (-max) - 1;
+  // maxincr and minincr could overflow, but they were only used after checking
+  // the range of value, so the overflow won't happen when they were used.
+  int64_t maxincr = static_cast<int64_t>(static_cast<uint64_t>(max) - static_cast<uint64_t>(value));
+  int64_t minincr = static_cast<int64_t>(static_cast<uint64_t>(min) - static_cast<uint64_t>(value));
+  auto wrap = [&]() {
+    uint64_t msb = static_cast<uint64_t>(1) << (bits - 1);
+    // perform the addition as unsigned so that's defined
+    uint64_t c = static_cast<uint64_t>(value) + static_cast<uint64_t>(incr);
+    // propagate the sign bit to all the higher order bits if it's set,
+    // or mask to the positive integer limit if it's clear.
+    if (bits < 64) {
+      uint64_t mask = UINT64_MAX << bits;
+      if (c & msb) {
+        c |= mask;
+      } else {
+        c &= ~mask;
+      }
+    }
+    *limit = static_cast<int64_t>(c);
+  };
+
+  if (value > max || (bits != 64 && incr > maxincr) || (value >= 0 && incr > 0 && incr > maxincr)) {
+    if (overflow == kBitfieldOverflowWrap) {
+      wrap();
+    } else if (overflow == kBitfieldOverflowSat) {
+      *limit = max;
+    }
+    return 1;
+  } else if (value < min || (bits != 64 && incr < minincr) || (value < 0 && incr < 0 && incr < minincr)) {
+    if (overflow == kBitfieldOverflowWrap) {
+      wrap();
+      return 1;
+    } else if (overflow == kBitfieldOverflowSat) {
+      *limit = min;
+    }
+    return -1;
+  }
+  return 0;
+}
+
+bool ComputeBitfieldValue(const BitfieldOperation &op, int64_t old_value, int64_t *new_value) {
+  // SET was checked as the new value plus zero increment
+  int64_t base = op.type == kBitfieldSet ? op.value : old_value;
+  int64_t incr = op.type == kBitfieldSet ? 0 : op.value;
+  int overflowed;
+  if (op.is_signed) {
+    int64_t limit = 0;
+    overflowed = checkSignedBitfieldOverflow(base, incr, op.bits, op.overflow, &limit);
+    *new_value = overflowed ? limit : static_cast<int64_t>(static_cast<uint64_t>(base) + static_cast<uint64_t>(incr));
+  } else {
+    uint64_t limit = 0;
+    overflowed = checkUnsignedBitfieldOverflow(static_cast<uint64_t>(base), incr, op.bits, op.overflow, &limit);
+    *new_value = static_cast<int64_t>(overflowed ? limit : static_cast<uint64_t>(base) + static_cast<uint64_t>(incr));
+  }
+  return !(overflowed && op.overflow == kBitfieldOverflowFail);
+}
+
+}  // namespace Redis
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+#include "status.h"
+
+namespace Redis {
+
+enum BitfieldOverflow {
+  kBitfieldOverflowWrap,
+  kBitfieldOverflowSat,
+  kBitfieldOverflowFail,
+};
+
+enum BitfieldOpType {
+  kBitfieldGet,
+  kBitfieldSet,
+  kBitfieldIncrBy,
+};
+
+struct BitfieldOperation {
+  BitfieldOpType type = kBitfieldGet;
+  BitfieldOverflow overflow = kBitfieldOverflowWrap;
+  bool is_signed = false;
+  uint8_t bits = 0;
+  uint64_t offset = 0;
+  // the new value of SET or the increment of INCRBY
+  int64_t value = 0;
+};
+
+struct BitfieldResult {
+  bool is_nil = false;
+  int64_t value = 0;
+};
+
+// Parse the type(e.g. i8, u16) and offset(e.g. 100, #2) of the BITFIELD sub-command
+Status ParseBitfieldType(const std::string &type, bool *is_signed, uint8_t *bits);
+Status ParseBitfieldOffset(const std::string &offset, uint8_t bits, uint64_t *result);
+// Convert the operations back to the BITFIELD arguments, it's used to replay the command
+std::vector<std::string> BitfieldOperationArgs(const std::vector<BitfieldOperation> &ops);
+
+// Decode the raw bits as signed or unsigned integer
+int64_t DecodeBitfieldValue(uint64_t raw, uint8_t bits, bool is_signed);
+// Compute the new value of SET/INCRBY with the overflow behavior,
+// return false when it was overflow and the behavior was FAIL.
+bool ComputeBitfieldValue(const BitfieldOperation &op, int64_t old_value, int64_t *new_value);
+
+// Execute the operation on the bits which were accessed by the get_bit and set_bit,
+// the bits were numbered from the most significant bit of the field.
+// Return true if the bits were modified.
+template <typename GetBit, typename SetBit>
+bool ExecuteBitfieldOperation(const BitfieldOperation &op, const GetBit &get_bit, const SetBit &set_bit,
+                              BitfieldResult *result) {
+  uint64_t raw = 0;
+  for (uint8_t i = 0; i < op.bits; i++) {
+    raw = (raw << 1) | (get_bit(op.offset + i) ? 1 : 0);
+  }
+  int64_t old_value = DecodeBitfieldValue(raw, op.bits, op.is_signed);
+  result->is_nil = false;
+  result->value = old_value;
+  if (op.type == kBitfieldGet) return false;
+
+  int64_t new_value = 0;
+  if (!ComputeBitfieldValue(op, old_value, &new_value)) {
+    result->is_nil = true;
+    return false;
+  }
+  // SET returns the old value and INCRBY returns the new value
+  if (op.type == kBitfieldIncrBy) result->value = new_value;
+  uint64_t new_raw = static_cast<uint64_t>(new_value);
+  for (uint8_t i = 0; i < op.bits; i++) {
+    set_bit(op.offset + i, ((new_raw >> (op.bits - 1 - i)) & 1) != 0);
+  }
+  return true;
+}
+
+}  // namespace Redis
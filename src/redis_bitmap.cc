@@ -1,36 +1,140 @@
 #include "redis_bitmap.h"
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
+#include "bit_util.h"
+#include "bitmap_container.h"
 #include "redis_bitmap_string.h"
+#include "redis_string.h"
 
 namespace Redis {
 
 const uint32_t kBitmapSegmentBits = 1024 * 8;
 const uint32_t kBitmapSegmentBytes = 1024;
 
-uint32_t kNum2Bits[256] = {
-    0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7,
-    4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8
+// The max number of segments read in a batch, to prevent large range query
+// from taking too much memory.
+const int kBitmapSegmentsPerRead = 64;
+// The max number of segments written in a batch by BITOP
+const int kBitmapSegmentsPerWrite = 256;
+
+namespace {
+
+// SegmentCursor walks through the segments of a bitmap in the order of the subkey,
+// the segment index was encoded as string, so all bitmaps share the same order
+// and the segments with the same index can be merged by moving the cursors together.
+class SegmentCursor {
+ public:
+  virtual ~SegmentCursor() = default;
+  virtual bool Valid() = 0;
+  virtual void Next() = 0;
+  virtual Slice Index() = 0;
+  virtual Slice Value() = 0;
+};
+
+class BitmapSegmentCursor : public SegmentCursor {
+ public:
+  BitmapSegmentCursor(rocksdb::DB *db, const rocksdb::ReadOptions &read_options,
+                      const Slice &ns_key, const Metadata &metadata)
+      : encoded_(Bitmap::IsContainerEncoded(metadata)) {
+    InternalKey(ns_key, "", metadata.version).Encode(&prefix_);
+    iter_ = std::unique_ptr<rocksdb::Iterator>(db->NewIterator(read_options));
+    iter_->Seek(prefix_);
+  }
+  bool Valid() override { return iter_->Valid() && iter_->key().starts_with(prefix_); }
+  void Next() override { iter_->Next(); }
+  Slice Index() override {
+    Slice index = iter_->key();
+    index.remove_prefix(prefix_.size());
+    return index;
+  }
+  Slice Value() override {
+    if (!encoded_) return iter_->value();
+    Slice value = iter_->value();
+    if (!BitmapContainer::Decode(value.data(), value.size(), &segment_)) {
+      status_ = rocksdb::Status::Corruption("the bitmap segment was corrupted");
+    }
+    return segment_;
+  }
+  rocksdb::Status status() { return status_.ok() ? iter_->status() : status_; }
+
+ private:
+  bool encoded_;
+  std::string prefix_;
+  std::string segment_;
+  rocksdb::Status status_;
+  std::unique_ptr<rocksdb::Iterator> iter_;
 };
 
+// The string was split into segments and converted to the bitmap layout on the fly
+class StringSegmentCursor : public SegmentCursor {
+ public:
+  explicit StringSegmentCursor(std::string &&value) : value_(std::move(value)) {
+    for (size_t offset = 0; offset < value_.size(); offset += kBitmapSegmentBytes) {
+      indexes_.emplace_back(std::to_string(offset));
+    }
+    std::sort(indexes_.begin(), indexes_.end());
+    load();
+  }
+  bool Valid() override { return pos_ < indexes_.size(); }
+  void Next() override {
+    pos_++;
+    load();
+  }
+  Slice Index() override { return indexes_[pos_]; }
+  Slice Value() override { return segment_; }
+
+ private:
+  std::string value_;
+  std::string segment_;
+  std::vector<std::string> indexes_;
+  size_t pos_ = 0;
+
+  void load() {
+    if (!Valid()) return;
+    size_t offset = std::stoul(indexes_[pos_]);
+    segment_ = value_.substr(offset, kBitmapSegmentBytes);
+    BitUtil::ReverseBitsInBytes(reinterpret_cast<uint8_t *>(&segment_[0]), segment_.size());
+  }
+};
+
+// The empty segments of all indexes in [0, size), it's used by NOT to fill the absent segments
+class EmptySegmentCursor : public SegmentCursor {
+ public:
+  explicit EmptySegmentCursor(uint32_t size) {
+    for (uint32_t offset = 0; offset < size; offset += kBitmapSegmentBytes) {
+      indexes_.emplace_back(std::to_string(offset));
+    }
+    std::sort(indexes_.begin(), indexes_.end());
+  }
+  bool Valid() override { return pos_ < indexes_.size(); }
+  void Next() override { pos_++; }
+  Slice Index() override { return indexes_[pos_]; }
+  Slice Value() override { return Slice(); }
+
+ private:
+  std::vector<std::string> indexes_;
+  size_t pos_ = 0;
+};
+
+}  // namespace
+
 rocksdb::Status Bitmap::GetMetadata(const Slice &ns_key, BitmapMetadata *metadata, std::string *raw_value) {
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  return GetMetadata(read_options, ns_key, metadata, raw_value);
+}
+
+rocksdb::Status Bitmap::GetMetadata(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                    BitmapMetadata *metadata, std::string *raw_value) {
   std::string old_metadata;
   metadata->Encode(&old_metadata);
-  auto s = GetRawMetadata(ns_key, raw_value);
+  auto s = GetRawMetadata(read_options, ns_key, raw_value);
   if (!s.ok()) return s;
   metadata->Decode(*raw_value);
 
@@ -72,6 +176,10 @@ rocksdb::Status Bitmap::GetBit(const Slice &user_key, uint32_t offset, bool *bit
   InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
   s = db_->Get(read_options, sub_key, &value);
   if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+  if (IsContainerEncoded(metadata)) {
+    *bit = BitmapContainer::GetBit(value.data(), value.size(), offset % kBitmapSegmentBits);
+    return rocksdb::Status::OK();
+  }
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
   if ((byte_index < value.size() && (value[byte_index] & (1 << (offset % 8))))) {
     *bit = true;
@@ -99,6 +207,12 @@ rocksdb::Status Bitmap::SetBit(const Slice &user_key, uint32_t offset, bool new_
   if (s.ok()) {
     s = db_->Get(rocksdb::ReadOptions(), sub_key, &value);
     if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.ok()) {
+      s = DecodeSegment(metadata, value, &value);
+      if (!s.ok()) return s;
+    }
+  } else {
+    initContainerEncoding(&metadata);
   }
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
   uint32_t bitmap_size = metadata.size;
@@ -121,10 +235,15 @@ rocksdb::Status Bitmap::SetBit(const Slice &user_key, uint32_t offset, bool new_
   } else {
     value[byte_index] &= ~(1 << bit_offset);
   }
+  std::vector<std::string> log_args = {std::to_string(offset)};
+  // the containers can't be parsed without the metadata, so log the new bit
+  if (IsContainerEncoded(metadata)) log_args.emplace_back(new_bit ? "1" : "0");
   rocksdb::WriteBatch batch;
-  WriteBatchLogData log_data(kRedisBitmap, {std::to_string(offset)});
+  WriteBatchLogData log_data(kRedisBitmap, std::move(log_args));
   batch.PutLogData(log_data.Encode());
-  batch.Put(sub_key, value);
+  std::string segment;
+  EncodeSegment(metadata, value, &segment);
+  batch.Put(sub_key, segment);
   if (metadata.size != bitmap_size) {
     metadata.size = bitmap_size;
     std::string bytes;
@@ -143,18 +262,18 @@ rocksdb::Status Bitmap::MSetBit(const Slice &user_key, const std::vector<BitmapP
   rocksdb::Status s = GetMetadata(ns_key, &metadata, &raw_value);
   if (!s.ok() && !s.IsNotFound()) return s;
 
+  if (s.IsNotFound()) initContainerEncoding(&metadata);
   uint32_t cnt = 0;
   rocksdb::WriteBatch batch;
   WriteBatchLogData log_data(kRedisBitmap);
   batch.PutLogData(log_data.Encode());
+  std::string segment;
   for (const auto &pair : pairs) {
     std::string sub_key;
     InternalKey(ns_key, std::to_string(pair.index), metadata.version).Encode(&sub_key);
-    batch.Put(sub_key, pair.value);
-
-    for (size_t j = 0; j < pair.value.size(); j++) {
-      cnt += kNum2Bits[static_cast<int>(pair.value[j])];
-    }
+    EncodeSegment(metadata, pair.value, &segment);
+    batch.Put(sub_key, segment);
+    cnt += BitUtil::Popcount(reinterpret_cast<const uint8_t *>(pair.value.data()), pair.value.size());
   }
   metadata.size = cnt;
   std::string bytes;
@@ -187,18 +306,30 @@ rocksdb::Status Bitmap::BitCount(const Slice &user_key, int start, int stop, uin
   read_options.snapshot = ss.GetSnapShot();
   int start_index = start / kBitmapSegmentBytes;
   int stop_index = stop / kBitmapSegmentBytes;
-  // Don't use multi get to prevent large range query, and take too much memory
-  std::string sub_key, value;
-  for (int i = start_index; i <= stop_index; i++) {
-    InternalKey(ns_key, std::to_string(i * kBitmapSegmentBytes), metadata.version).Encode(&sub_key);
-    s = db_->Get(read_options, sub_key, &value);
-    if (!s.ok() && !s.IsNotFound()) return s;
-    if (s.IsNotFound()) continue;
-    size_t j = 0;
-    if (i == start_index) j = start % kBitmapSegmentBytes;
-    for (; j < value.size(); j++) {
-      if (i == stop_index && j > (stop % kBitmapSegmentBytes)) break;
-      *cnt += kNum2Bits[static_cast<uint8_t>(value[j])];
+  std::vector<std::string> values;
+  std::vector<rocksdb::Status> statuses;
+  for (int first = start_index; first <= stop_index; first += kBitmapSegmentsPerRead) {
+    int count = std::min(kBitmapSegmentsPerRead, stop_index - first + 1);
+    multiGetSegments(read_options, ns_key, metadata.version, first, count, &values, &statuses);
+    for (int k = 0; k < count; k++) {
+      if (!statuses[k].ok() && !statuses[k].IsNotFound()) return statuses[k];
+      if (statuses[k].IsNotFound()) continue;
+      int i = first + k;
+      auto &value = values[k];
+      if (IsContainerEncoded(metadata)) {
+        // the whole segment was counted without decoding the container
+        if (i != start_index && i != stop_index) {
+          *cnt += BitmapContainer::Count(value.data(), value.size());
+          continue;
+        }
+        s = DecodeSegment(metadata, value, &value);
+        if (!s.ok()) return s;
+      }
+      size_t begin = 0, end = value.size();
+      if (i == start_index) begin = start % kBitmapSegmentBytes;
+      if (i == stop_index) end = std::min(end, static_cast<size_t>(stop % kBitmapSegmentBytes) + 1);
+      if (begin >= end) continue;
+      *cnt += BitUtil::Popcount(reinterpret_cast<const uint8_t *>(value.data()) + begin, end - begin);
     }
   }
   return rocksdb::Status::OK();
@@ -228,51 +359,293 @@ rocksdb::Status Bitmap::BitPos(const Slice &user_key, bool bit, int start, int s
     return rocksdb::Status::OK();
   }
 
-  auto bitPosInByte = [](char byte, bool bit) -> int {
-    for (int i = 0; i < 8; i++) {
-      if (bit && (byte & (1 << i)) != 0) return i;
-      if (!bit && (byte & (1 << i)) == 0) return i;
-    }
-    return -1;
-  };
-
   LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
   int start_index = start / kBitmapSegmentBytes;
   int stop_index = stop / kBitmapSegmentBytes;
-  // Don't use multi get to prevent large range query, and take too much memory
-  std::string sub_key, value;
-  for (int i = start_index; i <= stop_index; i++) {
-    InternalKey(ns_key, std::to_string(i * kBitmapSegmentBytes), metadata.version).Encode(&sub_key);
-    s = db_->Get(read_options, sub_key, &value);
-    if (!s.ok() && !s.IsNotFound()) return s;
-    if (s.IsNotFound()) {
-      if (!bit) {
-        *pos = i * kBitmapSegmentBits;
-        return rocksdb::Status::OK();
+  std::vector<std::string> values;
+  std::vector<rocksdb::Status> statuses;
+  // the position was usually found in the first few segments, so begin
+  // with a small batch and grow it when the position wasn't found.
+  int batch_size = 1;
+  for (int first = start_index; first <= stop_index; first += batch_size, batch_size *= 2) {
+    batch_size = std::min(batch_size, kBitmapSegmentsPerRead);
+    int count = std::min(batch_size, stop_index - first + 1);
+    multiGetSegments(read_options, ns_key, metadata.version, first, count, &values, &statuses);
+    for (int k = 0; k < count; k++) {
+      int i = first + k;
+      if (!statuses[k].ok() && !statuses[k].IsNotFound()) return statuses[k];
+      if (statuses[k].IsNotFound()) {
+        if (!bit) {
+          *pos = i * kBitmapSegmentBits;
+          return rocksdb::Status::OK();
+        }
+        continue;
       }
-      continue;
-    }
-    size_t j = 0;
-    if (i == start_index) j = start % kBitmapSegmentBytes;
-    for (; j < value.size(); j++) {
-      if (i == stop_index && j > (stop % kBitmapSegmentBytes)) break;
-      if (bitPosInByte(value[j], bit) != -1) {
-        *pos = static_cast<int>(i * kBitmapSegmentBits + j * 8 + bitPosInByte(value[j], bit));
+      auto &value = values[k];
+      s = DecodeSegment(metadata, value, &value);
+      if (!s.ok()) return s;
+      size_t begin = 0, end = value.size();
+      if (i == start_index) begin = start % kBitmapSegmentBytes;
+      if (i == stop_index) end = std::min(end, static_cast<size_t>(stop % kBitmapSegmentBytes) + 1);
+      if (begin < end) {
+        int64_t bit_pos = BitUtil::FindFirstBitLSB(reinterpret_cast<const uint8_t *>(value.data()) + begin,
+                                                   end - begin, bit);
+        if (bit_pos != -1) {
+          *pos = static_cast<int>(i * kBitmapSegmentBits + begin * 8 + bit_pos);
+          return rocksdb::Status::OK();
+        }
+      }
+      if (!bit && value.size() < kBitmapSegmentBytes) {
+        *pos = static_cast<int>(i * kBitmapSegmentBits + value.size() * 8);
         return rocksdb::Status::OK();
       }
     }
-    if (!bit && value.size() < kBitmapSegmentBytes) {
-      *pos = static_cast<int>(i * kBitmapSegmentBits + value.size() * 8);
-      return rocksdb::Status::OK();
-    }
   }
   // bit was not found
   *pos = bit ? -1 : static_cast<int>(metadata.size * 8);
   return rocksdb::Status::OK();
 }
 
+void Bitmap::multiGetSegments(const rocksdb::ReadOptions &read_options,
+                              const Slice &ns_key,
+                              uint64_t version,
+                              int first_index,
+                              int count,
+                              std::vector<std::string> *values,
+                              std::vector<rocksdb::Status> *statuses) {
+  std::vector<std::string> sub_keys(count);
+  std::vector<rocksdb::Slice> keys;
+  keys.reserve(count);
+  for (int k = 0; k < count; k++) {
+    InternalKey(ns_key, std::to_string((first_index + k) * kBitmapSegmentBytes), version).Encode(&sub_keys[k]);
+    keys.emplace_back(sub_keys[k]);
+  }
+  values->clear();
+  *statuses = db_->MultiGet(read_options, keys, values);
+}
+
+rocksdb::Status Bitmap::BitOp(BitUtil::BitOpFlags op_flag, const std::string &op_name,
+                              const Slice &user_key, const std::vector<Slice> &op_keys, int64_t *len) {
+  std::string ns_key, raw_value;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+
+  uint32_t max_size = 0;
+  bool has_empty_key = false;
+  std::vector<std::unique_ptr<SegmentCursor>> cursors;
+  std::vector<BitmapSegmentCursor *> bitmap_cursors;
+  for (const auto &op_key : op_keys) {
+    std::string op_ns_key;
+    AppendNamespacePrefix(op_key, &op_ns_key);
+    BitmapMetadata metadata(false);
+    // the metadata was read with the same snapshot as the segments, so they
+    // couldn't be of the different versions of the key
+    auto s = GetMetadata(read_options, op_ns_key, &metadata, &raw_value);
+    if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.IsNotFound()) {
+      has_empty_key = true;
+      continue;
+    }
+    if (metadata.Type() == kRedisString) {
+      auto value = raw_value.substr(STRING_HDR_SIZE, raw_value.size() - STRING_HDR_SIZE);
+      if (value.empty()) has_empty_key = true;
+      max_size = std::max(max_size, static_cast<uint32_t>(value.size()));
+      cursors.emplace_back(new StringSegmentCursor(std::move(value)));
+    } else {
+      max_size = std::max(max_size, metadata.size);
+      auto cursor = new BitmapSegmentCursor(db_, read_options, op_ns_key, metadata);
+      cursors.emplace_back(cursor);
+      bitmap_cursors.emplace_back(cursor);
+    }
+  }
+  // the result of AND was always empty when there was any empty key
+  if (op_flag == BitUtil::kBitOpAnd && has_empty_key) {
+    bitmap_cursors.clear();
+    cursors.clear();
+  }
+  if (op_flag == BitUtil::kBitOpNot) cursors.emplace_back(new EmptySegmentCursor(max_size));
+
+  auto log_args = std::vector<std::string>{std::to_string(kRedisCmdBitOp), op_name, user_key.ToString()};
+  for (const auto &op_key : op_keys) log_args.emplace_back(op_key.ToString());
+  WriteBatchLogData log_data(kRedisBitmap, std::move(log_args));
+  rocksdb::WriteBatch batch;
+  batch.PutLogData(log_data.Encode());
+  *len = max_size;
+  if (max_size == 0) {
+    batch.Delete(metadata_cf_handle_, ns_key);
+    return storage_->Write(rocksdb::WriteOptions(), &batch);
+  }
+
+  BitmapMetadata res_metadata;
+  initContainerEncoding(&res_metadata);
+  std::string sub_key, segment, encoded_segment;
+  while (true) {
+    // pick the smallest index of all cursors, and merge the segments with the same index
+    SegmentCursor *min_cursor = nullptr;
+    for (const auto &cursor : cursors) {
+      if (cursor->Valid() && (!min_cursor || cursor->Index().compare(min_cursor->Index()) < 0)) {
+        min_cursor = cursor.get();
+      }
+    }
+    if (!min_cursor) break;
+    std::string index = min_cursor->Index().ToString();
+    uint32_t segment_size = std::min(kBitmapSegmentBytes, max_size - std::min<uint32_t>(std::stoul(index), max_size));
+    size_t num_segments = 0;
+    segment.clear();
+    for (const auto &cursor : cursors) {
+      if (!cursor->Valid() || cursor->Index() != index) continue;
+      Slice value = cursor->Value();
+      if (value.size() > segment.size()) {
+        // the absent bytes were treated as zero
+        segment.append(value.size() - segment.size(), 0);
+      }
+      auto dst = reinterpret_cast<uint8_t *>(&segment[0]);
+      auto src = reinterpret_cast<const uint8_t *>(value.data());
+      if (num_segments == 0 || op_flag == BitUtil::kBitOpNot) {
+        memcpy(dst, src, value.size());
+      } else if (op_flag == BitUtil::kBitOpAnd) {
+        // the bytes out of the shorter segment should be zero
+        BitUtil::BitwiseOp(op_flag, dst, src, value.size());
+        memset(dst + value.size(), 0, segment.size() - value.size());
+      } else {
+        BitUtil::BitwiseOp(op_flag, dst, src, value.size());
+      }
+      num_segments++;
+      cursor->Next();
+    }
+    if (op_flag == BitUtil::kBitOpNot) {
+      segment.resize(segment_size, 0);
+      BitUtil::BitwiseOp(op_flag, reinterpret_cast<uint8_t *>(&segment[0]), nullptr, segment.size());
+    } else if (op_flag == BitUtil::kBitOpAnd && num_segments != cursors.size()) {
+      continue;  // the segment was absent in some bitmaps
+    }
+    if (segment.empty() || IsEmptySegment(segment)) continue;
+
+    InternalKey(ns_key, index, res_metadata.version).Encode(&sub_key);
+    EncodeSegment(res_metadata, segment, &encoded_segment);
+    batch.Put(sub_key, encoded_segment);
+    if (batch.Count() >= static_cast<uint32_t>(kBitmapSegmentsPerWrite)) {
+      // The segments of the new version were invisible before the metadata was written,
+      // so it's safe to write them in multiple batches.
+      auto s = storage_->Write(rocksdb::WriteOptions(), &batch);
+      if (!s.ok()) return s;
+      batch.Clear();
+      batch.PutLogData(log_data.Encode());
+    }
+  }
+  for (const auto &cursor : bitmap_cursors) {
+    if (!cursor->status().ok()) return cursor->status();
+  }
+  res_metadata.size = max_size;
+  std::string bytes;
+  res_metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status Bitmap::Bitfield(const Slice &user_key, const std::vector<BitfieldOperation> &ops,
+                                 std::vector<BitfieldResult> *rets) {
+  std::string ns_key, raw_value;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  BitmapMetadata metadata;
+  rocksdb::Status s = GetMetadata(ns_key, &metadata, &raw_value);
+  if (!s.ok() && !s.IsNotFound()) return s;
+
+  if (metadata.Type() == kRedisString) {
+    Redis::BitmapString bitmap_string_db(storage_, namespace_);
+    return bitmap_string_db.Bitfield(ns_key, &raw_value, ops, rets);
+  }
+
+  // Read all the segments touched by the operations at once, the operations
+  // were applied on the cached segments and written in one batch.
+  std::map<uint32_t, std::string> segments;
+  for (const auto &op : ops) {
+    uint32_t first = static_cast<uint32_t>(op.offset / kBitmapSegmentBits);
+    uint32_t last = static_cast<uint32_t>((op.offset + op.bits - 1) / kBitmapSegmentBits);
+    for (uint32_t i = first; i <= last; i++) segments.emplace(i * kBitmapSegmentBytes, "");
+  }
+  if (s.ok()) {
+    std::vector<std::string> sub_keys, values;
+    std::vector<rocksdb::Slice> keys;
+    sub_keys.reserve(segments.size());
+    for (const auto &segment : segments) {
+      sub_keys.emplace_back();
+      InternalKey(ns_key, std::to_string(segment.first), metadata.version).Encode(&sub_keys.back());
+      keys.emplace_back(sub_keys.back());
+    }
+    auto statuses = db_->MultiGet(rocksdb::ReadOptions(), keys, &values);
+    size_t k = 0;
+    for (auto &segment : segments) {
+      if (!statuses[k].ok() && !statuses[k].IsNotFound()) return statuses[k];
+      if (statuses[k].ok()) {
+        s = DecodeSegment(metadata, values[k], &segment.second);
+        if (!s.ok()) return s;
+      }
+      k++;
+    }
+  } else {
+    initContainerEncoding(&metadata);
+  }
+
+  std::set<uint32_t> dirty_segments;
+  uint32_t bitmap_size = metadata.size;
+  auto get_bit = [&segments](uint64_t offset) -> bool {
+    const auto &value = segments[static_cast<uint32_t>(offset / kBitmapSegmentBits) * kBitmapSegmentBytes];
+    uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
+    return byte_index < value.size() && (value[byte_index] & (1 << (offset % 8)));
+  };
+  auto set_bit = [&segments, &dirty_segments, &bitmap_size](uint64_t offset, bool bit) {
+    uint32_t index = static_cast<uint32_t>(offset / kBitmapSegmentBits) * kBitmapSegmentBytes;
+    auto &value = segments[index];
+    uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
+    if (byte_index >= value.size()) {  // expand the bitmap
+      value.append(byte_index - value.size() + 1, 0);
+      bitmap_size = std::max(bitmap_size, static_cast<uint32_t>(value.size()) + index);
+    }
+    if (bit) {
+      value[byte_index] |= 1 << (offset % 8);
+    } else {
+      value[byte_index] &= ~(1 << (offset % 8));
+    }
+    dirty_segments.insert(index);
+  };
+
+  rets->clear();
+  for (const auto &op : ops) {
+    BitfieldResult ret;
+    ExecuteBitfieldOperation(op, get_bit, set_bit, &ret);
+    rets->emplace_back(ret);
+  }
+  if (dirty_segments.empty()) return rocksdb::Status::OK();
+
+  auto log_args = std::vector<std::string>{std::to_string(kRedisCmdBitfield), user_key.ToString()};
+  auto op_args = BitfieldOperationArgs(ops);
+  log_args.insert(log_args.end(), op_args.begin(), op_args.end());
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisBitmap, std::move(log_args));
+  batch.PutLogData(log_data.Encode());
+  std::string sub_key, segment;
+  for (const auto index : dirty_segments) {
+    InternalKey(ns_key, std::to_string(index), metadata.version).Encode(&sub_key);
+    EncodeSegment(metadata, segments[index], &segment);
+    batch.Put(sub_key, segment);
+  }
+  // always write the metadata, so the command can be replayed by the metadata
+  metadata.size = bitmap_size;
+  std::string bytes;
+  metadata.Encode(&bytes);
+  batch.Put(metadata_cf_handle_, ns_key, bytes);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
 bool Bitmap::GetBitFromValueAndOffset(const std::string &value, uint32_t offset) {
   bool bit = false;
   uint32_t byte_index = (offset / 8) % kBitmapSegmentBytes;
@@ -287,4 +660,40 @@ bool Bitmap::IsEmptySegment(const Slice &segment) {
   std::string value = segment.ToString();
   return !memcmp(zero_byte_segment, value.c_str(), value.size());
 }
+
+bool Bitmap::IsEmptySegment(const Metadata &metadata, const Slice &segment) {
+  if (IsContainerEncoded(metadata)) return BitmapContainer::IsEmpty(segment.data(), segment.size());
+  return IsEmptySegment(segment);
+}
+
+bool Bitmap::IsContainerEncoded(const Metadata &metadata) {
+  return metadata.Type() == kRedisBitmap && (metadata.flags & kMetadataFlagBitmapContainer);
+}
+
+rocksdb::Status Bitmap::DecodeSegment(const Metadata &metadata, const Slice &segment, std::string *raw) {
+  if (!IsContainerEncoded(metadata)) {
+    if (segment.data() != raw->data()) raw->assign(segment.data(), segment.size());
+    return rocksdb::Status::OK();
+  }
+  std::string decoded;
+  if (!BitmapContainer::Decode(segment.data(), segment.size(), &decoded)) {
+    return rocksdb::Status::Corruption("the bitmap segment was corrupted");
+  }
+  *raw = std::move(decoded);
+  return rocksdb::Status::OK();
+}
+
+void Bitmap::EncodeSegment(const Metadata &metadata, const Slice &raw, std::string *segment) {
+  if (!IsContainerEncoded(metadata)) {
+    segment->assign(raw.data(), raw.size());
+    return;
+  }
+  BitmapContainer::Encode(raw.data(), raw.size(), segment);
+}
+
+// The encoding was decided when the bitmap was created, the existing bitmaps
+// keep their encoding after the config was changed.
+void Bitmap::initContainerEncoding(BitmapMetadata *metadata) {
+  if (storage_->BitmapContainerEnabled()) metadata->flags |= kMetadataFlagBitmapContainer;
+}
 }  // namespace Redis
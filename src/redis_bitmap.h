@@ -1,5 +1,7 @@
 #pragma once
 
+#include "bit_util.h"
+#include "redis_bitfield.h"
 #include "redis_db.h"
 #include "redis_metadata.h"
 
@@ -21,10 +23,28 @@ class Bitmap : public Database {
   rocksdb::Status MSetBit(const Slice &user_key, const std::vector<BitmapPair> &pairs);
   rocksdb::Status BitCount(const Slice &user_key, int start, int stop, uint32_t *cnt);
   rocksdb::Status BitPos(const Slice &user_key, bool bit, int start, int stop, bool stop_given, int *pos);
+  rocksdb::Status BitOp(BitUtil::BitOpFlags op_flag, const std::string &op_name,
+                        const Slice &user_key, const std::vector<Slice> &op_keys, int64_t *len);
+  rocksdb::Status Bitfield(const Slice &user_key, const std::vector<BitfieldOperation> &ops,
+                           std::vector<BitfieldResult> *rets);
   static bool GetBitFromValueAndOffset(const std::string &value, const uint32_t offset);
   static bool IsEmptySegment(const Slice &segment);
+  static bool IsEmptySegment(const Metadata &metadata, const Slice &segment);
+  static bool IsContainerEncoded(const Metadata &metadata);
+  static rocksdb::Status DecodeSegment(const Metadata &metadata, const Slice &segment, std::string *raw);
+  static void EncodeSegment(const Metadata &metadata, const Slice &raw, std::string *segment);
  private:
   rocksdb::Status GetMetadata(const Slice &ns_key, BitmapMetadata *metadata, std::string *raw_value);
+  rocksdb::Status GetMetadata(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                              BitmapMetadata *metadata, std::string *raw_value);
+  void initContainerEncoding(BitmapMetadata *metadata);
+  void multiGetSegments(const rocksdb::ReadOptions &read_options,
+                        const Slice &ns_key,
+                        uint64_t version,
+                        int first_index,
+                        int count,
+                        std::vector<std::string> *values,
+                        std::vector<rocksdb::Status> *statuses);
 };
 
 }  // namespace Redis
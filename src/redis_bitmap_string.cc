@@ -2,6 +2,7 @@
 #include <vector>
 #include <glog/logging.h>
 
+#include "bit_util.h"
 #include "redis_string.h"
 
 namespace Redis {
@@ -63,7 +64,7 @@ rocksdb::Status BitmapString::BitCount(const std::string &raw_value, int start,
      * zero can be returned is: start > stop. */
   if (start <= stop) {
     int bytes = stop - start + 1;
-    *cnt = redisPopcount((unsigned char *) (&string_value[0] + start), bytes);
+    *cnt = BitUtil::Popcount(reinterpret_cast<const uint8_t *>(&string_value[0] + start), bytes);
   }
   return rocksdb::Status::OK();
 }
@@ -105,72 +106,43 @@ rocksdb::Status BitmapString::BitPos(const std::string &raw_value,
   return rocksdb::Status::OK();
 }
 
-/* Count number of bits set in the binary array pointed by 's' and long
- * 'count' bytes. The implementation of this function is required to
- * work with a input string length up to 512 MB.
- *
- * This is a function from the redis project.
- * This function started out as:
- * https://github.com/antirez/redis/blob/94f2e7f/src/bitops.c#L40
- * */
-size_t BitmapString::redisPopcount(unsigned char *p, int count) {
-  size_t bits = 0;
-  uint32_t *p4;
-  static const unsigned char bitsinbyte[256] =
-      {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 1, 2, 2, 3, 2, 3,
-       3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4,
-       3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4,
-       4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5, 2, 3, 3, 4, 3, 4, 4, 5,
-       3, 4, 4, 5, 4, 5, 5, 6, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6,
-       6, 7, 2, 3, 3, 4, 3, 4, 4, 5, 3, 4, 4, 5, 4, 5, 5, 6, 3, 4, 4, 5, 4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 3, 4, 4, 5,
-       4, 5, 5, 6, 4, 5, 5, 6, 5, 6, 6, 7, 4, 5, 5, 6, 5, 6, 6, 7, 5, 6, 6, 7, 6, 7, 7, 8};
-
-  /* Count initial bytes not aligned to 32 bit. */
-  while (reinterpret_cast<uint64_t>(p) & 3 && count) {
-    bits += bitsinbyte[*p++];
-    count--;
+rocksdb::Status BitmapString::Bitfield(const Slice &ns_key,
+                                       std::string *raw_value,
+                                       const std::vector<BitfieldOperation> &ops,
+                                       std::vector<BitfieldResult> *rets) {
+  auto string_value = raw_value->substr(STRING_HDR_SIZE, raw_value->size() - STRING_HDR_SIZE);
+  // the bits were numbered from the most significant bit of each byte in the string
+  auto get_bit = [&string_value](uint64_t offset) -> bool {
+    uint64_t byte_index = offset >> 3;
+    if (byte_index >= string_value.size()) return false;
+    return (string_value[byte_index] & (1 << (7 - (offset & 0x7)))) != 0;
+  };
+  auto set_bit = [&string_value](uint64_t offset, bool bit) {
+    uint64_t byte_index = offset >> 3;
+    if (byte_index >= string_value.size()) {  // expand the bitmap
+      string_value.append(byte_index - string_value.size() + 1, 0);
+    }
+    char mask = static_cast<char>(1 << (7 - (offset & 0x7)));
+    string_value[byte_index] = static_cast<char>(bit ? (string_value[byte_index] | mask)
+                                                     : (string_value[byte_index] & ~mask));
+  };
+
+  bool modified = false;
+  rets->clear();
+  for (const auto &op : ops) {
+    BitfieldResult ret;
+    if (ExecuteBitfieldOperation(op, get_bit, set_bit, &ret)) modified = true;
+    rets->emplace_back(ret);
   }
+  if (!modified) return rocksdb::Status::OK();
 
-  /* Count bits 28 bytes at a time */
-  p4 = reinterpret_cast<uint32_t *>(p);
-  while (count >= 28) {
-    uint32_t aux1, aux2, aux3, aux4, aux5, aux6, aux7;
-
-    aux1 = *p4++;
-    aux2 = *p4++;
-    aux3 = *p4++;
-    aux4 = *p4++;
-    aux5 = *p4++;
-    aux6 = *p4++;
-    aux7 = *p4++;
-    count -= 28;
-
-    aux1 = aux1 - ((aux1 >> 1) & 0x55555555);
-    aux1 = (aux1 & 0x33333333) + ((aux1 >> 2) & 0x33333333);
-    aux2 = aux2 - ((aux2 >> 1) & 0x55555555);
-    aux2 = (aux2 & 0x33333333) + ((aux2 >> 2) & 0x33333333);
-    aux3 = aux3 - ((aux3 >> 1) & 0x55555555);
-    aux3 = (aux3 & 0x33333333) + ((aux3 >> 2) & 0x33333333);
-    aux4 = aux4 - ((aux4 >> 1) & 0x55555555);
-    aux4 = (aux4 & 0x33333333) + ((aux4 >> 2) & 0x33333333);
-    aux5 = aux5 - ((aux5 >> 1) & 0x55555555);
-    aux5 = (aux5 & 0x33333333) + ((aux5 >> 2) & 0x33333333);
-    aux6 = aux6 - ((aux6 >> 1) & 0x55555555);
-    aux6 = (aux6 & 0x33333333) + ((aux6 >> 2) & 0x33333333);
-    aux7 = aux7 - ((aux7 >> 1) & 0x55555555);
-    aux7 = (aux7 & 0x33333333) + ((aux7 >> 2) & 0x33333333);
-    bits += ((((aux1 + (aux1 >> 4)) & 0x0F0F0F0F) +
-        ((aux2 + (aux2 >> 4)) & 0x0F0F0F0F) +
-        ((aux3 + (aux3 >> 4)) & 0x0F0F0F0F) +
-        ((aux4 + (aux4 >> 4)) & 0x0F0F0F0F) +
-        ((aux5 + (aux5 >> 4)) & 0x0F0F0F0F) +
-        ((aux6 + (aux6 >> 4)) & 0x0F0F0F0F) +
-        ((aux7 + (aux7 >> 4)) & 0x0F0F0F0F)) * 0x01010101) >> 24;
-  }
-  /* Count the remaining bytes. */
-  p = (unsigned char *) p4;
-  while (count--) bits += bitsinbyte[*p++];
-  return bits;
+  *raw_value = raw_value->substr(0, STRING_HDR_SIZE);
+  raw_value->append(string_value);
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisString);
+  batch.PutLogData(log_data.Encode());
+  batch.Put(metadata_cf_handle_, ns_key, *raw_value);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
 }
 
 /* Return the position of the first bit set to one (if 'bit' is 1) or
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "redis_bitfield.h"
 #include "redis_db.h"
 #include "redis_metadata.h"
 
@@ -15,8 +16,9 @@ class BitmapString : public Database {
   rocksdb::Status SetBit(const Slice &ns_key, std::string *raw_value, uint32_t offset, bool new_bit, bool *old_bit);
   rocksdb::Status BitCount(const std::string &raw_value, int start, int stop, uint32_t *cnt);
   rocksdb::Status BitPos(const std::string &raw_value, bool bit, int start, int stop, bool stop_given, int *pos);
+  rocksdb::Status Bitfield(const Slice &ns_key, std::string *raw_value,
+                           const std::vector<BitfieldOperation> &ops, std::vector<BitfieldResult> *rets);
  private:
-  size_t redisPopcount(unsigned char *p, int count);
   int redisBitpos(unsigned char *c, int count, int bit);
 };
 
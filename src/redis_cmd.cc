@@ -1,13 +1,16 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/socket.h>
+#include <unistd.h>
 #include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <chrono>
+#include <mutex>
 #include <thread>
 #include <utility>
 #include <memory>
+#include <event2/event.h>
 #include <glog/logging.h>
 
 #include "redis_db.h"
@@ -21,6 +24,7 @@
 #include "redis_string.h"
 #include "redis_zset.h"
 #include "redis_geo.h"
+#include "redis_hyperloglog.h"
 #include "redis_pubsub.h"
 #include "redis_sortedint.h"
 #include "redis_slot.h"
@@ -826,6 +830,165 @@ class CommandBitPos: public Commander {
   bool bit_ = false, stop_given_ = false;
 };
 
+class CommandBitOp : public Commander {
+ public:
+  CommandBitOp() : Commander("bitop", -4, true) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    std::string opname = Util::ToLower(args[1]);
+    if (opname == "and") {
+      op_flag_ = BitUtil::kBitOpAnd;
+    } else if (opname == "or") {
+      op_flag_ = BitUtil::kBitOpOr;
+    } else if (opname == "xor") {
+      op_flag_ = BitUtil::kBitOpXor;
+    } else if (opname == "not") {
+      op_flag_ = BitUtil::kBitOpNot;
+    } else {
+      return Status(Status::RedisParseErr, "Unknown bit operation");
+    }
+    if (op_flag_ == BitUtil::kBitOpNot && args.size() != 4) {
+      return Status(Status::RedisParseErr, "BITOP NOT must be called with a single source key.");
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<Slice> op_keys;
+    for (uint64_t i = 3; i < args_.size(); i++) {
+      op_keys.emplace_back(args_[i]);
+    }
+    int64_t dest_key_len = 0;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.BitOp(op_flag_, args_[1], args_[2], op_keys, &dest_key_len);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(dest_key_len);
+    return Status::OK();
+  }
+
+ private:
+  BitUtil::BitOpFlags op_flag_ = BitUtil::kBitOpAnd;
+};
+
+class CommandBitfield : public Commander {
+ public:
+  explicit CommandBitfield(bool read_only = false)
+      : Commander(read_only ? "bitfield_ro" : "bitfield", -2, !read_only), read_only_(read_only) {}
+  Status Parse(const std::vector<std::string> &args) override {
+    BitfieldOverflow overflow = kBitfieldOverflowWrap;
+    for (size_t i = 2; i < args.size(); i++) {
+      std::string sub_command = Util::ToLower(args[i]);
+      if (sub_command == "overflow") {
+        if (i + 1 >= args.size()) return Status(Status::RedisParseErr, errInvalidSyntax);
+        std::string behavior = Util::ToLower(args[++i]);
+        if (behavior == "wrap") {
+          overflow = kBitfieldOverflowWrap;
+        } else if (behavior == "sat") {
+          overflow = kBitfieldOverflowSat;
+        } else if (behavior == "fail") {
+          overflow = kBitfieldOverflowFail;
+        } else {
+          return Status(Status::RedisParseErr, "Invalid OVERFLOW type specified");
+        }
+        continue;
+      }
+
+      BitfieldOperation op;
+      op.overflow = overflow;
+      if (sub_command == "get") {
+        op.type = kBitfieldGet;
+      } else if (sub_command == "set" && !read_only_) {
+        op.type = kBitfieldSet;
+      } else if (sub_command == "incrby" && !read_only_) {
+        op.type = kBitfieldIncrBy;
+      } else if (read_only_) {
+        return Status(Status::RedisParseErr, "BITFIELD_RO only supports the GET subcommand");
+      } else {
+        return Status(Status::RedisParseErr, errInvalidSyntax);
+      }
+      size_t num_args = op.type == kBitfieldGet ? 2 : 3;
+      if (i + num_args >= args.size()) return Status(Status::RedisParseErr, errInvalidSyntax);
+      Status s = ParseBitfieldType(args[i + 1], &op.is_signed, &op.bits);
+      if (!s.IsOK()) return s;
+      s = ParseBitfieldOffset(args[i + 2], op.bits, &op.offset);
+      if (!s.IsOK()) return s;
+      if (op.type != kBitfieldGet) {
+        try {
+          size_t pos = 0;
+          op.value = std::stoll(args[i + 3], &pos);
+          if (pos != args[i + 3].size()) return Status(Status::RedisParseErr, errValueNotInterger);
+        } catch (std::exception &e) {
+          return Status(Status::RedisParseErr, errValueNotInterger);
+        }
+      }
+      ops_.emplace_back(op);
+      i += num_args;
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<BitfieldResult> rets;
+    Redis::Bitmap bitmap_db(svr->storage_, conn->GetNamespace());
+    rocksdb::Status s = bitmap_db.Bitfield(args_[1], ops_, &rets);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::MultiLen(rets.size());
+    for (const auto &ret : rets) {
+      *output += ret.is_nil ? Redis::NilString() : Redis::Integer(ret.value);
+    }
+    return Status::OK();
+  }
+
+ private:
+  bool read_only_ = false;
+  std::vector<BitfieldOperation> ops_;
+};
+
+class CommandBitfieldRO : public CommandBitfield {
+ public:
+  CommandBitfieldRO() : CommandBitfield(true) {}
+};
+
+class CommandPfAdd : public Commander {
+ public:
+  CommandPfAdd() : Commander("pfadd", -2, true) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    std::vector<std::string> elements(args_.begin() + 2, args_.end());
+    int ret = 0;
+    rocksdb::Status s = hll_db.Add(args_[1], elements, &ret);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(ret);
+    return Status::OK();
+  }
+};
+
+class CommandPfCount : public Commander {
+ public:
+  CommandPfCount() : Commander("pfcount", -2, false) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    std::vector<Slice> keys(args_.begin() + 1, args_.end());
+    uint64_t card = 0;
+    rocksdb::Status s = hll_db.Count(keys, &card);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::Integer(card);
+    return Status::OK();
+  }
+};
+
+class CommandPfMerge : public Commander {
+ public:
+  CommandPfMerge() : Commander("pfmerge", -2, true) {}
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    Redis::HyperLogLog hll_db(svr->storage_, conn->GetNamespace());
+    std::vector<Slice> source_keys(args_.begin() + 2, args_.end());
+    rocksdb::Status s = hll_db.Merge(args_[1], source_keys);
+    if (!s.ok()) return Status(Status::RedisExecErr, s.ToString());
+    *output = Redis::SimpleString("OK");
+    return Status::OK();
+  }
+};
+
 class CommandType : public Commander {
  public:
   CommandType() : Commander("type", 2, false) {}
@@ -1811,7 +1974,7 @@ class CommandSMembers : public Commander {
 
 class CommandSIsMember : public Commander {
  public:
-  CommandSIsMember() : Commander("sismmeber", 3, false) {}
+  CommandSIsMember() : Commander("sismember", 3, false) {}
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     Redis::Set set_db(svr->storage_, conn->GetNamespace());
     int ret;
@@ -2960,6 +3123,145 @@ class CommandGeoRadiusByMemberReadonly : public CommandGeoRadiusByMember {
   CommandGeoRadiusByMemberReadonly() : CommandGeoRadiusByMember("georadius_ro", -5, false) {}
 };
 
+// GEOSEARCH key FROMMEMBER member|FROMLONLAT longitude latitude BYRADIUS radius unit|BYBOX width height unit
+//   [ASC|DESC] [COUNT count [ANY]] [WITHCOORD] [WITHDIST] [WITHHASH]
+// GEOSEARCHSTORE destination source ... [STOREDIST]
+class CommandGeoSearch : public CommandGeoRadius {
+ public:
+  CommandGeoSearch() : CommandGeoRadius("geosearch", -7, false) {}
+  explicit CommandGeoSearch(const std::string &name, int arity, bool is_write = false)
+      : CommandGeoRadius(name, arity, is_write) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    size_t i = is_write_ ? 3 : 2;
+    if (is_write_) store_key_ = args[1];
+    while (i < args.size()) {
+      std::string opt = Util::ToLower(args[i]);
+      if (opt == "frommember" && i + 1 < args.size() && member_.empty() && !from_lonlat_) {
+        member_ = args[i + 1];
+        i += 2;
+      } else if (opt == "fromlonlat" && i + 2 < args.size() && member_.empty() && !from_lonlat_) {
+        auto s = ParseLongLat(args[i + 1], args[i + 2], &shape_.longitude, &shape_.latitude);
+        if (!s.IsOK()) return s;
+        from_lonlat_ = true;
+        i += 3;
+      } else if (opt == "byradius" && i + 2 < args.size() && !by_shape_) {
+        shape_.type = kGeoShapeTypeRadius;
+        auto s = parseDistance(args[i + 1], &shape_.radius);
+        if (!s.IsOK()) return s;
+        s = ParseDistanceUnit(args[i + 2]);
+        if (!s.IsOK()) return s;
+        shape_.radius = GetRadiusMeters(shape_.radius);
+        by_shape_ = true;
+        i += 3;
+      } else if (opt == "bybox" && i + 3 < args.size() && !by_shape_) {
+        shape_.type = kGeoShapeTypeBox;
+        auto s = parseDistance(args[i + 1], &shape_.width);
+        if (!s.IsOK()) return s;
+        s = parseDistance(args[i + 2], &shape_.height);
+        if (!s.IsOK()) return s;
+        s = ParseDistanceUnit(args[i + 3]);
+        if (!s.IsOK()) return s;
+        shape_.width = GetRadiusMeters(shape_.width);
+        shape_.height = GetRadiusMeters(shape_.height);
+        by_shape_ = true;
+        i += 4;
+      } else if (opt == "asc") {
+        sort_ = kSortASC;
+        i++;
+      } else if (opt == "desc") {
+        sort_ = kSortDESC;
+        i++;
+      } else if (opt == "count" && i + 1 < args.size()) {
+        try {
+          count_ = std::stoi(args[i + 1]);
+        } catch (const std::exception &e) {
+          return Status(Status::RedisParseErr, "ERR count is not a valid int");
+        }
+        if (count_ <= 0) return Status(Status::RedisParseErr, "ERR COUNT must be > 0");
+        i += 2;
+        if (i < args.size() && Util::ToLower(args[i]) == "any") {
+          any_ = true;
+          i++;
+        }
+      } else if (!is_write_ && opt == "withcoord") {
+        with_coord_ = true;
+        i++;
+      } else if (!is_write_ && opt == "withdist") {
+        with_dist_ = true;
+        i++;
+      } else if (!is_write_ && opt == "withhash") {
+        with_hash_ = true;
+        i++;
+      } else if (is_write_ && opt == "storedist") {
+        store_distance_ = true;
+        i++;
+      } else {
+        return Status(Status::RedisParseErr, std::string("ERR ") + errInvalidSyntax);
+      }
+    }
+    if (member_.empty() && !from_lonlat_) {
+      return Status(Status::RedisParseErr, "ERR exactly one of FROMMEMBER or FROMLONLAT can be specified");
+    }
+    if (!by_shape_) {
+      return Status(Status::RedisParseErr, "ERR exactly one of BYRADIUS and BYBOX can be specified");
+    }
+    /* COUNT without ordering does not make much sense (we need to
+     * sort in order to return the closest N entries), force ASC ordering
+     * unless ANY was specified. */
+    if (count_ != 0 && sort_ == kSortNone && !any_) {
+      sort_ = kSortASC;
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<GeoPoint> geo_points;
+    Redis::Geo geo_db(svr->storage_, conn->GetNamespace());
+    const std::string &user_key = is_write_ ? args_[2] : args_[1];
+    rocksdb::Status s;
+    if (from_lonlat_) {
+      s = geo_db.Search(user_key, shape_, count_, any_, sort_, store_key_, store_distance_,
+                        GetUnitConversion(), &geo_points);
+    } else {
+      s = geo_db.SearchByMember(user_key, member_, shape_, count_, any_, sort_, store_key_, store_distance_,
+                                GetUnitConversion(), &geo_points);
+    }
+    if (!s.ok() && !s.IsNotFound()) {
+      return Status(Status::RedisExecErr, s.ToString());
+    }
+    if (is_write_) {
+      int result_length = geo_points.size();
+      *output = Redis::Integer((count_ == 0 || result_length < count_) ? result_length : count_);
+    } else {
+      *output = GenerateOutput(geo_points);
+    }
+    return Status::OK();
+  }
+
+ private:
+  Status parseDistance(const std::string &param, double *distance) {
+    try {
+      *distance = std::stod(param);
+    } catch (const std::exception &e) {
+      return Status(Status::RedisParseErr, "ERR value is not a valid float");
+    }
+    if (*distance < 0) return Status(Status::RedisParseErr, "ERR radius cannot be negative");
+    return Status::OK();
+  }
+
+  GeoShape shape_ = {kGeoShapeTypeRadius, 0, 0, 0, 0, 0};
+  std::string member_;
+  bool from_lonlat_ = false;
+  bool by_shape_ = false;
+  bool any_ = false;
+};
+
+class CommandGeoSearchStore : public CommandGeoSearch {
+ public:
+  CommandGeoSearchStore() : CommandGeoSearch("geosearchstore", -8, true) {}
+};
+
 class CommandSortedintAdd : public Commander {
  public:
   CommandSortedintAdd() : Commander("siadd", -3, true) {}
@@ -3195,6 +3497,80 @@ class CommandRole : public Commander {
   }
 };
 
+class CommandWait : public Commander {
+ public:
+  CommandWait() : Commander("wait", 3, false) {}
+  ~CommandWait() {
+    if (timer_ != nullptr) {
+      event_free(timer_);
+      timer_ = nullptr;
+    }
+  }
+
+  Status Parse(const std::vector<std::string> &args) override {
+    try {
+      num_slaves_ = std::stoi(args[1]);
+      timeout_ = std::stoll(args[2]);
+    } catch (const std::exception &e) {
+      return Status(Status::RedisParseErr, errValueNotInterger);
+    }
+    if (timeout_ < 0) {
+      return Status(Status::RedisParseErr, "timeout is negative");
+    }
+    return Commander::Parse(args);
+  }
+
+  // Block until the num of slaves acknowledged the latest seq when the command
+  // was executed, or the timeout(ms) reached, and reply the num of the slaves.
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (svr->IsSlave()) {
+      return Status(Status::RedisExecErr, "WAIT cannot be used with slave instances");
+    }
+    svr_ = svr;
+    conn_ = conn;
+    target_seq_ = svr->storage_->LatestSeq();
+    deadline_ = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_);
+    int acked = svr->GetAckedSlaveNum(target_seq_);
+    if (acked >= num_slaves_) {
+      *output = Redis::Integer(acked);
+      return Status::OK();
+    }
+
+    // The connection was suspended until the reply, so the pipelined commands
+    // after WAIT were executed and replied in order after resuming.
+    timer_ = event_new(conn->Owner()->GetEventBase(), -1, EV_PERSIST, TimerCB, this);
+    timeval tm = {0, kCheckIntervalMs * 1000};
+    evtimer_add(timer_, &tm);
+    conn->Suspend();
+    return Status::OK();
+  }
+
+  static void TimerCB(int, int16_t events, void *ctx) {
+    auto self = reinterpret_cast<CommandWait *>(ctx);
+    int acked = self->svr_->GetAckedSlaveNum(self->target_seq_);
+    if (acked < self->num_slaves_
+        && (self->timeout_ == 0 || std::chrono::steady_clock::now() < self->deadline_)) {
+      return;
+    }
+    event_free(self->timer_);
+    self->timer_ = nullptr;
+    auto conn = self->conn_;
+    conn->Reply(Redis::Integer(acked));
+    // the command might be freed by the pipelined commands after resuming
+    conn->Resume();
+  }
+
+ private:
+  static const int kCheckIntervalMs = 10;
+  int num_slaves_ = 0;
+  int64_t timeout_ = 0;  // millisecond, 0 means blocking forever
+  rocksdb::SequenceNumber target_seq_ = 0;
+  std::chrono::steady_clock::time_point deadline_;
+  Server *svr_ = nullptr;
+  Connection *conn_ = nullptr;
+  event *timer_ = nullptr;
+};
+
 class CommandCompact : public Commander {
  public:
   CommandCompact() : Commander("compact", 1, false) {}
@@ -3629,6 +4005,107 @@ class CommandSlowlog : public Commander {
   int64_t cnt_ = 10;
 };
 
+// LATENCY HISTOGRAM [command ...], reply the cumulative latency distribution
+// of the commands in the same format as Redis, the count of the bucket was the
+// number of calls which took no more than the bucket microseconds.
+class CommandLatency : public Commander {
+ public:
+  CommandLatency() : Commander("latency", -2, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    if (Util::ToLower(args[1]) != "histogram") {
+      return Status(Status::RedisParseErr, "LATENCY subcommand must be HISTOGRAM");
+    }
+    for (size_t i = 2; i < args.size(); i++) {
+      commands_.emplace_back(Util::ToLower(args[i]));
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<int> command_ids;
+    if (commands_.empty()) {
+      for (size_t i = 0; i < svr->stats_.GetCommands().size(); i++) command_ids.emplace_back(static_cast<int>(i));
+    } else {
+      for (const auto &command : commands_) {
+        int id = svr->stats_.GetCommandID(command);
+        if (id >= 0) command_ids.emplace_back(id);
+      }
+    }
+
+    std::vector<std::string> list;
+    std::vector<uint64_t> histogram, cumulative_counts;
+    for (const auto id : command_ids) {
+      uint64_t calls, latency;
+      svr->stats_.GetCommandStat(id, &calls, &latency, &histogram);
+      if (calls == 0) continue;
+      LatencyHistogram::PowerOfTwoCounts(histogram, &cumulative_counts);
+      std::vector<std::string> buckets;
+      uint64_t last_cumulative = 0;
+      for (size_t i = 0; i < cumulative_counts.size(); i++) {
+        if (cumulative_counts[i] == last_cumulative) continue;
+        buckets.emplace_back(Redis::Integer(1LL << i));
+        buckets.emplace_back(Redis::Integer(cumulative_counts[i]));
+        last_cumulative = cumulative_counts[i];
+      }
+      list.emplace_back(Redis::BulkString(svr->stats_.GetCommands()[id]));
+      list.emplace_back(Redis::Array({Redis::BulkString("calls"), Redis::Integer(calls),
+                                      Redis::BulkString("histogram_usec"), Redis::Array(buckets)}));
+    }
+    *output = Redis::Array(list);
+    return Status::OK();
+  }
+
+ private:
+  std::vector<std::string> commands_;
+};
+
+class CommandPerfStats : public Commander {
+ public:
+  CommandPerfStats() : Commander("perfstats", -1, false) {}
+
+  Status Parse(const std::vector<std::string> &args) override {
+    for (size_t i = 1; i < args.size(); i++) {
+      commands_.emplace_back(Util::ToLower(args[i]));
+    }
+    return Commander::Parse(args);
+  }
+
+  Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    std::vector<int> command_ids;
+    if (commands_.empty()) {
+      for (size_t i = 0; i < svr->stats_.GetCommands().size(); i++) command_ids.emplace_back(static_cast<int>(i));
+    } else {
+      for (const auto &command : commands_) {
+        int id = svr->stats_.GetCommandID(command);
+        if (id >= 0) command_ids.emplace_back(id);
+      }
+    }
+
+    std::vector<std::string> list;
+    std::vector<uint64_t> counters;
+    for (const auto id : command_ids) {
+      uint64_t samples;
+      svr->stats_.GetCommandPerfStat(id, &samples, &counters);
+      if (samples == 0) continue;
+      std::vector<std::string> fields;
+      fields.emplace_back(Redis::BulkString("samples"));
+      fields.emplace_back(Redis::Integer(samples));
+      for (int i = 0; i < kPerfCounterNum; i++) {
+        fields.emplace_back(Redis::BulkString(Stats::PerfCounterName(i)));
+        fields.emplace_back(Redis::Integer(counters[i]));
+      }
+      list.emplace_back(Redis::BulkString(svr->stats_.GetCommands()[id]));
+      list.emplace_back(Redis::Array(fields));
+    }
+    *output = Redis::Array(list);
+    return Status::OK();
+  }
+
+ private:
+  std::vector<std::string> commands_;
+};
+
 class CommandClient : public Commander {
  public:
   CommandClient() : Commander("client", -2, false) {}
@@ -4010,14 +4487,8 @@ class CommandReplConf : public Commander {
     if (args.size() % 2 == 0) {
       return Status(Status::RedisParseErr, errWrongNumOfArguments);
     }
-    if (args.size() >= 3) {
-      Status s = ParseParam(Util::ToLower(args[1]), args_[2]);
-      if (!s.IsOK()) {
-        return s;
-      }
-    }
-    if (args.size() >= 5) {
-      Status s = ParseParam(Util::ToLower(args[3]), args_[4]);
+    for (size_t i = 1; i + 1 < args.size(); i += 2) {
+      Status s = ParseParam(Util::ToLower(args[i]), args_[i + 1]);
       if (!s.IsOK()) {
         return s;
       }
@@ -4036,6 +4507,13 @@ class CommandReplConf : public Commander {
       } catch (const std::exception &e) {
         return Status(Status::RedisParseErr, "listening-port should be number");
       }
+    } else if (option == "compression") {
+      compression_ = ParseReplCompression(value);
+      if (compression_ == kReplCompressionNone) {
+        return Status(Status::RedisParseErr, "unsupported compression");
+      }
+    } else if (option == "capa") {
+      // the acks were read by the feed slave thread, and the unknown capabilities were ignored
     } else {
       return Status(Status::RedisParseErr, "unknown option");
     }
@@ -4046,23 +4524,47 @@ class CommandReplConf : public Commander {
     if (port_ != 0) {
       conn->SetListeningPort(port_);
     }
+    if (compression_ != kReplCompressionNone) conn->SetReplCompression(ReplCompressionName(compression_));
     *output = Redis::SimpleString("OK");
     return Status::OK();
   }
 
  private:
   uint32_t port_ = 0;
+  ReplCompression compression_ = kReplCompressionNone;
 };
 
 class CommandFetchMeta : public Commander {
  public:
-  CommandFetchMeta() : Commander("_fetch_meta", 1, false) {}
+  CommandFetchMeta() : Commander("_fetch_meta", -1, false) {}
 
   Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() > 2) return Status(Status::RedisParseErr, errWrongNumOfArguments);
+    if (args.size() == 2) {
+      if (Util::ToLower(args[1]) != "checkpoint") return Status(Status::RedisParseErr, errInvalidSyntax);
+      checkpoint_ = true;
+    }
     return Status::OK();
   }
 
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
+    if (checkpoint_) {
+      uint64_t checkpoint_id;
+      std::string meta;
+      auto s = Engine::Storage::BackupManager::OpenCheckpointMeta(svr->storage_, &checkpoint_id, &meta);
+      if (!s.IsOK()) {
+        LOG(ERROR) << "Failed to open checkpoint meta, err: " << s.Msg();
+        return Status(Status::DBBackupFileErr, "can't create db checkpoint");
+      }
+      // the checkpoint was released when the slave closed the connection
+      conn->SetSyncCheckpointID(checkpoint_id);
+      conn->Reply(std::to_string(checkpoint_id) + CRLF);
+      conn->Reply(std::to_string(meta.size()) + CRLF);
+      conn->Reply(meta);
+      svr->stats_.IncrFullSyncCounter();
+      return Status::OK();
+    }
+
     uint64_t file_size;
     rocksdb::BackupID meta_id;
     int fd;
@@ -4077,33 +4579,144 @@ class CommandFetchMeta : public Commander {
     // Send meta file size
     conn->Reply(std::to_string(file_size) + CRLF);
     // Send meta content
-    conn->SendFile(fd);
+    conn->SendFile(fd, 0, file_size);
     svr->stats_.IncrFullSyncCounter();
     return Status::OK();
   }
+
+ private:
+  bool checkpoint_ = false;
 };
 
 class CommandFetchFile : public Commander {
  public:
-  CommandFetchFile() : Commander("_fetch_file", 2, false) {}
+  CommandFetchFile() : Commander("_fetch_file", -2, false) {}
+  ~CommandFetchFile() override {
+    if (!chunk_) return;
+    std::lock_guard<std::mutex> guard(chunk_->mu);
+    chunk_->cancelled = true;
+  }
 
+  // _fetch_file <path> [<checkpoint id> <offset> [<codec>]], the checkpoint id was 0
+  // for the data files, and the file was sent from the offset to resume the fetching.
   Status Parse(const std::vector<std::string> &args) override {
+    if (args.size() > 5) return Status(Status::RedisParseErr, errWrongNumOfArguments);
     path_ = args[1];
+    if (args.size() >= 3) {
+      auto s = Util::StringToNum(args[2], &checkpoint_id_, 0);
+      if (!s.IsOK()) return Status(Status::RedisParseErr, errValueNotInterger);
+    }
+    if (args.size() >= 4) {
+      auto s = Util::StringToNum(args[3], &offset_, 0);
+      if (!s.IsOK()) return Status(Status::RedisParseErr, errValueNotInterger);
+    }
+    if (args.size() == 5) {
+      compression_ = ParseReplCompression(args[4]);
+      if (compression_ == kReplCompressionNone) {
+        return Status(Status::RedisParseErr, "unsupported compression");
+      }
+    }
     return Status::OK();
   }
 
   Status Execute(Server *svr, Connection *conn, std::string *output) override {
     uint64_t file_size = 0;
-    auto fd = Engine::Storage::BackupManager::OpenDataFile(svr->storage_, path_,
-                                                           &file_size);
+    int fd;
+    if (checkpoint_id_ > 0) {
+      fd = Engine::Storage::BackupManager::OpenCheckpointFile(svr->storage_, checkpoint_id_, path_, &file_size);
+    } else {
+      fd = Engine::Storage::BackupManager::OpenDataFile(svr->storage_, path_, &file_size);
+    }
     if (fd < 0) return Status(Status::DBBackupFileErr);
-    conn->Reply(std::to_string(file_size) + CRLF);
-    conn->SendFile(fd);
+    if (static_cast<uint64_t>(offset_) > file_size) {
+      close(fd);
+      return Status(Status::RedisExecErr, "offset is out of the file size");
+    }
+    // The sst files which were compressed by rocksdb were sent as is
+    bool compressed_sst = path_.size() > 4 && path_.compare(path_.size() - 4, 4, ".sst") == 0
+                          && svr->GetConfig()->RocksDB.compression != rocksdb::kNoCompression;
+    if (compression_ != kReplCompressionNone && !compressed_sst) return sendCompressedChunk(svr, conn, fd, file_size);
+    conn->Reply(std::to_string(file_size - offset_) + CRLF);
+    conn->SendFile(fd, offset_, file_size - offset_);
     return Status::OK();
   }
 
  private:
   std::string path_;
+  int64_t checkpoint_id_ = 0;
+  int64_t offset_ = 0;
+  ReplCompression compression_ = kReplCompressionNone;
+  // The file was compressed by chunks to bound the memory and the time of the
+  // fetch file thread, the slave would request the rest of the file after every chunk.
+  static const uint64_t kCompressChunkSize = 4 * MiB;
+
+  // The chunk was read and compressed by the fetch file thread, and replied by
+  // the worker thread. It was cancelled if the connection was freed before.
+  struct CompressedChunk {
+    std::mutex mu;
+    bool cancelled = false;
+    Connection *conn = nullptr;
+    Status status;
+    std::string reply;
+  };
+  std::shared_ptr<CompressedChunk> chunk_;
+
+  // The connection was suspended until the chunk was replied, so the replies of
+  // the pipelined requests were kept in order.
+  Status sendCompressedChunk(Server *svr, Connection *conn, int fd, uint64_t file_size) {
+    uint64_t remaining = file_size - offset_;
+    uint64_t chunk_size = kCompressChunkSize;
+    chunk_size = std::min(remaining, chunk_size);
+    uint64_t offset = static_cast<uint64_t>(offset_);
+    auto chunk = std::make_shared<CompressedChunk>();
+    chunk->conn = conn;
+    auto base = conn->Owner()->GetEventBase();
+    Task task;
+    task.arg = svr;
+    auto codec = compression_;
+    task.callback = [chunk, fd, offset, chunk_size, remaining, base, codec](void *arg) {
+      auto svr = static_cast<Server *>(arg);
+      std::string data(chunk_size, 0);
+      ssize_t n = pread(fd, &data[0], data.size(), offset);
+      close(fd);
+      if (n != static_cast<ssize_t>(data.size())) {
+        chunk->status = Status(Status::DBBackupFileErr);
+      } else {
+        std::string compressed;
+        CompressReplData(&svr->stats_, codec, data.data(), data.size(), &compressed);
+        chunk->reply = "!" + std::to_string(remaining) + " " + std::to_string(data.size()) + " "
+                       + std::to_string(compressed.size()) + CRLF;
+        chunk->reply.append(compressed);
+      }
+      auto arg_chunk = new std::shared_ptr<CompressedChunk>(chunk);
+      if (event_base_once(base, -1, EV_TIMEOUT, onChunkCompressed, arg_chunk, nullptr) != 0) delete arg_chunk;
+    };
+    auto s = svr->AsyncFetchFileTask(task);
+    if (!s.IsOK()) {
+      close(fd);
+      return s;
+    }
+    chunk_ = chunk;
+    conn->Suspend();
+    return Status::OK();
+  }
+
+  static void onChunkCompressed(evutil_socket_t, int16_t, void *arg) {
+    std::unique_ptr<std::shared_ptr<CompressedChunk>> chunk(static_cast<std::shared_ptr<CompressedChunk> *>(arg));
+    Connection *conn = nullptr;
+    {
+      std::lock_guard<std::mutex> guard((*chunk)->mu);
+      if ((*chunk)->cancelled) return;
+      conn = (*chunk)->conn;
+    }
+    if ((*chunk)->status.IsOK()) {
+      conn->Reply((*chunk)->reply);
+    } else {
+      conn->Reply(Redis::Error("ERR " + (*chunk)->status.Msg()));
+    }
+    // the command might be freed by the pipelined commands after resuming
+    conn->Resume();
+  }
 };
 
 class CommandDBName : public Commander {
@@ -4506,18 +5119,25 @@ class CommandSlotsCheck : public Commander {
   }
 };
 
+using CommanderFactory = std::function<std::unique_ptr<Commander>()>;
+struct CommanderAttributes {
+  CommanderFactory factory;
+  // the index of the command in GetCommandList, it's the command ID of the stats
+  int id;
+};
+
 #define ADD_CMD(name, fn) \
-{name,  []() -> std::unique_ptr<Commander> { \
+{name, {[]() -> std::unique_ptr<Commander> { \
   return std::unique_ptr<Commander>(new fn()); \
-}}
+}, -1}}
 
-using CommanderFactory = std::function<std::unique_ptr<Commander>()>;
-std::map<std::string, CommanderFactory> command_table = {
+std::map<std::string, CommanderAttributes> command_table = {
     ADD_CMD("auth",      CommandAuth),
     ADD_CMD("ping",      CommandPing),
     ADD_CMD("select",    CommandSelect),
     ADD_CMD("info",      CommandInfo),
     ADD_CMD("role",      CommandRole),
+    ADD_CMD("wait",      CommandWait),
     ADD_CMD("config",    CommandConfig),
     ADD_CMD("namespace", CommandNamespace),
     ADD_CMD("keys",      CommandKeys),
@@ -4525,7 +5145,9 @@ std::map<std::string, CommanderFactory> command_table = {
     ADD_CMD("flushall",  CommandFlushAll),
     ADD_CMD("dbsize",    CommandDBSize),
     ADD_CMD("slowlog",   CommandSlowlog),
+    ADD_CMD("latency",   CommandLatency),
     ADD_CMD("perflog",   CommandPerfLog),
+    ADD_CMD("perfstats", CommandPerfStats),
     ADD_CMD("client",    CommandClient),
     ADD_CMD("monitor",   CommandMonitor),
     ADD_CMD("shutdown",  CommandShutdown),
@@ -4573,6 +5195,13 @@ std::map<std::string, CommanderFactory> command_table = {
     ADD_CMD("msetbit",  CommandMSetBit),
     ADD_CMD("bitcount", CommandBitCount),
     ADD_CMD("bitpos",   CommandBitPos),
+    ADD_CMD("bitop",    CommandBitOp),
+    ADD_CMD("bitfield", CommandBitfield),
+    ADD_CMD("bitfield_ro", CommandBitfieldRO),
+
+    ADD_CMD("pfadd", CommandPfAdd),
+    ADD_CMD("pfcount", CommandPfCount),
+    ADD_CMD("pfmerge", CommandPfMerge),
 
     // hash command
     ADD_CMD("hget",         CommandHGet),
@@ -4660,6 +5289,8 @@ std::map<std::string, CommanderFactory> command_table = {
     ADD_CMD("georadiusbymember",    CommandGeoRadiusByMember),
     ADD_CMD("georadius_ro",         CommandGeoRadiusReadonly),
     ADD_CMD("georadiusbymember_ro", CommandGeoRadiusByMemberReadonly),
+    ADD_CMD("geosearch",            CommandGeoSearch),
+    ADD_CMD("geosearchstore",       CommandGeoSearchStore),
 
     // pub/sub command
     ADD_CMD("publish",      CommandPublish),
@@ -4706,7 +5337,7 @@ std::map<std::string, CommanderFactory> command_table = {
 
 // Replication related commands, which are received by workers listening on
 // `repl-port`
-std::map<std::string, CommanderFactory> repl_command_table = {
+std::map<std::string, CommanderAttributes> repl_command_table = {
     ADD_CMD("auth",        CommandAuth),
     ADD_CMD("replconf",    CommandReplConf),
     ADD_CMD("psync",       CommandPSync),
@@ -4715,22 +5346,32 @@ std::map<std::string, CommanderFactory> repl_command_table = {
     ADD_CMD("_db_name",    CommandDBName),
 };
 
+// Assign the command IDs in the same order as GetCommandList, the commands with
+// the same name in both tables share the ID, like Stats::SetCommands does.
+static bool assignCommandIDs() {
+  std::map<std::string, int> ids;
+  for (auto table : {&command_table, &repl_command_table}) {
+    for (auto &cmd : *table) {
+      auto iter = ids.find(cmd.first);
+      if (iter == ids.end()) iter = ids.emplace(cmd.first, static_cast<int>(ids.size())).first;
+      cmd.second.id = iter->second;
+    }
+  }
+  return true;
+}
+
 Status LookupCommand(const std::string &cmd_name,
                      std::unique_ptr<Commander> *cmd, bool is_repl) {
+  static bool command_ids_assigned = assignCommandIDs();
+  (void) command_ids_assigned;
   if (cmd_name.empty()) return Status(Status::RedisUnknownCmd);
-  if (is_repl) {
-    auto cmd_factory = repl_command_table.find(Util::ToLower(cmd_name));
-    if (cmd_factory == repl_command_table.end()) {
-      return Status(Status::RedisUnknownCmd);
-    }
-    *cmd = cmd_factory->second();
-  } else {
-    auto cmd_factory = command_table.find(Util::ToLower(cmd_name));
-    if (cmd_factory == command_table.end()) {
-      return Status(Status::RedisUnknownCmd);
-    }
-    *cmd = cmd_factory->second();
+  auto &table = is_repl ? repl_command_table : command_table;
+  auto cmd_attributes = table.find(Util::ToLower(cmd_name));
+  if (cmd_attributes == table.end()) {
+    return Status(Status::RedisUnknownCmd);
   }
+  *cmd = cmd_attributes->second.factory();
+  (*cmd)->SetID(cmd_attributes->second.id);
   return Status::OK();
 }
 
@@ -31,6 +31,9 @@ class Commander {
   std::string Name() { return name_; }
   int GetArity() { return arity_; }
   bool IsWrite() { return is_write_; }
+  // The command ID of the stats, it was resolved when the command was looked up
+  int GetID() { return id_; }
+  void SetID(int id) { id_ = id; }
 
   void SetArgs(const std::vector<std::string> &args) { args_ = args; }
   const std::vector<std::string>* Args() {
@@ -50,6 +53,7 @@ class Commander {
   std::string name_;
   int arity_;
   bool is_write_;
+  int id_ = -1;
 };
 
 bool IsCommandExists(const std::string &cmd);
@@ -19,6 +19,9 @@ Connection::~Connection() {
   // unscribe all channels and patterns if exists
   UnSubscribeAll();
   PUnSubscribeAll();
+  if (sync_checkpoint_id_ != 0) {
+    Engine::Storage::BackupManager::ReleaseCheckpoint(owner_->svr_->storage_, sync_checkpoint_id_);
+  }
 }
 
 std::string Connection::ToString() {
@@ -94,10 +97,22 @@ void Connection::Reply(const std::string &msg) {
   Redis::Reply(bufferevent_get_output(bev_), msg);
 }
 
-void Connection::SendFile(int fd) {
+void Connection::SendFile(int fd, uint64_t offset, uint64_t length) {
   // NOTE: we don't need to close the fd, the libevent will do that
   auto output = bufferevent_get_output(bev_);
-  evbuffer_add_file(output, fd, 0, -1);
+  evbuffer_add_file(output, fd, offset, length);
+}
+
+void Connection::Suspend() {
+  suspended_ = true;
+  bufferevent_disable(bev_, EV_READ);
+}
+
+void Connection::Resume() {
+  suspended_ = false;
+  bufferevent_enable(bev_, EV_READ);
+  // execute the commands which were pipelined after the suspending one
+  OnRead(bev_, this);
 }
 
 void Connection::SetAddr(std::string ip, int port) {
@@ -106,6 +121,14 @@ void Connection::SetAddr(std::string ip, int port) {
   addr_ = ip_ +":"+ std::to_string(port_);
 }
 
+void Connection::SetSyncCheckpointID(uint64_t checkpoint_id) {
+  // release the previous checkpoint if the slave fetched the meta again
+  if (sync_checkpoint_id_ != 0) {
+    Engine::Storage::BackupManager::ReleaseCheckpoint(owner_->svr_->storage_, sync_checkpoint_id_);
+  }
+  sync_checkpoint_id_ = checkpoint_id;
+}
+
 uint64_t Connection::GetAge() {
   time_t now;
   time(&now);
@@ -30,7 +30,12 @@ class Connection {
   static void OnWrite(struct bufferevent *bev, void *ctx);
   static void OnEvent(bufferevent *bev, int16_t events, void *ctx);
   void Reply(const std::string &msg);
-  void SendFile(int fd);
+  void SendFile(int fd, uint64_t offset, uint64_t length);
+  // The command which replies asynchronously suspends the connection, and the
+  // rest of the pipelined commands were executed in order after it resumed.
+  void Suspend();
+  void Resume();
+  bool IsSuspended() { return suspended_; }
   std::string ToString();
 
   typedef std::function<void(std::string, int)> unsubscribe_callback;
@@ -62,6 +67,10 @@ class Connection {
   int GetPort() { return port_; }
   void SetListeningPort(int port) { listening_port_ = port; }
   int GetListeningPort() { return listening_port_; }
+  // the name of the codec which the slave asked to compress the replication stream
+  void SetReplCompression(std::string codec) { repl_compression_ = std::move(codec); }
+  const std::string &GetReplCompression() { return repl_compression_; }
+  void SetSyncCheckpointID(uint64_t checkpoint_id);
 
   bool IsAdmin() { return is_admin_; }
   void BecomeAdmin() { is_admin_ = true; }
@@ -86,6 +95,10 @@ class Connection {
   int port_ = 0;
   std::string addr_;
   int listening_port_ = 0;
+  std::string repl_compression_;
+  bool suspended_ = false;
+  // the checkpoint was held by the slave which was fetching the files
+  uint64_t sync_checkpoint_id_ = 0;
   bool is_admin_ = false;
   std::string last_cmd_;
   time_t create_time_;
@@ -39,6 +39,11 @@ rocksdb::Status Database::GetRawMetadata(const Slice &ns_key, std::string *bytes
   LatestSnapShot ss(db_);
   rocksdb::ReadOptions read_options;
   read_options.snapshot = ss.GetSnapShot();
+  return GetRawMetadata(read_options, ns_key, bytes);
+}
+
+rocksdb::Status Database::GetRawMetadata(const rocksdb::ReadOptions &read_options, const Slice &ns_key,
+                                         std::string *bytes) {
   return db_->Get(read_options, metadata_cf_handle_, ns_key, bytes);
 }
 
@@ -14,6 +14,7 @@ class Database {
   explicit Database(Engine::Storage *storage, const std::string &ns = "");
   rocksdb::Status GetMetadata(RedisType type, const Slice &ns_key, Metadata *metadata);
   rocksdb::Status GetRawMetadata(const Slice &ns_key, std::string *bytes);
+  rocksdb::Status GetRawMetadata(const rocksdb::ReadOptions &read_options, const Slice &ns_key, std::string *bytes);
   rocksdb::Status GetRawMetadataByUserKey(const Slice &user_key, std::string *bytes);
   rocksdb::Status Expire(const Slice &user_key, int timestamp);
   rocksdb::Status Del(const Slice &user_key);
@@ -42,18 +43,25 @@ class Database {
   rocksdb::ColumnFamilyHandle *metadata_cf_handle_;
   std::string namespace_;
 
+  // Use the snapshot pinned by the current thread if any, e.g. the visible
+  // snapshot of the slave, or create the latest snapshot.
   class LatestSnapShot {
    public:
     explicit LatestSnapShot(rocksdb::DB *db) : db_(db) {
-      snapshot_ = db_->GetSnapshot();
+      snapshot_ = Engine::Storage::GetPinnedSnapshot();
+      if (snapshot_ == nullptr) {
+        snapshot_ = db_->GetSnapshot();
+        owned_ = true;
+      }
     }
     ~LatestSnapShot() {
-      db_->ReleaseSnapshot(snapshot_);
+      if (owned_) db_->ReleaseSnapshot(snapshot_);
     }
     const rocksdb::Snapshot *GetSnapShot() { return snapshot_; }
    private:
     rocksdb::DB *db_ = nullptr;
     const rocksdb::Snapshot *snapshot_ = nullptr;
+    bool owned_ = false;
   };
 };
 
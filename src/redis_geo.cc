@@ -1,8 +1,19 @@
 #include "redis_geo.h"
 
 #include <algorithm>
+#include <iterator>
+#include <map>
+#include <memory>
+#include "encoding.h"
 #include "util.h"
 
+// The geohash boxes were split into 16 sub-boxes to skip the parts out of the search area
+const int kGeoSearchRefineSteps = 2;
+const double kGeoSearchDistanceSlack = 1;  // in meters
+// The nearest points were searched in the rings whose radius was doubled from
+// 1/2^kGeoSearchRingDoublings of the search radius up to the search radius.
+const int kGeoSearchRingDoublings = 6;
+
 namespace Redis {
 
 rocksdb::Status Geo::Add(const Slice &user_key, std::vector<GeoPoint> *geo_points, int *ret) {
@@ -73,22 +84,121 @@ rocksdb::Status Geo::Radius(const Slice &user_key,
                             bool store_distance,
                             double unit_conversion,
                             std::vector<GeoPoint> *geo_points) {
+  GeoShape shape;
+  shape.type = kGeoShapeTypeRadius;
+  shape.longitude = longitude;
+  shape.latitude = latitude;
+  shape.radius = radius_meters;
+  return Search(user_key, shape, count, false, sort, store_key, store_distance, unit_conversion, geo_points);
+}
+
+rocksdb::Status Geo::RadiusByMember(const Slice &user_key,
+                                    const Slice &member,
+                                    double radius_meters,
+                                    int count,
+                                    DistanceSort sort,
+                                    const std::string &store_key,
+                                    bool store_distance,
+                                    double unit_conversion,
+                                    std::vector<GeoPoint> *geo_points) {
+  GeoPoint geo_point;
+  auto s = Get(user_key, member, &geo_point);
+  if (!s.ok()) return s;
+
+  return Radius(user_key, geo_point.longitude, geo_point.latitude, radius_meters,
+                count,
+                sort,
+                store_key, store_distance, unit_conversion, geo_points);
+}
+
+/* Search the points within the shape, the geohash boxes covering the shape were
+ * split into sub-boxes and visited from the nearest one. When only the nearest
+ * 'count' points were wanted (or any 'count' points), the search was expanded
+ * ring by ring from a small radius around the center, and the radius was doubled
+ * until the search radius. A bounded heap kept the candidates, and the search was
+ * stopped once the worst candidate was within the scanned ring, since all the
+ * points inside the ring were already seen. With 'any', the search was stopped
+ * as soon as 'count' points were found. */
+rocksdb::Status Geo::Search(const Slice &user_key,
+                            const GeoShape &shape,
+                            int count,
+                            bool any,
+                            DistanceSort sort,
+                            const std::string &store_key,
+                            bool store_distance,
+                            double unit_conversion,
+                            std::vector<GeoPoint> *geo_points) {
   std::string ns_key;
   AppendNamespacePrefix(user_key, &ns_key);
   ZSetMetadata metadata(false);
   rocksdb::Status s = ZSet::GetMetadata(ns_key, &metadata);
-  if (!s.ok()) return s;
-
-  /* Get all neighbor geohash boxes for our radius search */
-  GeoHashRadius georadius = GeoHashHelper::GetAreasByRadiusWGS84(longitude, latitude, radius_meters);
-
-  /* Search the zset for all matching points */
-  membersOfAllNeighbors(user_key, georadius, longitude, latitude, radius_meters, geo_points);
+  if (!s.ok()) {
+    // The store key was removed as the result was empty
+    if (s.IsNotFound() && !store_key.empty()) Database::Del(store_key);
+    return s;
+  }
 
-  /* If no matching results, the user gets an empty reply. */
-  if (geo_points->empty() && store_key.empty()) {
-    return rocksdb::Status::OK();
+  rocksdb::ReadOptions read_options;
+  LatestSnapShot ss(db_);
+  read_options.snapshot = ss.GetSnapShot();
+  read_options.fill_cache = false;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, score_cf_handle_));
+  std::string prefix_key;
+  InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
+
+  // The heap top was the worst candidate, it's the farthest point for ASC
+  // and the nearest point for DESC.
+  bool bounded = count > 0 && !any && sort != kSortNone;
+  auto better = sort == kSortDESC ? sortGeoPointDESC : sortGeoPointASC;
+  size_t limit = static_cast<size_t>(count);
+  // Any point in the box was within (width + height) / 2 from the center
+  double radius = shape.type == kGeoShapeTypeRadius ? shape.radius : (shape.width + shape.height) / 2;
+  // The farthest points for DESC were only known after the whole shape was scanned
+  bool ring_search = count > 0 && (any || (bounded && sort == kSortASC));
+  double ring_radius = ring_search ? radius / (1 << kGeoSearchRingDoublings) : radius;
+  // The score ranges which were scanned by the inner rings, [min, max) without overlapping
+  std::map<GeoHashFix52Bits, GeoHashFix52Bits> scanned;
+  std::vector<GeoSearchBox> boxes;
+  std::vector<std::pair<GeoHashFix52Bits, GeoHashFix52Bits>> ranges;
+  std::vector<GeoPoint> box_points;
+  bool done = false;
+  while (!done) {
+    ring_radius = std::min(ring_radius, radius);
+    boxes.clear();
+    searchBoxesOfShape(shape, ring_radius, &boxes);
+    for (const auto &box : boxes) {
+      if (bounded && sort == kSortASC && geo_points->size() == limit && box.min_dist > geo_points->front().dist) {
+        break;
+      }
+      unscannedRanges(&scanned, box.min, box.max, &ranges);
+      for (const auto &range : ranges) {
+        box_points.clear();
+        getPointsInRange(iter.get(), prefix_key, range.first, range.second, shape, &box_points);
+        for (auto &geo_point : box_points) {
+          if (!bounded) {
+            geo_points->emplace_back(std::move(geo_point));
+          } else if (geo_points->size() < limit) {
+            geo_points->emplace_back(std::move(geo_point));
+            std::push_heap(geo_points->begin(), geo_points->end(), better);
+          } else if (better(geo_point, geo_points->front())) {
+            std::pop_heap(geo_points->begin(), geo_points->end(), better);
+            geo_points->back() = std::move(geo_point);
+            std::push_heap(geo_points->begin(), geo_points->end(), better);
+          }
+        }
+      }
+      if (any && count > 0 && geo_points->size() >= limit) {
+        geo_points->resize(limit);
+        done = true;
+        break;
+      }
+    }
+    if (ring_radius >= radius) break;
+    // All the points within the ring were seen, the outer ones couldn't be nearer
+    if (bounded && geo_points->size() == limit && geo_points->front().dist <= ring_radius) break;
+    ring_radius *= 2;
   }
+  if (!iter->status().ok()) return iter->status();
 
   /* Process [optional] requested sorting */
   if (sort == kSortASC) {
@@ -101,28 +211,28 @@ rocksdb::Status Geo::Radius(const Slice &user_key,
     int64_t result_length = geo_points->size();
     int64_t returned_items_count = (count == 0 || result_length < count) ? result_length : count;
     if (returned_items_count == 0) {
-      ZSet::Del(user_key);
-    } else {
-      std::vector<MemberScore> member_scores;
-      for (const auto &geo_point : *geo_points) {
-        if (returned_items_count-- <= 0) {
-          break;
-        }
-        double score = store_distance ? geo_point.dist / unit_conversion : geo_point.score;
-        member_scores.emplace_back(MemberScore{geo_point.member, score});
+      s = Database::Del(store_key);
+      return s.IsNotFound() ? rocksdb::Status::OK() : s;
+    }
+    std::vector<MemberScore> member_scores;
+    for (const auto &geo_point : *geo_points) {
+      if (returned_items_count-- <= 0) {
+        break;
       }
-      int ret;
-      ZSet::Add(store_key, 0, &member_scores, &ret);
+      double score = store_distance ? geo_point.dist / unit_conversion : geo_point.score;
+      member_scores.emplace_back(MemberScore{geo_point.member, score});
     }
+    return ZSet::Overwrite(store_key, member_scores);
   }
 
   return rocksdb::Status::OK();
 }
 
-rocksdb::Status Geo::RadiusByMember(const Slice &user_key,
+rocksdb::Status Geo::SearchByMember(const Slice &user_key,
                                     const Slice &member,
-                                    double radius_meters,
+                                    GeoShape shape,
                                     int count,
+                                    bool any,
                                     DistanceSort sort,
                                     const std::string &store_key,
                                     bool store_distance,
@@ -132,10 +242,9 @@ rocksdb::Status Geo::RadiusByMember(const Slice &user_key,
   auto s = Get(user_key, member, &geo_point);
   if (!s.ok()) return s;
 
-  return Radius(user_key, geo_point.longitude, geo_point.latitude, radius_meters,
-                count,
-                sort,
-                store_key, store_distance, unit_conversion, geo_points);
+  shape.longitude = geo_point.longitude;
+  shape.latitude = geo_point.latitude;
+  return Search(user_key, shape, count, any, sort, store_key, store_distance, unit_conversion, geo_points);
 }
 
 rocksdb::Status Geo::Get(const Slice &user_key,
@@ -212,16 +321,12 @@ int Geo::decodeGeoHash(double bits, double *xy) {
   return geohashDecodeToLongLatWGS84(hash, xy);
 }
 
-/* Search all eight neighbors + self geohash box */
-int Geo::membersOfAllNeighbors(const Slice &user_key,
-                               GeoHashRadius n,
-                               double lon,
-                               double lat,
-                               double radius,
-                               std::vector<GeoPoint> *geo_points) {
+/* Collect the sub-boxes of all eight neighbors + self geohash box which may
+ * intersect with the shape within the radius from the center, and sort them by
+ * the distance to the center. */
+void Geo::searchBoxesOfShape(const GeoShape &shape, double radius, std::vector<GeoSearchBox> *boxes) {
+  GeoHashRadius n = GeoHashHelper::GetAreasByRadiusWGS84(shape.longitude, shape.latitude, radius);
   GeoHashBits neighbors[9];
-  unsigned int i, count = 0, last_processed = 0;
-
   neighbors[0] = n.hash;
   neighbors[1] = n.neighbors.north;
   neighbors[2] = n.neighbors.south;
@@ -232,41 +337,68 @@ int Geo::membersOfAllNeighbors(const Slice &user_key,
   neighbors[7] = n.neighbors.south_east;
   neighbors[8] = n.neighbors.south_west;
 
-  /* For each neighbor (*and* our own hashbox), get all the matching
-   * members and add them to the potential result list. */
-  for (i = 0; i < sizeof(neighbors) / sizeof(*neighbors); i++) {
-    if (HASHISZERO(neighbors[i])) {
-      continue;
-    }
-
-    /* When a huge Radius (in the 5000 km range or more) is used,
-     * adjacent neighbors can be the same, leading to duplicated
-     * elements. Skip every range which is the same as the one
-     * processed previously. */
-    if (last_processed &&
-        neighbors[i].bits == neighbors[last_processed].bits &&
-        neighbors[i].step == neighbors[last_processed].step) {
-      continue;
+  for (const auto &neighbor : neighbors) {
+    if (HASHISZERO(neighbor)) continue;
+    // Split the box into 4^steps sub-boxes, the sub-boxes out of the shape were
+    // skipped and the nearer ones were scanned first.
+    int steps = std::min(kGeoSearchRefineSteps, GEO_STEP_MAX - neighbor.step);
+    for (uint64_t i = 0; i < (1ULL << (2 * steps)); i++) {
+      GeoHashBits hash;
+      hash.bits = (neighbor.bits << (2 * steps)) | i;
+      hash.step = static_cast<uint8_t>(neighbor.step + steps);
+      GeoHashArea area;
+      if (!geohashDecodeType(hash, &area)) continue;
+      // Tolerate the rounding errors of the decoded coordinates
+      double min_dist = GeoHashHelper::GetMinDistanceToArea(shape.longitude, shape.latitude, area);
+      min_dist = std::max(0.0, min_dist - kGeoSearchDistanceSlack);
+      if (min_dist > radius) continue;
+      if (shape.type == kGeoShapeTypeBox) {
+        double nearest_lat = std::max(area.latitude.min, std::min(shape.latitude, area.latitude.max));
+        if (GeoHashHelper::GetLatDistance(shape.latitude, nearest_lat) - kGeoSearchDistanceSlack > shape.height / 2) {
+          continue;
+        }
+      }
+      GeoSearchBox box;
+      scoresOfGeoHashBox(hash, &box.min, &box.max);
+      box.min_dist = min_dist;
+      boxes->emplace_back(box);
     }
-    count += membersOfGeoHashBox(user_key, neighbors[i], geo_points, lon, lat, radius);
-    last_processed = i;
   }
-  return count;
+
+  /* When a huge Radius (in the 5000 km range or more) is used,
+   * adjacent neighbors can be the same, leading to duplicated
+   * elements. Remove the duplicated sub-boxes. */
+  std::sort(boxes->begin(), boxes->end(), [](const GeoSearchBox &a, const GeoSearchBox &b) {
+    return a.min < b.min;
+  });
+  boxes->erase(std::unique(boxes->begin(), boxes->end(), [](const GeoSearchBox &a, const GeoSearchBox &b) {
+    return a.min == b.min && a.max == b.max;
+  }), boxes->end());
+  std::stable_sort(boxes->begin(), boxes->end(), [](const GeoSearchBox &a, const GeoSearchBox &b) {
+    return a.min_dist < b.min_dist;
+  });
 }
 
-/* Obtain all members between the min/max of this geohash bounding box.
- * Populate a GeoArray of GeoPoints by calling getPointsInRange().
- * Return the number of points added to the array. */
-int Geo::membersOfGeoHashBox(const Slice &user_key,
-                             GeoHashBits hash,
-                             std::vector<GeoPoint> *geo_points,
-                             double lon,
-                             double lat,
-                             double radius) {
-  GeoHashFix52Bits min, max;
-
-  scoresOfGeoHashBox(hash, &min, &max);
-  return getPointsInRange(user_key, min, max, lon, lat, radius, geo_points);
+/* Return the parts of [min, max) which weren't in the scanned ranges, and add them
+ * into the scanned ranges. The geohash boxes were either nested or disjoint, but
+ * the boxes of the outer rings may cover many scanned boxes of the inner rings. */
+void Geo::unscannedRanges(std::map<GeoHashFix52Bits, GeoHashFix52Bits> *scanned,
+                          GeoHashFix52Bits min, GeoHashFix52Bits max,
+                          std::vector<std::pair<GeoHashFix52Bits, GeoHashFix52Bits>> *ranges) {
+  ranges->clear();
+  // start from the scanned range which overlaps or touches min
+  auto iter = scanned->upper_bound(min);
+  if (iter != scanned->begin() && std::prev(iter)->second >= min) --iter;
+  GeoHashFix52Bits start = min, merged_min = min, merged_max = max;
+  while (iter != scanned->end() && iter->first <= max) {
+    if (start < iter->first) ranges->emplace_back(start, iter->first);
+    start = std::max(start, iter->second);
+    merged_min = std::min(merged_min, iter->first);
+    merged_max = std::max(merged_max, iter->second);
+    iter = scanned->erase(iter);
+  }
+  if (start < max) ranges->emplace_back(start, max);
+  (*scanned)[merged_min] = merged_max;
 }
 
 /* Compute the sorted set scores min (inclusive), max (exclusive) we should
@@ -298,81 +430,101 @@ void Geo::scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix
   *max = GeoHashHelper::Align52Bits(hash);
 }
 
-/* Query a Redis sorted set to extract all the elements between 'min' and
- * 'max', appending them into the array of GeoPoint structures 'gparray'.
- * The command returns the number of elements added to the array.
+/* Query the sorted set to extract all the elements between 'min' and
+ * 'max' with the shared iterator, appending them into the array of GeoPoint
+ * structures 'geo_points'.
  *
- * Elements which are farest than 'radius' from the specified 'x' and 'y'
- * coordinates are not included.
+ * Elements which are out of the shape are not included.
  *
  * The ability of this function to append to an existing set of points is
  * important for good performances because querying by radius is performed
  * using multiple queries to the sorted set, that we later need to sort
  * via qsort. Similarly we need to be able to reject points outside the search
  * radius area ASAP in order to allocate and process more points than needed. */
-int Geo::getPointsInRange(const Slice &user_key,
-                          double min,
-                          double max,
-                          double lon,
-                          double lat,
-                          double radius,
-                          std::vector<GeoPoint> *geo_points) {
+void Geo::getPointsInRange(rocksdb::Iterator *iter,
+                           const std::string &prefix_key,
+                           double min,
+                           double max,
+                           const GeoShape &shape,
+                           std::vector<GeoPoint> *geo_points) {
   /* include min in range; exclude max in range */
   /* That's: min <= val < max */
-  ZRangeSpec spec;
-  spec.min = min;
-  spec.max = max;
-  spec.maxex = true;
-  int size;
-  std::vector<MemberScore> member_scores;
-  rocksdb::Status s = ZSet::RangeByScore(user_key, spec, &member_scores, &size);
-  if (!s.ok()) return 0;
-
-  for (const auto &member_score : member_scores) {
-    appendIfWithinRadius(geo_points, lon, lat, radius, member_score.score, member_score.member);
+  std::string start_score_bytes, start_key;
+  PutDouble(&start_score_bytes, min);
+  start_key = prefix_key;
+  start_key.append(start_score_bytes);
+  std::vector<double> scores;
+  std::vector<std::string> members;
+  for (iter->Seek(start_key); iter->Valid() && iter->key().starts_with(prefix_key); iter->Next()) {
+    InternalKey ikey(iter->key());
+    Slice score_key = ikey.GetSubKey();
+    double score;
+    GetDouble(&score_key, &score);
+    if (score >= max) break;
+    scores.emplace_back(score);
+    members.emplace_back(score_key.ToString());
   }
-  return 0;
+  appendPointsWithinShape(shape, scores, &members, geo_points);
 }
 
-/* Helper function for geoGetPointsInRange(): given a sorted set score
- * representing a point, and another point (the center of our search) and
- * a radius, appends this entry as a geoPoint into the specified geoArray
- * only if the point is within the search area.
- *
- * returns true if the point is included, or false if it is outside. */
-bool Geo::appendIfWithinRadius(std::vector<GeoPoint> *geo_points,
-                               double lon,
-                               double lat,
-                               double radius,
-                               double score,
-                               const std::string &member) {
-  double distance, xy[2];
-
-  if (!decodeGeoHash(score, xy)) return false; /* Can't decode. */
-  /* Note that geohashGetDistanceIfInRadiusWGS84() takes arguments in
-   * reverse order: longitude first, latitude later. */
-  if (!GeoHashHelper::GetDistanceIfInRadiusWGS84(lon, lat, xy[0], xy[1],
-                                                 radius, &distance)) {
-    return false;
+/* Helper function for getPointsInRange(): given the sorted set scores
+ * representing the points, and the shape of the search area, appends the
+ * entries as geoPoints into the specified geoArray only if the points are
+ * within the search area. The scores were decoded in batch, and the radius
+ * was checked by the batch distance kernel which skips the trigonometric
+ * functions for most of the points out of the radius. */
+void Geo::appendPointsWithinShape(const GeoShape &shape,
+                                  const std::vector<double> &scores,
+                                  std::vector<std::string> *members,
+                                  std::vector<GeoPoint> *geo_points) {
+  size_t n = scores.size();
+  if (n == 0) return;
+  std::vector<double> xs(n, 0), ys(n, 0), distances(n, -1);
+  std::vector<char> decoded(n, 0);
+  for (size_t i = 0; i < n; i++) {
+    double xy[2];
+    if (!decodeGeoHash(scores[i], xy)) continue; /* Can't decode. */
+    decoded[i] = 1;
+    xs[i] = xy[0];
+    ys[i] = xy[1];
+  }
+  /* Note that the distance functions take arguments in reverse order:
+   * longitude first, latitude later. */
+  if (shape.type == kGeoShapeTypeRadius) {
+    GeoHashHelper::GetDistancesIfInRadius(shape.longitude, shape.latitude, shape.radius,
+                                          xs.data(), ys.data(), n, distances.data());
+  } else {
+    for (size_t i = 0; i < n; i++) {
+      if (!GeoHashHelper::GetDistanceIfInRectangle(shape.width, shape.height, shape.longitude, shape.latitude,
+                                                   xs[i], ys[i], &distances[i])) {
+        distances[i] = -1;
+      }
+    }
   }
 
-  /* Append the new element. */
-  GeoPoint geo_point;
-  geo_point.longitude = xy[0];
-  geo_point.latitude = xy[1];
-  geo_point.dist = distance;
-  geo_point.member = member;
-  geo_point.score = score;
-  geo_points->emplace_back(geo_point);
-  return true;
+  /* Append the new elements. */
+  for (size_t i = 0; i < n; i++) {
+    if (!decoded[i] || distances[i] < 0) continue;
+    GeoPoint geo_point;
+    geo_point.longitude = xs[i];
+    geo_point.latitude = ys[i];
+    geo_point.dist = distances[i];
+    geo_point.member = std::move((*members)[i]);
+    geo_point.score = scores[i];
+    geo_points->emplace_back(std::move(geo_point));
+  }
 }
 
+// The points with the same distance were ordered by the member, so the result
+// was deterministic no matter which boxes were scanned first.
 bool Geo::sortGeoPointASC(const GeoPoint &gp1, const GeoPoint &gp2) {
-  return gp1.dist < gp2.dist;
+  if (gp1.dist != gp2.dist) return gp1.dist < gp2.dist;
+  return gp1.member < gp2.member;
 }
 
 bool Geo::sortGeoPointDESC(const GeoPoint &gp1, const GeoPoint &gp2) {
-  return gp1.dist >= gp2.dist;
+  if (gp1.dist != gp2.dist) return gp1.dist > gp2.dist;
+  return gp1.member < gp2.member;
 }
 
 }  // namespace Redis
@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <limits>
+#include <utility>
 
 #include "redis_db.h"
 #include "redis_metadata.h"
@@ -23,6 +24,31 @@ enum DistanceSort {
   kSortDESC,
 };
 
+enum GeoShapeType {
+  kGeoShapeTypeRadius,
+  kGeoShapeTypeBox,
+};
+
+// The search area centered at (longitude, latitude), the radius or
+// the width/height of the box was in meters.
+typedef struct GeoShape {
+  GeoShapeType type;
+  double longitude;
+  double latitude;
+  double radius;
+  double width;
+  double height;
+} GeoShape;
+
+// The sub-box of the geohash boxes which may intersect with the search area,
+// min/max were the score range and min_dist was the lower bound of the
+// distance from the center to any point in the box.
+typedef struct GeoSearchBox {
+  GeoHashFix52Bits min;
+  GeoHashFix52Bits max;
+  double min_dist;
+} GeoSearchBox;
+
 // Structures represent points and array of points on the earth.
 typedef struct GeoPoint {
   double longitude;
@@ -65,6 +91,25 @@ class Geo : public ZSet {
                                  bool store_distance,
                                  double unit_conversion,
                                  std::vector<GeoPoint> *geo_points);
+  rocksdb::Status Search(const Slice &user_key,
+                         const GeoShape &shape,
+                         int count,
+                         bool any,
+                         DistanceSort sort,
+                         const std::string &store_key,
+                         bool store_distance,
+                         double unit_conversion,
+                         std::vector<GeoPoint> *geo_points);
+  rocksdb::Status SearchByMember(const Slice &user_key,
+                                 const Slice &member,
+                                 GeoShape shape,
+                                 int count,
+                                 bool any,
+                                 DistanceSort sort,
+                                 const std::string &store_key,
+                                 bool store_distance,
+                                 double unit_conversion,
+                                 std::vector<GeoPoint> *geo_points);
 
   rocksdb::Status Get(const Slice &user_key,
                       const Slice &member,
@@ -76,32 +121,21 @@ class Geo : public ZSet {
 
  private:
   int decodeGeoHash(double bits, double *xy);
-  int membersOfAllNeighbors(const Slice &user_key,
-                            GeoHashRadius n,
-                            double lon,
-                            double lat,
-                            double radius,
-                            std::vector<GeoPoint> *geo_points);
-  int membersOfGeoHashBox(const Slice &user_key,
-                          GeoHashBits hash,
-                          std::vector<GeoPoint> *geo_points,
-                          double lon,
-                          double lat,
-                          double radius);
+  void searchBoxesOfShape(const GeoShape &shape, double radius, std::vector<GeoSearchBox> *boxes);
+  static void unscannedRanges(std::map<GeoHashFix52Bits, GeoHashFix52Bits> *scanned,
+                              GeoHashFix52Bits min, GeoHashFix52Bits max,
+                              std::vector<std::pair<GeoHashFix52Bits, GeoHashFix52Bits>> *ranges);
   void scoresOfGeoHashBox(GeoHashBits hash, GeoHashFix52Bits *min, GeoHashFix52Bits *max);
-  int getPointsInRange(const Slice &user_key,
-                       double min,
-                       double max,
-                       double lon,
-                       double lat,
-                       double radius,
-                       std::vector<GeoPoint> *geo_points);
-  bool appendIfWithinRadius(std::vector<GeoPoint> *geo_points,
-                            double lon,
-                            double lat,
-                            double radius,
-                            double score,
-                            const std::string &member);
+  void getPointsInRange(rocksdb::Iterator *iter,
+                        const std::string &prefix_key,
+                        double min,
+                        double max,
+                        const GeoShape &shape,
+                        std::vector<GeoPoint> *geo_points);
+  void appendPointsWithinShape(const GeoShape &shape,
+                               const std::vector<double> &scores,
+                               std::vector<std::string> *members,
+                               std::vector<GeoPoint> *geo_points);
 
   static bool sortGeoPointASC(const GeoPoint &gp1, const GeoPoint &gp2);
   static bool sortGeoPointDESC(const GeoPoint &gp1, const GeoPoint &gp2);
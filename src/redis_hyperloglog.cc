@@ -0,0 +1,137 @@
+#include "redis_hyperloglog.h"
+
+#include "hyperloglog.h"
+#include "redis_string.h"
+
+namespace Redis {
+
+rocksdb::Status HyperLogLog::getRawValue(const rocksdb::ReadOptions &read_options,
+                                         const std::string &ns_key, std::string *raw_value) {
+  raw_value->clear();
+  rocksdb::Status s = db_->Get(read_options, metadata_cf_handle_, ns_key, raw_value);
+  if (!s.ok()) return s;
+
+  Metadata metadata(kRedisNone, false);
+  metadata.Decode(*raw_value);
+  if (metadata.Expired()) {
+    raw_value->clear();
+    return rocksdb::Status::NotFound("the key was expired");
+  }
+  if (metadata.Type() != kRedisString) {
+    if (metadata.size == 0) {
+      // the metadata of the empty key mustn't be taken as the prefix of the new value
+      raw_value->clear();
+      return rocksdb::Status::NotFound("no elements");
+    }
+    return rocksdb::Status::InvalidArgument("WRONGTYPE Operation against a key holding the wrong kind of value");
+  }
+  if (!HLL::IsValid(raw_value->substr(STRING_HDR_SIZE))) {
+    return rocksdb::Status::InvalidArgument("WRONGTYPE Key is not a valid HyperLogLog string value.");
+  }
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status HyperLogLog::updateRawValue(const std::string &ns_key, const std::string &raw_value) {
+  rocksdb::WriteBatch batch;
+  WriteBatchLogData log_data(kRedisString);
+  batch.PutLogData(log_data.Encode());
+  batch.Put(metadata_cf_handle_, ns_key, raw_value);
+  return storage_->Write(rocksdb::WriteOptions(), &batch);
+}
+
+rocksdb::Status HyperLogLog::Add(const Slice &user_key, const std::vector<std::string> &elements, int *ret) {
+  *ret = 0;
+  std::string ns_key, raw_value, hll;
+  AppendNamespacePrefix(user_key, &ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), ns_key);
+  rocksdb::Status s = getRawValue(rocksdb::ReadOptions(), ns_key, &raw_value);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    Metadata metadata(kRedisString, false);
+    raw_value.clear();
+    metadata.Encode(&raw_value);
+    HLL::CreateEmpty(&hll);
+    *ret = 1;  // the key was created even if there was no element
+  } else {
+    hll = raw_value.substr(STRING_HDR_SIZE);
+    raw_value.resize(STRING_HDR_SIZE);  // keep the expire of the existing key
+  }
+
+  bool corrupted = false;
+  if (HLL::Add(&hll, elements, storage_->HLLSparseMaxBytes(), &corrupted)) *ret = 1;
+  if (corrupted) return rocksdb::Status::Corruption("INVALIDOBJ Corrupted HLL object detected");
+  if (*ret == 0) return rocksdb::Status::OK();
+  raw_value.append(hll);
+  return updateRawValue(ns_key, raw_value);
+}
+
+rocksdb::Status HyperLogLog::Count(const std::vector<Slice> &user_keys, uint64_t *card) {
+  *card = 0;
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  std::string ns_key, raw_value;
+  if (user_keys.size() == 1) {
+    AppendNamespacePrefix(user_keys[0], &ns_key);
+    auto s = getRawValue(read_options, ns_key, &raw_value);
+    if (!s.ok()) return s.IsNotFound() ? rocksdb::Status::OK() : s;
+    // The updated cache wasn't written back, since PFCOUNT was a read-only
+    // command in kvrocks, the cache would be updated by the next PFADD.
+    std::string hll = raw_value.substr(STRING_HDR_SIZE);
+    if (!HLL::Count(&hll, card)) return rocksdb::Status::Corruption("INVALIDOBJ Corrupted HLL object detected");
+    return rocksdb::Status::OK();
+  }
+
+  // merge the registers of all keys, and count the union
+  std::vector<uint8_t> max(HLL::kRegisters, 0);
+  for (const auto &user_key : user_keys) {
+    AppendNamespacePrefix(user_key, &ns_key);
+    auto s = getRawValue(read_options, ns_key, &raw_value);
+    if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.IsNotFound()) continue;
+    if (!HLL::MergeRegisters(raw_value.substr(STRING_HDR_SIZE), max.data())) {
+      return rocksdb::Status::Corruption("INVALIDOBJ Corrupted HLL object detected");
+    }
+  }
+  *card = HLL::CountRegisters(max.data());
+  return rocksdb::Status::OK();
+}
+
+rocksdb::Status HyperLogLog::Merge(const Slice &dest_key, const std::vector<Slice> &source_keys) {
+  std::string dest_ns_key, ns_key, raw_value, dest_raw_value;
+  AppendNamespacePrefix(dest_key, &dest_ns_key);
+
+  LockGuard guard(storage_->GetLockManager(), dest_ns_key);
+  LatestSnapShot ss(db_);
+  rocksdb::ReadOptions read_options;
+  read_options.snapshot = ss.GetSnapShot();
+  std::vector<uint8_t> max(HLL::kRegisters, 0);
+  // the dest key was also merged if it exists
+  auto s = getRawValue(read_options, dest_ns_key, &dest_raw_value);
+  if (!s.ok() && !s.IsNotFound()) return s;
+  if (s.IsNotFound()) {
+    Metadata metadata(kRedisString, false);
+    dest_raw_value.clear();
+    metadata.Encode(&dest_raw_value);
+  } else if (!HLL::MergeRegisters(dest_raw_value.substr(STRING_HDR_SIZE), max.data())) {
+    return rocksdb::Status::Corruption("INVALIDOBJ Corrupted HLL object detected");
+  }
+  for (const auto &source_key : source_keys) {
+    AppendNamespacePrefix(source_key, &ns_key);
+    s = getRawValue(read_options, ns_key, &raw_value);
+    if (!s.ok() && !s.IsNotFound()) return s;
+    if (s.IsNotFound()) continue;
+    if (!HLL::MergeRegisters(raw_value.substr(STRING_HDR_SIZE), max.data())) {
+      return rocksdb::Status::Corruption("INVALIDOBJ Corrupted HLL object detected");
+    }
+  }
+
+  std::string hll;
+  HLL::DenseFromRegisters(max.data(), &hll);
+  dest_raw_value.resize(STRING_HDR_SIZE);  // keep the expire of the existing key
+  dest_raw_value.append(hll);
+  return updateRawValue(dest_ns_key, dest_raw_value);
+}
+
+}  // namespace Redis
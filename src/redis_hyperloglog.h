@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "redis_db.h"
+#include "redis_metadata.h"
+
+namespace Redis {
+
+// The HyperLogLog was stored as the string value with the Redis compatible
+// encodings(see hyperloglog.h), so it can be synced to Redis as the string.
+class HyperLogLog : public Database {
+ public:
+  explicit HyperLogLog(Engine::Storage *storage, const std::string &ns) : Database(storage, ns) {}
+  rocksdb::Status Add(const Slice &user_key, const std::vector<std::string> &elements, int *ret);
+  rocksdb::Status Count(const std::vector<Slice> &user_keys, uint64_t *card);
+  rocksdb::Status Merge(const Slice &dest_key, const std::vector<Slice> &source_keys);
+
+ private:
+  rocksdb::Status getRawValue(const rocksdb::ReadOptions &read_options,
+                              const std::string &ns_key, std::string *raw_value);
+  rocksdb::Status updateRawValue(const std::string &ns_key, const std::string &raw_value);
+};
+
+}  // namespace Redis
@@ -29,6 +29,8 @@ enum RedisCommand {
   kRedisCmdLPush,
   kRedisCmdRPush,
   kRedisCmdExpire,
+  kRedisCmdBitOp,
+  kRedisCmdBitfield,
 };
 
 const std::vector<std::string> RedisTypeNames = {
@@ -112,6 +114,10 @@ class ZSetMetadata : public Metadata {
   explicit ZSetMetadata(bool generate_version = true): Metadata(kRedisZSet, generate_version){}
 };
 
+// The lower 4 bits of the flags were the type, and the segments of the bitmap
+// were encoded as containers(see bitmap_container.h) if this flag was set.
+const uint8_t kMetadataFlagBitmapContainer = 0x10;
+
 class BitmapMetadata : public Metadata {
  public:
   explicit BitmapMetadata(bool generate_version = true): Metadata(kRedisBitmap, generate_version){}
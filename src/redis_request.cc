@@ -124,22 +124,46 @@ bool Request::isProfilingEnabled(const std::string &cmd) {
   return false;
 }
 
-void Request::recordProfilingSampleIfNeed(const std::string &cmd, uint64_t duration) {
+void Request::recordProfilingSampleIfNeed(const std::string &cmd, int cmd_id, uint64_t duration) {
+  auto perf_context = rocksdb::get_perf_context();
+  uint64_t counters[kPerfCounterNum];
+  counters[kPerfBlockCacheHit] = perf_context->block_cache_hit_count;
+  counters[kPerfBlockRead] = perf_context->block_read_count;
+  counters[kPerfBlockReadBytes] = perf_context->block_read_byte;
+  counters[kPerfBloomSstChecked] = perf_context->bloom_sst_hit_count + perf_context->bloom_sst_miss_count;
+  // the bloom filter was useful when it told the key wasn't in the sst
+  counters[kPerfBloomSstUseful] = perf_context->bloom_sst_miss_count;
+  counters[kPerfMemtableGet] = perf_context->get_from_memtable_count;
+  counters[kPerfMemtableGetNanos] = perf_context->get_from_memtable_time;
+  counters[kPerfSstGetNanos] = perf_context->get_from_output_files_time;
+  counters[kPerfSeek] = perf_context->seek_child_seek_count;
+  counters[kPerfInternalKeySkipped] = perf_context->internal_key_skipped_count;
+  counters[kPerfInternalDeleteSkipped] = perf_context->internal_delete_skipped_count;
+  counters[kPerfReadBytes] = perf_context->get_read_bytes + perf_context->multiget_read_bytes +
+                             perf_context->iter_read_bytes;
+  bool has_db_operation = false;
+  for (const auto counter : counters) {
+    if (counter != 0) has_db_operation = true;
+  }
+  // the counters of every sampled command were aggregated, while only the slow
+  // commands were recorded into the perf log since the text was costly to keep
+  if (has_db_operation) svr_->stats_.IncrPerfCounters(cmd_id, counters);
+
   int threshold = svr_->GetConfig()->profiling_sample_record_threshold_ms;
   if (threshold > 0 && static_cast<int>(duration/1000) < threshold) {
     rocksdb::SetPerfLevel(rocksdb::PerfLevel::kDisable);
     return;
   }
 
-  std::string perf_context = rocksdb::get_perf_context()->ToString(true);
+  std::string perf_context_str = perf_context->ToString(true);
   std::string iostats_context = rocksdb::get_iostats_context()->ToString(true);
   rocksdb::SetPerfLevel(rocksdb::PerfLevel::kDisable);
-  if (perf_context.empty()) return;  // request without db operation
+  if (perf_context_str.empty()) return;  // request without db operation
   auto entry = new PerfEntry();
   entry->cmd_name = cmd;
   entry->duration = duration;
   entry->iostats_context = std::move(iostats_context);
-  entry->perf_context = std::move(perf_context);
+  entry->perf_context = std::move(perf_context_str);
   svr_->GetPerfLog()->PushEntry(entry);
 }
 
@@ -149,7 +173,14 @@ void Request::ExecuteCommands(Connection *conn) {
   Config *config = svr_->GetConfig();
   std::string reply, password;
   password = conn->IsRepl() ? config->masterauth : config->requirepass;
-  for (auto &cmd_tokens : commands_) {
+  // The reads on the slave share the visible snapshot in this round, it was
+  // released before returning, so the db could be closed while loading.
+  std::shared_ptr<const rocksdb::Snapshot> snapshot;
+  size_t executed = 0;
+  for (; executed < commands_.size(); executed++) {
+    // the rest was kept until the connection resumed
+    if (conn->IsSuspended()) break;
+    auto &cmd_tokens = commands_[executed];
     if (conn->IsFlagEnabled(Redis::Connection::kCloseAfterReply)) break;
     if (conn->GetNamespace().empty()) {
       if (!password.empty() && Util::ToLower(cmd_tokens.front()) != "auth") {
@@ -196,7 +227,8 @@ void Request::ExecuteCommands(Connection *conn) {
       continue;
     }
     conn->SetLastCmd(cmd_name);
-    svr_->stats_.IncrCalls(cmd_name);
+    int cmd_id = conn->current_cmd_->GetID();
+    svr_->stats_.IncrCalls(cmd_id);
     auto start = std::chrono::high_resolution_clock::now();
     bool is_profiling = isProfilingEnabled(cmd_name);
     svr_->IncrExecutingCommandNum();
@@ -208,13 +240,18 @@ void Request::ExecuteCommands(Connection *conn) {
       conn->Reply(Redis::Error("ERR restoring the db from backup"));
       break;
     }
+    bool pin_snapshot = config->slave_snapshot_read && config->slave_readonly
+                        && svr_->IsSlave() && !conn->current_cmd_->IsWrite();
+    if (pin_snapshot && !snapshot) snapshot = svr_->storage_->GetVisibleSnapshot();
+    if (pin_snapshot) Engine::Storage::PinSnapshot(snapshot.get());
     s = conn->current_cmd_->Execute(svr_, conn, &reply);
+    Engine::Storage::PinSnapshot(nullptr);
     svr_->DecrExecutingCommandNum();
     auto end = std::chrono::high_resolution_clock::now();
     uint64_t duration = std::chrono::duration_cast<std::chrono::microseconds>(end-start).count();
-    if (is_profiling) recordProfilingSampleIfNeed(cmd_name, duration);
+    if (is_profiling) recordProfilingSampleIfNeed(cmd_name, cmd_id, duration);
     svr_->SlowlogPushEntryIfNeeded(conn->current_cmd_->Args(), duration);
-    svr_->stats_.IncrLatency(static_cast<uint64_t>(duration), cmd_name);
+    svr_->stats_.IncrLatency(static_cast<uint64_t>(duration), cmd_id);
     svr_->FeedMonitorConns(conn, cmd_tokens);
     if (!s.IsOK()) {
       conn->Reply(Redis::Error("ERR " + s.Msg()));
@@ -223,6 +260,10 @@ void Request::ExecuteCommands(Connection *conn) {
     if (!reply.empty()) conn->Reply(reply);
     reply.clear();
   }
+  if (conn->IsSuspended()) {
+    commands_.erase(commands_.begin(), commands_.begin() + executed);
+    return;
+  }
   commands_.clear();
 }
 
@@ -38,7 +38,7 @@ class Request {
   Server *svr_;
   bool inCommandWhitelist(const std::string &command);
   bool isProfilingEnabled(const std::string &cmd);
-  void recordProfilingSampleIfNeed(const std::string &cmd, uint64_t duration);
+  void recordProfilingSampleIfNeed(const std::string &cmd, int cmd_id, uint64_t duration);
 };
 
 }  // namespace Redis
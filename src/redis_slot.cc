@@ -15,6 +15,7 @@
 #include "util.h"
 #include "redis_reply.h"
 #include "encoding.h"
+#include "redis_bitmap.h"
 
 uint32_t crc32tab[256];
 void CRC32TableInit(uint32_t poly) {
@@ -504,7 +505,18 @@ Status Slot::generateMigrateCommandComplexKV(const Slice &key, const Metadata &m
         list.emplace_back(ikey.GetSubKey().ToString());
         break;
       }
-      case kRedisBitmap:
+      case kRedisBitmap: {
+        // the target would encode the segments by its own config
+        std::string segment;
+        auto s = Redis::Bitmap::DecodeSegment(metadata, iter->value(), &segment);
+        if (!s.ok()) {
+          delete iter;
+          return Status(Status::NotOK, s.ToString());
+        }
+        list.emplace_back(ikey.GetSubKey().ToString());
+        list.emplace_back(std::move(segment));
+        break;
+      }
       case kRedisHash: {
         list.emplace_back(ikey.GetSubKey().ToString());
         list.emplace_back(iter->value().ToString());
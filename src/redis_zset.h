@@ -108,7 +108,7 @@ class ZSet : public SubKeyScanner {
 
   rocksdb::Status GetMetadata(const Slice &ns_key, ZSetMetadata *metadata);
 
- private:
+ protected:
   rocksdb::ColumnFamilyHandle *score_cf_handle_;
 };
 
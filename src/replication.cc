@@ -3,13 +3,20 @@
 #include <signal.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
 #include <future>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <event2/buffer.h>
 #include <event2/bufferevent.h>
 #include <event2/event.h>
 #include <glog/logging.h>
+#ifdef SNAPPY
+#include <snappy.h>
+#endif
 
 #include "redis_reply.h"
 #include "rocksdb_crc32c.h"
@@ -17,11 +24,256 @@
 #include "status.h"
 #include "server.h"
 
+namespace {
+
+// The pending batches were flushed when any limit was reached or the slave caught up
+const size_t kMaxPendingBytes = 1024 * 1024;
+const size_t kMaxPendingBatches = 512;
+const int kMaxPendingMilliseconds = 10;
+const int kWaitWALDataMilliseconds = 100;
+const int kLivenessCheckIntervalSecs = 2;
+// The small batches weren't worth compressing
+const size_t kMinCompressBytes = 256;
+// The replication data was compressed for the network, so the fastest level was used
+const int kZstdCompressionLevel = 1;
+const size_t kZstdDecompressBufferSize = 64 * 1024;
+
+// The raw write batch begins with the fixed64 sequence and the fixed32 count,
+// both were encoded in little endian by rocksdb.
+const size_t kWriteBatchHeaderSize = 12;
+// The pending batches of the replica applier
+const size_t kMaxApplyPendingBytes = 64 * 1024 * 1024;
+const size_t kMaxApplyGroupBytes = 4 * 1024 * 1024;
+
+uint64_t decodeBatchSequence(const std::string &batch) {
+  uint64_t seq = 0;
+  for (int i = 7; i >= 0; i--) seq = (seq << 8) | static_cast<uint8_t>(batch[i]);
+  return seq;
+}
+
+uint32_t decodeBatchCount(const std::string &batch) {
+  uint32_t count = 0;
+  for (int i = 11; i >= 8; i--) count = (count << 8) | static_cast<uint8_t>(batch[i]);
+  return count;
+}
+
+// The slave acknowledges the applied seq once it was changed, or every second
+const int kAckIntervalSecs = 1;
+// The acks were tiny, the slave must be broken if too many bytes were pending
+const size_t kMaxAckBufferBytes = 64 * 1024;
+const size_t kMaxUnackedSends = 1024;
+
+int64_t steadyNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Parse one multi bulk command from the pos of the buffer, returns 1 if the
+// command was parsed and the pos was moved to the next one, 0 if the command
+// wasn't complete yet, and -1 if it was malformed.
+int parseMultiBulk(const std::string &buf, size_t *pos, std::vector<std::string> *args) {
+  size_t p = *pos;
+  auto read_line = [&buf, &p](std::string *line) {
+    auto end = buf.find(CRLF, p);
+    if (end == std::string::npos) return false;
+    line->assign(buf, p, end - p);
+    p = end + 2;
+    return true;
+  };
+  std::string line;
+  if (!read_line(&line)) return 0;
+  if (line.size() < 2 || line[0] != '*') return -1;
+  auto n = std::strtol(line.c_str() + 1, nullptr, 10);
+  if (n <= 0 || n > 16) return -1;
+  args->clear();
+  for (int64_t i = 0; i < n; i++) {
+    if (!read_line(&line)) return 0;
+    if (line.size() < 2 || line[0] != '$') return -1;
+    auto len = std::strtol(line.c_str() + 1, nullptr, 10);
+    if (len < 0 || len > 1024) return -1;
+    if (buf.size() < p + len + 2) return 0;
+    args->emplace_back(buf, p, len);
+    p += len + 2;
+  }
+  *pos = p;
+  return 1;
+}
+
+int64_t elapsedMicros(std::chrono::steady_clock::time_point start) {
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+}  // namespace
+
+ReplCompression ParseReplCompression(const std::string &name) {
+  auto codec = Util::ToLower(name);
+#ifdef SNAPPY
+  if (codec == "snappy") return kReplCompressionSnappy;
+#endif
+#ifdef ZSTD
+  if (codec == "zstd") return kReplCompressionZstd;
+#endif
+  return kReplCompressionNone;
+}
+
+const char *ReplCompressionName(ReplCompression codec) {
+  switch (codec) {
+    case kReplCompressionSnappy:
+      return "snappy";
+    case kReplCompressionZstd:
+      return "zstd";
+    default:
+      return "none";
+  }
+}
+
+ReplCompression PreferredReplCompression() {
+#ifdef ZSTD
+  return kReplCompressionZstd;
+#else
+  return FallbackReplCompression(kReplCompressionZstd);
+#endif
+}
+
+// The older masters only support snappy
+ReplCompression FallbackReplCompression(ReplCompression codec) {
+#ifdef SNAPPY
+  if (codec == kReplCompressionZstd) return kReplCompressionSnappy;
+#endif
+  return kReplCompressionNone;
+}
+
+void CompressReplData(Stats *stats, ReplCompression codec, const char *data, size_t len, std::string *output) {
+  auto start = std::chrono::steady_clock::now();
+  switch (codec) {
+#ifdef SNAPPY
+    case kReplCompressionSnappy:
+      snappy::Compress(data, len, output);
+      break;
+#endif
+#ifdef ZSTD
+    case kReplCompressionZstd: {
+      output->resize(ZSTD_compressBound(len));
+      auto n = ZSTD_compress(&(*output)[0], output->size(), data, len, kZstdCompressionLevel);
+      // never failed with the bound size, send it as is to be safe
+      if (ZSTD_isError(n)) {
+        output->assign(data, len);
+        return;
+      }
+      output->resize(n);
+      break;
+    }
+#endif
+    default:
+      output->assign(data, len);
+      return;
+  }
+  stats->IncrReplCompress(len, output->size(), elapsedMicros(start));
+}
+
+bool DecompressReplData(Stats *stats, ReplCompression codec, const char *data, size_t len, std::string *output) {
+  auto start = std::chrono::steady_clock::now();
+  switch (codec) {
+#ifdef SNAPPY
+    case kReplCompressionSnappy:
+      if (!snappy::Uncompress(data, len, output)) return false;
+      break;
+#endif
+#ifdef ZSTD
+    case kReplCompressionZstd: {
+      auto size = ZSTD_getFrameContentSize(data, len);
+      if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) return false;
+      output->resize(size);
+      auto n = ZSTD_decompress(&(*output)[0], output->size(), data, len);
+      if (ZSTD_isError(n) || n != size) return false;
+      break;
+    }
+#endif
+    default:
+      return false;
+  }
+  stats->IncrReplDecompress(len, output->size(), elapsedMicros(start));
+  return true;
+}
+
+ReplStreamCodec::ReplStreamCodec(ReplCompression codec) : codec_(codec) {}
+
+ReplStreamCodec::~ReplStreamCodec() {
+#ifdef ZSTD
+  if (cctx_) ZSTD_freeCCtx(cctx_);
+  if (dctx_) ZSTD_freeDCtx(dctx_);
+#endif
+}
+
+bool ReplStreamCodec::Compress(Stats *stats, const char *data, size_t len, std::string *output) {
+#ifdef ZSTD
+  if (codec_ == kReplCompressionZstd) {
+    auto start = std::chrono::steady_clock::now();
+    if (!cctx_) {
+      cctx_ = ZSTD_createCCtx();
+      if (!cctx_) return false;
+      ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, kZstdCompressionLevel);
+    }
+    // The frame was flushed instead of ended, so the window was kept for the next frames
+    output->resize(ZSTD_compressBound(len));
+    ZSTD_inBuffer in = {data, len, 0};
+    ZSTD_outBuffer out = {&(*output)[0], output->size(), 0};
+    size_t remaining;
+    do {
+      if (out.pos == out.size) {
+        output->resize(output->size() * 2);
+        out.dst = &(*output)[0];
+        out.size = output->size();
+      }
+      remaining = ZSTD_compressStream2(cctx_, &out, &in, ZSTD_e_flush);
+      if (ZSTD_isError(remaining)) return false;
+    } while (remaining != 0);
+    output->resize(out.pos);
+    stats->IncrReplCompress(len, output->size(), elapsedMicros(start));
+    return true;
+  }
+#endif
+  CompressReplData(stats, codec_, data, len, output);
+  return true;
+}
+
+bool ReplStreamCodec::Decompress(Stats *stats, const char *data, size_t len, std::string *output) {
+#ifdef ZSTD
+  if (codec_ == kReplCompressionZstd) {
+    auto start = std::chrono::steady_clock::now();
+    if (!dctx_) {
+      dctx_ = ZSTD_createDCtx();
+      if (!dctx_) return false;
+    }
+    // The frame was flushed by the master, so all of its data was decompressed once
+    // the input was consumed and the output buffer wasn't full.
+    output->clear();
+    ZSTD_inBuffer in = {data, len, 0};
+    size_t decompressed = 0;
+    while (true) {
+      output->resize(decompressed + kZstdDecompressBufferSize);
+      ZSTD_outBuffer out = {&(*output)[decompressed], kZstdDecompressBufferSize, 0};
+      auto ret = ZSTD_decompressStream(dctx_, &out, &in);
+      if (ZSTD_isError(ret)) return false;
+      decompressed += out.pos;
+      if (in.pos == in.size && out.pos < out.size) break;
+    }
+    output->resize(decompressed);
+    stats->IncrReplDecompress(len, output->size(), elapsedMicros(start));
+    return true;
+  }
+#endif
+  return DecompressReplData(stats, codec_, data, len, output);
+}
+
 FeedSlaveThread::~FeedSlaveThread() {
   delete conn_;
 }
 
 Status FeedSlaveThread::Start() {
+  auto codec = ParseReplCompression(conn_->GetReplCompression());
+  if (codec != kReplCompressionNone) codec_ = std::unique_ptr<ReplStreamCodec>(new ReplStreamCodec(codec));
   try {
     t_ = std::thread([this]() {
       Util::ThreadSetName("feed-slave-thread");
@@ -35,7 +287,9 @@ Status FeedSlaveThread::Start() {
       // force feed slave thread was scheduled after making the fd blocking,
       // and write "+OK\r\n" response to psync command
       usleep(10000);
+      srv_->GetWALTailer()->Subscribe();
       this->loop();
+      srv_->GetWALTailer()->Unsubscribe();
     });
   } catch (const std::system_error &e) {
     conn_ = nullptr;  // prevent connection was freed when failed to start the thread
@@ -54,7 +308,9 @@ void FeedSlaveThread::Join() {
 }
 
 void FeedSlaveThread::checkLivenessIfNeed() {
-  if (++interval % 1000) return;
+  auto now = std::chrono::steady_clock::now();
+  if (now - last_send_time_ < std::chrono::seconds(kLivenessCheckIntervalSecs)) return;
+  last_send_time_ = now;
   const auto ping_command = Redis::BulkString("ping");
   auto s = Util::SockSend(conn_->GetFD(), ping_command);
   if (!s.IsOK()) {
@@ -64,55 +320,201 @@ void FeedSlaveThread::checkLivenessIfNeed() {
   }
 }
 
+// Send the pending batches as the bulk strings with one writev, the batches
+// were referenced by the iovecs instead of being copied into the bulk strings.
+// If the slave asked for the compression, the bulk strings were compressed
+// together and sent as the frame "!<compressed length>\r\n<compressed>\r\n".
+Status FeedSlaveThread::flushPendingBatches() {
+  if (pending_batches_.empty()) return Status::OK();
+  std::vector<iovec> iov;
+  iov.reserve(pending_batches_.size() * 3);
+  for (const auto &batch : pending_batches_) {
+    const auto &data = batch->batch->Data();
+    iov.push_back({const_cast<char *>(batch->header.data()), batch->header.size()});
+    iov.push_back({const_cast<char *>(data.data()), data.size()});
+    iov.push_back({const_cast<char *>(CRLF), 2});
+  }
+  size_t sent_bytes = pending_bytes_;
+  std::string frame_header, compressed;
+  if (codec_ && pending_bytes_ >= kMinCompressBytes) {
+    std::string raw;
+    raw.reserve(pending_bytes_);
+    for (const auto &v : iov) raw.append(static_cast<const char *>(v.iov_base), v.iov_len);
+    if (!codec_->Compress(&srv_->stats_, raw.data(), raw.size(), &compressed)) {
+      LOG(ERROR) << "Failed to compress the batches for slave: " << conn_->GetAddr();
+      return Status(Status::NotOK, "failed to compress the batches");
+    }
+    // the stateful codec must send the frame, or the slave's window would be out of sync
+    if (codec_->IsStateful() || compressed.size() < raw.size()) {
+      frame_header = "!" + std::to_string(compressed.size()) + CRLF;
+      iov.clear();
+      iov.push_back({&frame_header[0], frame_header.size()});
+      iov.push_back({&compressed[0], compressed.size()});
+      iov.push_back({const_cast<char *>(CRLF), 2});
+      sent_bytes = frame_header.size() + compressed.size() + 2;
+    }
+  }
+  auto s = Util::SockSendv(conn_->GetFD(), &iov);
+  if (!s.IsOK()) {
+    LOG(ERROR) << "Write error while sending batch to slave: " << s.Msg() << ". batch: 0x"
+               << Util::StringToHex(pending_batches_.front()->batch->Data());
+    return s;
+  }
+  flushes_++;
+  sent_batches_ += pending_batches_.size();
+  sent_bytes_ += sent_bytes;
+  if (unacked_sends_.size() < kMaxUnackedSends) {
+    unacked_sends_.emplace_back(next_repl_seq_ - 1, steadyNowMs());
+    if (oldest_unacked_ms_ == 0) oldest_unacked_ms_ = unacked_sends_.front().second;
+  }
+  pending_batches_.clear();
+  pending_bytes_ = 0;
+  last_send_time_ = std::chrono::steady_clock::now();
+  return Status::OK();
+}
+
+// Read the "REPLCONF ACK <seq>" commands sent by the slave without blocking,
+// the incomplete command was kept in the buffer until the rest was received.
+Status FeedSlaveThread::readAcks() {
+  char buf[4096];
+  while (true) {
+    auto n = recv(conn_->GetFD(), buf, sizeof(buf), MSG_DONTWAIT);
+    if (n == 0) return Status(Status::NotOK, "the connection was closed by the slave");
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      return Status(Status::NotOK, strerror(errno));
+    }
+    ack_buffer_.append(buf, n);
+    if (ack_buffer_.size() > kMaxAckBufferBytes) {
+      return Status(Status::NotOK, "too many bytes were sent by the slave");
+    }
+  }
+
+  size_t pos = 0;
+  std::vector<std::string> args;
+  while (true) {
+    auto ret = parseMultiBulk(ack_buffer_, &pos, &args);
+    if (ret < 0) return Status(Status::NotOK, "malformed command was sent by the slave");
+    if (ret == 0) break;
+    if (args.size() != 3 || Util::ToLower(args[0]) != "replconf" || Util::ToLower(args[1]) != "ack") {
+      LOG(WARNING) << "Unexpected command was sent by the slave[" << conn_->GetAddr() << "]: " << args[0];
+      continue;
+    }
+    try {
+      ackSeq(std::stoull(args[2]));
+    } catch (const std::exception &e) {
+      return Status(Status::NotOK, "the acked seq was not a number");
+    }
+  }
+  ack_buffer_.erase(0, pos);
+  return Status::OK();
+}
+
+void FeedSlaveThread::ackSeq(rocksdb::SequenceNumber seq) {
+  if (seq > ack_seq_) ack_seq_ = seq;
+  while (!unacked_sends_.empty() && unacked_sends_.front().first <= seq) {
+    unacked_sends_.pop_front();
+  }
+  oldest_unacked_ms_ = unacked_sends_.empty() ? 0 : unacked_sends_.front().second;
+}
+
+uint64_t FeedSlaveThread::GetAckLagMs() {
+  int64_t oldest = oldest_unacked_ms_;
+  if (oldest == 0) return 0;
+  return static_cast<uint64_t>(std::max<int64_t>(steadyNowMs() - oldest, 0));
+}
+
+// Read the batch of the next_repl_seq_ from the shared WAL tailer, or from the
+// private WAL iterator when the slave lags behind the ring of the tailer. The
+// batch would be nullptr if there was no new data.
+Status FeedSlaveThread::nextBatch(std::shared_ptr<const WALBatch> *batch) {
+  batch->reset();
+  auto tailer = srv_->GetWALTailer();
+  auto result = tailer->Read(next_repl_seq_, batch);
+  if (result == WALTailer::kFound) {
+    iter_ = nullptr;  // caught up the ring, the private iterator was useless
+    return Status::OK();
+  }
+  if (result == WALTailer::kNoData) {
+    iter_ = nullptr;
+    tailer->WaitForData(next_repl_seq_, kWaitWALDataMilliseconds);
+    return Status::OK();
+  }
+
+  if (!srv_->storage_->WaitForWALData(next_repl_seq_, kWaitWALDataMilliseconds)) return Status::OK();
+  // The iterator stays at the last sent batch until the next batch was written
+  if (iter_ && iter_->Valid()) iter_->Next();
+  if (!iter_ || !iter_->Valid()) {
+    if (iter_) LOG(INFO) << "WAL was rotated, would reopen again";
+    if (!srv_->storage_->GetWALIter(next_repl_seq_, &iter_).IsOK()) {
+      iter_ = nullptr;
+      std::this_thread::sleep_for(std::chrono::milliseconds(kMaxPendingMilliseconds));
+      return Status::OK();
+    }
+  }
+  auto wal_batch = iter_->GetBatch();
+  if (wal_batch.sequence != next_repl_seq_) {
+    return Status(Status::NotOK, "WAL iterator is discrete, some seq might be lost, sequence "
+                                 + std::to_string(next_repl_seq_) + " expectd, but got "
+                                 + std::to_string(wal_batch.sequence));
+  }
+  *batch = std::make_shared<const WALBatch>(wal_batch.sequence, std::move(wal_batch.writeBatchPtr));
+  return Status::OK();
+}
+
 void FeedSlaveThread::loop() {
   // is_first_repl_batch was used to fix that replication may be stuck in a dead loop
   // when some seqs might be lost in the middle of the WAL log, so forced to replicate
   // first batch here to work around this issue instead of waiting for enough batch size.
   bool is_first_repl_batch = true;
-  uint32_t yield_milliseconds = 2000;
-  std::vector<std::string> batch_list;
+  std::chrono::steady_clock::time_point first_pending_time;
   while (!IsStopped()) {
-    if (!iter_ || !iter_->Valid()) {
-      if (iter_) LOG(INFO) << "WAL was rotated, would reopen again";
-      if (!srv_->storage_->WALHasNewData(next_repl_seq_)
-          || !srv_->storage_->GetWALIter(next_repl_seq_, &iter_).IsOK()) {
-        iter_ = nullptr;
-        usleep(yield_milliseconds);
-        checkLivenessIfNeed();
-        continue;
-      }
-    }
-    // iter_ would be always valid here
-    auto batch = iter_->GetBatch();
-    if (batch.sequence != next_repl_seq_) {
-      LOG(ERROR) << "Fatal error encountered, WAL iterator is discrete, some seq might be lost"
-                 << ", sequence " << next_repl_seq_ << " expectd, but got " << batch.sequence;
+    std::shared_ptr<const WALBatch> batch;
+    auto s = nextBatch(&batch);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "Fatal error encountered, " << s.Msg();
       Stop();
       return;
     }
-    auto data = batch.writeBatchPtr->Data();
-    batch_list.emplace_back(Redis::BulkString(data));
-    // feed the bulks data to slave in batch mode iff the lag was far from the master
-    auto latest_seq = srv_->storage_->LatestSeq();
-    if (is_first_repl_batch || latest_seq - batch.sequence <= 20 || batch_list.size() >= 20) {
-      for (const auto &bulk_str : batch_list) {
-        auto s = Util::SockSend(conn_->GetFD(), bulk_str);
-        if (!s.IsOK()) {
-          LOG(ERROR) << "Write error while sending batch to slave: " << s.Msg() << ". batch: 0x"
-                     << Util::StringToHex(data);
-          Stop();
-          return;
-        }
+    if (!batch) {
+      if (!flushPendingBatches().IsOK()) {
+        Stop();
+        return;
+      }
+      s = readAcks();
+      if (!s.IsOK()) {
+        LOG(ERROR) << "Failed to read the acks of the slave[" << conn_->GetAddr() << "]: " << s.Msg()
+                   << ", would stop the thread";
+        Stop();
+        return;
       }
-      is_first_repl_batch = false;
-      batch_list.clear();
-    }
-    next_repl_seq_ = batch.sequence + batch.writeBatchPtr->Count();
-    while (!IsStopped() && !srv_->storage_->WALHasNewData(next_repl_seq_)) {
-      usleep(yield_milliseconds);
       checkLivenessIfNeed();
+      continue;
+    }
+    next_repl_seq_ = batch->seq + batch->count;
+    if (pending_batches_.empty()) first_pending_time = std::chrono::steady_clock::now();
+    pending_bytes_ += batch->Size() + 2;
+    pending_batches_.emplace_back(std::move(batch));
+    // Coalesce the batches while the slave was lagging behind, and flush them once
+    // caught up, so the batches were sent without delay under the light load.
+    if (is_first_repl_batch || !srv_->storage_->WALHasNewData(next_repl_seq_)
+        || pending_bytes_ >= kMaxPendingBytes || pending_batches_.size() >= kMaxPendingBatches
+        || std::chrono::steady_clock::now() - first_pending_time >= std::chrono::milliseconds(kMaxPendingMilliseconds)) {
+      if (!flushPendingBatches().IsOK()) {
+        Stop();
+        return;
+      }
+      is_first_repl_batch = false;
+      // the acks were also read after flushing, since the thread might be never idle
+      s = readAcks();
+      if (!s.IsOK()) {
+        LOG(ERROR) << "Failed to read the acks of the slave[" << conn_->GetAddr() << "]: " << s.Msg()
+                   << ", would stop the thread";
+        Stop();
+        return;
+      }
     }
-    iter_->Next();
   }
 }
 
@@ -253,6 +655,18 @@ ReplicationThread::ReplicationThread(std::string host, uint32_t port,
                        CallbacksStateMachine::CallbackType{
                            CallbacksStateMachine::READ, "replconf read", replConfReadCB
                        },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::WRITE, "replconf compression write", replConfCompressionWriteCB
+                       },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::READ, "replconf compression read", replConfCompressionReadCB
+                       },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::WRITE, "replconf capa write", replConfCapaWriteCB
+                       },
+                       CallbacksStateMachine::CallbackType{
+                           CallbacksStateMachine::READ, "replconf capa read", replConfCapaReadCB
+                       },
                        CallbacksStateMachine::CallbackType{
                            CallbacksStateMachine::WRITE, "psync write", tryPSyncWriteCB
                        },
@@ -281,6 +695,9 @@ Status ReplicationThread::Start(std::function<void()> &&pre_fullsync_cb,
   // cleanup the old backups, so we can start replication in a clean state
   storage_->PurgeOldBackups(0, 0);
 
+  applier_ = std::unique_ptr<ReplicaApplier>(new ReplicaApplier(srv_));
+  auto s = applier_->Start();
+  if (!s.IsOK()) return s;
   try {
     t_ = std::thread([this]() {
       Util::ThreadSetName("master-repl");
@@ -299,6 +716,10 @@ void ReplicationThread::Stop() {
   stop_flag_ = true;  // Stopping procedure is asynchronous,
                       // handled by timer
   t_.join();
+  // the received batches were applied before stopping
+  if (applier_) applier_->Stop();
+  // don't keep the old versions for the visible snapshot after becoming the master
+  storage_->ReleaseVisibleSnapshot();
   LOG(INFO) << "[replication] Stopped";
 }
 
@@ -408,6 +829,7 @@ ReplicationThread::CBState ReplicationThread::replConfReadCB(
     bufferevent *bev, void *ctx) {
   char *line;
   size_t line_len;
+  auto self = static_cast<ReplicationThread *>(ctx);
   auto input = bufferevent_get_input(bev);
   line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
   if (!line) return CBState::AGAIN;
@@ -429,9 +851,93 @@ ReplicationThread::CBState ReplicationThread::replConfReadCB(
   }
 }
 
+// The compression was asked in a separate replconf like the capabilities, so the
+// listening port wasn't lost if the master rejected it.
+ReplicationThread::CBState ReplicationThread::replConfCompressionWriteCB(
+    bufferevent *bev, void *ctx) {
+  auto self = static_cast<ReplicationThread *>(ctx);
+  self->repl_compression_ = kReplCompressionNone;
+  if (self->srv_->GetConfig()->slave_replication_compression) self->repl_compression_ = PreferredReplCompression();
+  if (self->repl_compression_ == kReplCompressionNone) return CBState::NEXT;
+  send_string(bev, Redis::MultiBulkString({"replconf", "compression", ReplCompressionName(self->repl_compression_)}));
+  LOG(INFO) << "[replication] replconf compression request was sent, waiting for response";
+  return CBState::NEXT;
+}
+
+ReplicationThread::CBState ReplicationThread::replConfCompressionReadCB(
+    bufferevent *bev, void *ctx) {
+  char *line;
+  size_t line_len;
+  auto self = static_cast<ReplicationThread *>(ctx);
+  // nothing was sent if the compression wasn't enabled
+  if (self->repl_compression_ == kReplCompressionNone) return CBState::NEXT;
+  auto input = bufferevent_get_input(bev);
+  line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
+  if (!line) return CBState::AGAIN;
+
+  if (line[0] == '-' && isRestoringError(line)) {
+    free(line);
+    LOG(WARNING) << "The master was restoring the db, retry later";
+    return CBState::RESTART;
+  }
+  if (strncmp(line, "+OK", 3) != 0) {
+    LOG(WARNING) << "[replication] Failed to replconf compression "
+                 << ReplCompressionName(self->repl_compression_) << ": " << line+1;
+    free(line);
+    // the master doesn't support the codec, ask for the older one or fall back to the raw data
+    self->repl_compression_ = FallbackReplCompression(self->repl_compression_);
+    if (self->repl_compression_ == kReplCompressionNone) return CBState::NEXT;
+    send_string(bev, Redis::MultiBulkString({"replconf", "compression", ReplCompressionName(self->repl_compression_)}));
+    return CBState::AGAIN;
+  }
+  free(line);
+  return CBState::NEXT;
+}
+
+// The capabilities were sent in a separate replconf, the old masters reject the
+// unknown options, and the listening port shouldn't be lost with them.
+ReplicationThread::CBState ReplicationThread::replConfCapaWriteCB(
+    bufferevent *bev, void *ctx) {
+  auto self = static_cast<ReplicationThread *>(ctx);
+  // ask the master to read the acks of the applied seq
+  send_string(bev, Redis::MultiBulkString({"replconf", "capa", "ack"}));
+  self->repl_ack_ = true;
+  LOG(INFO) << "[replication] replconf capa request was sent, waiting for response";
+  return CBState::NEXT;
+}
+
+ReplicationThread::CBState ReplicationThread::replConfCapaReadCB(
+    bufferevent *bev, void *ctx) {
+  char *line;
+  size_t line_len;
+  auto self = static_cast<ReplicationThread *>(ctx);
+  auto input = bufferevent_get_input(bev);
+  line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
+  if (!line) return CBState::AGAIN;
+
+  if (line[0] == '-' && isRestoringError(line)) {
+    free(line);
+    LOG(WARNING) << "The master was restoring the db, retry later";
+    return CBState::RESTART;
+  }
+  if (strncmp(line, "+OK", 3) != 0) {
+    // the master doesn't read the acks, the slave wouldn't send them
+    LOG(WARNING) << "[replication] Failed to replconf capa: " << line+1;
+    self->repl_ack_ = false;
+  }
+  free(line);
+  return CBState::NEXT;
+}
+
 ReplicationThread::CBState ReplicationThread::tryPSyncWriteCB(
     bufferevent *bev, void *ctx) {
   auto self = static_cast<ReplicationThread *>(ctx);
+  // The pending batches must be applied before the next seq was decided
+  auto s = self->applier_->Flush();
+  if (!s.IsOK()) {
+    LOG(WARNING) << "[replication] The pending batches failed to apply, would psync from the latest seq, err: "
+                 << s.Msg();
+  }
   auto next_seq = self->storage_->LatestSeq() + 1;
   send_string(bev, Redis::MultiBulkString({"PSYNC", std::to_string(next_seq)}));
   self->repl_state_ = kReplSendPSync;
@@ -463,6 +969,11 @@ ReplicationThread::CBState ReplicationThread::tryPSyncReadCB(bufferevent *bev,
   } else {
     // PSYNC is OK, use IncrementBatchLoop
     free(line);
+    // the master compressed the stream with a new codec for every psync
+    self->incr_codec_.reset();
+    if (self->repl_compression_ != kReplCompressionNone) {
+      self->incr_codec_ = std::unique_ptr<ReplStreamCodec>(new ReplStreamCodec(self->repl_compression_));
+    }
     LOG(INFO) << "[replication] PSync is ok, start increment batch loop";
     return CBState::NEXT;
   }
@@ -483,6 +994,7 @@ ReplicationThread::CBState ReplicationThread::incrementBatchLoopCB(
         line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
         if (!line) return CBState::AGAIN;
         self->incr_bulk_len_ = line_len > 0 ? std::strtoull(line + 1, nullptr, 10) : 0;
+        self->incr_compressed_ = line_len > 0 && line[0] == '!';
         free(line);
         if (self->incr_bulk_len_ == 0) {
           LOG(ERROR) << "[replication] Invalid increment data size";
@@ -494,17 +1006,28 @@ ReplicationThread::CBState ReplicationThread::incrementBatchLoopCB(
         // Read bulk data (batch data)
         if (self->incr_bulk_len_+2 <= evbuffer_get_length(input)) {  // We got enough data
           bulk_data = reinterpret_cast<char *>(evbuffer_pullup(input, self->incr_bulk_len_ + 2));
+          if (self->incr_compressed_) {
+            // The compressed frame was made of the bulk strings, put them back into the input
+            std::string bulks;
+            if (!self->incr_codec_
+                || !self->incr_codec_->Decompress(&self->srv_->stats_, bulk_data, self->incr_bulk_len_, &bulks)) {
+              LOG(ERROR) << "[replication] Failed to decompress the increment data";
+              return CBState::RESTART;
+            }
+            evbuffer_drain(input, self->incr_bulk_len_ + 2);
+            evbuffer_prepend(input, bulks.data(), bulks.size());
+            self->incr_state_ = Incr_batch_size;
+            break;
+          }
           std::string bulk_string = std::string(bulk_data, self->incr_bulk_len_);
           // master would send the ping heartbeat packet to check whether the slave was alive or not,
           // don't write ping to db here.
           if (bulk_string != "ping") {
-            auto s = self->storage_->WriteBatch(std::string(bulk_data, self->incr_bulk_len_));
+            auto s = self->applier_->Push(std::move(bulk_string));
             if (!s.IsOK()) {
-              LOG(ERROR) << "[replication] CRITICAL - Failed to write batch to local, " << s.Msg() << ". batch: 0x"
-                         << Util::StringToHex(bulk_string);
+              LOG(ERROR) << "[replication] Failed to apply the batches, " << s.Msg();
               return CBState::RESTART;
             }
-            self->ParseWriteBatch(bulk_string);
           }
           evbuffer_drain(input, self->incr_bulk_len_ + 2);
           self->incr_state_ = Incr_batch_size;
@@ -518,10 +1041,16 @@ ReplicationThread::CBState ReplicationThread::incrementBatchLoopCB(
 
 ReplicationThread::CBState ReplicationThread::fullSyncWriteCB(
     bufferevent *bev, void *ctx) {
-  send_string(bev, Redis::MultiBulkString({"_fetch_meta"}));
   auto self = static_cast<ReplicationThread *>(ctx);
+  self->fullsync_checkpoint_ = self->srv_->GetConfig()->slave_fullsync_checkpoint && !self->checkpoint_unsupported_;
+  if (self->fullsync_checkpoint_) {
+    send_string(bev, Redis::MultiBulkString({"_fetch_meta", "checkpoint"}));
+  } else {
+    send_string(bev, Redis::MultiBulkString({"_fetch_meta"}));
+  }
   self->repl_state_ = kReplFetchMeta;
-  LOG(INFO) << "[replication] Start syncing data with fullsync";
+  LOG(INFO) << "[replication] Start syncing data with fullsync"
+            << (self->fullsync_checkpoint_ ? " from the checkpoint" : "");
   return CBState::NEXT;
 }
 
@@ -537,19 +1066,33 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
       if (!line) return CBState::AGAIN;
       if (line[0] == '-') {
         LOG(ERROR) << "[replication] Failed to fetch meta id: " << line;
+        if (self->fullsync_checkpoint_ && isUnsupportedError(line)) {
+          LOG(WARNING) << "[replication] The master didn't support the checkpoint, fall back to the backup";
+          self->checkpoint_unsupported_ = true;
+        }
         free(line);
         return CBState::RESTART;
       }
-      self->fullsync_meta_id_ = static_cast<rocksdb::BackupID>(
-          line_len > 0 ? std::strtoul(line, nullptr, 10) : 0);
-      free(line);
-      if (self->fullsync_meta_id_ == 0) {
-        LOG(ERROR) << "[replication] Invalid meta id received";
-        return CBState::RESTART;
+      if (self->fullsync_checkpoint_) {
+        self->fullsync_checkpoint_id_ = line_len > 0 ? std::strtoull(line, nullptr, 10) : 0;
+        free(line);
+        if (self->fullsync_checkpoint_id_ == 0) {
+          LOG(ERROR) << "[replication] Invalid checkpoint id received";
+          return CBState::RESTART;
+        }
+        LOG(INFO) << "[replication] Success to fetch checkpoint id: " << self->fullsync_checkpoint_id_;
+      } else {
+        self->fullsync_meta_id_ = static_cast<rocksdb::BackupID>(
+            line_len > 0 ? std::strtoul(line, nullptr, 10) : 0);
+        free(line);
+        if (self->fullsync_meta_id_ == 0) {
+          LOG(ERROR) << "[replication] Invalid meta id received";
+          return CBState::RESTART;
+        }
+        self->storage_->PurgeBackupIfNeed(self->fullsync_meta_id_);
+        LOG(INFO) << "[replication] Success to fetch meta id: " << self->fullsync_meta_id_;
       }
-      self->storage_->PurgeBackupIfNeed(self->fullsync_meta_id_);
       self->fullsync_state_ = kFetchMetaSize;
-      LOG(INFO) << "[replication] Success to fetch meta id: " << self->fullsync_meta_id_;
     case kFetchMetaSize:
       line = evbuffer_readln(input, &line_len, EVBUFFER_EOL_CRLF_STRICT);
       if (!line) return CBState::AGAIN;
@@ -570,6 +1113,7 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
       if (evbuffer_get_length(input) < self->fullsync_filesize_) {
         return CBState::AGAIN;
       }
+      if (self->fullsync_checkpoint_) return self->fullSyncFromCheckpoint(input);
       auto meta = Engine::Storage::BackupManager::ParseMetaAndSave(
           self->storage_, self->fullsync_meta_id_, input);
       assert(evbuffer_get_length(input) == 0);
@@ -604,70 +1148,37 @@ ReplicationThread::CBState ReplicationThread::fullSyncReadCB(bufferevent *bev,
   return CBState::QUIT;
 }
 
-Status ReplicationThread::parallelFetchFile(const std::vector<std::pair<std::string, uint32_t>> &files) {
-  size_t concurrency = 1;
-  if (files.size() > 20) {
-    // Use 4 threads to download files in parallel
-    concurrency = 4;
+ReplicationThread::CBState ReplicationThread::fullSyncFromCheckpoint(evbuffer *input) {
+  auto meta = Engine::Storage::BackupManager::ParseCheckpointMeta(input);
+  fullsync_state_ = kFetchMetaID;
+  if (meta.files.empty()) {
+    LOG(ERROR) << "[replication] Invalid checkpoint meta received";
+    return CBState::RESTART;
   }
-  std::atomic<uint32_t> fetch_cnt = {0};
-  std::atomic<uint32_t> skip_cnt = {0};
-  std::vector<std::future<Status>> results;
-  for (size_t tid = 0; tid < concurrency; ++tid) {
-    results.push_back(std::async(
-        std::launch::async, [this, &files, tid, concurrency, &fetch_cnt, &skip_cnt]() -> Status {
-          if (this->stop_flag_) {
-            return Status(Status::NotOK, "replication thread was stopped");
-          }
-          int sock_fd;
-          Status s = Util::SockConnect(this->host_, this->port_, &sock_fd);
-          if (!s.IsOK()) {
-            return Status(Status::NotOK, "connect the server err: " + s.Msg());
-          }
-          s = this->sendAuth(sock_fd);
-          if (!s.IsOK()) {
-            close(sock_fd);
-            return Status(Status::NotOK, "sned the auth command err: " + s.Msg());
-          }
-          for (auto f_idx = tid; f_idx < files.size(); f_idx += concurrency) {
-            if (this->stop_flag_) {
-              return Status(Status::NotOK, "replication thread was stopped");
-            }
-            const auto &f_name = files[f_idx].first;
-            const auto &f_crc = files[f_idx].second;
-            // Don't fetch existing files
-            if (Engine::Storage::BackupManager::FileExists(this->storage_, f_name, f_crc)) {
-              skip_cnt.fetch_add(1);
-              uint32_t cur_skip_cnt = skip_cnt.load();
-              uint32_t cur_fetch_cnt = fetch_cnt.load();
-              LOG(INFO) << "[skip] "<< f_name << " " << f_crc
-                        << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
-                        << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
-              continue;
-            }
-            fetch_cnt.fetch_add(1);
-            uint32_t cur_skip_cnt = skip_cnt.load();
-            uint32_t cur_fetch_cnt = fetch_cnt.load();
-            LOG(INFO) << "[fetch] " << f_name << " " << f_crc
-                       << ", skip count: " << cur_skip_cnt << ", fetch count: " << cur_fetch_cnt
-                       << ", progress: " << cur_skip_cnt+cur_fetch_cnt<< "/" << files.size();
-            s = this->fetchFile(sock_fd, f_name, f_crc);
-            if (!s.IsOK()) {
-              close(sock_fd);
-              return Status(Status::NotOK, "fetch file err: " + s.Msg());
-            }
-          }
-          close(sock_fd);
-          return Status::OK();
-        }));
+  LOG(INFO) << "[replication] Succeeded fetching checkpoint meta, seq: " << meta.seq
+            << ", fetching files in parallel";
+  repl_state_ = kReplFetchSST;
+  auto s = Engine::Storage::BackupManager::PrepareCheckpointDir(storage_);
+  if (s.IsOK()) s = parallelFetchCheckpointFile(fullsync_checkpoint_id_, meta.files);
+  if (!s.IsOK()) {
+    LOG(ERROR) << "[replication] Failed to parallel fetch checkpoint files while " + s.Msg();
+    return CBState::RESTART;
   }
+  LOG(INFO) << "[replication] Succeeded fetching files in parallel, restoring the checkpoint";
 
-  // Wait til finish
-  for (auto &f : results) {
-    Status s = f.get();
-    if (!s.IsOK()) return s;
+  // Restore DB from checkpoint
+  pre_fullsync_cb_();
+  s = storage_->RestoreFromCheckpoint();
+  if (!s.IsOK()) {
+    LOG(ERROR) << "[replication] Failed to restore checkpoint while " + s.Msg() + ", restart fullsync";
+    return CBState::RESTART;
   }
-  return Status::OK();
+  LOG(INFO) << "[replication] Succeeded restoring the checkpoint, fullsync was finish";
+  post_fullsync_cb_();
+
+  // Switch to psync state machine again
+  psync_steps_.Start();
+  return CBState::QUIT;
 }
 
 Status ReplicationThread::sendAuth(int sock_fd) {
@@ -700,71 +1211,417 @@ Status ReplicationThread::sendAuth(int sock_fd) {
 }
 
 
-Status ReplicationThread::fetchFile(int sock_fd, std::string path,
-                                    uint32_t crc) {
-  size_t line_len, file_size;
+namespace {
+
+// The number of the _fetch_file requests in flight on every connection, the
+// master sends the next file while the slave was writing the previous one.
+const size_t kFetchPipelineDepth = 4;
+const size_t kFetchMinConcurrency = 2;
+const size_t kFetchMaxConcurrency = 16;
+// Add a connection only if the last one increased the throughput at least 10%
+const double kFetchConcurrencyGain = 1.1;
+const size_t kFetchBufferSize = 256 * 1024;
+// The connection would be resumed from the received offset after disconnecting
+const int kFetchMaxRetries = 3;
 
-  const auto fetch_command = Redis::MultiBulkString({"_fetch_file", path});
-  auto s = Util::SockSend(sock_fd, fetch_command);
-  if (!s.IsOK()) return Status(Status::NotOK, "send fetch command: "+s.Msg());
+}  // namespace
+
+struct ReplicationThread::FetchContext {
+  std::vector<FetchFileTask> tasks;
+  uint64_t checkpoint_id = 0;
+  std::mutex mu;
+  size_t next_task = 0;
+  std::atomic<bool> failed = {false};
+  Status error;
+  ReplCompression compression = kReplCompressionNone;
+};
+
+// The file which was being fetched on the connection, the tmp file and the
+// crc were kept across the reconnection, so it can be resumed from the offset.
+struct ReplicationThread::InFlightFile {
+  size_t idx = 0;
+  std::unique_ptr<rocksdb::WritableFile> file;
+  uint64_t received = 0;
+  uint32_t crc = 0;
+  uint64_t expected_size = 0;
+  bool size_known = false;
+  bool size_counted = false;
+  uint64_t remaining = 0;
+  // the compressed file was sent by chunks, and the rest should be requested
+  bool partial = false;
+};
+
+void ReplicationThread::FetchProgress::Reset(uint64_t files, uint64_t bytes) {
+  total_files = files;
+  fetched_files = 0;
+  skipped_files = 0;
+  total_bytes = bytes;
+  fetched_bytes = 0;
+  connections = 0;
+  start_time = time(nullptr);
+}
+
+Status ReplicationThread::parallelFetchFile(const std::vector<std::pair<std::string, uint32_t>> &files) {
+  FetchContext ctx;
+  ctx.compression = repl_compression_;
+  for (const auto &file : files) ctx.tasks.emplace_back(FetchFileTask{file.first, file.second, 0});
+  return parallelFetch(&ctx);
+}
+
+Status ReplicationThread::parallelFetchCheckpointFile(uint64_t checkpoint_id,
+                                                      const std::vector<std::pair<std::string, uint64_t>> &files) {
+  FetchContext ctx;
+  ctx.checkpoint_id = checkpoint_id;
+  ctx.compression = repl_compression_;
+  for (const auto &file : files) ctx.tasks.emplace_back(FetchFileTask{file.first, 0, file.second});
+  return parallelFetch(&ctx);
+}
+
+// The connections were added one by one while the measured throughput kept
+// growing, so a fast link uses more connections and a slow one won't be
+// flooded with the requests.
+Status ReplicationThread::parallelFetch(FetchContext *ctx) {
+  uint64_t total_bytes = 0;
+  for (const auto &task : ctx->tasks) total_bytes += task.size;
+  fetch_progress_.Reset(ctx->tasks.size(), total_bytes);
+  if (ctx->tasks.empty()) return Status::OK();
+
+  std::vector<std::future<Status>> results;
+  auto add_connection = [this, ctx, &results]() {
+    results.push_back(std::async(std::launch::async, [this, ctx]() -> Status {
+      auto s = this->fetchFilesOnConnection(ctx);
+      if (!s.IsOK()) {
+        std::lock_guard<std::mutex> guard(ctx->mu);
+        // keep the first error, the others were failed by it
+        if (!ctx->failed) ctx->error = s;
+        ctx->failed = true;
+      }
+      return s;
+    }));
+    fetch_progress_.connections++;
+  };
+  size_t max_concurrency = std::min(kFetchMaxConcurrency, ctx->tasks.size());
+  for (size_t i = 0; i < std::min(kFetchMinConcurrency, max_concurrency); i++) add_connection();
+
+  bool growing = true;
+  double best_throughput = 0;
+  uint64_t last_fetched_bytes = 0;
+  auto last_time = std::chrono::steady_clock::now();
+  while (true) {
+    bool finished = true;
+    for (auto &f : results) {
+      if (f.wait_for(std::chrono::milliseconds(0)) != std::future_status::ready) finished = false;
+    }
+    if (finished || ctx->failed) break;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_time).count();
+    if (!growing || elapsed < 1000) continue;
+    uint64_t fetched_bytes = fetch_progress_.fetched_bytes;
+    double throughput = static_cast<double>(fetched_bytes - last_fetched_bytes) * 1000 / elapsed;
+    last_fetched_bytes = fetched_bytes;
+    last_time = now;
+    bool has_pending_tasks;
+    {
+      std::lock_guard<std::mutex> guard(ctx->mu);
+      has_pending_tasks = ctx->next_task < ctx->tasks.size();
+    }
+    if (results.size() >= max_concurrency || !has_pending_tasks) {
+      growing = false;
+    } else if (throughput > best_throughput * kFetchConcurrencyGain) {
+      best_throughput = throughput;
+      add_connection();
+    } else {
+      growing = false;
+      LOG(INFO) << "[replication] The fetch throughput was saturated with " << results.size() << " connections";
+    }
+  }
 
+  // Wait til finish
+  for (auto &f : results) f.get();
+  if (ctx->failed) return ctx->error;
+  return Status::OK();
+}
+
+// Fetch the files on one connection with the pipelined requests until all the
+// files were claimed, the connection was reconnected and the in flight files
+// were resumed from the received bytes if the connection was broken.
+Status ReplicationThread::fetchFilesOnConnection(FetchContext *ctx) {
+  std::deque<InFlightFile> window;
+  std::unique_ptr<char[]> buffer(new char[kFetchBufferSize]);
   evbuffer *evbuf = evbuffer_new();
-  // Read file size line
+  int sock_fd = -1;
+  int retries = 0;
+  Status s;
+  while (true) {
+    if (this->stop_flag_) {
+      s = Status(Status::NotOK, "replication thread was stopped");
+      break;
+    }
+    if (ctx->failed) {
+      s = Status(Status::NotOK, "other connection failed");
+      break;
+    }
+    if (sock_fd < 0) {
+      if (retries > kFetchMaxRetries) break;
+      if (retries > 0) std::this_thread::sleep_for(std::chrono::seconds(1));
+      s = Util::SockConnect(this->host_, this->port_, &sock_fd);
+      if (!s.IsOK()) {
+        s = Status(Status::NotOK, "connect the server err: " + s.Msg());
+        retries++;
+        continue;
+      }
+      s = this->sendAuth(sock_fd);
+      if (!s.IsOK()) {
+        close(sock_fd);
+        sock_fd = -1;
+        s = Status(Status::NotOK, "send the auth command err: " + s.Msg());
+        retries++;
+        continue;
+      }
+      evbuffer_drain(evbuf, evbuffer_get_length(evbuf));
+      // resend the requests of the in flight files
+      std::string requests;
+      for (auto &f : window) {
+        f.size_known = false;
+        requests.append(fetchFileRequest(ctx, f.idx, f.received));
+      }
+      if (!requests.empty()) {
+        s = Util::SockSend(sock_fd, requests);
+        if (!s.IsOK()) {
+          close(sock_fd);
+          sock_fd = -1;
+          retries++;
+          continue;
+        }
+      }
+    }
+
+    // Claim the files to fill the pipeline
+    std::string requests;
+    while (window.size() < kFetchPipelineDepth) {
+      size_t idx;
+      if (!claimFetchFile(ctx, &idx)) break;
+      const auto &task = ctx->tasks[idx];
+      InFlightFile f;
+      f.idx = idx;
+      f.expected_size = task.size;
+      f.file = ctx->checkpoint_id > 0 ? Engine::Storage::BackupManager::NewCheckpointTmpFile(storage_, task.path)
+                                      : Engine::Storage::BackupManager::NewTmpFile(storage_, task.path);
+      if (!f.file) {
+        s = Status(Status::NotOK, "unable to create tmp file");
+        break;
+      }
+      requests.append(fetchFileRequest(ctx, idx, 0));
+      window.emplace_back(std::move(f));
+    }
+    if (!s.IsOK()) break;
+    if (!requests.empty()) {
+      s = Util::SockSend(sock_fd, requests);
+      if (!s.IsOK()) {
+        close(sock_fd);
+        sock_fd = -1;
+        retries++;
+        continue;
+      }
+    }
+    if (window.empty()) break;  // all files were fetched
+
+    bool retryable = false;
+    s = receiveFile(sock_fd, evbuf, buffer.get(), &window.front(), &retryable);
+    if (!s.IsOK()) {
+      if (!retryable) break;
+      LOG(WARNING) << "[replication] Failed to fetch " << ctx->tasks[window.front().idx].path << ": " << s.Msg()
+                   << ", resume from " << window.front().received << " bytes";
+      close(sock_fd);
+      sock_fd = -1;
+      retries++;
+      continue;
+    }
+    retries = 0;
+    if (window.front().partial) {
+      // request the rest of the compressed file after the requests in flight
+      InFlightFile f = std::move(window.front());
+      window.pop_front();
+      f.partial = false;
+      std::string request = fetchFileRequest(ctx, f.idx, f.received);
+      window.emplace_back(std::move(f));
+      s = Util::SockSend(sock_fd, request);
+      if (!s.IsOK()) {
+        close(sock_fd);
+        sock_fd = -1;
+        retries++;
+      }
+      continue;
+    }
+    s = finishFetchFile(ctx, &window.front());
+    if (!s.IsOK()) break;
+    window.pop_front();
+  }
+  if (sock_fd >= 0) close(sock_fd);
+  evbuffer_free(evbuf);
+  if (!s.IsOK()) return Status(Status::NotOK, "fetch file err: " + s.Msg());
+  return Status::OK();
+}
+
+// _fetch_file <path> [<checkpoint id> <offset> [<codec>]], the checkpoint id was 0
+// for the backup files and the short form was kept for the masters without resuming.
+std::string ReplicationThread::fetchFileRequest(FetchContext *ctx, size_t idx, uint64_t offset) {
+  const auto &path = ctx->tasks[idx].path;
+  if (ctx->compression != kReplCompressionNone) {
+    return Redis::MultiBulkString({"_fetch_file", path, std::to_string(ctx->checkpoint_id),
+                                   std::to_string(offset), ReplCompressionName(ctx->compression)});
+  }
+  if (ctx->checkpoint_id == 0 && offset == 0) return Redis::MultiBulkString({"_fetch_file", path});
+  return Redis::MultiBulkString({"_fetch_file", path, std::to_string(ctx->checkpoint_id), std::to_string(offset)});
+}
+
+bool ReplicationThread::claimFetchFile(FetchContext *ctx, size_t *idx) {
   while (true) {
-    if (evbuffer_read(evbuf, sock_fd, -1) <= 0) {
-      evbuffer_free(evbuf);
-      return Status(Status::NotOK, std::string("read size: ")+strerror(errno));
+    {
+      std::lock_guard<std::mutex> guard(ctx->mu);
+      if (ctx->next_task >= ctx->tasks.size()) return false;
+      *idx = ctx->next_task++;
+    }
+    const auto &task = ctx->tasks[*idx];
+    // Don't fetch existing backup files
+    if (ctx->checkpoint_id == 0 && Engine::Storage::BackupManager::FileExists(storage_, task.path, task.crc)) {
+      uint64_t skipped = ++fetch_progress_.skipped_files;
+      LOG(INFO) << "[skip] " << task.path << " " << task.crc << ", progress: "
+                << skipped + fetch_progress_.fetched_files << "/" << ctx->tasks.size();
+      continue;
+    }
+    return true;
+  }
+}
+
+// Receive the file size line and the content of the file, the content was read
+// into the large buffer directly from the socket once the evbuffer was drained,
+// and never read beyond the file, so the pipelined responses were kept.
+Status ReplicationThread::receiveFile(int sock_fd, evbuffer *evbuf, char *buffer, InFlightFile *f, bool *retryable) {
+  size_t line_len;
+  *retryable = true;
+  if (!f->size_known) {
+    char *line;
+    while ((line = evbuffer_readln(evbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT)) == nullptr) {
+      if (evbuffer_read(evbuf, sock_fd, -1) <= 0) {
+        return Status(Status::NotOK, std::string("read size: ") + strerror(errno));
+      }
     }
-    char *line = evbuffer_readln(evbuf, &line_len, EVBUFFER_EOL_CRLF_STRICT);
-    if (!line) continue;
     if (*line == '-') {
       std::string msg(line);
       free(line);
-      evbuffer_free(evbuf);
+      *retryable = false;
       return Status(Status::NotOK, msg);
     }
-    file_size = line_len > 0 ? std::strtoull(line, nullptr, 10) : 0;
+    // The compressed chunk: !<remaining bytes of the file> <chunk length> <compressed length>
+    bool compressed = *line == '!';
+    char *end = line + (compressed ? 1 : 0);
+    f->remaining = line_len > 0 ? std::strtoull(end, &end, 10) : 0;
+    uint64_t chunk_len = compressed ? std::strtoull(end, &end, 10) : 0;
+    uint64_t compressed_len = compressed ? std::strtoull(end, &end, 10) : 0;
     free(line);
-    break;
+    // the size of the backup files wasn't known until the first response
+    if (!f->size_counted) {
+      if (f->received == 0 && f->expected_size == 0) fetch_progress_.total_bytes += f->remaining;
+      f->size_counted = true;
+    }
+    if (compressed) return receiveCompressedChunk(sock_fd, evbuf, chunk_len, compressed_len, f, retryable);
+    f->size_known = true;
   }
 
-  // Write to tmp file
-  auto tmp_file = Engine::Storage::BackupManager::NewTmpFile(storage_, path);
-  if (!tmp_file) {
-    evbuffer_free(evbuf);
-    return Status(Status::NotOK, "unable to create tmp file");
+  while (f->remaining > 0) {
+    size_t want = std::min<uint64_t>(f->remaining, kFetchBufferSize);
+    ssize_t data_len;
+    if (evbuffer_get_length(evbuf) > 0) {
+      data_len = evbuffer_remove(evbuf, buffer, want);
+    } else {
+      data_len = read(sock_fd, buffer, want);
+      if (data_len < 0 && errno == EINTR) continue;
+      if (data_len == 0) return Status(Status::NotOK, "read sst file: connection closed");
+    }
+    if (data_len < 0) return Status(Status::NotOK, std::string("read sst file: ") + strerror(errno));
+    auto s = f->file->Append(rocksdb::Slice(buffer, data_len));
+    if (!s.ok()) {
+      *retryable = false;
+      return Status(Status::NotOK, "write tmp file: " + s.ToString());
+    }
+    f->crc = rocksdb::crc32c::Extend(f->crc, buffer, data_len);
+    f->received += data_len;
+    f->remaining -= data_len;
+    fetch_progress_.fetched_bytes += data_len;
   }
+  return Status::OK();
+}
 
-  size_t seen_bytes = 0;
-  uint32_t tmp_crc = 0;
-  char data[1024];
-  while (seen_bytes < file_size) {
+// The chunk was appended to the file only after it was received completely, so
+// it can be requested again from the received offset after reconnecting.
+Status ReplicationThread::receiveCompressedChunk(int sock_fd, evbuffer *evbuf, uint64_t chunk_len,
+                                                 uint64_t compressed_len, InFlightFile *f, bool *retryable) {
+  if (chunk_len > f->remaining) {
+    *retryable = false;
+    return Status(Status::NotOK, "invalid compressed chunk length");
+  }
+  std::string compressed(compressed_len, 0);
+  size_t received = 0;
+  while (received < compressed_len) {
+    ssize_t data_len;
     if (evbuffer_get_length(evbuf) > 0) {
-      auto data_len = evbuffer_remove(evbuf, data, 1024);
-      if (data_len == 0) continue;
-      if (data_len < 0) {
-        evbuffer_free(evbuf);
-        return Status(Status::NotOK, "read sst file data error");
-      }
-      tmp_file->Append(rocksdb::Slice(data, data_len));
-      tmp_crc = rocksdb::crc32c::Extend(tmp_crc, data, data_len);
-      seen_bytes += data_len;
+      data_len = evbuffer_remove(evbuf, &compressed[received], compressed_len - received);
     } else {
-      if (evbuffer_read(evbuf, sock_fd, -1) <= 0) {
-        evbuffer_free(evbuf);
-        return Status(Status::NotOK, std::string("read sst file: ")+strerror(errno));
-      }
+      data_len = read(sock_fd, &compressed[received], compressed_len - received);
+      if (data_len < 0 && errno == EINTR) continue;
+      if (data_len == 0) return Status(Status::NotOK, "read sst file: connection closed");
     }
+    if (data_len < 0) return Status(Status::NotOK, std::string("read sst file: ") + strerror(errno));
+    received += data_len;
   }
-  if (crc != tmp_crc) {
-    evbuffer_free(evbuf);
-    char err_buf[64];
-    snprintf(err_buf, sizeof(err_buf), "CRC mismatched, %u was expected but got %u", crc, tmp_crc);
-    return Status(Status::NotOK, err_buf);
+  std::string chunk;
+  if (!DecompressReplData(&srv_->stats_, repl_compression_, compressed.data(), compressed.size(), &chunk)
+      || chunk.size() != chunk_len) {
+    *retryable = false;
+    return Status(Status::NotOK, "failed to decompress the file chunk");
   }
-  evbuffer_free(evbuf);
-  // File is OK, rename to formal name
-  return Engine::Storage::BackupManager::SwapTmpFile(storage_, path);
+  auto s = f->file->Append(chunk);
+  if (!s.ok()) {
+    *retryable = false;
+    return Status(Status::NotOK, "write tmp file: " + s.ToString());
+  }
+  f->crc = rocksdb::crc32c::Extend(f->crc, chunk.data(), chunk.size());
+  f->received += chunk_len;
+  f->partial = chunk_len < f->remaining;
+  f->remaining = 0;
+  fetch_progress_.fetched_bytes += chunk_len;
+  return Status::OK();
+}
+
+Status ReplicationThread::finishFetchFile(FetchContext *ctx, InFlightFile *f) {
+  const auto &task = ctx->tasks[f->idx];
+  auto r_status = f->file->Close();
+  if (!r_status.ok()) return Status(Status::NotOK, r_status.ToString());
+  Status s;
+  if (ctx->checkpoint_id > 0) {
+    if (f->received != task.size) {
+      return Status(Status::NotOK, "size mismatched, " + std::to_string(task.size) + " was expected but got "
+                                   + std::to_string(f->received));
+    }
+    s = Engine::Storage::BackupManager::SwapCheckpointTmpFile(storage_, task.path);
+  } else {
+    if (f->crc != task.crc) {
+      char err_buf[64];
+      snprintf(err_buf, sizeof(err_buf), "CRC mismatched, %u was expected but got %u", task.crc, f->crc);
+      return Status(Status::NotOK, err_buf);
+    }
+    // File is OK, rename to formal name
+    s = Engine::Storage::BackupManager::SwapTmpFile(storage_, task.path);
+  }
+  if (!s.IsOK()) return s;
+  uint64_t fetched = ++fetch_progress_.fetched_files;
+  LOG(INFO) << "[fetch] " << task.path << " " << f->received << " bytes, skip count: "
+            << fetch_progress_.skipped_files << ", fetch count: " << fetched << ", progress: "
+            << fetched + fetch_progress_.skipped_files << "/" << ctx->tasks.size();
+  return Status::OK();
 }
 
 // Check if stop_flag_ is set, when do, tear down replication
@@ -776,28 +1633,41 @@ void ReplicationThread::EventTimerCB(int, int16_t, void *ctx) {
     event_base_loopbreak(self->base_);
     self->psync_steps_.Stop();
     self->fullsync_steps_.Stop();
+    return;
   }
+  self->sendAckIfNeed();
 }
 
-rocksdb::Status ReplicationThread::ParseWriteBatch(const std::string &batch_string) {
-  rocksdb::WriteBatch write_batch(batch_string);
-  WriteBatchHandler write_batch_handler;
-  rocksdb::Status status;
-
-  status = write_batch.Iterate(&write_batch_handler);
-  if (!status.ok()) return status;
-  if (write_batch_handler.IsPublish()) {
-    srv_->PublishMessage(write_batch_handler.GetPublishChannel().ToString(),
-                         write_batch_handler.GetPublishValue().ToString());
-  }
+// Acknowledge the applied seq to the master, so the master knows how far
+// the slave was really behind, and the WAIT command could be unblocked.
+void ReplicationThread::sendAckIfNeed() {
+  if (!repl_ack_ || repl_state_ != kReplConnected) return;
+  auto bev = psync_steps_.GetBufferEvent();
+  if (!bev) return;
+  auto seq = storage_->LatestSeq();
+  auto now = std::chrono::steady_clock::now();
+  if (seq == last_ack_seq_ && now - last_ack_time_ < std::chrono::seconds(kAckIntervalSecs)) return;
+  send_string(bev, Redis::MultiBulkString({"REPLCONF", "ACK", std::to_string(seq)}));
+  last_ack_seq_ = seq;
+  last_ack_time_ = now;
+}
 
-  return rocksdb::Status::OK();
+void ReplicationThread::GetApplyStats(ReplicaApplyStats *stats) {
+  if (applier_) applier_->GetStats(stats);
 }
 
 bool ReplicationThread::isRestoringError(const char *err) {
   return std::string(err) == "-ERR restoring the db from backup";
 }
 
+// The master which didn't know the request replied the unknown command, the
+// wrong number of arguments (the old _fetch_meta took no argument) or the syntax error.
+bool ReplicationThread::isUnsupportedError(const char *err) {
+  return strncmp(err, "-ERR unknown command", 20) == 0
+         || strncmp(err, "-ERR wrong number of arguments", 30) == 0
+         || strstr(err, "syntax error") != nullptr;
+}
+
 rocksdb::Status WriteBatchHandler::PutCF(uint32_t column_family_id, const rocksdb::Slice &key,
                                          const rocksdb::Slice &value) {
   if (column_family_id != kColumnFamilyIDPubSub) {
@@ -808,3 +1678,154 @@ rocksdb::Status WriteBatchHandler::PutCF(uint32_t column_family_id, const rocksd
   is_publish_ = true;
   return rocksdb::Status::OK();
 }
+
+Status ReplicaApplier::Start() {
+  window_start_ = std::chrono::steady_clock::now();
+  try {
+    t_ = std::thread([this]() {
+      Util::ThreadSetName("replica-apply");
+      this->loop();
+    });
+  } catch (const std::system_error &e) {
+    return Status(Status::NotOK, e.what());
+  }
+  return Status::OK();
+}
+
+void ReplicaApplier::Stop() {
+  {
+    std::lock_guard<std::mutex> guard(mu_);
+    stop_ = true;
+    cond_.notify_all();
+  }
+  if (t_.joinable()) t_.join();
+}
+
+Status ReplicaApplier::Push(std::string &&batch) {
+  if (batch.size() < kWriteBatchHeaderSize) {
+    return Status(Status::NotOK, "malformed write batch, size: " + std::to_string(batch.size()));
+  }
+  auto seq = decodeBatchSequence(batch);
+  auto count = decodeBatchCount(batch);
+
+  std::unique_lock<std::mutex> lock(mu_);
+  cond_.wait(lock, [this] {
+    return stop_ || !error_.IsOK() || queue_bytes_ < kMaxApplyPendingBytes;
+  });
+  if (!error_.IsOK()) return error_;
+  if (stop_) return Status(Status::NotOK, "the replica applier was stopped");
+  if (count > 0) stats_.received_seq = seq + count - 1;
+  queue_bytes_ += batch.size();
+  queue_.emplace_back(PendingBatch{std::move(batch), std::chrono::steady_clock::now()});
+  cond_.notify_all();
+  return Status::OK();
+}
+
+Status ReplicaApplier::Flush() {
+  std::unique_lock<std::mutex> lock(mu_);
+  cond_.wait(lock, [this] {
+    return !error_.IsOK() || (queue_.empty() && applying_batches_ == 0);
+  });
+  auto s = error_;
+  error_ = Status::OK();
+  return s;
+}
+
+void ReplicaApplier::loop() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    // all the pending batches were applied while stopping
+    if (queue_.empty()) break;
+
+    std::vector<PendingBatch> batches;
+    size_t bytes = 0;
+    while (!queue_.empty() && (batches.empty() || bytes + queue_.front().data.size() <= kMaxApplyGroupBytes)) {
+      bytes += queue_.front().data.size();
+      batches.emplace_back(std::move(queue_.front()));
+      queue_.pop_front();
+    }
+    queue_bytes_ -= bytes;
+    applying_batches_ = batches.size();
+    applying_time_ = batches.front().received_time;
+    cond_.notify_all();
+
+    lock.unlock();
+    auto s = apply(&batches);
+    lock.lock();
+
+    applying_batches_ = 0;
+    if (!s.IsOK()) {
+      // The later batches were useless, they would be sent again after
+      // the replication thread psync from the latest seq.
+      error_ = s;
+      queue_.clear();
+      queue_bytes_ = 0;
+    } else {
+      stats_.batches += batches.size();
+      stats_.groups++;
+      stats_.bytes += bytes;
+      window_batches_ += batches.size();
+      auto now = std::chrono::steady_clock::now();
+      auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start_).count();
+      if (elapsed >= 1000) {
+        stats_.batches_per_sec = window_batches_ * 1000 / elapsed;
+        window_batches_ = 0;
+        window_start_ = now;
+      }
+    }
+    cond_.notify_all();
+  }
+}
+
+Status ReplicaApplier::apply(std::vector<PendingBatch> *batches) {
+  // Every batch was written as is and in order, the WAL consumers (the chained
+  // slaves, the kvrocks2redis and the WAL archiver) rely on the same batch
+  // boundaries as the master, e.g. a PUBLISH was one batch, and the sequences
+  // were the same as the master only if the batches were written in order.
+  // The group only saves the locking and the refreshing of the visible seq.
+  rocksdb::SequenceNumber last_seq = 0;
+  Status s;
+  for (auto &batch : *batches) {
+    auto seq = decodeBatchSequence(batch.data);
+    auto count = decodeBatchCount(batch.data);
+    rocksdb::WriteBatch write_batch(std::move(batch.data));
+    s = srv_->storage_->WriteBatch(&write_batch);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[replication] CRITICAL - Failed to write batch to local, "
+                 << s.Msg() << ". batch: 0x" << Util::StringToHex(write_batch.Data());
+      break;
+    }
+    if (count > 0) last_seq = seq + count - 1;
+    publishIfNeed(&write_batch);
+  }
+  // the reads would see the batches after the visible snapshot was refreshed
+  if (last_seq > 0) srv_->storage_->SetVisibleSeq(last_seq);
+  return s;
+}
+
+void ReplicaApplier::publishIfNeed(rocksdb::WriteBatch *batch) {
+  WriteBatchHandler write_batch_handler;
+  auto status = batch->Iterate(&write_batch_handler);
+  if (!status.ok()) return;
+  if (write_batch_handler.IsPublish()) {
+    srv_->PublishMessage(write_batch_handler.GetPublishChannel().ToString(),
+                         write_batch_handler.GetPublishValue().ToString());
+  }
+}
+
+void ReplicaApplier::GetStats(ReplicaApplyStats *stats) {
+  std::lock_guard<std::mutex> guard(mu_);
+  *stats = stats_;
+  auto now = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start_).count();
+  // the window wasn't refreshed while no batch was applied
+  if (elapsed >= 2000) stats->batches_per_sec = window_batches_ * 1000 / elapsed;
+  stats->pending_batches = queue_.size() + applying_batches_;
+  stats->pending_bytes = queue_bytes_;
+  stats->lag_ms = 0;
+  if (applying_batches_ > 0 || !queue_.empty()) {
+    auto oldest = applying_batches_ > 0 ? applying_time_ : queue_.front().received_time;
+    stats->lag_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - oldest).count();
+  }
+}
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 #include <vector>
 #include <utility>
@@ -8,10 +12,15 @@
 #include <string>
 #include <deque>
 #include <event2/bufferevent.h>
+#ifdef ZSTD
+#include <zstd.h>
+#endif
 
 #include "status.h"
 #include "storage.h"
 #include "redis_connection.h"
+#include "stats.h"
+#include "wal_tailer.h"
 
 class Server;
 
@@ -28,6 +37,53 @@ enum ReplState {
 };
 
 
+// The replication stream and the fetched files were compressed if the slave
+// asked for it with REPLCONF, and the cost was recorded in the stats. The slave
+// asked for zstd if the server was built with it, and fell back to snappy if the
+// master rejected zstd.
+enum ReplCompression {
+  kReplCompressionNone = 0,
+  kReplCompressionSnappy,
+  kReplCompressionZstd,
+};
+
+// Return kReplCompressionNone if the codec wasn't built into the server
+ReplCompression ParseReplCompression(const std::string &name);
+const char *ReplCompressionName(ReplCompression codec);
+ReplCompression PreferredReplCompression();
+ReplCompression FallbackReplCompression(ReplCompression codec);
+// The fetched file chunks were compressed one by one, so every chunk can be
+// requested again after reconnecting.
+void CompressReplData(Stats *stats, ReplCompression codec, const char *data, size_t len, std::string *output);
+bool DecompressReplData(Stats *stats, ReplCompression codec, const char *data, size_t len, std::string *output);
+
+// ReplStreamCodec compresses or decompresses the frames of the replication stream.
+// The zstd stream kept its window across the frames, so every frame was compressed
+// with the previous frames as the dictionary, which catches the redundancy across
+// the small batches. Both sides must see every frame in the same order, and the
+// codec was created for every connection.
+class ReplStreamCodec {
+ public:
+  explicit ReplStreamCodec(ReplCompression codec);
+  ~ReplStreamCodec();
+  ReplStreamCodec(const ReplStreamCodec &) = delete;
+  ReplStreamCodec &operator=(const ReplStreamCodec &) = delete;
+
+  ReplCompression Codec() const { return codec_; }
+  // The stateful codec must send every compressed frame even if it wasn't smaller
+  bool IsStateful() const { return codec_ == kReplCompressionZstd; }
+  bool Compress(Stats *stats, const char *data, size_t len, std::string *output);
+  bool Decompress(Stats *stats, const char *data, size_t len, std::string *output);
+
+ private:
+  ReplCompression codec_;
+#ifdef ZSTD
+  // the contexts were created by the first frame, one side only uses one of them
+  ZSTD_CCtx *cctx_ = nullptr;
+  ZSTD_DCtx *dctx_ = nullptr;
+#endif
+};
+
 class FeedSlaveThread {
  public:
   explicit FeedSlaveThread(Server *srv, Redis::Connection *conn, rocksdb::SequenceNumber next_repl_seq)
@@ -40,18 +96,53 @@ class FeedSlaveThread {
   bool IsStopped() { return stop_; }
   Redis::Connection *GetConn() { return conn_; }
   rocksdb::SequenceNumber GetCurrentReplSeq() { return next_repl_seq_ == 0 ? 0 : next_repl_seq_-1; }
+  uint64_t GetSentBatches() { return sent_batches_; }
+  uint64_t GetSentBytes() { return sent_bytes_; }
+  uint64_t GetFlushes() { return flushes_; }
+  // The seq which was applied by the slave, it's 0 if the slave never acknowledged
+  rocksdb::SequenceNumber GetAckSeq() { return ack_seq_; }
+  // How long the oldest batch which wasn't acknowledged by the slave was sent
+  uint64_t GetAckLagMs();
 
  private:
-  uint64_t interval = 0;
   bool stop_ = false;
   Server *srv_ = nullptr;
   Redis::Connection *conn_ = nullptr;
   rocksdb::SequenceNumber next_repl_seq_ = 0;
   std::thread t_;
   std::unique_ptr<rocksdb::TransactionLogIterator> iter_ = nullptr;
+  std::vector<std::shared_ptr<const WALBatch>> pending_batches_;
+  size_t pending_bytes_ = 0;
+  std::unique_ptr<ReplStreamCodec> codec_;
+  std::chrono::steady_clock::time_point last_send_time_ = std::chrono::steady_clock::now();
+  std::atomic<uint64_t> sent_batches_ = {0};
+  std::atomic<uint64_t> sent_bytes_ = {0};
+  std::atomic<uint64_t> flushes_ = {0};
+  std::string ack_buffer_;
+  std::atomic<rocksdb::SequenceNumber> ack_seq_ = {0};
+  // the steady clock time in ms of the oldest unacknowledged send, 0 if there was none
+  std::atomic<int64_t> oldest_unacked_ms_ = {0};
+  std::deque<std::pair<rocksdb::SequenceNumber, int64_t>> unacked_sends_;
 
   void loop();
   void checkLivenessIfNeed();
+  Status readAcks();
+  void ackSeq(rocksdb::SequenceNumber seq);
+  Status flushPendingBatches();
+  Status nextBatch(std::shared_ptr<const WALBatch> *batch);
+};
+
+class ReplicaApplier;
+
+struct ReplicaApplyStats {
+  uint64_t batches = 0;
+  uint64_t groups = 0;  // the consecutive batches were applied in groups
+  uint64_t bytes = 0;
+  uint64_t batches_per_sec = 0;
+  uint64_t pending_batches = 0;
+  uint64_t pending_bytes = 0;
+  rocksdb::SequenceNumber received_seq = 0;
+  uint64_t lag_ms = 0;  // how long the oldest pending batch was waiting
 };
 
 class ReplicationThread {
@@ -64,6 +155,20 @@ class ReplicationThread {
   ReplState State() { return repl_state_; }
   time_t LastIOTime() { return last_io_time_; }
 
+  // The progress of fetching the files in the full sync
+  struct FetchProgress {
+    std::atomic<uint64_t> total_files = {0};
+    std::atomic<uint64_t> fetched_files = {0};
+    std::atomic<uint64_t> skipped_files = {0};
+    std::atomic<uint64_t> total_bytes = {0};
+    std::atomic<uint64_t> fetched_bytes = {0};
+    std::atomic<uint64_t> connections = {0};
+    std::atomic<time_t> start_time = {0};
+    void Reset(uint64_t files, uint64_t bytes);
+  };
+  const FetchProgress &GetFetchProgress() { return fetch_progress_; }
+  void GetApplyStats(ReplicaApplyStats *stats);
+
  protected:
   event_base *base_ = nullptr;
 
@@ -86,6 +191,7 @@ class ReplicationThread {
 
     void Start();
     void Stop();
+    bufferevent *GetBufferEvent() { return bev_; }
     static void EvCallback(bufferevent *bev, void *ctx);
     static void ConnEventCB(bufferevent *bev, int16_t events,
                             void *state_machine_ptr);
@@ -114,6 +220,7 @@ class ReplicationThread {
  private:
   std::thread t_;
   bool stop_flag_ = false;
+  FetchProgress fetch_progress_;
   std::string host_;
   uint32_t port_;
   std::string auth_;
@@ -121,6 +228,7 @@ class ReplicationThread {
   Engine::Storage *storage_ = nullptr;
   ReplState repl_state_;
   time_t last_io_time_ = 0;
+  std::unique_ptr<ReplicaApplier> applier_;
 
   std::function<void()> pre_fullsync_cb_;
   std::function<void()> post_fullsync_cb_;
@@ -133,6 +241,17 @@ class ReplicationThread {
   } fullsync_state_ = kFetchMetaID;
   rocksdb::BackupID fullsync_meta_id_ = 0;
   size_t fullsync_filesize_ = 0;
+  // fetch the files from the checkpoint instead of the backup of the master
+  bool fullsync_checkpoint_ = false;
+  // fall back to the backup if the master didn't support the checkpoint
+  bool checkpoint_unsupported_ = false;
+  // the codec which the master accepted to compress the stream and the files
+  ReplCompression repl_compression_ = kReplCompressionNone;
+  // the master accepted the acks of the applied seq
+  bool repl_ack_ = false;
+  rocksdb::SequenceNumber last_ack_seq_ = 0;
+  std::chrono::steady_clock::time_point last_ack_time_;
+  uint64_t fullsync_checkpoint_id_ = 0;
 
   // Internal states managed by IncrementBatchLoop procedure
   enum IncrementBatchLoopState {
@@ -141,6 +260,8 @@ class ReplicationThread {
   } incr_state_ = Incr_batch_size;
 
   size_t incr_bulk_len_ = 0;
+  bool incr_compressed_ = false;
+  std::unique_ptr<ReplStreamCodec> incr_codec_;
 
   using CBState = CallbacksStateMachine::State;
   CallbacksStateMachine psync_steps_;
@@ -154,21 +275,42 @@ class ReplicationThread {
   static CBState checkDBNameReadCB(bufferevent *bev, void *ctx);
   static CBState replConfWriteCB(bufferevent *bev, void *ctx);
   static CBState replConfReadCB(bufferevent *bev, void *ctx);
+  static CBState replConfCompressionWriteCB(bufferevent *bev, void *ctx);
+  static CBState replConfCompressionReadCB(bufferevent *bev, void *ctx);
+  static CBState replConfCapaWriteCB(bufferevent *bev, void *ctx);
+  static CBState replConfCapaReadCB(bufferevent *bev, void *ctx);
   static CBState tryPSyncWriteCB(bufferevent *bev, void *ctx);
   static CBState tryPSyncReadCB(bufferevent *bev, void *ctx);
   static CBState incrementBatchLoopCB(bufferevent *bev, void *ctx);
   static CBState fullSyncWriteCB(bufferevent *bev, void *ctx);
   static CBState fullSyncReadCB(bufferevent *bev, void *ctx);
+  CBState fullSyncFromCheckpoint(evbuffer *input);
 
   // Synchronized-Blocking ops
   Status sendAuth(int sock_fd);
-  Status fetchFile(int sock_fd, std::string path, uint32_t crc);
+  struct FetchFileTask {
+    std::string path;
+    uint32_t crc;   // the crc of the backup file
+    uint64_t size;  // the size of the checkpoint file
+  };
+  struct FetchContext;
+  struct InFlightFile;
+  Status parallelFetch(FetchContext *ctx);
+  Status fetchFilesOnConnection(FetchContext *ctx);
+  std::string fetchFileRequest(FetchContext *ctx, size_t idx, uint64_t offset);
+  bool claimFetchFile(FetchContext *ctx, size_t *idx);
+  Status receiveFile(int sock_fd, evbuffer *evbuf, char *buffer, InFlightFile *f, bool *retryable);
+  Status receiveCompressedChunk(int sock_fd, evbuffer *evbuf, uint64_t chunk_len, uint64_t compressed_len,
+                                InFlightFile *f, bool *retryable);
+  Status finishFetchFile(FetchContext *ctx, InFlightFile *f);
   Status parallelFetchFile(const std::vector<std::pair<std::string, uint32_t>> &files);
+  Status parallelFetchCheckpointFile(uint64_t checkpoint_id,
+                                     const std::vector<std::pair<std::string, uint64_t>> &files);
   static bool isRestoringError(const char *err);
+  static bool isUnsupportedError(const char *err);
 
   static void EventTimerCB(int, int16_t, void *ctx);
-
-  rocksdb::Status ParseWriteBatch(const std::string &batch_string);
+  void sendAckIfNeed();
 };
 
 /*
@@ -186,3 +328,49 @@ class WriteBatchHandler : public rocksdb::WriteBatch::Handler {
   std::pair<std::string, std::string> publish_message_;
   bool is_publish_ = false;
 };
+
+// ReplicaApplier applies the batches received from the master in its own thread,
+// so the replication thread can keep receiving while the batches were written.
+// The consecutive batches were applied in one group, but each of them was still
+// written separately to keep the batch boundaries of the master in the WAL.
+// The batches were not written by concurrent writers, rocksdb assigns the
+// sequences in the order of the writes, so the replica's sequences would
+// diverge from the master once two batches were reordered.
+class ReplicaApplier {
+ public:
+  explicit ReplicaApplier(Server *srv) : srv_(srv) {}
+  ~ReplicaApplier() { Stop(); }
+  Status Start();
+  // The pending batches were applied before the thread exits
+  void Stop();
+  // Push the batch to be applied, it blocks while too many bytes were pending,
+  // and returns the error if any batch failed to apply.
+  Status Push(std::string &&batch);
+  // Wait until the pending batches were applied, and clear the error if any
+  Status Flush();
+  void GetStats(ReplicaApplyStats *stats);
+
+ private:
+  struct PendingBatch {
+    std::string data;
+    std::chrono::steady_clock::time_point received_time;
+  };
+
+  Server *srv_ = nullptr;
+  std::thread t_;
+  std::mutex mu_;
+  std::condition_variable cond_;
+  std::deque<PendingBatch> queue_;
+  size_t queue_bytes_ = 0;
+  size_t applying_batches_ = 0;
+  std::chrono::steady_clock::time_point applying_time_;
+  bool stop_ = false;
+  Status error_;
+  ReplicaApplyStats stats_;
+  uint64_t window_batches_ = 0;
+  std::chrono::steady_clock::time_point window_start_;
+
+  void loop();
+  Status apply(std::vector<PendingBatch> *batches);
+  void publishIfNeed(rocksdb::WriteBatch *batch);
+};
@@ -4,6 +4,10 @@
 #include <sys/statvfs.h>
 #include <sys/utsname.h>
 #include <sys/resource.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <map>
 #include <utility>
 #include <memory>
 #include <glog/logging.h>
@@ -22,13 +26,10 @@ std::atomic<int>Server::unix_time_ = {0};
 
 Server::Server(Engine::Storage *storage, Config *config) :
   storage_(storage), config_(config) {
-  // init commands stats here to prevent concurrent insert, and cause core
+  // assign the command IDs of the stats before any command was executed
   std::vector<std::string> commands;
   Redis::GetCommandList(&commands);
-  for (const auto &cmd : commands) {
-    stats_.commands_stats[cmd].calls = 0;
-    stats_.commands_stats[cmd].latency = 0;
-  }
+  stats_.SetCommands(commands);
 
   for (int i = 0; i < config->workers; i++) {
     auto worker = new Worker(this, config);
@@ -44,12 +45,35 @@ Server::Server(Engine::Storage *storage, Config *config) :
     repl_worker->SetReplicationRateLimit(max_replication_bytes);
     worker_threads_.emplace_back(new WorkerThread(repl_worker));
   }
+  // the rate limit of the repl workers was changed online by CONFIG SET
+  config->SetFieldCallback("max-replication-mb", [](Server* srv, const std::string &k, const std::string& v)->Status {
+    if (!srv) return Status::OK();
+    srv->SetReplicationRateLimit(static_cast<uint64_t>(srv->GetConfig()->max_replication_mb));
+    return Status::OK();
+  });
+  fetch_file_runner_ = std::unique_ptr<TaskRunner>(new TaskRunner(config->repl_workers));
+  compaction_checker_ = std::unique_ptr<CompactionChecker>(new CompactionChecker(storage, config));
+  expire_sweeper_ = std::unique_ptr<ExpireSweeper>(new ExpireSweeper(storage, config));
+  wal_tailer_ = std::unique_ptr<WALTailer>(new WALTailer(storage));
+  wal_archiver_ = std::unique_ptr<WALArchiver>(new WALArchiver(storage, config));
+  if (config->metrics_port > 0) {
+    // the metrics were served by the first worker, the scrape was cheap enough
+    metrics_exporter_ = std::unique_ptr<MetricsExporter>(new MetricsExporter(this));
+    Status s = metrics_exporter_->Listen(worker_threads_[0]->GetWorker()->GetEventBase(),
+                                         config->binds, config->metrics_port);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[server] Failed to serve the metrics, encounter error: " << s.Msg();
+      exit(1);
+    }
+  }
   slow_log_.SetMaxEntries(config->slowlog_max_len);
   perf_log_.SetMaxEntries(config->profiling_sample_record_max_len);
   time(&start_time_);
 }
 
 Server::~Server() {
+  // the http server should be freed before the event base of the worker
+  metrics_exporter_.reset();
   for (const auto &worker_thread : worker_threads_) {
     delete worker_thread;
   }
@@ -68,6 +92,11 @@ Status Server::Start() {
     worker->Start();
   }
   task_runner_.Start();
+  fetch_file_runner_->Start();
+  Status s = wal_tailer_->Start();
+  if (!s.IsOK()) return s;
+  s = wal_archiver_->Start();
+  if (!s.IsOK()) return s;
   // setup server cron thread
   cron_thread_ = std::thread([this]() {
     Util::ThreadSetName("server-cron");
@@ -78,7 +107,6 @@ Status Server::Start() {
     uint64_t counter = 0;
     int32_t last_compact_date = 0;
     Util::ThreadSetName("compaction-checker");
-    CompactionChecker compaction_checker(this->storage_);
     while (!stop_) {
       if (is_loading_ == false && ++counter % 600 == 0  // check every minute
           && config_->compaction_checker_range.Enabled()) {
@@ -90,20 +118,31 @@ Status Server::Start() {
           std::vector<std::string> cf_names = {Engine::kMetadataColumnFamilyName,
                                                Engine::kSubkeyColumnFamilyName,
                                                Engine::kZSetScoreColumnFamilyName};
-          for (const auto &cf_name : cf_names) {
-            compaction_checker.PickCompactionFiles(cf_name);
-          }
+          compaction_checker_->PickCompactionFiles(cf_names);
         }
         // compact once per day
         if (now != 0 && last_compact_date != now/86400) {
           last_compact_date = now/86400;
-          compaction_checker.CompactPubsubAndSlotFiles();
+          compaction_checker_->CompactPubsubAndSlotFiles();
         }
       }
       usleep(100000);
     }
   });
 
+  expire_sweeper_thread_ = std::thread([this]() {
+    Util::ThreadSetName("expire-sweeper");
+    while (!stop_) {
+      // the replicas would receive the deletions from the master
+      int keys_per_sec = config_->active_expire_keys_per_sec;
+      if (is_loading_ == false && !IsSlave() && keys_per_sec > 0) {
+        // sweep every 100ms
+        expire_sweeper_->Sweep(std::max(keys_per_sec / 10, 1));
+      }
+      usleep(100000);
+    }
+  });
+
   if (config_->codis_enabled) {
     slotsmgrt_sender_thread_ = new Redis::SlotsMgrtSenderThread(storage_);
     slotsmgrt_sender_thread_->Start();
@@ -121,8 +160,11 @@ void Server::Stop() {
   for (const auto slave_thread : slave_threads_) slave_thread->Stop();
   slave_threads_mu_.unlock();
   cleanupExitedSlaves();
+  wal_tailer_->Stop();
+  wal_archiver_->Stop();
   rocksdb::CancelAllBackgroundWork(storage_->GetDB());
   task_runner_.Stop();
+  fetch_file_runner_->Stop();
   if (slotsmgrt_sender_thread_ != nullptr) {
     slotsmgrt_sender_thread_->Stop();
   }
@@ -133,11 +175,15 @@ void Server::Join() {
     worker->Join();
   }
   task_runner_.Join();
+  fetch_file_runner_->Join();
+  wal_tailer_->Join();
+  wal_archiver_->Join();
   if (cron_thread_.joinable()) cron_thread_.join();
   if (slotsmgrt_sender_thread_ != nullptr) {
     slotsmgrt_sender_thread_->Join();
   }
   if (compaction_checker_thread_.joinable()) compaction_checker_thread_.join();
+  if (expire_sweeper_thread_.joinable()) expire_sweeper_thread_.join();
 }
 
 Status Server::AddMaster(std::string host, uint32_t port) {
@@ -240,6 +286,16 @@ void Server::cleanupExitedSlaves() {
   slave_threads_mu_.unlock();
 }
 
+int Server::GetAckedSlaveNum(rocksdb::SequenceNumber seq) {
+  int acked = 0;
+  slave_threads_mu_.lock();
+  for (const auto &slave_thread : slave_threads_) {
+    if (!slave_thread->IsStopped() && slave_thread->GetAckSeq() >= seq) acked++;
+  }
+  slave_threads_mu_.unlock();
+  return acked;
+}
+
 void Server::FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens) {
   if (monitor_clients_ <= 0) return;
   for (const auto &worker_thread : worker_threads_) {
@@ -498,12 +554,21 @@ void Server::cron() {
         Status s = AsyncBgsaveDB();
         LOG(INFO) << "[server] Schedule to bgsave the db, result: " << s.Msg();
       }
+      if (wal_archiver_->IsEnabled() && config_->wal_archive_checkpoint_cron.IsEnabled()
+          && config_->wal_archive_checkpoint_cron.IsTimeMatch(&now)) {
+        wal_archiver_->RequestCheckpoint();
+        LOG(INFO) << "[server] Schedule to create the checkpoint of the WAL archive";
+      }
     }
     // check every minutes
     if (is_loading_ == false && counter != 0 && counter % 600 == 0) {
       Status s = AsyncPurgeOldBackups(config_->max_backup_to_keep, config_->max_backup_keep_hours);
       LOG(INFO) << "[server] Schedule to purge old backups, result: " << s.Msg();
     }
+    // check every 10 seconds, purge the sync checkpoint after all slaves released it
+    if (is_loading_ == false && counter != 0 && counter % 100 == 0) {
+      storage_->PurgeSyncCheckpointIfNeed();
+    }
     // check every 30 minutes
     if (is_loading_ == false && config_->auto_resize_block_and_sst && counter != 0 && counter % 18000 == 0) {
       Status s = autoResizeBlockAndSST();
@@ -556,6 +621,13 @@ void Server::GetRocksDBInfo(std::string *info) {
     db->GetIntProperty(cf_handle, "rocksdb.estimate-table-readers-mem", &index_and_filter_cache_usage);
     string_stream << "index_and_filter_cache_usage:[" << cf_handle->GetName() << "]:" << index_and_filter_cache_usage
                   << "\r\n";
+    std::map<std::string, std::string> cf_stats_map;
+    double write_amp = 0;
+    if (db->GetMapProperty(cf_handle, rocksdb::DB::Properties::kCFStats, &cf_stats_map)) {
+      auto iter = cf_stats_map.find("compaction.Sum.WriteAmp");
+      if (iter != cf_stats_map.end()) write_amp = std::strtod(iter->second.c_str(), nullptr);
+    }
+    string_stream << "write_amp[" << cf_handle->GetName() << "]:" << write_amp << "\r\n";
   }
   string_stream << "all_mem_tables:" << memtable_sizes << "\r\n";
   string_stream << "cur_mem_tables:" << cur_memtable_sizes << "\r\n";
@@ -570,6 +642,17 @@ void Server::GetRocksDBInfo(std::string *info) {
   string_stream << "num_background_errors:" << num_backgroud_errors << "\r\n";
   string_stream << "flush_count:" << storage_->GetFlushCount()<< "\r\n";
   string_stream << "compaction_count:" << storage_->GetCompactionCount()<< "\r\n";
+  string_stream << "compaction_filter_metadata_lookups:" << storage_->GetCompactionFilterLookups() << "\r\n";
+  string_stream << "compaction_filter_metadata_seeks:" << storage_->GetCompactionFilterSeeks() << "\r\n";
+  CompactionCheckerStats checker_stats;
+  compaction_checker_->GetStats(&checker_stats);
+  string_stream << "compaction_checker_last_check_time:" << checker_stats.last_check_time << "\r\n";
+  string_stream << "compaction_checker_last_candidate_ranges:" << checker_stats.last_candidate_ranges << "\r\n";
+  string_stream << "compaction_checker_last_picked_ranges:" << checker_stats.last_picked_ranges << "\r\n";
+  string_stream << "compaction_checker_last_picked_bytes:" << checker_stats.last_picked_bytes << "\r\n";
+  string_stream << "compaction_checker_last_reclaimable_bytes:" << checker_stats.last_reclaimable_bytes << "\r\n";
+  string_stream << "compaction_checker_total_compacted_ranges:" << checker_stats.total_compacted_ranges << "\r\n";
+  string_stream << "compaction_checker_total_reclaimable_bytes:" << checker_stats.total_reclaimable_bytes << "\r\n";
   string_stream << "is_bgsaving:" << (db_bgsave_ ? "yes" : "no") << "\r\n";
   string_stream << "is_compacting:" << (db_compacting_ ? "yes" : "no") << "\r\n";
   *info = string_stream.str();
@@ -635,8 +718,31 @@ void Server::GetReplicationInfo(std::string *info) {
     string_stream << "master_link_status:" << (state == kReplConnected? "up":"down") << "\r\n";
     string_stream << "master_sync_unrecoverable_error:" << (state == kReplError ? "yes" : "no") << "\r\n";
     string_stream << "master_sync_in_progress:" << (state == kReplFetchMeta || state == kReplFetchSST) << "\r\n";
+    if (state == kReplFetchSST) {
+      const auto &progress = replication_thread_->GetFetchProgress();
+      uint64_t fetched_bytes = progress.fetched_bytes;
+      time_t elapsed = std::max<time_t>(now - progress.start_time, 1);
+      string_stream << "master_sync_total_files:" << progress.total_files << "\r\n";
+      string_stream << "master_sync_fetched_files:" << progress.fetched_files << "\r\n";
+      string_stream << "master_sync_skipped_files:" << progress.skipped_files << "\r\n";
+      string_stream << "master_sync_total_bytes:" << progress.total_bytes << "\r\n";
+      string_stream << "master_sync_read_bytes:" << fetched_bytes << "\r\n";
+      string_stream << "master_sync_throughput_kbps:" << fetched_bytes / 1024 / elapsed << "\r\n";
+      string_stream << "master_sync_connections:" << progress.connections << "\r\n";
+    }
     string_stream << "master_last_io_seconds_ago:" << now-replication_thread_->LastIOTime() << "\r\n";
     string_stream << "slave_repl_offset:" << storage_->LatestSeq() << "\r\n";
+    ReplicaApplyStats apply_stats;
+    replication_thread_->GetApplyStats(&apply_stats);
+    auto applied_seq = storage_->LatestSeq();
+    auto lag_seqs = apply_stats.received_seq > applied_seq ? apply_stats.received_seq - applied_seq : 0;
+    string_stream << "slave_apply_batches:" << apply_stats.batches << "\r\n";
+    string_stream << "slave_apply_groups:" << apply_stats.groups << "\r\n";
+    string_stream << "slave_apply_batches_per_sec:" << apply_stats.batches_per_sec << "\r\n";
+    string_stream << "slave_apply_pending_batches:" << apply_stats.pending_batches << "\r\n";
+    string_stream << "slave_apply_lag_seqs:" << lag_seqs << "\r\n";
+    string_stream << "slave_apply_lag_seconds:" << apply_stats.lag_ms / 1000.0 << "\r\n";
+    string_stream << "slave_visible_seq:" << storage_->GetVisibleSeq() << "\r\n";
     string_stream << "slave_priority:" << config_->slave_priority << "\r\n";
   }
 
@@ -650,10 +756,20 @@ void Server::GetReplicationInfo(std::string *info) {
     string_stream << "ip=" << slave->GetConn()->GetIP()
                   << ",port=" << slave->GetConn()->GetListeningPort()
                   << ",offset=" << slave->GetCurrentReplSeq()
-                  << ",lag=" << latest_seq - slave->GetCurrentReplSeq() << "\r\n";
+                  << ",lag=" << latest_seq - slave->GetCurrentReplSeq()
+                  << ",sent_batches=" << slave->GetSentBatches()
+                  << ",sent_bytes=" << slave->GetSentBytes()
+                  << ",flushes=" << slave->GetFlushes()
+                  << ",ack_offset=" << slave->GetAckSeq()
+                  << ",ack_lag_ms=" << slave->GetAckLagMs() << "\r\n";
     ++idx;
   }
   slave_threads_mu_.unlock();
+  WALTailerStats wal_tailer_stats;
+  wal_tailer_->GetStats(&wal_tailer_stats);
+  string_stream << "wal_tailer_batches:" << wal_tailer_stats.batches << "\r\n";
+  string_stream << "wal_tailer_bytes:" << wal_tailer_stats.bytes << "\r\n";
+  string_stream << "wal_tailer_first_seq:" << wal_tailer_stats.first_seq << "\r\n";
 
   *info = string_stream.str();
 }
@@ -724,13 +840,31 @@ void Server::GetStatsInfo(std::string *info) {
   std::ostringstream string_stream;
   string_stream << "# Stats\r\n";
   string_stream << "total_connections_received:" << total_clients_ <<"\r\n";
-  string_stream << "total_commands_processed:" << stats_.total_calls <<"\r\n";
+  string_stream << "total_commands_processed:" << stats_.GetTotalCalls() <<"\r\n";
   string_stream << "total_net_input_bytes:" << stats_.in_bytes <<"\r\n";
   string_stream << "total_net_output_bytes:" << stats_.out_bytes <<"\r\n";
   string_stream << "sync_full:" << stats_.fullsync_counter <<"\r\n";
   string_stream << "sync_partial_ok:" << stats_.psync_ok_counter <<"\r\n";
   string_stream << "sync_partial_err:" << stats_.psync_err_counter <<"\r\n";
+  uint64_t compress_input_bytes = stats_.repl_compress_input_bytes;
+  uint64_t compress_output_bytes = stats_.repl_compress_output_bytes;
+  double compression_ratio = compress_output_bytes == 0 ? 0 :
+                             static_cast<double>(compress_input_bytes) / compress_output_bytes;
+  string_stream << "repl_compress_input_bytes:" << compress_input_bytes <<"\r\n";
+  string_stream << "repl_compress_output_bytes:" << compress_output_bytes <<"\r\n";
+  string_stream << "repl_compression_ratio:" << compression_ratio <<"\r\n";
+  string_stream << "repl_compress_cpu_ms:" << stats_.repl_compress_micros / 1000 <<"\r\n";
+  string_stream << "repl_decompress_input_bytes:" << stats_.repl_decompress_input_bytes <<"\r\n";
+  string_stream << "repl_decompress_output_bytes:" << stats_.repl_decompress_output_bytes <<"\r\n";
+  string_stream << "repl_decompress_cpu_ms:" << stats_.repl_decompress_micros / 1000 <<"\r\n";
   string_stream << "pubsub_channels:" << pubsub_channels_.size() <<"\r\n";
+  ExpireSweeperStats sweeper_stats;
+  expire_sweeper_->GetStats(&sweeper_stats);
+  string_stream << "expired_keys:" << sweeper_stats.expired_keys <<"\r\n";
+  string_stream << "expired_subkeys:" << sweeper_stats.deleted_subkeys <<"\r\n";
+  string_stream << "expire_sweeper_scanned_keys:" << sweeper_stats.scanned_keys <<"\r\n";
+  string_stream << "expire_sweeper_rounds:" << sweeper_stats.rounds <<"\r\n";
+  string_stream << "expire_sweeper_last_round_time:" << sweeper_stats.last_round_time <<"\r\n";
   *info = string_stream.str();
 }
 
@@ -738,13 +872,18 @@ void Server::GetCommandsStatsInfo(std::string *info) {
   std::ostringstream string_stream;
   string_stream << "# Commandstats\r\n";
 
-  for (const auto &cmd_stat : stats_.commands_stats) {
-    auto calls = cmd_stat.second.calls.load();
-    auto latency = cmd_stat.second.latency.load();
+  std::vector<uint64_t> histogram;
+  const auto &commands = stats_.GetCommands();
+  for (size_t i = 0; i < commands.size(); i++) {
+    uint64_t calls, latency;
+    stats_.GetCommandStat(static_cast<int>(i), &calls, &latency, &histogram);
     if (calls == 0) continue;
-    string_stream << "cmdstat_" << cmd_stat.first << ":calls=" << calls
+    string_stream << "cmdstat_" << commands[i] << ":calls=" << calls
                   << ",usec=" << latency << ",usec_per_call="
                   << ((calls == 0) ? 0 : static_cast<float>(latency/calls))
+                  << ",p50=" << LatencyHistogram::ValueAtPercentile(histogram, 50)
+                  << ",p99=" << LatencyHistogram::ValueAtPercentile(histogram, 99)
+                  << ",p999=" << LatencyHistogram::ValueAtPercentile(histogram, 99.9)
                   << "\r\n";
   }
   *info = string_stream.str();
@@ -773,6 +912,20 @@ void Server::GetInfo(const std::string &ns, const std::string &section, std::str
   if (all || section == "persistence") {
     string_stream << "# Persistence\r\n";
     string_stream << "loading:" << is_loading_ <<"\r\n";
+    string_stream << "wal_archive_enabled:" << (wal_archiver_->IsEnabled() ? 1 : 0) << "\r\n";
+    if (wal_archiver_->IsEnabled()) {
+      WALArchiverStats archiver_stats;
+      wal_archiver_->GetStats(&archiver_stats);
+      string_stream << "wal_archive_seq:" << archiver_stats.archived_seq << "\r\n";
+      auto latest_seq = storage_->LatestSeq();
+      string_stream << "wal_archive_lag_seqs:"
+                    << (latest_seq > archiver_stats.archived_seq ? latest_seq - archiver_stats.archived_seq : 0)
+                    << "\r\n";
+      string_stream << "wal_archive_batches:" << archiver_stats.archived_batches << "\r\n";
+      string_stream << "wal_archive_bytes:" << archiver_stats.archived_bytes << "\r\n";
+      string_stream << "wal_archive_last_checkpoint_seq:" << archiver_stats.last_checkpoint_seq << "\r\n";
+      string_stream << "wal_archive_last_checkpoint_time:" << archiver_stats.last_checkpoint_time << "\r\n";
+    }
   }
   if (all || section == "stats") {
     std::string stats_info;
@@ -860,6 +1013,180 @@ std::string Server::GetRocksDBStatsJson() {
   return output;
 }
 
+namespace {
+
+// Convert the name into the metric name, e.g. rocksdb.block.cache.miss to rocksdb_block_cache_miss
+std::string metricName(const std::string &name) {
+  std::string metric_name = name;
+  for (auto &c : metric_name) {
+    if (!isalnum(c) && c != '_') c = '_';
+  }
+  return metric_name;
+}
+
+void appendMetricType(std::string *output, const std::string &name, const char *type) {
+  output->append("# TYPE ").append(name).append(" ").append(type).append("\n");
+}
+
+template <typename T>
+void appendMetric(std::string *output, const std::string &name, const std::string &labels, T value) {
+  output->append(name);
+  if (!labels.empty()) output->append("{").append(labels).append("}");
+  output->append(" ").append(std::to_string(value)).append("\n");
+}
+
+}  // namespace
+
+// Render the metrics in the OpenMetrics text format, the counters were read
+// from the in-memory stats without any IO, so it's cheap to be scraped every second.
+void Server::GetMetrics(std::string *output) {
+  output->clear();
+  output->reserve(64 * 1024);
+
+  time_t now;
+  time(&now);
+  appendMetricType(output, "kvrocks_uptime_seconds", "gauge");
+  appendMetric(output, "kvrocks_uptime_seconds", "", static_cast<int64_t>(now - start_time_));
+  appendMetricType(output, "kvrocks_connected_clients", "gauge");
+  appendMetric(output, "kvrocks_connected_clients", "", connected_clients_.load());
+  appendMetricType(output, "kvrocks_used_memory_rss_bytes", "gauge");
+  appendMetric(output, "kvrocks_used_memory_rss_bytes", "", Stats::GetMemoryRSS());
+  appendMetricType(output, "kvrocks_net_input_bytes", "counter");
+  appendMetric(output, "kvrocks_net_input_bytes_total", "", stats_.in_bytes.load());
+  appendMetricType(output, "kvrocks_net_output_bytes", "counter");
+  appendMetric(output, "kvrocks_net_output_bytes_total", "", stats_.out_bytes.load());
+  appendMetricType(output, "kvrocks_executing_commands", "gauge");
+  appendMetric(output, "kvrocks_executing_commands", "", excuting_command_num_.load());
+
+  // the worker load
+  appendMetricType(output, "kvrocks_worker_connections", "gauge");
+  for (size_t i = 0; i < worker_threads_.size(); i++) {
+    auto worker = worker_threads_[i]->GetWorker();
+    std::string labels = "worker=\"" + std::to_string(i) + "\",type=\"" + (worker->IsRepl() ? "repl" : "redis") + "\"";
+    appendMetric(output, "kvrocks_worker_connections", labels, worker->GetConnectionsNum());
+  }
+
+  // the command stats and the latency histograms, the le of the buckets were in microseconds
+  struct CommandMetric {
+    std::string labels;
+    uint64_t calls;
+    uint64_t latency;
+    std::vector<uint64_t> cumulative_counts;
+  };
+  std::vector<CommandMetric> command_metrics;
+  std::vector<uint64_t> histogram;
+  const auto &commands = stats_.GetCommands();
+  for (size_t i = 0; i < commands.size(); i++) {
+    CommandMetric metric;
+    stats_.GetCommandStat(static_cast<int>(i), &metric.calls, &metric.latency, &histogram);
+    if (metric.calls == 0) continue;
+    metric.labels = "cmd=\"" + commands[i] + "\"";
+    LatencyHistogram::PowerOfTwoCounts(histogram, &metric.cumulative_counts);
+    command_metrics.emplace_back(std::move(metric));
+  }
+  appendMetricType(output, "kvrocks_command_calls", "counter");
+  for (const auto &metric : command_metrics) {
+    appendMetric(output, "kvrocks_command_calls_total", metric.labels, metric.calls);
+  }
+  appendMetricType(output, "kvrocks_command_duration_microseconds", "histogram");
+  for (const auto &metric : command_metrics) {
+    const auto &counts = metric.cumulative_counts;
+    // skip the buckets larger than 2^24us(~16s), they're all in the +Inf bucket
+    for (int i = 0; i <= 24; i++) {
+      appendMetric(output, "kvrocks_command_duration_microseconds_bucket",
+                   metric.labels + ",le=\"" + std::to_string(1ULL << i) + "\"", counts[i]);
+    }
+    appendMetric(output, "kvrocks_command_duration_microseconds_bucket", metric.labels + ",le=\"+Inf\"",
+                 counts.back());
+    appendMetric(output, "kvrocks_command_duration_microseconds_count", metric.labels, counts.back());
+    appendMetric(output, "kvrocks_command_duration_microseconds_sum", metric.labels, metric.latency);
+  }
+
+  // the db may be closed and reopened when loading, so hold a db ref while using
+  // the db, and skip the metrics which need the db if it's closing.
+  bool db_accessible = !IsLoading() && storage_->IncrDBRefs().IsOK();
+
+  // the replication
+  rocksdb::SequenceNumber latest_seq = 0;
+  if (db_accessible) {
+    latest_seq = storage_->LatestSeq();
+    appendMetricType(output, "kvrocks_replication_offset", "gauge");
+    appendMetric(output, "kvrocks_replication_offset", "", latest_seq);
+  }
+  appendMetricType(output, "kvrocks_is_slave", "gauge");
+  appendMetric(output, "kvrocks_is_slave", "", IsSlave() ? 1 : 0);
+  if (IsSlave()) {
+    appendMetricType(output, "kvrocks_master_link_up", "gauge");
+    appendMetric(output, "kvrocks_master_link_up", "", GetReplicationState() == kReplConnected ? 1 : 0);
+    slaveof_mu_.lock();
+    if (replication_thread_) {
+      appendMetricType(output, "kvrocks_master_last_io_seconds_ago", "gauge");
+      appendMetric(output, "kvrocks_master_last_io_seconds_ago", "",
+                   static_cast<int64_t>(now - replication_thread_->LastIOTime()));
+    }
+    slaveof_mu_.unlock();
+  }
+  slave_threads_mu_.lock();
+  appendMetricType(output, "kvrocks_connected_slaves", "gauge");
+  appendMetric(output, "kvrocks_connected_slaves", "", slave_threads_.size());
+  appendMetricType(output, "kvrocks_slave_lag", "gauge");
+  for (const auto &slave : slave_threads_) {
+    if (!db_accessible || slave->IsStopped()) continue;
+    std::string labels = "ip=\"" + slave->GetConn()->GetIP() + "\",port=\""
+        + std::to_string(slave->GetConn()->GetListeningPort()) + "\"";
+    appendMetric(output, "kvrocks_slave_lag", labels, latest_seq - slave->GetCurrentReplSeq());
+  }
+  slave_threads_mu_.unlock();
+
+  if (db_accessible) {
+    rocksdb::DB *db = storage_->GetDB();
+    auto stats = db->GetDBOptions().statistics;
+    if (stats) {
+      for (const auto &iter : rocksdb::TickersNameMap) {
+        std::string name = "kvrocks_" + metricName(iter.second);
+        appendMetricType(output, name, "counter");
+        appendMetric(output, name + "_total", "", stats->getTickerCount(iter.first));
+      }
+      for (const auto &iter : rocksdb::HistogramsNameMap) {
+        std::string name = "kvrocks_" + metricName(iter.second);
+        rocksdb::HistogramData hist_data;
+        stats->histogramData(iter.first, &hist_data);
+        appendMetricType(output, name, "summary");
+        appendMetric(output, name, "quantile=\"0.5\"", hist_data.median);
+        appendMetric(output, name, "quantile=\"0.95\"", hist_data.percentile95);
+        appendMetric(output, name, "quantile=\"0.99\"", hist_data.percentile99);
+        appendMetric(output, name + "_sum", "", hist_data.sum);
+        appendMetric(output, name + "_count", "", hist_data.count);
+      }
+    }
+    const char *cf_properties[] = {
+        "rocksdb.estimate-num-keys",
+        "rocksdb.estimate-live-data-size",
+        "rocksdb.total-sst-files-size",
+        "rocksdb.cur-size-all-mem-tables",
+        "rocksdb.num-immutable-mem-table",
+        "rocksdb.estimate-pending-compaction-bytes",
+        "rocksdb.num-running-compactions",
+        "rocksdb.num-running-flushes",
+        "rocksdb.block-cache-usage",
+        "rocksdb.estimate-table-readers-mem",
+        "rocksdb.is-write-stopped",
+        "rocksdb.actual-delayed-write-rate",
+    };
+    for (const auto property : cf_properties) {
+      std::string name = "kvrocks_" + metricName(property);
+      appendMetricType(output, name, "gauge");
+      for (const auto &cf_handle : *storage_->GetCFHandles()) {
+        uint64_t value = 0;
+        db->GetIntProperty(cf_handle, property, &value);
+        appendMetric(output, name, "cf=\"" + cf_handle->GetName() + "\"", value);
+      }
+    }
+    storage_->DecrDBRefs();
+  }
+  output->append("# EOF\n");
+}
+
 /*
  * Reclaim the old db ptr before restore the db from backup,
  * as restore db would delete the db and column families.
@@ -17,6 +17,11 @@
 #include "redis_slot.h"
 #include "log_collector.h"
 #include "worker.h"
+#include "compaction_checker.h"
+#include "expire_sweeper.h"
+#include "metrics_exporter.h"
+#include "wal_tailer.h"
+#include "wal_archiver.h"
 
 struct DBScanInfo {
   time_t last_scan_time = 0;
@@ -52,6 +57,8 @@ class Server {
   Status AddSlave(Redis::Connection *conn, rocksdb::SequenceNumber next_repl_seq);
   void DisconnectSlaves();
   void cleanupExitedSlaves();
+  // The num of the slaves which acknowledged that the seq was applied
+  int GetAckedSlaveNum(rocksdb::SequenceNumber seq);
   bool IsSlave() { return !master_host_.empty(); }
   void FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens);
 
@@ -83,6 +90,7 @@ class Server {
   void GetCommandsStatsInfo(std::string *info);
   void GetInfo(const std::string &ns, const std::string &section, std::string *info);
   std::string GetRocksDBStatsJson();
+  void GetMetrics(std::string *output);
   ReplState GetReplicationState();
 
   void ReclaimOldDBPtr();
@@ -90,6 +98,9 @@ class Server {
   Status AsyncBgsaveDB();
   Status AsyncPurgeOldBackups(uint32_t num_backups_to_keep, uint32_t backup_max_keep_hours);
   Status AsyncScanDBSize(const std::string &ns);
+  // The compressed chunks of the fetched files were read and compressed by the
+  // fetch file threads instead of the repl workers.
+  Status AsyncFetchFileTask(Task task) { return fetch_file_runner_->Publish(task); }
   void GetLastestKeyNumStats(const std::string &ns, KeyNumStats *stats);
   time_t GetLastScanTime(const std::string &ns);
 
@@ -106,6 +117,7 @@ class Server {
 
   LogCollector<PerfEntry> *GetPerfLog() { return &perf_log_; }
   LogCollector<SlowEntry> *GetSlowLog() { return &slow_log_; }
+  WALTailer *GetWALTailer() { return wal_tailer_.get(); }
   void SlowlogPushEntryIfNeeded(const std::vector<std::string>* args, uint64_t duration);
 
   Stats stats_;
@@ -158,7 +170,14 @@ class Server {
   // threads
   std::thread cron_thread_;
   std::thread compaction_checker_thread_;
+  std::unique_ptr<CompactionChecker> compaction_checker_;
+  std::thread expire_sweeper_thread_;
+  std::unique_ptr<ExpireSweeper> expire_sweeper_;
+  std::unique_ptr<MetricsExporter> metrics_exporter_;
+  std::unique_ptr<WALTailer> wal_tailer_;
+  std::unique_ptr<WALArchiver> wal_archiver_;
   TaskRunner task_runner_;
+  std::unique_ptr<TaskRunner> fetch_file_runner_;
   std::vector<WorkerThread *> worker_threads_;
   std::unique_ptr<ReplicationThread> replication_thread_;
 };
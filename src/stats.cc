@@ -45,11 +45,199 @@ int64_t Stats::GetMemoryRSS() {
 }
 #endif
 
-void Stats::IncrCalls(const std::string &command_name) {
-  total_calls.fetch_add(1, std::memory_order_relaxed);
-  commands_stats[command_name].calls.fetch_add(1, std::memory_order_relaxed);
+LatencyHistogram::LatencyHistogram() {
+  for (auto &count : counts_) count.store(0, std::memory_order_relaxed);
 }
 
-void Stats::IncrLatency(uint64_t latency, const std::string &command_name) {
-  commands_stats[command_name].latency.fetch_add(latency, std::memory_order_relaxed);
+int LatencyHistogram::BucketIndex(uint64_t value) {
+  if (value <= kSubBuckets) return static_cast<int>(value);
+  // the buckets were (lower, upper], so the values were shifted by one
+  uint64_t offset = value - 1;
+  int msb = 63 - __builtin_clzll(offset);
+  if (msb >= kMaxValueBits) return kBuckets - 1;
+  int shift = msb - kSubBucketBits;
+  return (shift + 1) * kSubBuckets + static_cast<int>((offset >> shift) & (kSubBuckets - 1)) + 1;
+}
+
+uint64_t LatencyHistogram::BucketLowerBound(int index) {
+  if (index <= kSubBuckets) return static_cast<uint64_t>(index);
+  int shift = (index - 1) / kSubBuckets - 1;
+  return (static_cast<uint64_t>(kSubBuckets + (index - 1) % kSubBuckets) << shift) + 1;
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int index) {
+  if (index <= kSubBuckets) return static_cast<uint64_t>(index);
+  int shift = (index - 1) / kSubBuckets - 1;
+  return static_cast<uint64_t>(kSubBuckets + (index - 1) % kSubBuckets + 1) << shift;
+}
+
+void LatencyHistogram::Record(uint64_t value) {
+  // Only the owner thread writes the histogram, so the load and store were
+  // enough and cheaper than the atomic increment.
+  auto &count = counts_[BucketIndex(value)];
+  count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::MergeInto(std::vector<uint64_t> *counts) const {
+  counts->resize(kBuckets, 0);
+  for (int i = 0; i < kBuckets; i++) {
+    (*counts)[i] += counts_[i].load(std::memory_order_relaxed);
+  }
+}
+
+uint64_t LatencyHistogram::ValueAtPercentile(const std::vector<uint64_t> &counts, double percentile) {
+  uint64_t total = 0;
+  for (const auto count : counts) total += count;
+  if (total == 0) return 0;
+  // the rank of the percentile, at least the first value
+  auto rank = static_cast<uint64_t>(percentile / 100 * total + 0.5);
+  if (rank == 0) rank = 1;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < counts.size(); i++) {
+    seen += counts[i];
+    if (seen >= rank) return BucketUpperBound(static_cast<int>(i));
+  }
+  return BucketUpperBound(static_cast<int>(counts.size() - 1));
+}
+
+void LatencyHistogram::PowerOfTwoCounts(const std::vector<uint64_t> &counts,
+                                        std::vector<uint64_t> *cumulative_counts) {
+  cumulative_counts->assign(kMaxValueBits + 1, 0);
+  uint64_t cumulative = 0;
+  int index = 0;
+  for (int i = 0; i <= kMaxValueBits; i++) {
+    for (; index < static_cast<int>(counts.size()) && BucketUpperBound(index) <= (1ULL << i); index++) {
+      cumulative += counts[index];
+    }
+    (*cumulative_counts)[i] = cumulative;
+  }
+}
+
+Stats::Stats() {
+  static std::atomic<uint64_t> next_id = {1};
+  id_ = next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Stats::SetCommands(const std::vector<std::string> &command_names) {
+  command_names_.clear();
+  command_ids_.clear();
+  for (const auto &name : command_names) {
+    if (command_ids_.count(name)) continue;
+    command_ids_[name] = static_cast<int>(command_names_.size());
+    command_names_.emplace_back(name);
+  }
+}
+
+int Stats::GetCommandID(const std::string &command_name) const {
+  auto iter = command_ids_.find(command_name);
+  return iter == command_ids_.end() ? -1 : iter->second;
+}
+
+// Return the command stats of the current thread, they were registered when the
+// thread recorded the stats at the first time and owned by the Stats.
+CommandStat *Stats::threadCommandStats() {
+  // The Stats id was unique in the process, so the thread won't use the
+  // stats of another(or destroyed) Stats instance. A thread may record into
+  // more than one Stats, e.g. the tests and the replication, so the stats were
+  // cached per instance and the last used one was checked first.
+  thread_local uint64_t last_id = 0;
+  thread_local CommandStat *last_stats = nullptr;
+  thread_local std::unordered_map<uint64_t, CommandStat *> thread_stats_by_id;
+  if (last_id == id_) return last_stats;
+  auto iter = thread_stats_by_id.find(id_);
+  if (iter == thread_stats_by_id.end()) {
+    std::lock_guard<std::mutex> guard(thread_stats_mu_);
+    thread_stats_.emplace_back(new CommandStat[command_names_.size()]);
+    iter = thread_stats_by_id.emplace(id_, thread_stats_.back().get()).first;
+  }
+  last_id = id_;
+  last_stats = iter->second;
+  return last_stats;
+}
+
+void Stats::IncrCalls(int command_id) {
+  if (command_id < 0 || command_id >= static_cast<int>(command_names_.size())) return;
+  auto &calls = threadCommandStats()[command_id].calls;
+  calls.store(calls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Stats::IncrLatency(uint64_t latency, int command_id) {
+  if (command_id < 0 || command_id >= static_cast<int>(command_names_.size())) return;
+  auto &stat = threadCommandStats()[command_id];
+  stat.latency.store(stat.latency.load(std::memory_order_relaxed) + latency, std::memory_order_relaxed);
+  auto histogram = stat.histogram.load(std::memory_order_relaxed);
+  if (!histogram) {
+    histogram = new LatencyHistogram();
+    stat.histogram.store(histogram, std::memory_order_release);
+  }
+  histogram->Record(latency);
+}
+
+uint64_t Stats::GetTotalCalls() {
+  uint64_t total_calls = 0;
+  std::lock_guard<std::mutex> guard(thread_stats_mu_);
+  for (const auto &thread_stats : thread_stats_) {
+    for (size_t i = 0; i < command_names_.size(); i++) {
+      total_calls += thread_stats[i].calls.load(std::memory_order_relaxed);
+    }
+  }
+  return total_calls;
+}
+
+void Stats::GetCommandStat(int command_id, uint64_t *calls, uint64_t *latency, std::vector<uint64_t> *histogram) {
+  *calls = 0;
+  *latency = 0;
+  if (histogram) histogram->assign(LatencyHistogram::kBuckets, 0);
+  if (command_id < 0 || command_id >= static_cast<int>(command_names_.size())) return;
+  std::lock_guard<std::mutex> guard(thread_stats_mu_);
+  for (const auto &thread_stats : thread_stats_) {
+    const auto &stat = thread_stats[command_id];
+    *calls += stat.calls.load(std::memory_order_relaxed);
+    *latency += stat.latency.load(std::memory_order_relaxed);
+    auto thread_histogram = stat.histogram.load(std::memory_order_acquire);
+    if (histogram && thread_histogram) thread_histogram->MergeInto(histogram);
+  }
+}
+
+void Stats::IncrPerfCounters(int command_id, const uint64_t *counters) {
+  if (command_id < 0 || command_id >= static_cast<int>(command_names_.size())) return;
+  auto &stat = threadCommandStats()[command_id];
+  stat.perf_samples.store(stat.perf_samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  for (int i = 0; i < kPerfCounterNum; i++) {
+    auto &counter = stat.perf_counters[i];
+    counter.store(counter.load(std::memory_order_relaxed) + counters[i], std::memory_order_relaxed);
+  }
+}
+
+void Stats::GetCommandPerfStat(int command_id, uint64_t *samples, std::vector<uint64_t> *counters) {
+  *samples = 0;
+  counters->assign(kPerfCounterNum, 0);
+  if (command_id < 0 || command_id >= static_cast<int>(command_names_.size())) return;
+  std::lock_guard<std::mutex> guard(thread_stats_mu_);
+  for (const auto &thread_stats : thread_stats_) {
+    const auto &stat = thread_stats[command_id];
+    *samples += stat.perf_samples.load(std::memory_order_relaxed);
+    for (int i = 0; i < kPerfCounterNum; i++) {
+      (*counters)[i] += stat.perf_counters[i].load(std::memory_order_relaxed);
+    }
+  }
+}
+
+const char *Stats::PerfCounterName(int counter) {
+  static const char *names[kPerfCounterNum] = {
+      "block_cache_hit",
+      "block_read",
+      "block_read_bytes",
+      "bloom_sst_checked",
+      "bloom_sst_useful",
+      "memtable_get",
+      "memtable_get_nanos",
+      "sst_get_nanos",
+      "seek",
+      "internal_key_skipped",
+      "internal_delete_skipped",
+      "read_bytes",
+  };
+  if (counter < 0 || counter >= kPerfCounterNum) return "";
+  return names[counter];
 }
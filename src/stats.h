@@ -1,33 +1,131 @@
 #pragma once
 
 #include <unistd.h>
-#include <map>
 #include <atomic>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
-struct command_stat {
-  std::atomic<uint64_t> calls;
-  std::atomic<uint64_t> latency;
+// The latency histogram with the log-linear buckets like HdrHistogram, the values
+// in (2^n, 2^(n+1)] were split into kSubBuckets linear buckets, so the relative
+// error of the percentiles was below 1/kSubBuckets, and every power of two was the
+// upper bound of a bucket. The values not greater than kSubBuckets had their own
+// buckets. The histogram was written by one thread and may be read by other
+// threads at the same time.
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 4;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // the values larger than 2^kMaxValueBits were recorded into the last bucket
+  static const int kMaxValueBits = 36;
+  static const int kBuckets = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets + 1;
+
+  LatencyHistogram();
+  void Record(uint64_t value);
+  void MergeInto(std::vector<uint64_t> *counts) const;
+
+  static int BucketIndex(uint64_t value);
+  static uint64_t BucketLowerBound(int index);
+  static uint64_t BucketUpperBound(int index);
+  // Return the highest value of the bucket where the percentile(0-100) falls
+  static uint64_t ValueAtPercentile(const std::vector<uint64_t> &counts, double percentile);
+  // The i-th cumulative count was the number of the values not greater than 2^i,
+  // like the le buckets of Prometheus. It was exact since 2^i was a bucket upper bound.
+  static void PowerOfTwoCounts(const std::vector<uint64_t> &counts, std::vector<uint64_t> *cumulative_counts);
+
+ private:
+  std::atomic<uint64_t> counts_[kBuckets];
+};
+
+// The RocksDB perf context counters aggregated per command for the sampled commands
+enum PerfCounter {
+  kPerfBlockCacheHit = 0,
+  kPerfBlockRead,
+  kPerfBlockReadBytes,
+  kPerfBloomSstChecked,
+  kPerfBloomSstUseful,
+  kPerfMemtableGet,
+  kPerfMemtableGetNanos,
+  kPerfSstGetNanos,
+  kPerfSeek,
+  kPerfInternalKeySkipped,
+  kPerfInternalDeleteSkipped,
+  kPerfReadBytes,
+  kPerfCounterNum,
+};
+
+struct CommandStat {
+  std::atomic<uint64_t> calls = {0};
+  std::atomic<uint64_t> latency = {0};
+  // allocated by the owner thread when the command was executed at the first time
+  std::atomic<LatencyHistogram *> histogram = {nullptr};
+  std::atomic<uint64_t> perf_samples = {0};
+  std::atomic<uint64_t> perf_counters[kPerfCounterNum] = {};
+
+  ~CommandStat() { delete histogram.load(); }
 };
 
 class Stats {
  public:
-  std::atomic<uint64_t> total_calls = {0};
   std::atomic<uint64_t> in_bytes = {0};
   std::atomic<uint64_t> out_bytes = {0};
 
   std::atomic<uint64_t> fullsync_counter = {0};
   std::atomic<uint64_t> psync_err_counter = {0};
   std::atomic<uint64_t> psync_ok_counter = {0};
-  std::map<std::string, command_stat> commands_stats;
+
+  // the replication data compressed by the master and decompressed by the slave
+  std::atomic<uint64_t> repl_compress_input_bytes = {0};
+  std::atomic<uint64_t> repl_compress_output_bytes = {0};
+  std::atomic<uint64_t> repl_compress_micros = {0};
+  std::atomic<uint64_t> repl_decompress_input_bytes = {0};
+  std::atomic<uint64_t> repl_decompress_output_bytes = {0};
+  std::atomic<uint64_t> repl_decompress_micros = {0};
 
  public:
-  void IncrCalls(const std::string &command_name);
-  void IncrLatency(uint64_t latency, const std::string &command_name);
+  Stats();
+  // The command ID was the index of the command name, SetCommands should be
+  // called before any command was executed.
+  void SetCommands(const std::vector<std::string> &command_names);
+  const std::vector<std::string> &GetCommands() const { return command_names_; }
+  int GetCommandID(const std::string &command_name) const;
+
+  // The counters were kept per thread and indexed by the command ID, so the
+  // worker threads won't contend with each other, they're aggregated on read.
+  void IncrCalls(int command_id);
+  void IncrLatency(uint64_t latency, int command_id);
+  uint64_t GetTotalCalls();
+  void GetCommandStat(int command_id, uint64_t *calls, uint64_t *latency, std::vector<uint64_t> *histogram);
+  // The counters should have kPerfCounterNum elements which were indexed by PerfCounter
+  void IncrPerfCounters(int command_id, const uint64_t *counters);
+  void GetCommandPerfStat(int command_id, uint64_t *samples, std::vector<uint64_t> *counters);
+  static const char *PerfCounterName(int counter);
+
   void IncrInbondBytes(uint64_t bytes) { in_bytes.fetch_add(bytes, std::memory_order_relaxed); }
   void IncrOutbondBytes(uint64_t bytes) { out_bytes.fetch_add(bytes, std::memory_order_relaxed); }
   void IncrFullSyncCounter() { fullsync_counter.fetch_add(1, std::memory_order_relaxed); }
   void IncrPSyncErrCounter() { psync_err_counter.fetch_add(1, std::memory_order_relaxed); }
   void IncrPSyncOKCounter() { psync_ok_counter.fetch_add(1, std::memory_order_relaxed); }
+  void IncrReplCompress(uint64_t input_bytes, uint64_t output_bytes, uint64_t micros) {
+    repl_compress_input_bytes.fetch_add(input_bytes, std::memory_order_relaxed);
+    repl_compress_output_bytes.fetch_add(output_bytes, std::memory_order_relaxed);
+    repl_compress_micros.fetch_add(micros, std::memory_order_relaxed);
+  }
+  void IncrReplDecompress(uint64_t input_bytes, uint64_t output_bytes, uint64_t micros) {
+    repl_decompress_input_bytes.fetch_add(input_bytes, std::memory_order_relaxed);
+    repl_decompress_output_bytes.fetch_add(output_bytes, std::memory_order_relaxed);
+    repl_decompress_micros.fetch_add(micros, std::memory_order_relaxed);
+  }
   static int64_t GetMemoryRSS();
+
+ private:
+  CommandStat *threadCommandStats();
+
+  uint64_t id_;
+  std::vector<std::string> command_names_;
+  std::unordered_map<std::string, int> command_ids_;
+  std::mutex thread_stats_mu_;
+  std::vector<std::unique_ptr<CommandStat[]>> thread_stats_;
 };
@@ -2,6 +2,7 @@
 
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <chrono>
 #include <iostream>
 #include <memory>
 #include <algorithm>
@@ -10,9 +11,11 @@
 #include <rocksdb/filter_policy.h>
 #include <rocksdb/table.h>
 #include <rocksdb/sst_file_manager.h>
+#include <rocksdb/sst_file_reader.h>
 #include <rocksdb/utilities/table_properties_collectors.h>
 #include <rocksdb/rate_limiter.h>
 #include <rocksdb/env.h>
+#include <rocksdb/utilities/checkpoint.h>
 
 #include "config.h"
 #include "redis_db.h"
@@ -34,6 +37,8 @@ const char *kSlotColumnFamilyName = "slot";
 
 const uint64_t kIORateLimitMaxMb = 1024000;
 
+thread_local const rocksdb::Snapshot *Storage::pinned_snapshot_ = nullptr;
+
 using rocksdb::Slice;
 using Redis::WriteBatchExtractor;
 
@@ -57,6 +62,11 @@ void Storage::CloseDB() {
   // prevent to destroy the cloumn family while the compact filter was using
   db_mu_.lock();
   db_closing_ = true;
+  db_mu_.unlock();
+  // the visible snapshot holds a db ref until the reads released it
+  ReleaseVisibleSnapshot();
+  visible_seq_ = 0;
+  db_mu_.lock();
   while (db_refs_ != 0) {
     db_mu_.unlock();
     usleep(10000);
@@ -113,6 +123,13 @@ Status Storage::SetColumnFamilyOption(const std::string &key, const std::string
   return Status::OK();
 }
 
+Status Storage::SetColumnFamilyOption(const std::string &cf_name,
+                                      const std::string &key, const std::string &value) {
+  auto s = db_->SetOptions(GetCFHandle(cf_name), {{key, value}});
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
 Status Storage::SetOption(const std::string &key, const std::string &value) {
   auto s = db_->SetOptions({{key, value}});
   if (!s.ok()) return Status(Status::NotOK, s.ToString());
@@ -125,6 +142,18 @@ Status Storage::SetDBOption(const std::string &key, const std::string &value) {
   return Status::OK();
 }
 
+static void InitCompactionOptions(const ColumnFamilyCompaction &compaction, rocksdb::ColumnFamilyOptions *cf_options) {
+  cf_options->compaction_style = static_cast<rocksdb::CompactionStyle>(compaction.compaction_style);
+  cf_options->max_bytes_for_level_multiplier = compaction.max_bytes_for_level_multiplier;
+  cf_options->level_compaction_dynamic_level_bytes = compaction.level_compaction_dynamic_level_bytes;
+  if (cf_options->compaction_style == rocksdb::kCompactionStyleUniversal) {
+    // the per level compression was set by OptimizeLevelStyleCompaction,
+    // universal compaction always writes the sorted runs into the last levels
+    // which should use the configured compression.
+    cf_options->compression_per_level.clear();
+  }
+}
+
 Status Storage::CreateColumnFamilies(const rocksdb::Options &options) {
   rocksdb::DB *tmp_db;
   rocksdb::ColumnFamilyOptions cf_options(options);
@@ -175,6 +204,7 @@ Status Storage::Open(bool read_only) {
   metadata_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(metadata_table_opts));
   metadata_opts.compaction_filter_factory = std::make_shared<MetadataFilterFactory>();
   metadata_opts.disable_auto_compactions = config_->RocksDB.disable_auto_compactions;
+  InitCompactionOptions(config_->RocksDB.metadata_compaction, &metadata_opts);
   metadata_opts.table_properties_collector_factories.emplace_back(
       NewCompactOnExpiredTableCollectorFactory(kMetadataColumnFamilyName, 0.3));
 
@@ -188,6 +218,7 @@ Status Storage::Open(bool read_only) {
   subkey_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(subkey_table_opts));
   subkey_opts.compaction_filter_factory = std::make_shared<SubKeyFilterFactory>(this);
   subkey_opts.disable_auto_compactions = config_->RocksDB.disable_auto_compactions;
+  InitCompactionOptions(config_->RocksDB.subkey_compaction, &subkey_opts);
   subkey_opts.table_properties_collector_factories.emplace_back(
       NewCompactOnExpiredTableCollectorFactory(kSubkeyColumnFamilyName, 0.3));
 
@@ -198,6 +229,7 @@ Status Storage::Open(bool read_only) {
   pubsub_opts.table_factory.reset(rocksdb::NewBlockBasedTableFactory(pubsub_table_opts));
   pubsub_opts.compaction_filter_factory = std::make_shared<PubSubFilterFactory>();
   pubsub_opts.disable_auto_compactions = config_->RocksDB.disable_auto_compactions;
+  InitCompactionOptions(config_->RocksDB.pubsub_compaction, &pubsub_opts);
 
   std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
   // Caution: don't change the order of column family, or the handle will be mismatched
@@ -314,6 +346,99 @@ Status Storage::RestoreFromBackup() {
   return s.ok() ? Status::OK() : Status(Status::DBBackupErr, s.ToString());
 }
 
+// The slave fetched the checkpoint files of the master into this directory
+std::string restoringCheckpointDir(const Config *config) {
+  return config->sync_checkpoint_dir + ".restore";
+}
+
+// The checkpoint files were all in the checkpoint dir, so the name from the
+// other side must not escape it.
+bool isValidCheckpointFile(const std::string &rel_path) {
+  return !rel_path.empty() && rel_path[0] != '/' && rel_path.find('/') == std::string::npos
+         && rel_path.find("..") == std::string::npos;
+}
+
+Status RemoveDirRecursively(rocksdb::Env *env, const std::string &dir) {
+  if (!env->FileExists(dir).ok()) return Status::OK();
+  std::vector<std::string> children;
+  auto s = env->GetChildren(dir, &children);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  for (const auto &child : children) {
+    if (child == "." || child == "..") continue;
+    auto path = dir + "/" + child;
+    bool is_dir = false;
+    if (env->IsDirectory(path, &is_dir).ok() && is_dir) {
+      auto status = RemoveDirRecursively(env, path);
+      if (!status.IsOK()) return status;
+      continue;
+    }
+    s = env->DeleteFile(path);
+    if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  }
+  s = env->DeleteDir(dir);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+Status Storage::RestoreFromCheckpoint() {
+  std::string checkpoint_dir = restoringCheckpointDir(config_);
+  std::string old_db_dir = config_->db_dir + ".old";
+  // the backup engine would be opened again when reopening the db
+  if (backup_ != nullptr) {
+    DestroyBackup();
+    backup_ = nullptr;
+  }
+  CloseDB();
+
+  // Swap the db dir with the checkpoint dir, and keep the old db until the
+  // checkpoint was opened successfully, so we can fall back to the old db.
+  auto status = RemoveDirRecursively(backup_env_, old_db_dir);
+  rocksdb::Status s;
+  if (status.IsOK()) {
+    s = backup_env_->RenameFile(config_->db_dir, old_db_dir);
+    if (s.ok()) {
+      s = backup_env_->RenameFile(checkpoint_dir, config_->db_dir);
+      if (!s.ok()) backup_env_->RenameFile(old_db_dir, config_->db_dir);
+    }
+    if (!s.ok()) status = Status(Status::DBBackupErr, s.ToString());
+  }
+  if (!status.IsOK()) {
+    LOG(ERROR) << "[storage] Failed to swap the db with the checkpoint: " << status.Msg();
+    auto s2 = Open();
+    if (!s2.IsOK()) {
+      LOG(ERROR) << "[storage] Failed to reopen db: " << s2.Msg();
+      return Status(Status::DBOpenErr, s2.Msg());
+    }
+    return status;
+  }
+
+  status = Open();
+  if (!status.IsOK() && db_ == nullptr) {
+    LOG(ERROR) << "[storage] Failed to open the checkpoint: " << status.Msg() << ", fall back to the old db";
+    RemoveDirRecursively(backup_env_, config_->db_dir);
+    backup_env_->RenameFile(old_db_dir, config_->db_dir);
+    auto s2 = Open();
+    if (!s2.IsOK()) {
+      LOG(ERROR) << "[storage] Failed to reopen db: " << s2.Msg();
+      return Status(Status::DBOpenErr, s2.Msg());
+    }
+    return Status(Status::DBOpenErr, status.Msg());
+  }
+  if (!status.IsOK()) return status;
+  RemoveDirRecursively(backup_env_, old_db_dir);
+  LOG(INFO) << "[storage] Restore from checkpoint";
+  return Status::OK();
+}
+
+void Storage::PurgeSyncCheckpointIfNeed() {
+  std::lock_guard<std::mutex> guard(checkpoint_mu_);
+  if (checkpoint_refs_ > 0) return;
+  if (!backup_env_->FileExists(config_->sync_checkpoint_dir).ok()) return;
+  auto s = RemoveDirRecursively(backup_env_, config_->sync_checkpoint_dir);
+  LOG(INFO) << "[storage] Purge the sync checkpoint(id: " << checkpoint_id_ << "), result: "
+            << (s.IsOK() ? "OK" : s.Msg());
+}
+
 void Storage::PurgeOldBackups(uint32_t num_backups_to_keep, uint32_t backup_max_keep_hours) {
   time_t now = time(nullptr);
   std::vector<rocksdb::BackupInfo> backup_infos;
@@ -388,6 +513,7 @@ rocksdb::Status Storage::Write(const rocksdb::WriteOptions &options, rocksdb::Wr
   auto s = db_->Write(options, updates);
   if (!s.ok()) return s;
 
+  notifyWALWaiters();
   return s;
 }
 
@@ -405,7 +531,9 @@ rocksdb::Status Storage::Delete(const rocksdb::WriteOptions &options,
     auto s = slot_db.UpdateKeys({}, delete_keys, &batch);
     if (!s.ok()) return s;
   }
-  return db_->Write(options, &batch);
+  auto s = db_->Write(options, &batch);
+  if (s.ok()) notifyWALWaiters();
+  return s;
 }
 
 rocksdb::Status Storage::DeleteRange(const std::string &first_key, const std::string &last_key) {
@@ -427,18 +555,37 @@ rocksdb::Status Storage::DeleteRange(const std::string &first_key, const std::st
   return rocksdb::Status::OK();
 }
 
-Status Storage::WriteBatch(std::string &&raw_batch) {
+Status Storage::WriteBatch(rocksdb::WriteBatch *batch) {
   if (reach_db_size_limit_) {
     return Status(Status::NotOK, "reach space limit");
   }
-  auto bat = rocksdb::WriteBatch(std::move(raw_batch));
-  auto s = db_->Write(rocksdb::WriteOptions(), &bat);
+  auto s = db_->Write(rocksdb::WriteOptions(), batch);
   if (!s.ok()) {
     return Status(Status::NotOK, s.ToString());
   }
+  notifyWALWaiters();
   return Status::OK();
 }
 
+bool Storage::WaitForWALData(rocksdb::SequenceNumber seq, int64_t timeout_ms) {
+  if (WALHasNewData(seq)) return true;
+  std::unique_lock<std::mutex> lock(wal_notify_mu_);
+  wal_waiters_++;
+  // The writes which don't go through the storage(e.g. the slot DeleteRange) won't notify
+  // the waiters, they would be found after the timeout.
+  bool has_new_data = wal_notify_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                                              [this, seq] { return WALHasNewData(seq); });
+  wal_waiters_--;
+  return has_new_data;
+}
+
+void Storage::notifyWALWaiters() {
+  // Don't take the lock on the write path if nobody was waiting
+  if (wal_waiters_ == 0) return;
+  std::lock_guard<std::mutex> guard(wal_notify_mu_);
+  wal_notify_cv_.notify_all();
+}
+
 rocksdb::ColumnFamilyHandle *Storage::GetCFHandle(const std::string &name) {
   if (name == kMetadataColumnFamilyName) {
     return cf_handles_[1];
@@ -455,15 +602,32 @@ rocksdb::ColumnFamilyHandle *Storage::GetCFHandle(const std::string &name) {
 }
 
 rocksdb::Status Storage::Compact(const Slice *begin, const Slice *end) {
-  rocksdb::CompactRangeOptions compact_opts;
-  compact_opts.change_level = true;
   for (const auto &cf_handle : cf_handles_) {
-    rocksdb::Status s = db_->CompactRange(compact_opts, cf_handle, begin, end);
+    rocksdb::Status s = compact(cf_handle, begin, end, true);
     if (!s.ok()) return s;
   }
   return rocksdb::Status::OK();
 }
 
+rocksdb::Status Storage::Compact(const std::string &cf_name, const Slice *begin, const Slice *end, bool exclusive) {
+  // the db is closing, don't use DB and cf_handles
+  auto s = IncrDBRefs();
+  if (!s.IsOK()) return rocksdb::Status::Aborted(s.Msg());
+  auto r_status = compact(GetCFHandle(cf_name), begin, end, exclusive);
+  DecrDBRefs();
+  return r_status;
+}
+
+rocksdb::Status Storage::compact(rocksdb::ColumnFamilyHandle *cf_handle, const Slice *begin, const Slice *end,
+                                 bool exclusive) {
+  rocksdb::CompactRangeOptions compact_opts;
+  // Only the exclusive compaction moved the output to the lowest fitting level,
+  // the level refitting couldn't run in parallel and moved the whole levels.
+  compact_opts.change_level = exclusive;
+  compact_opts.exclusive_manual_compaction = exclusive;
+  return db_->CompactRange(compact_opts, cf_handle, begin, end);
+}
+
 uint64_t Storage::GetTotalSize(const std::string &ns) {
   if (ns == kDefaultNamespace) {
     return sst_file_manager_->GetTotalSize();
@@ -538,6 +702,29 @@ Status Storage::DecrDBRefs() {
   return Status::OK();
 }
 
+std::shared_ptr<const rocksdb::Snapshot> Storage::GetVisibleSnapshot() {
+  std::lock_guard<std::mutex> guard(visible_snapshot_mu_);
+  if (visible_snapshot_ && visible_snapshot_->GetSequenceNumber() >= visible_seq_) {
+    return visible_snapshot_;
+  }
+  if (!IncrDBRefs().IsOK()) return nullptr;
+  auto db = db_;
+  visible_snapshot_ = std::shared_ptr<const rocksdb::Snapshot>(
+      db->GetSnapshot(), [this, db](const rocksdb::Snapshot *snapshot) {
+        db->ReleaseSnapshot(snapshot);
+        DecrDBRefs();
+      });
+  return visible_snapshot_;
+}
+
+void Storage::ReleaseVisibleSnapshot() {
+  std::shared_ptr<const rocksdb::Snapshot> snapshot;
+  {
+    std::lock_guard<std::mutex> guard(visible_snapshot_mu_);
+    snapshot.swap(visible_snapshot_);
+  }
+}
+
 Status Storage::BackupManager::OpenLatestMeta(Storage *storage,
                                               int *fd,
                                               rocksdb::BackupID *meta_id,
@@ -581,6 +768,103 @@ int Storage::BackupManager::OpenDataFile(Storage *storage, const std::string &re
   return rv;
 }
 
+// Return true if the WAL from the seq was still available, so the slave could
+// do the psync with it.
+static bool isWALAvailable(Storage *storage, rocksdb::SequenceNumber seq) {
+  if (seq > storage->LatestSeq()) return seq == storage->LatestSeq() + 1;
+  std::unique_ptr<rocksdb::TransactionLogIterator> iter;
+  auto s = storage->GetWALIter(seq, &iter);
+  return s.IsOK() && iter->GetBatch().sequence == seq;
+}
+
+Status Storage::BackupManager::OpenCheckpointMeta(Storage *storage, uint64_t *checkpoint_id, std::string *meta) {
+  auto env = storage->backup_env_;
+  const auto &dir = storage->config_->sync_checkpoint_dir;
+  std::lock_guard<std::mutex> guard(storage->checkpoint_mu_);
+  // The checkpoint which was being fetched by other slaves would be reused,
+  // so the slaves doing the full sync at the same time share the same files.
+  // But the slave couldn't do the psync after loading the checkpoint if the WAL
+  // after it was purged, so the stale checkpoint was expired and recreated, the
+  // slaves still fetching it would fail and retry the full sync.
+  if (storage->checkpoint_refs_ > 0 && !isWALAvailable(storage, storage->checkpoint_seq_ + 1)) {
+    LOG(WARNING) << "[storage] The WAL after the checkpoint(id: " << storage->checkpoint_id_
+                 << ", seq: " << storage->checkpoint_seq_ << ") was purged, expire it";
+    storage->checkpoint_refs_ = 0;
+  }
+  if (storage->checkpoint_refs_ == 0) {
+    auto status = RemoveDirRecursively(env, dir);
+    if (!status.IsOK()) return status;
+    LOG(INFO) << "[storage] Start to create new checkpoint";
+    rocksdb::Checkpoint *checkpoint = nullptr;
+    auto s = rocksdb::Checkpoint::Create(storage->db_, &checkpoint);
+    if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+    std::unique_ptr<rocksdb::Checkpoint> checkpoint_guard(checkpoint);
+    // flush the memtable first, so the slave needn't fetch the WAL files
+    s = checkpoint->CreateCheckpoint(dir, 0, &storage->checkpoint_seq_);
+    if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+    auto id = static_cast<uint64_t>(time(nullptr));
+    storage->checkpoint_id_ = id > storage->checkpoint_id_ ? id : storage->checkpoint_id_ + 1;
+    LOG(INFO) << "[storage] Success to create new checkpoint(id: " << storage->checkpoint_id_
+              << "), seq: " << storage->checkpoint_seq_;
+  }
+
+  std::vector<std::string> children;
+  auto s = env->GetChildren(dir, &children);
+  if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+  std::string files;
+  uint64_t num_files = 0, total_size = 0;
+  for (const auto &child : children) {
+    if (child == "." || child == "..") continue;
+    uint64_t file_size = 0;
+    s = env->GetFileSize(dir + "/" + child, &file_size);
+    if (!s.ok()) return Status(Status::DBBackupErr, s.ToString());
+    files.append(child + " " + std::to_string(file_size) + "\n");
+    num_files++;
+    total_size += file_size;
+  }
+  *meta = std::to_string(storage->checkpoint_seq_) + "\n" + std::to_string(num_files) + "\n" + files;
+  *checkpoint_id = storage->checkpoint_id_;
+  storage->checkpoint_refs_++;
+  LOG(INFO) << "[storage] The checkpoint(id: " << storage->checkpoint_id_ << ") has " << num_files
+            << " files, size: " << total_size << ", refs: " << storage->checkpoint_refs_;
+  return Status::OK();
+}
+
+int Storage::BackupManager::OpenCheckpointFile(Storage *storage, uint64_t checkpoint_id,
+                                               const std::string &rel_path, uint64_t *file_size) {
+  {
+    std::lock_guard<std::mutex> guard(storage->checkpoint_mu_);
+    if (storage->checkpoint_refs_ == 0 || storage->checkpoint_id_ != checkpoint_id) {
+      LOG(ERROR) << "[storage] The checkpoint(id: " << checkpoint_id << ") was expired";
+      return -1;
+    }
+  }
+  if (!isValidCheckpointFile(rel_path)) {
+    LOG(ERROR) << "[storage] Invalid checkpoint file: " << rel_path;
+    return -1;
+  }
+  std::string abs_path = storage->config_->sync_checkpoint_dir + "/" + rel_path;
+  auto s = storage->backup_env_->GetFileSize(abs_path, file_size);
+  if (!s.ok()) {
+    LOG(ERROR) << "[storage] Checkpoint file [" << abs_path << "] not found";
+    return -1;
+  }
+  // the opened file was still readable after the checkpoint was purged
+  auto rv = open(abs_path.c_str(), O_RDONLY);
+  if (rv < 0) {
+    LOG(ERROR) << "[storage] Failed to open file: " << strerror(errno);
+  }
+  return rv;
+}
+
+void Storage::BackupManager::ReleaseCheckpoint(Storage *storage, uint64_t checkpoint_id) {
+  std::lock_guard<std::mutex> guard(storage->checkpoint_mu_);
+  if (storage->checkpoint_refs_ == 0 || storage->checkpoint_id_ != checkpoint_id) return;
+  storage->checkpoint_refs_--;
+  LOG(INFO) << "[storage] The checkpoint(id: " << checkpoint_id << ") was released, refs: "
+            << storage->checkpoint_refs_;
+}
+
 Storage::BackupManager::MetaInfo Storage::BackupManager::ParseMetaAndSave(
     Storage *storage, rocksdb::BackupID meta_id, evbuffer *evbuf) {
   char *line;
@@ -715,6 +999,77 @@ bool Storage::BackupManager::FileExists(Storage *storage, const std::string &rel
   return crc == tmp_crc;
 }
 
+Storage::BackupManager::CheckpointMetaInfo Storage::BackupManager::ParseCheckpointMeta(evbuffer *evbuf) {
+  char *line;
+  size_t len;
+  Storage::BackupManager::CheckpointMetaInfo meta;
+  // sequence
+  line = evbuffer_readln(evbuf, &len, EVBUFFER_EOL_LF);
+  if (!line) return meta;
+  meta.seq = std::strtoull(line, nullptr, 10);
+  free(line);
+  // file count
+  line = evbuffer_readln(evbuf, &len, EVBUFFER_EOL_LF);
+  if (!line) return meta;
+  free(line);
+  // file list
+  while ((line = evbuffer_readln(evbuf, &len, EVBUFFER_EOL_LF)) != nullptr) {
+    DLOG(INFO) << "[meta] file info: " << line;
+    auto sep = strchr(line, ' ');
+    if (sep) meta.files.emplace_back(std::string(line, sep - line), std::strtoull(sep + 1, nullptr, 10));
+    free(line);
+    if (sep && !isValidCheckpointFile(meta.files.back().first)) {
+      LOG(ERROR) << "[meta] Invalid checkpoint file: " << meta.files.back().first;
+      // the meta with no files was rejected by the caller
+      evbuffer_drain(evbuf, evbuffer_get_length(evbuf));
+      meta.files.clear();
+      return meta;
+    }
+  }
+  return meta;
+}
+
+Status Storage::BackupManager::PrepareCheckpointDir(Storage *storage) {
+  auto dir = restoringCheckpointDir(storage->config_);
+  auto status = RemoveDirRecursively(storage->backup_env_, dir);
+  if (!status.IsOK()) return status;
+  return MkdirRecursively(storage->backup_env_, dir);
+}
+
+std::unique_ptr<rocksdb::WritableFile> Storage::BackupManager::NewCheckpointTmpFile(
+    Storage *storage, const std::string &rel_path) {
+  if (!isValidCheckpointFile(rel_path)) {
+    LOG(ERROR) << "[storage] Invalid checkpoint file: " << rel_path;
+    return nullptr;
+  }
+  std::string tmp_path = restoringCheckpointDir(storage->config_) + "/" + rel_path + ".tmp";
+  std::unique_ptr<rocksdb::WritableFile> wf;
+  auto s = storage->backup_env_->NewWritableFile(tmp_path, &wf, rocksdb::EnvOptions());
+  if (!s.ok()) {
+    LOG(ERROR) << "[storage] Failed to create checkpoint file: " << s.ToString();
+    return nullptr;
+  }
+  return wf;
+}
+
+Status Storage::BackupManager::SwapCheckpointTmpFile(Storage *storage, const std::string &rel_path) {
+  if (!isValidCheckpointFile(rel_path)) return Status(Status::NotOK, "invalid checkpoint file: " + rel_path);
+  std::string orig_path = restoringCheckpointDir(storage->config_) + "/" + rel_path;
+  std::string tmp_path = orig_path + ".tmp";
+  // The checkpoint files were sent without the checksum to avoid reading the
+  // whole db on the master, so verify the block checksums of the sst files here.
+  if (rel_path.size() > 4 && rel_path.compare(rel_path.size() - 4, 4, ".sst") == 0) {
+    rocksdb::SstFileReader reader((rocksdb::Options()));
+    auto s = reader.Open(tmp_path);
+    if (s.ok()) s = reader.VerifyChecksum();
+    if (!s.ok()) return Status(Status::NotOK, "corrupted sst file " + rel_path + ": " + s.ToString());
+  }
+  if (!storage->backup_env_->RenameFile(tmp_path, orig_path).ok()) {
+    return Status(Status::NotOK, "unable to rename: " + tmp_path);
+  }
+  return Status::OK();
+}
+
 void Storage::PurgeBackupIfNeed(uint32_t next_backup_id) {
   std::vector<rocksdb::BackupInfo> backup_infos;
   backup_->GetBackupInfo(&backup_infos);
@@ -6,9 +6,12 @@
 #include <string>
 #include <vector>
 #include <atomic>
+#include <condition_variable>
+#include <mutex>
 #include <rocksdb/db.h>
 #include <rocksdb/options.h>
 #include <rocksdb/utilities/backupable_db.h>
+#include <rocksdb/version.h>
 #include <event2/bufferevent.h>
 
 #include "status.h"
@@ -30,6 +33,8 @@ extern const char *kSubkeyColumnFamilyName;
 extern const char *kSlotMetadataColumnFamilyName;
 extern const char *kSlotColumnFamilyName;
 
+Status RemoveDirRecursively(rocksdb::Env *env, const std::string &dir);
+
 class Storage {
  public:
   explicit Storage(Config *config);
@@ -41,15 +46,18 @@ class Storage {
   void CloseDB();
   void InitOptions(rocksdb::Options *options);
   Status SetColumnFamilyOption(const std::string &key, const std::string &value);
+  Status SetColumnFamilyOption(const std::string &cf_name, const std::string &key, const std::string &value);
   Status SetOption(const std::string &key, const std::string &value);
   Status SetDBOption(const std::string &key, const std::string &value);
   Status CreateColumnFamilies(const rocksdb::Options &options);
   Status CreateBackup();
   Status DestroyBackup();
   Status RestoreFromBackup();
+  Status RestoreFromCheckpoint();
+  void PurgeSyncCheckpointIfNeed();
   Status GetWALIter(rocksdb::SequenceNumber seq,
                     std::unique_ptr<rocksdb::TransactionLogIterator> *iter);
-  Status WriteBatch(std::string &&raw_batch);
+  Status WriteBatch(rocksdb::WriteBatch *batch);
   rocksdb::SequenceNumber LatestSeq();
   rocksdb::Status Write(const rocksdb::WriteOptions& options, rocksdb::WriteBatch* updates);
   rocksdb::Status Delete(const rocksdb::WriteOptions &options,
@@ -57,9 +65,30 @@ class Storage {
                          const rocksdb::Slice &key);
   rocksdb::Status DeleteRange(const std::string &first_key, const std::string &last_key);
   bool WALHasNewData(rocksdb::SequenceNumber seq) { return seq <= LatestSeq(); }
+  // Wait until the WAL has the data of the seq or the timeout, it was woken up by
+  // the writes instead of polling. Return true if the WAL has the new data.
+  bool WaitForWALData(rocksdb::SequenceNumber seq, int64_t timeout_ms);
   void PurgeBackupIfNeed(uint32_t next_backup_id);
 
+  // The replica applier publishes the seq of the last fully applied batch, and
+  // the reads on the slave share the snapshot of it, which was refreshed only
+  // after the visible seq was advanced.
+  void SetVisibleSeq(rocksdb::SequenceNumber seq) { visible_seq_ = seq; }
+  rocksdb::SequenceNumber GetVisibleSeq() { return visible_seq_; }
+  // Return nullptr if the db is closing. The snapshot holds a db ref until it
+  // was released, so it must not be kept while the db might be closed.
+  std::shared_ptr<const rocksdb::Snapshot> GetVisibleSnapshot();
+  void ReleaseVisibleSnapshot();
+  // The reads of the current thread use the pinned snapshot instead of
+  // creating a new one, see Redis::Database::LatestSnapShot.
+  static void PinSnapshot(const rocksdb::Snapshot *snapshot) { pinned_snapshot_ = snapshot; }
+  static const rocksdb::Snapshot *GetPinnedSnapshot() { return pinned_snapshot_; }
+
   rocksdb::Status Compact(const rocksdb::Slice *begin, const rocksdb::Slice *end);
+  // Compact the key range of the column family with a db ref held, the non-exclusive
+  // compactions were allowed to run in parallel with other manual compactions.
+  rocksdb::Status Compact(const std::string &cf_name, const rocksdb::Slice *begin, const rocksdb::Slice *end,
+                          bool exclusive = true);
   rocksdb::DB *GetDB();
   bool IsClosing() { return db_closing_; }
   Status IncrDBRefs();
@@ -77,7 +106,15 @@ class Storage {
   void IncrFlushCount(uint64_t n) { flush_count_.fetch_add(n); }
   uint64_t GetCompactionCount() { return compaction_count_; }
   void IncrCompactionCount(uint64_t n) { compaction_count_.fetch_add(n); }
+  uint64_t GetCompactionFilterLookups() { return compaction_filter_lookups_; }
+  uint64_t GetCompactionFilterSeeks() { return compaction_filter_seeks_; }
+  void IncrCompactionFilterLookups(bool seek) {
+    compaction_filter_lookups_.fetch_add(1, std::memory_order_relaxed);
+    if (seek) compaction_filter_seeks_.fetch_add(1, std::memory_order_relaxed);
+  }
   bool CodisEnabled() { return config_->codis_enabled; }
+  bool BitmapContainerEnabled() { return config_->bitmap_container_encoding; }
+  size_t HLLSparseMaxBytes() { return static_cast<size_t>(config_->hll_sparse_max_bytes); }
 
   Storage(const Storage &) = delete;
   Storage &operator=(const Storage &) = delete;
@@ -91,6 +128,13 @@ class Storage {
                                  uint64_t *file_size);
     static int OpenDataFile(Storage *storage, const std::string &rel_path,
                             uint64_t *file_size);
+    // The checkpoint was made of the hard links to the live files, and shared by
+    // the slaves which were doing the full sync at the same time. It was released
+    // when the slave finished fetching, and purged after all slaves released it.
+    static Status OpenCheckpointMeta(Storage *storage, uint64_t *checkpoint_id, std::string *meta);
+    static int OpenCheckpointFile(Storage *storage, uint64_t checkpoint_id,
+                                  const std::string &rel_path, uint64_t *file_size);
+    static void ReleaseCheckpoint(Storage *storage, uint64_t checkpoint_id);
 
     // Slave side
     struct MetaInfo {
@@ -107,6 +151,17 @@ class Storage {
         Storage *storage, const std::string &rel_path);
     static Status SwapTmpFile(Storage *storage, const std::string &rel_path);
     static bool FileExists(Storage *storage, const std::string &rel_path, uint32_t crc);
+
+    struct CheckpointMetaInfo {
+      rocksdb::SequenceNumber seq = 0;
+      // [[filename, size]...]
+      std::vector<std::pair<std::string, uint64_t>> files;
+    };
+    static CheckpointMetaInfo ParseCheckpointMeta(evbuffer *evbuf);
+    static Status PrepareCheckpointDir(Storage *storage);
+    static std::unique_ptr<rocksdb::WritableFile> NewCheckpointTmpFile(
+        Storage *storage, const std::string &rel_path);
+    static Status SwapCheckpointTmpFile(Storage *storage, const std::string &rel_path);
   };
 
   void SetDBInRetryableIOError(bool yes_or_no) { db_in_retryable_io_error_ = yes_or_no; }
@@ -125,11 +180,31 @@ class Storage {
   bool reach_db_size_limit_ = false;
   std::atomic<uint64_t> flush_count_{0};
   std::atomic<uint64_t> compaction_count_{0};
+  std::atomic<uint64_t> compaction_filter_lookups_{0};
+  std::atomic<uint64_t> compaction_filter_seeks_{0};
+
+  std::mutex checkpoint_mu_;
+  uint64_t checkpoint_id_ = 0;
+  rocksdb::SequenceNumber checkpoint_seq_ = 0;
+  int checkpoint_refs_ = 0;
+
+  std::mutex wal_notify_mu_;
+  std::condition_variable wal_notify_cv_;
+  std::atomic<int> wal_waiters_{0};
+
+  std::mutex visible_snapshot_mu_;
+  std::shared_ptr<const rocksdb::Snapshot> visible_snapshot_;
+  std::atomic<rocksdb::SequenceNumber> visible_seq_{0};
+  static thread_local const rocksdb::Snapshot *pinned_snapshot_;
 
   std::mutex db_mu_;
   int db_refs_ = 0;
   bool db_closing_ = true;
   bool db_in_retryable_io_error_ = false;
+
+  void notifyWALWaiters();
+  rocksdb::Status compact(rocksdb::ColumnFamilyHandle *cf_handle, const rocksdb::Slice *begin,
+                          const rocksdb::Slice *end, bool exclusive);
 };
 
 }  // namespace Engine
@@ -2,12 +2,10 @@
 #include <utility>
 #include "encoding.h"
 #include "redis_metadata.h"
-#include "server.h"
 
 rocksdb::Status
 CompactOnExpiredCollector::AddUserKey(const rocksdb::Slice &key, const rocksdb::Slice &value,
     rocksdb::EntryType entry_type, rocksdb::SequenceNumber, uint64_t) {
-  int now;
   uint8_t type;
   uint32_t expired, subkeys = 0;
   uint64_t version;
@@ -39,8 +37,7 @@ CompactOnExpiredCollector::AddUserKey(const rocksdb::Slice &key, const rocksdb::
       GetFixed32(&cv, &subkeys);
   }
   total_keys_ += subkeys;
-  now = Server::GetUnixTime();
-  if ((expired > 0 && expired < static_cast<uint32_t>(now))
+  if ((expired > 0 && expired < static_cast<uint32_t>(now_))
       || (type != kRedisString && subkeys == 0)) {
     deleted_keys_ += subkeys + 1;
   }
@@ -3,12 +3,16 @@
 #include <utility>
 #include <string>
 #include <memory>
+#include <rocksdb/env.h>
 #include <rocksdb/table_properties.h>
 
 class CompactOnExpiredCollector : public rocksdb::TablePropertiesCollector {
  public:
   explicit CompactOnExpiredCollector(const std::string &cf_name, float trigger_threshold)
-      : cf_name_(cf_name), trigger_threshold_(trigger_threshold) {}
+      : cf_name_(cf_name), trigger_threshold_(trigger_threshold) {
+    // the table was built in a short time, so the clock was read once per table
+    rocksdb::Env::Default()->GetCurrentTime(&now_);
+  }
   const char * Name() const override { return "compact_on_expired_collector"; }
   bool NeedCompact() const override;
   rocksdb::Status AddUserKey(const rocksdb::Slice &key, const rocksdb::Slice &value,
@@ -21,6 +25,7 @@ class CompactOnExpiredCollector : public rocksdb::TablePropertiesCollector {
   float trigger_threshold_;
   int64_t total_keys_ = 0;
   int64_t deleted_keys_ = 0;
+  int64_t now_ = 0;
   std::string start_key_;
   std::string stop_key_;
 };
@@ -10,6 +10,7 @@
 #include <pthread.h>
 #include <fcntl.h>
 #include <math.h>
+#include <limits.h>
 #include <string>
 #include <algorithm>
 #include <event2/util.h>
@@ -182,6 +183,28 @@ Status SockSend(int fd, const std::string &data) {
   return Status::OK();
 }
 
+Status SockSendv(int fd, std::vector<iovec> *iov) {
+  size_t start = 0;
+  while (start < iov->size()) {
+    int iovcnt = static_cast<int>(std::min<size_t>(iov->size() - start, IOV_MAX));
+    ssize_t nwritten = writev(fd, iov->data() + start, iovcnt);
+    if (nwritten == -1) {
+      if (errno == EINTR) continue;
+      return Status(Status::NotOK, strerror(errno));
+    }
+    // skip the buffers which were written, and adjust the partial written one
+    while (start < iov->size() && nwritten >= static_cast<ssize_t>((*iov)[start].iov_len)) {
+      nwritten -= (*iov)[start].iov_len;
+      start++;
+    }
+    if (nwritten > 0) {
+      (*iov)[start].iov_base = static_cast<char *>((*iov)[start].iov_base) + nwritten;
+      (*iov)[start].iov_len -= nwritten;
+    }
+  }
+  return Status::OK();
+}
+
 Status SockReadLine(int fd, std::string *data) {
   size_t line_len;
   evbuffer *evbuf = evbuffer_new();
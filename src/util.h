@@ -3,6 +3,7 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #include <cctype>
 #include <string>
@@ -43,6 +44,8 @@ Status SockConnect(std::string host, uint32_t port, int *fd, uint64_t conn_timeo
 Status SockSetTcpNoDelay(int fd, int val);
 Status SockSetTcpKeepalive(int fd, int interval);
 Status SockSend(int fd, const std::string &data);
+// Send all the buffers with writev, the iovecs were consumed while sending
+Status SockSendv(int fd, std::vector<iovec> *iov);
 Status SockReadLine(int fd, std::string *data);
 int GetPeerAddr(int fd, std::string *addr, uint32_t *port);
 bool IsPortInUse(int port);
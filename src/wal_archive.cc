@@ -0,0 +1,395 @@
+#include "wal_archive.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <glog/logging.h>
+#include <rocksdb/write_batch.h>
+
+#include "rocksdb_crc32c.h"
+
+namespace WALArchive {
+
+const char *kCheckpointInfoFile = "CHECKPOINT_INFO";
+
+namespace {
+
+const char *kSegmentSuffix = ".wal";
+const char *kTmpSegmentSuffix = ".wal.tmp";
+const size_t kRecordHeaderSize = 20;
+const size_t kRecordMaxSize = 1024 * 1024 * 1024;
+
+void putFixed32(std::string *dst, uint32_t value) {
+  for (int i = 0; i < 4; i++, value >>= 8) dst->push_back(static_cast<char>(value & 0xff));
+}
+
+void putFixed64(std::string *dst, uint64_t value) {
+  for (int i = 0; i < 8; i++, value >>= 8) dst->push_back(static_cast<char>(value & 0xff));
+}
+
+uint32_t getFixed32(const char *ptr) {
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; i--) value = (value << 8) | static_cast<uint8_t>(ptr[i]);
+  return value;
+}
+
+uint64_t getFixed64(const char *ptr) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) value = (value << 8) | static_cast<uint8_t>(ptr[i]);
+  return value;
+}
+
+bool hasSuffix(const std::string &name, const std::string &suffix) {
+  return name.size() > suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool parseSeq(const std::string &str, rocksdb::SequenceNumber *seq) {
+  if (str.empty() || !std::all_of(str.begin(), str.end(), ::isdigit)) return false;
+  try {
+    *seq = std::stoull(str);
+  } catch (const std::exception &e) {
+    return false;
+  }
+  return true;
+}
+
+std::string seqName(rocksdb::SequenceNumber seq) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%020" PRIu64, static_cast<uint64_t>(seq));
+  return buf;
+}
+
+Status copyFile(rocksdb::Env *env, const std::string &src, const std::string &dst) {
+  std::unique_ptr<rocksdb::SequentialFile> src_file;
+  std::unique_ptr<rocksdb::WritableFile> dst_file;
+  auto s = env->NewSequentialFile(src, &src_file, rocksdb::EnvOptions());
+  if (s.ok()) s = env->NewWritableFile(dst, &dst_file, rocksdb::EnvOptions());
+  std::string buf(1024 * 1024, 0);
+  while (s.ok()) {
+    rocksdb::Slice data;
+    s = src_file->Read(buf.size(), &data, &buf[0]);
+    if (!s.ok() || data.empty()) break;
+    s = dst_file->Append(data);
+  }
+  if (s.ok()) s = dst_file->Sync();
+  if (s.ok()) s = dst_file->Close();
+  if (!s.ok()) return Status(Status::NotOK, "failed to copy " + src + ": " + s.ToString());
+  return Status::OK();
+}
+
+}  // namespace
+
+std::string SegmentDir(const std::string &archive_dir) {
+  return archive_dir + "/wal";
+}
+
+std::string CheckpointDir(const std::string &archive_dir) {
+  return archive_dir + "/checkpoints";
+}
+
+std::string HistoryDir(const std::string &archive_dir) {
+  return archive_dir + "/history";
+}
+
+std::string SegmentPath(const std::string &archive_dir, rocksdb::SequenceNumber first_seq, bool closed) {
+  return SegmentDir(archive_dir) + "/" + seqName(first_seq) + (closed ? kSegmentSuffix : kTmpSegmentSuffix);
+}
+
+std::string CheckpointPath(const std::string &archive_dir, rocksdb::SequenceNumber seq) {
+  return CheckpointDir(archive_dir) + "/" + seqName(seq);
+}
+
+Status ListSegments(rocksdb::Env *env, const std::string &archive_dir, std::vector<SegmentInfo> *segments) {
+  segments->clear();
+  auto dir = SegmentDir(archive_dir);
+  if (!env->FileExists(dir).ok()) return Status::OK();
+  std::vector<std::string> children;
+  auto s = env->GetChildren(dir, &children);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  for (const auto &child : children) {
+    SegmentInfo segment;
+    std::string seq_str;
+    if (hasSuffix(child, kTmpSegmentSuffix)) {
+      seq_str = child.substr(0, child.size() - strlen(kTmpSegmentSuffix));
+    } else if (hasSuffix(child, kSegmentSuffix)) {
+      seq_str = child.substr(0, child.size() - strlen(kSegmentSuffix));
+      segment.closed = true;
+    } else {
+      continue;
+    }
+    if (!parseSeq(seq_str, &segment.first_seq)) continue;
+    segment.path = dir + "/" + child;
+    segments->emplace_back(std::move(segment));
+  }
+  std::sort(segments->begin(), segments->end(), [](const SegmentInfo &a, const SegmentInfo &b) {
+    return a.first_seq < b.first_seq;
+  });
+  return Status::OK();
+}
+
+Status ListCheckpoints(rocksdb::Env *env, const std::string &archive_dir, std::vector<CheckpointInfo> *checkpoints) {
+  checkpoints->clear();
+  auto dir = CheckpointDir(archive_dir);
+  if (!env->FileExists(dir).ok()) return Status::OK();
+  std::vector<std::string> children;
+  auto s = env->GetChildren(dir, &children);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  for (const auto &child : children) {
+    CheckpointInfo checkpoint;
+    if (!parseSeq(child, &checkpoint.seq)) continue;
+    checkpoint.path = dir + "/" + child;
+    // the checkpoint without the info file wasn't finished
+    std::string info;
+    s = rocksdb::ReadFileToString(env, checkpoint.path + "/" + kCheckpointInfoFile, &info);
+    if (!s.ok()) continue;
+    rocksdb::SequenceNumber seq = 0;
+    long long time = 0;  // NOLINT
+    if (sscanf(info.c_str(), "%" SCNu64 " %lld", &seq, &time) != 2 || seq != checkpoint.seq) continue;
+    checkpoint.time = time;
+    checkpoints->emplace_back(std::move(checkpoint));
+  }
+  std::sort(checkpoints->begin(), checkpoints->end(), [](const CheckpointInfo &a, const CheckpointInfo &b) {
+    return a.seq < b.seq;
+  });
+  return Status::OK();
+}
+
+Status RetireArchive(rocksdb::Env *env, const std::string &archive_dir, std::string *retired_dir) {
+  auto history_dir = HistoryDir(archive_dir);
+  auto s = env->CreateDirIfMissing(history_dir);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  char buf[32];
+  time_t now = time(nullptr);
+  struct tm tm;
+  localtime_r(&now, &tm);
+  strftime(buf, sizeof(buf), "%Y%m%d-%H%M%S", &tm);
+  *retired_dir = history_dir + "/" + buf;
+  for (int i = 1; env->FileExists(*retired_dir).ok(); i++) {
+    *retired_dir = history_dir + "/" + buf + "-" + std::to_string(i);
+  }
+  s = env->CreateDir(*retired_dir);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+
+  std::vector<std::pair<std::string, std::string>> dirs = {
+      {SegmentDir(archive_dir), SegmentDir(*retired_dir)},
+      {CheckpointDir(archive_dir), CheckpointDir(*retired_dir)},
+  };
+  for (const auto &dir : dirs) {
+    if (env->FileExists(dir.first).ok()) {
+      s = env->RenameFile(dir.first, dir.second);
+      if (!s.ok()) return Status(Status::NotOK, "failed to retire " + dir.first + ": " + s.ToString());
+    }
+    s = env->CreateDir(dir.first);
+    if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  }
+  return Status::OK();
+}
+
+Status WriteCheckpointInfo(rocksdb::Env *env, const std::string &path, rocksdb::SequenceNumber seq, int64_t time) {
+  auto info = std::to_string(seq) + " " + std::to_string(time) + "\n";
+  auto s = rocksdb::WriteStringToFile(env, info, path + "/" + kCheckpointInfoFile, true);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+Status PickCheckpoint(rocksdb::Env *env, const std::string &archive_dir, rocksdb::SequenceNumber target_seq,
+                      int64_t target_time, CheckpointInfo *checkpoint) {
+  std::vector<CheckpointInfo> checkpoints;
+  auto s = ListCheckpoints(env, archive_dir, &checkpoints);
+  if (!s.IsOK()) return s;
+  const CheckpointInfo *base = nullptr;
+  for (const auto &info : checkpoints) {
+    if (target_seq != 0 && info.seq > target_seq) break;
+    if (target_time != 0 && info.time > target_time) break;
+    base = &info;
+  }
+  if (base == nullptr) return Status(Status::NotOK, "no checkpoint before the target in " + archive_dir);
+  *checkpoint = *base;
+  return Status::OK();
+}
+
+// The sst files were large and independent, so they were copied in parallel
+Status CopyCheckpoint(rocksdb::Env *env, const std::string &checkpoint_dir, const std::string &db_dir, int threads) {
+  std::vector<std::string> children, files;
+  auto s = env->GetChildren(checkpoint_dir, &children);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  for (const auto &child : children) {
+    if (child == "." || child == ".." || child == kCheckpointInfoFile) continue;
+    files.emplace_back(child);
+  }
+  s = env->CreateDirIfMissing(db_dir);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+
+  std::atomic<size_t> next_file{0};
+  std::atomic<bool> failed{false};
+  std::vector<Status> results(threads, Status::OK());
+  std::vector<std::thread> copy_threads;
+  for (int i = 0; i < threads; i++) {
+    copy_threads.emplace_back([&, i]() {
+      size_t n;
+      while (!failed && (n = next_file++) < files.size()) {
+        auto status = copyFile(env, checkpoint_dir + "/" + files[n], db_dir + "/" + files[n]);
+        if (!status.IsOK()) {
+          results[i] = status;
+          failed = true;
+        }
+      }
+    });
+  }
+  for (auto &t : copy_threads) t.join();
+  for (const auto &result : results) {
+    if (!result.IsOK()) return result;
+  }
+  LOG(INFO) << "Copied " << files.size() << " files of the checkpoint " << checkpoint_dir;
+  return Status::OK();
+}
+
+Status Replay(rocksdb::Env *env, const std::string &archive_dir, rocksdb::DB *db,
+              const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles,
+              rocksdb::SequenceNumber checkpoint_seq, rocksdb::SequenceNumber target_seq, int64_t target_time,
+              rocksdb::SequenceNumber *restored_seq) {
+  std::vector<SegmentInfo> segments;
+  auto status = ListSegments(env, archive_dir, &segments);
+  if (!status.IsOK()) return status;
+
+  rocksdb::WriteOptions write_opts;
+  // all the column families were flushed after replaying, so the WAL is useless here
+  write_opts.disableWAL = true;
+  rocksdb::SequenceNumber next_seq = checkpoint_seq + 1;
+  uint64_t batches = 0;
+  bool reached_target = false;
+  for (size_t i = 0; i < segments.size() && !reached_target; i++) {
+    // all the batches of the segment were before the next one
+    if (i + 1 < segments.size() && segments[i + 1].first_seq <= next_seq) continue;
+    SegmentReader reader;
+    status = reader.Open(env, segments[i].path);
+    if (!status.IsOK()) return status;
+    Record record;
+    bool eof = false;
+    while (true) {
+      status = reader.Next(&record, &eof);
+      if (!status.IsOK()) return Status(Status::NotOK, segments[i].path + ": " + status.Msg());
+      if (eof) break;
+      rocksdb::WriteBatch batch(std::move(record.batch));
+      auto last_seq = record.seq + batch.Count() - 1;
+      if (last_seq < next_seq) continue;
+      if (record.seq != next_seq) {
+        return Status(Status::NotOK, "the archived batches were discrete, sequence " + std::to_string(next_seq)
+                                     + " expected, but got " + std::to_string(record.seq));
+      }
+      if ((target_seq != 0 && last_seq > target_seq) || (target_time != 0 && record.time_ms / 1000 > target_time)) {
+        reached_target = true;
+        break;
+      }
+      auto s = db->Write(write_opts, &batch);
+      if (!s.ok()) return Status(Status::NotOK, "failed to write the batch " + std::to_string(record.seq)
+                                                + ": " + s.ToString());
+      next_seq = last_seq + 1;
+      if (++batches % 100000 == 0) LOG(INFO) << "Replayed " << batches << " batches to " << last_seq;
+    }
+  }
+  auto s = db->Flush(rocksdb::FlushOptions(), cf_handles);
+  if (!s.ok()) return Status(Status::NotOK, "failed to flush the db: " + s.ToString());
+  if (!reached_target && target_seq != 0 && next_seq <= target_seq) {
+    LOG(WARNING) << "The archive ended before the target seq " << target_seq;
+  }
+  LOG(INFO) << "Replayed " << batches << " batches since the checkpoint";
+  *restored_seq = next_seq - 1;
+  return Status::OK();
+}
+
+Status SegmentWriter::Open(rocksdb::Env *env, const std::string &path) {
+  auto s = env->NewWritableFile(path, &file_, rocksdb::EnvOptions());
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  size_ = 0;
+  return Status::OK();
+}
+
+Status SegmentWriter::Append(rocksdb::SequenceNumber seq, int64_t time_ms, const rocksdb::Slice &batch) {
+  std::string header;
+  header.reserve(kRecordHeaderSize);
+  putFixed64(&header, seq);
+  putFixed64(&header, static_cast<uint64_t>(time_ms));
+  putFixed32(&header, static_cast<uint32_t>(batch.size()));
+  uint32_t crc = rocksdb::crc32c::Extend(0, header.data(), header.size());
+  crc = rocksdb::crc32c::Extend(crc, batch.data(), batch.size());
+  std::string trailer;
+  putFixed32(&trailer, crc);
+
+  auto s = file_->Append(header);
+  if (s.ok()) s = file_->Append(batch);
+  if (s.ok()) s = file_->Append(trailer);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  size_ += header.size() + batch.size() + trailer.size();
+  return Status::OK();
+}
+
+Status SegmentWriter::Sync() {
+  auto s = file_->Flush();
+  if (s.ok()) s = file_->Sync();
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+Status SegmentWriter::Close() {
+  if (!file_) return Status::OK();
+  auto status = Sync();
+  auto s = file_->Close();
+  file_.reset();
+  if (!status.IsOK()) return status;
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+Status SegmentReader::Open(rocksdb::Env *env, const std::string &path) {
+  auto s = env->NewSequentialFile(path, &file_, rocksdb::EnvOptions());
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  offset_ = 0;
+  return Status::OK();
+}
+
+Status SegmentReader::read(size_t n, rocksdb::Slice *result) {
+  if (scratch_.size() < n) scratch_.resize(n);
+  auto s = file_->Read(n, result, &scratch_[0]);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  return Status::OK();
+}
+
+Status SegmentReader::Next(Record *record, bool *eof) {
+  *eof = false;
+  rocksdb::Slice result;
+  auto s = read(kRecordHeaderSize, &result);
+  if (!s.IsOK()) return s;
+  if (result.size() < kRecordHeaderSize) {
+    *eof = true;
+    return Status::OK();
+  }
+  std::string header = result.ToString();
+  record->seq = getFixed64(header.data());
+  record->time_ms = static_cast<int64_t>(getFixed64(header.data() + 8));
+  size_t size = getFixed32(header.data() + 16);
+  if (size > kRecordMaxSize) return Status(Status::NotOK, "the size of the record was corrupted");
+
+  s = read(size + 4, &result);
+  if (!s.IsOK()) return s;
+  if (result.size() < size + 4) {
+    *eof = true;
+    return Status::OK();
+  }
+  uint32_t crc = rocksdb::crc32c::Extend(0, header.data(), header.size());
+  crc = rocksdb::crc32c::Extend(crc, result.data(), size);
+  if (crc != getFixed32(result.data() + size)) {
+    return Status(Status::NotOK, "the crc of the record with seq " + std::to_string(record->seq) + " mismatched");
+  }
+  record->batch.assign(result.data(), size);
+  offset_ += kRecordHeaderSize + size + 4;
+  return Status::OK();
+}
+
+}  // namespace WALArchive
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rocksdb/db.h>
+#include <rocksdb/env.h>
+#include <rocksdb/slice.h>
+#include <rocksdb/types.h>
+
+#include "status.h"
+
+// The WAL archive dir was shared by the server and kvrocksrestore:
+//   wal/<first seq>.wal          the closed segments of the archived batches
+//   wal/<first seq>.wal.tmp      the segment which was being written
+//   checkpoints/<seq>/           the checkpoints of the db with the CHECKPOINT_INFO file
+//   history/<time>/              the retired archives of the older histories of the db,
+//                                and each of them has the same layout as the archive dir
+// The records of the segment were encoded as:
+//   seq(fixed64) | archived time in ms(fixed64) | size(fixed32) | batch | crc32c(fixed32)
+// and the crc32c covers all the preceding fields of the record.
+namespace WALArchive {
+
+extern const char *kCheckpointInfoFile;
+
+struct Record {
+  rocksdb::SequenceNumber seq = 0;
+  int64_t time_ms = 0;
+  std::string batch;
+};
+
+struct SegmentInfo {
+  std::string path;
+  rocksdb::SequenceNumber first_seq = 0;
+  bool closed = false;
+};
+
+struct CheckpointInfo {
+  std::string path;
+  rocksdb::SequenceNumber seq = 0;
+  int64_t time = 0;  // unix time in seconds
+};
+
+std::string SegmentDir(const std::string &archive_dir);
+std::string CheckpointDir(const std::string &archive_dir);
+std::string HistoryDir(const std::string &archive_dir);
+std::string SegmentPath(const std::string &archive_dir, rocksdb::SequenceNumber first_seq, bool closed);
+std::string CheckpointPath(const std::string &archive_dir, rocksdb::SequenceNumber seq);
+
+// The segments and checkpoints were sorted by the seq
+Status ListSegments(rocksdb::Env *env, const std::string &archive_dir, std::vector<SegmentInfo> *segments);
+Status ListCheckpoints(rocksdb::Env *env, const std::string &archive_dir, std::vector<CheckpointInfo> *checkpoints);
+// Move the segments and checkpoints into a new dir of the history dir, and
+// the archive dir was left empty for the new history of the db.
+Status RetireArchive(rocksdb::Env *env, const std::string &archive_dir, std::string *retired_dir);
+Status WriteCheckpointInfo(rocksdb::Env *env, const std::string &path, rocksdb::SequenceNumber seq, int64_t time);
+
+// The target_seq and target_time of the restore were 0 if they were the latest.
+// Pick the newest checkpoint not after the target as the base of the restore.
+Status PickCheckpoint(rocksdb::Env *env, const std::string &archive_dir, rocksdb::SequenceNumber target_seq,
+                      int64_t target_time, CheckpointInfo *checkpoint);
+// Copy the files of the checkpoint into the db dir with the parallel threads
+Status CopyCheckpoint(rocksdb::Env *env, const std::string &checkpoint_dir, const std::string &db_dir, int threads);
+// Replay the archived batches after the checkpoint seq until the target into
+// the db opened from the checkpoint, the batches must be contiguous since the
+// checkpoint. All the column families in cf_handles were flushed after replaying.
+// The restored_seq was set to the seq of the last replayed batch.
+Status Replay(rocksdb::Env *env, const std::string &archive_dir, rocksdb::DB *db,
+              const std::vector<rocksdb::ColumnFamilyHandle *> &cf_handles,
+              rocksdb::SequenceNumber checkpoint_seq, rocksdb::SequenceNumber target_seq, int64_t target_time,
+              rocksdb::SequenceNumber *restored_seq);
+
+class SegmentWriter {
+ public:
+  Status Open(rocksdb::Env *env, const std::string &path);
+  Status Append(rocksdb::SequenceNumber seq, int64_t time_ms, const rocksdb::Slice &batch);
+  Status Sync();
+  Status Close();
+  bool IsOpened() { return file_ != nullptr; }
+  uint64_t Size() { return size_; }
+
+ private:
+  std::unique_ptr<rocksdb::WritableFile> file_;
+  uint64_t size_ = 0;
+};
+
+class SegmentReader {
+ public:
+  Status Open(rocksdb::Env *env, const std::string &path);
+  // The eof was set at the end of the segment, and the torn record at the
+  // tail of the segment which was being written was treated as the end.
+  Status Next(Record *record, bool *eof);
+  // The size of the complete records which were read
+  uint64_t Offset() { return offset_; }
+
+ private:
+  std::unique_ptr<rocksdb::SequentialFile> file_;
+  std::string scratch_;
+  uint64_t offset_ = 0;
+
+  Status read(size_t n, rocksdb::Slice *result);
+};
+
+}  // namespace WALArchive
@@ -0,0 +1,371 @@
+#include "wal_archiver.h"
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <glog/logging.h>
+#include <rocksdb/utilities/checkpoint.h>
+
+#include "util.h"
+
+namespace {
+
+const uint64_t kMaxSegmentBytes = 64 * 1024 * 1024;
+const int kMaxSegmentSecs = 60;
+const int kSyncIntervalMs = 1000;
+const int kMaxIterFailures = 3;
+const int kCheckpointRetrySecs = 10;
+
+int64_t systemNowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+Status WALArchiver::Start() {
+  if (!IsEnabled()) return Status::OK();
+  auto env = rocksdb::Env::Default();
+  const auto &archive_dir = config_->wal_archive_dir;
+  for (const auto &dir : {archive_dir, WALArchive::SegmentDir(archive_dir), WALArchive::CheckpointDir(archive_dir)}) {
+    auto s = env->CreateDirIfMissing(dir);
+    if (!s.ok()) return Status(Status::NotOK, "failed to create the wal archive dir: " + s.ToString());
+  }
+  auto s = recover();
+  if (!s.IsOK()) return s;
+  try {
+    t_ = std::thread([this]() {
+      Util::ThreadSetName("wal-archiver");
+      this->loop();
+    });
+  } catch (const std::system_error &e) {
+    return Status(Status::NotOK, e.what());
+  }
+  return Status::OK();
+}
+
+void WALArchiver::Stop() {
+  stop_ = true;
+}
+
+void WALArchiver::Join() {
+  if (t_.joinable()) t_.join();
+}
+
+void WALArchiver::GetStats(WALArchiverStats *stats) {
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  *stats = stats_;
+}
+
+// Continue archiving after the last archived batch, the segment which was being
+// written when the server exited was truncated to its complete records and closed.
+Status WALArchiver::recover() {
+  auto env = rocksdb::Env::Default();
+  const auto &archive_dir = config_->wal_archive_dir;
+  std::vector<WALArchive::SegmentInfo> segments;
+  auto s = WALArchive::ListSegments(env, archive_dir, &segments);
+  if (!s.IsOK()) return s;
+
+  rocksdb::SequenceNumber last_seq = 0;
+  bool found = false;
+  while (!segments.empty() && !found) {
+    const auto &segment = segments.back();
+    WALArchive::SegmentReader reader;
+    s = reader.Open(env, segment.path);
+    if (!s.IsOK()) return s;
+    WALArchive::Record record;
+    bool eof = false;
+    while (true) {
+      s = reader.Next(&record, &eof);
+      // the record being written might be partially synced with the garbage
+      if (!s.IsOK() && !segment.closed) {
+        LOG(WARNING) << "[wal archiver] Dropped the torn tail of the segment " << segment.path << ", err: " << s.Msg();
+        break;
+      }
+      if (!s.IsOK()) return Status(Status::NotOK, "failed to read the segment " + segment.path + ": " + s.Msg());
+      if (eof) break;
+      last_seq = record.seq + rocksdb::WriteBatch(record.batch).Count() - 1;
+      found = true;
+    }
+    if (!found) {
+      env->DeleteFile(segment.path);
+      segments.pop_back();
+      continue;
+    }
+    if (!segment.closed) {
+      // the closed segment must not end with the torn record
+      if (truncate(segment.path.c_str(), static_cast<off_t>(reader.Offset())) != 0) {
+        return Status(Status::NotOK, "failed to truncate the segment " + segment.path + ": " + strerror(errno));
+      }
+      auto closed_path = WALArchive::SegmentPath(archive_dir, segment.first_seq, true);
+      auto rs = env->RenameFile(segment.path, closed_path);
+      if (!rs.ok()) return Status(Status::NotOK, "failed to close the segment " + segment.path + ": " + rs.ToString());
+    }
+  }
+
+  std::vector<WALArchive::CheckpointInfo> checkpoints;
+  s = WALArchive::ListCheckpoints(env, archive_dir, &checkpoints);
+  if (!s.IsOK()) return s;
+  if (!checkpoints.empty()) {
+    stats_.last_checkpoint_seq = checkpoints.back().seq;
+    stats_.last_checkpoint_time = checkpoints.back().time;
+  }
+
+  auto latest_seq = storage_->LatestSeq();
+  if (!found && !checkpoints.empty()) last_seq = checkpoints.back().seq;
+  if ((found || !checkpoints.empty()) && last_seq > latest_seq) {
+    // The db was restored to an older seq, so the seqs of the new batches
+    // would collide with the archived ones.
+    s = startNewHistory("the seq of the db went back to " + std::to_string(latest_seq));
+    if (!s.IsOK()) return s;
+  } else if (!found) {
+    // Nothing was archived yet, the archive starts from a new checkpoint of the db
+    next_seq_ = latest_seq + 1;
+    need_checkpoint_ = true;
+  } else {
+    next_seq_ = last_seq + 1;
+    if (checkpoints.empty()) need_checkpoint_ = true;
+  }
+  stats_.archived_seq = next_seq_ - 1;
+  LOG(INFO) << "[wal archiver] Would archive the WAL from " << next_seq_ << " into " << archive_dir;
+  return Status::OK();
+}
+
+void WALArchiver::loop() {
+  while (!stop_) {
+    if (!storage_->IncrDBRefs().IsOK()) {
+      // the db was closing for restoring, its history would be replaced
+      iter_ = nullptr;
+      db_ = nullptr;
+      db_reopened_ = true;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    if (need_checkpoint_ && std::chrono::steady_clock::now() >= checkpoint_retry_time_) {
+      need_checkpoint_ = false;
+      auto s = createCheckpoint();
+      if (!s.IsOK()) {
+        // the archive has no base to restore from until the checkpoint was created
+        LOG(ERROR) << "[wal archiver] Failed to create the checkpoint, would retry later, err: " << s.Msg();
+        checkpoint_retry_time_ = std::chrono::steady_clock::now() + std::chrono::seconds(kCheckpointRetrySecs);
+        need_checkpoint_ = true;
+      }
+    }
+    bool archived = false;
+    auto s = archiveNext(&archived);
+    if (s.IsOK() && !archived) storage_->WaitForWALData(next_seq_, 100);
+    storage_->DecrDBRefs();
+    if (!s.IsOK()) {
+      LOG(ERROR) << "[wal archiver] Failed to archive the WAL from " << next_seq_ << ", err: " << s.Msg();
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+
+    if (!writer_.IsOpened()) continue;
+    auto now = std::chrono::steady_clock::now();
+    Status sync_status;
+    if (now - segment_open_time_ >= std::chrono::seconds(kMaxSegmentSecs)) {
+      sync_status = closeSegment();
+    } else if (now - last_sync_time_ >= std::chrono::milliseconds(kSyncIntervalMs)) {
+      sync_status = writer_.Sync();
+      last_sync_time_ = now;
+    }
+    if (!sync_status.IsOK()) LOG(ERROR) << "[wal archiver] Failed to sync the segment, err: " << sync_status.Msg();
+  }
+  auto s = closeSegment();
+  if (!s.IsOK()) LOG(ERROR) << "[wal archiver] Failed to close the segment, err: " << s.Msg();
+}
+
+// Archive the next batch of the WAL, the archived was set to false if there
+// was no new data. The caller must hold the db ref.
+Status WALArchiver::archiveNext(bool *archived) {
+  *archived = false;
+  if (storage_->GetDB() != db_) {
+    iter_ = nullptr;
+    db_ = storage_->GetDB();
+  }
+  if (db_reopened_) return startNewHistory("the db was reopened after restoring");
+  auto latest_seq = storage_->LatestSeq();
+  if (next_seq_ > latest_seq + 1) {
+    return startNewHistory("the seq of the db went back to " + std::to_string(latest_seq));
+  }
+  if (next_seq_ > latest_seq) return Status::OK();
+
+  // The iterator stays at the last archived batch until the next batch was written
+  if (iter_ && iter_->Valid()) iter_->Next();
+  if (!iter_ || !iter_->Valid()) {
+    auto s = storage_->GetWALIter(next_seq_, &iter_);
+    if (!s.IsOK()) {
+      iter_ = nullptr;
+      // the WAL might have been purged before it was archived
+      if (++iter_failures_ >= kMaxIterFailures) {
+        restartFromLatest("failed to open the WAL iterator: " + s.Msg());
+        return Status::OK();
+      }
+      return s;
+    }
+  }
+  iter_failures_ = 0;
+  auto batch = iter_->GetBatch();
+  if (batch.sequence != next_seq_) {
+    restartFromLatest("the WAL iterator is discrete, sequence " + std::to_string(next_seq_) +
+                      " expected, but got " + std::to_string(batch.sequence));
+    return Status::OK();
+  }
+
+  auto env = rocksdb::Env::Default();
+  if (!writer_.IsOpened()) {
+    auto s = writer_.Open(env, WALArchive::SegmentPath(config_->wal_archive_dir, batch.sequence, false));
+    if (!s.IsOK()) return s;
+    segment_first_seq_ = batch.sequence;
+    segment_open_time_ = last_sync_time_ = std::chrono::steady_clock::now();
+  }
+  const auto &data = batch.writeBatchPtr->Data();
+  auto s = writer_.Append(batch.sequence, systemNowMs(), data);
+  if (!s.IsOK()) {
+    // The segment might end with a torn record, which was treated as its
+    // end, so the batch was retried in a new segment.
+    closeSegment();
+    return s;
+  }
+  next_seq_ = batch.sequence + batch.writeBatchPtr->Count();
+  {
+    std::lock_guard<std::mutex> guard(stats_mu_);
+    stats_.archived_seq = next_seq_ - 1;
+    stats_.archived_batches++;
+    stats_.archived_bytes += data.size();
+  }
+  if (writer_.Size() >= kMaxSegmentBytes) {
+    s = closeSegment();
+    if (!s.IsOK()) LOG(ERROR) << "[wal archiver] Failed to close the segment, err: " << s.Msg();
+  }
+  *archived = true;
+  return Status::OK();
+}
+
+Status WALArchiver::closeSegment() {
+  if (!writer_.IsOpened()) return Status::OK();
+  auto s = writer_.Close();
+  const auto &archive_dir = config_->wal_archive_dir;
+  auto rs = rocksdb::Env::Default()->RenameFile(WALArchive::SegmentPath(archive_dir, segment_first_seq_, false),
+                                                WALArchive::SegmentPath(archive_dir, segment_first_seq_, true));
+  if (!s.IsOK()) return s;
+  if (!rs.ok()) return Status(Status::NotOK, rs.ToString());
+  return Status::OK();
+}
+
+// The batches between the archived seq and the latest seq were lost, so the
+// older archives couldn't restore the db after the gap. Restart archiving from
+// the latest seq with a new checkpoint as the base.
+void WALArchiver::restartFromLatest(const std::string &reason) {
+  LOG(WARNING) << "[wal archiver] Would restart archiving from the latest seq with a new checkpoint, since "
+               << reason;
+  auto s = closeSegment();
+  if (!s.IsOK()) LOG(ERROR) << "[wal archiver] Failed to close the segment, err: " << s.Msg();
+  iter_ = nullptr;
+  iter_failures_ = 0;
+  next_seq_ = storage_->LatestSeq() + 1;
+  need_checkpoint_ = true;
+}
+
+// The db was replaced by another history, so the archived batches couldn't be
+// continued, and the batches of the new history might have the same seqs.
+// Retire the archive of the old history, which could still restore the db to
+// the point before, and restart archiving from the latest seq.
+Status WALArchiver::startNewHistory(const std::string &reason) {
+  LOG(WARNING) << "[wal archiver] Would start a new history of the archive, since " << reason;
+  auto s = closeSegment();
+  if (!s.IsOK()) LOG(ERROR) << "[wal archiver] Failed to close the segment, err: " << s.Msg();
+  std::string retired_dir;
+  s = WALArchive::RetireArchive(rocksdb::Env::Default(), config_->wal_archive_dir, &retired_dir);
+  if (!s.IsOK()) return Status(Status::NotOK, "failed to retire the archive: " + s.Msg());
+  LOG(INFO) << "[wal archiver] Retired the archive of the old history into " << retired_dir;
+  iter_ = nullptr;
+  iter_failures_ = 0;
+  db_reopened_ = false;
+  next_seq_ = storage_->LatestSeq() + 1;
+  need_checkpoint_ = true;
+  std::lock_guard<std::mutex> guard(stats_mu_);
+  stats_.archived_seq = next_seq_ - 1;
+  stats_.last_checkpoint_seq = 0;
+  stats_.last_checkpoint_time = 0;
+  return Status::OK();
+}
+
+// The caller must hold the db ref
+Status WALArchiver::createCheckpoint() {
+  auto env = rocksdb::Env::Default();
+  const auto &archive_dir = config_->wal_archive_dir;
+  auto tmp_dir = WALArchive::CheckpointDir(archive_dir) + "/tmp";
+  auto status = Engine::RemoveDirRecursively(env, tmp_dir);
+  if (!status.IsOK()) return status;
+
+  rocksdb::Checkpoint *checkpoint = nullptr;
+  auto s = rocksdb::Checkpoint::Create(storage_->GetDB(), &checkpoint);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  std::unique_ptr<rocksdb::Checkpoint> checkpoint_guard(checkpoint);
+  rocksdb::SequenceNumber seq = 0;
+  s = checkpoint->CreateCheckpoint(tmp_dir, 0, &seq);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  auto now = static_cast<int64_t>(time(nullptr));
+  status = WALArchive::WriteCheckpointInfo(env, tmp_dir, seq, now);
+  if (!status.IsOK()) return status;
+
+  // Never reuse the existing checkpoint with the same seq, replace it with the new one
+  auto checkpoint_dir = WALArchive::CheckpointPath(archive_dir, seq);
+  auto old_dir = checkpoint_dir + ".old";
+  bool replaced = env->FileExists(checkpoint_dir).ok();
+  if (replaced) {
+    status = Engine::RemoveDirRecursively(env, old_dir);
+    if (!status.IsOK()) return status;
+    s = env->RenameFile(checkpoint_dir, old_dir);
+    if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  }
+  s = env->RenameFile(tmp_dir, checkpoint_dir);
+  if (!s.ok()) return Status(Status::NotOK, s.ToString());
+  if (replaced) Engine::RemoveDirRecursively(env, old_dir);
+  {
+    std::lock_guard<std::mutex> guard(stats_mu_);
+    stats_.last_checkpoint_seq = seq;
+    stats_.last_checkpoint_time = now;
+  }
+  LOG(INFO) << "[wal archiver] Created the checkpoint with seq " << seq << " in " << checkpoint_dir;
+  purgeOldArchives();
+  return Status::OK();
+}
+
+// Keep the newest checkpoints, and the segments which have any batch after
+// the oldest kept checkpoint.
+void WALArchiver::purgeOldArchives() {
+  auto env = rocksdb::Env::Default();
+  const auto &archive_dir = config_->wal_archive_dir;
+  std::vector<WALArchive::CheckpointInfo> checkpoints;
+  auto s = WALArchive::ListCheckpoints(env, archive_dir, &checkpoints);
+  if (!s.IsOK() || checkpoints.empty()) return;
+  size_t keep = static_cast<size_t>(std::max(config_->wal_archive_keep_checkpoints, 1));
+  while (checkpoints.size() > keep) {
+    s = Engine::RemoveDirRecursively(env, checkpoints.front().path);
+    if (!s.IsOK()) {
+      LOG(WARNING) << "[wal archiver] Failed to purge the checkpoint " << checkpoints.front().path
+                   << ", err: " << s.Msg();
+      return;
+    }
+    LOG(INFO) << "[wal archiver] Purged the checkpoint " << checkpoints.front().path;
+    checkpoints.erase(checkpoints.begin());
+  }
+
+  auto oldest_seq = checkpoints.front().seq;
+  std::vector<WALArchive::SegmentInfo> segments;
+  s = WALArchive::ListSegments(env, archive_dir, &segments);
+  if (!s.IsOK()) return;
+  // All the batches of the segment were before the first seq of the next one
+  for (size_t i = 0; i + 1 < segments.size(); i++) {
+    if (!segments[i].closed || segments[i + 1].first_seq > oldest_seq + 1) break;
+    auto rs = env->DeleteFile(segments[i].path);
+    if (!rs.ok()) {
+      LOG(WARNING) << "[wal archiver] Failed to purge the segment " << segments[i].path << ", err: " << rs.ToString();
+      return;
+    }
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <rocksdb/db.h>
+
+#include "config.h"
+#include "status.h"
+#include "storage.h"
+#include "wal_archive.h"
+
+struct WALArchiverStats {
+  rocksdb::SequenceNumber archived_seq = 0;
+  uint64_t archived_batches = 0;
+  uint64_t archived_bytes = 0;
+  rocksdb::SequenceNumber last_checkpoint_seq = 0;
+  int64_t last_checkpoint_time = 0;
+};
+
+// WALArchiver archives the WAL batches continuously into the segments of the
+// wal-archive-dir, and creates the checkpoints periodically, so the db could be
+// restored to any seq or time after the oldest checkpoint by kvrocksrestore.
+// The segments older than the oldest kept checkpoint were purged. Once the db
+// was replaced by another history, e.g. restored from the backup or the master,
+// the archive of the old history was moved into the history dir.
+class WALArchiver {
+ public:
+  WALArchiver(Engine::Storage *storage, Config *config) : storage_(storage), config_(config) {}
+  ~WALArchiver() = default;
+
+  bool IsEnabled() { return !config_->wal_archive_dir.empty(); }
+  Status Start();
+  void Stop();
+  void Join();
+  // The checkpoint was created by the archiver thread later
+  void RequestCheckpoint() { need_checkpoint_ = true; }
+  void GetStats(WALArchiverStats *stats);
+
+ private:
+  Engine::Storage *storage_ = nullptr;
+  Config *config_ = nullptr;
+  std::thread t_;
+  std::atomic<bool> stop_{false};
+  rocksdb::DB *db_ = nullptr;  // the db which the iterator was opened on
+  std::unique_ptr<rocksdb::TransactionLogIterator> iter_;
+  rocksdb::SequenceNumber next_seq_ = 0;
+  WALArchive::SegmentWriter writer_;
+  rocksdb::SequenceNumber segment_first_seq_ = 0;
+  std::chrono::steady_clock::time_point segment_open_time_;
+  std::chrono::steady_clock::time_point last_sync_time_;
+  int iter_failures_ = 0;
+  bool db_reopened_ = false;
+  std::atomic<bool> need_checkpoint_{false};
+  std::chrono::steady_clock::time_point checkpoint_retry_time_;
+
+  std::mutex stats_mu_;
+  WALArchiverStats stats_;
+
+  void loop();
+  Status recover();
+  Status archiveNext(bool *archived);
+  Status closeSegment();
+  void restartFromLatest(const std::string &reason);
+  Status startNewHistory(const std::string &reason);
+  Status createCheckpoint();
+  void purgeOldArchives();
+};
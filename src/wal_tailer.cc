@@ -0,0 +1,150 @@
+#include "wal_tailer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <glog/logging.h>
+
+#include "redis_reply.h"
+#include "util.h"
+
+WALBatch::WALBatch(rocksdb::SequenceNumber seq, std::unique_ptr<rocksdb::WriteBatch> write_batch)
+    : seq(seq),
+      count(write_batch->Count()),
+      header("$" + std::to_string(write_batch->GetDataSize()) + CRLF),
+      batch(std::move(write_batch)) {}
+
+Status WALTailer::Start() {
+  try {
+    t_ = std::thread([this]() {
+      Util::ThreadSetName("wal-tailer");
+      this->loop();
+    });
+  } catch (const std::system_error &e) {
+    return Status(Status::NotOK, e.what());
+  }
+  return Status::OK();
+}
+
+void WALTailer::Stop() {
+  stop_ = true;
+  std::lock_guard<std::mutex> guard(mu_);
+  cond_.notify_all();
+}
+
+void WALTailer::Join() {
+  if (t_.joinable()) t_.join();
+}
+
+void WALTailer::loop() {
+  while (!stop_) {
+    if (subscribers_ == 0) {
+      reset();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    if (!storage_->IncrDBRefs().IsOK()) {
+      // the db was closing for restoring, restart tailing after it was reopened
+      reset();
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    if (!tailNext()) storage_->WaitForWALData(next_seq_, 100);
+    storage_->DecrDBRefs();
+  }
+  reset();
+}
+
+void WALTailer::reset() {
+  iter_ = nullptr;
+  db_ = nullptr;
+  std::lock_guard<std::mutex> guard(mu_);
+  ring_.clear();
+  ring_bytes_ = 0;
+  next_seq_ = 0;
+}
+
+// Tail the next batch into the ring, return false if there was no new data.
+// The next_seq_ was only modified by the tailer thread, so it's safe to read
+// it without the lock here. The caller must hold the db ref.
+bool WALTailer::tailNext() {
+  if (storage_->GetDB() != db_) {
+    // the db was reopened, the iterator and the batches in the ring belong to the old one
+    reset();
+    db_ = storage_->GetDB();
+  }
+  auto latest_seq = storage_->LatestSeq();
+  if (next_seq_ == 0 || next_seq_ > latest_seq + 1) {
+    // Start tailing from the latest seq, the slaves behind it would read the WAL
+    // by themselves. The db was restored if the seq went back, so restart as well.
+    if (next_seq_ != 0) reset();
+    std::lock_guard<std::mutex> guard(mu_);
+    next_seq_ = latest_seq + 1;
+    return false;
+  }
+  if (next_seq_ > latest_seq) return false;
+
+  // The iterator stays at the last tailed batch until the next batch was written
+  if (iter_ && iter_->Valid()) iter_->Next();
+  if (!iter_ || !iter_->Valid()) {
+    auto s = storage_->GetWALIter(next_seq_, &iter_);
+    if (!s.IsOK()) {
+      LOG(WARNING) << "[wal tailer] Failed to open the WAL iterator from " << next_seq_
+                   << ", err: " << s.Msg() << ", would restart tailing from the latest seq";
+      reset();
+      return false;
+    }
+  }
+  auto batch = iter_->GetBatch();
+  if (batch.sequence != next_seq_) {
+    LOG(WARNING) << "[wal tailer] The WAL iterator is discrete, sequence " << next_seq_
+                 << " expected, but got " << batch.sequence << ", would restart tailing from the latest seq";
+    reset();
+    return false;
+  }
+  append(std::make_shared<const WALBatch>(batch.sequence, std::move(batch.writeBatchPtr)));
+  return true;
+}
+
+void WALTailer::append(std::shared_ptr<const WALBatch> batch) {
+  std::lock_guard<std::mutex> guard(mu_);
+  ring_bytes_ += batch->Size();
+  next_seq_ = batch->seq + batch->count;
+  ring_.emplace_back(std::move(batch));
+  // the evicted batches were still alive if any slave was sending them
+  while (ring_bytes_ > max_bytes_ && ring_.size() > 1) {
+    ring_bytes_ -= ring_.front()->Size();
+    ring_.pop_front();
+  }
+  cond_.notify_all();
+}
+
+WALTailer::ReadResult WALTailer::Read(rocksdb::SequenceNumber seq, std::shared_ptr<const WALBatch> *batch) {
+  std::lock_guard<std::mutex> guard(mu_);
+  if (next_seq_ == 0) return kBehind;
+  if (seq >= next_seq_) return kNoData;
+  if (ring_.empty() || seq < ring_.front()->seq) return kBehind;
+  auto iter = std::upper_bound(ring_.begin(), ring_.end(), seq,
+                               [](rocksdb::SequenceNumber target, const std::shared_ptr<const WALBatch> &b) {
+                                 return target < b->seq;
+                               });
+  --iter;
+  // The seq was in the middle of the batch, let the slave's iterator report it
+  if ((*iter)->seq != seq) return kBehind;
+  *batch = *iter;
+  return kFound;
+}
+
+void WALTailer::WaitForData(rocksdb::SequenceNumber seq, int64_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mu_);
+  cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this, seq] {
+    return stop_ || (next_seq_ != 0 && seq < next_seq_);
+  });
+}
+
+void WALTailer::GetStats(WALTailerStats *stats) {
+  std::lock_guard<std::mutex> guard(mu_);
+  stats->batches = ring_.size();
+  stats->bytes = ring_bytes_;
+  stats->first_seq = ring_.empty() ? next_seq_ : ring_.front()->seq;
+  stats->next_seq = next_seq_;
+}
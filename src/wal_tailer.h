@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <rocksdb/db.h>
+
+#include "status.h"
+#include "storage.h"
+
+// The write batch read from the WAL, it was shared by all the slaves which
+// were feeding from the tailer, and the bulk header was encoded only once.
+struct WALBatch {
+  rocksdb::SequenceNumber seq = 0;
+  uint64_t count = 0;
+  std::string header;
+  std::unique_ptr<rocksdb::WriteBatch> batch;
+
+  WALBatch(rocksdb::SequenceNumber seq, std::unique_ptr<rocksdb::WriteBatch> batch);
+  size_t Size() const { return header.size() + batch->GetDataSize(); }
+};
+
+struct WALTailerStats {
+  uint64_t batches = 0;
+  uint64_t bytes = 0;
+  rocksdb::SequenceNumber first_seq = 0;
+  rocksdb::SequenceNumber next_seq = 0;
+};
+
+// WALTailer reads the WAL with one iterator and keeps the recent batches in
+// the ring, so the slaves don't read and decode the same WAL files again and
+// again. The slaves which lag behind the ring should read the WAL by themselves
+// until they catch up the ring. The tailer only works while it was subscribed.
+class WALTailer {
+ public:
+  enum ReadResult {
+    kFound,
+    kBehind,   // the seq was evicted from the ring
+    kNoData,   // the seq wasn't tailed yet
+  };
+
+  explicit WALTailer(Engine::Storage *storage, size_t max_bytes = kDefaultMaxBytes)
+      : storage_(storage), max_bytes_(max_bytes) {}
+  ~WALTailer() = default;
+
+  Status Start();
+  void Stop();
+  void Join();
+  void Subscribe() { subscribers_++; }
+  void Unsubscribe() { subscribers_--; }
+
+  // Get the batch starting from the seq, the batch was shared and should not be modified
+  ReadResult Read(rocksdb::SequenceNumber seq, std::shared_ptr<const WALBatch> *batch);
+  // Wait until the batch of the seq was tailed or the timeout
+  void WaitForData(rocksdb::SequenceNumber seq, int64_t timeout_ms);
+  void GetStats(WALTailerStats *stats);
+
+  static const size_t kDefaultMaxBytes = 32 * 1024 * 1024;
+
+ private:
+  Engine::Storage *storage_ = nullptr;
+  size_t max_bytes_;
+  std::thread t_;
+  std::atomic<bool> stop_{false};
+  std::atomic<int> subscribers_{0};
+  std::unique_ptr<rocksdb::TransactionLogIterator> iter_;
+  rocksdb::DB *db_ = nullptr;  // the db which the iterator was opened on
+
+  std::mutex mu_;
+  std::condition_variable cond_;
+  std::deque<std::shared_ptr<const WALBatch>> ring_;
+  size_t ring_bytes_ = 0;
+  // the seq of the next batch to be tailed, and the ring was empty before tailing
+  rocksdb::SequenceNumber next_seq_ = 0;
+
+  void loop();
+  bool tailNext();
+  void reset();
+  void append(std::shared_ptr<const WALBatch> batch);
+};
@@ -148,6 +148,11 @@ void Worker::Stop() {
   }
 }
 
+size_t Worker::GetConnectionsNum() {
+  std::unique_lock<std::mutex> lock(conns_mu_);
+  return conns_.size();
+}
+
 Status Worker::AddConnection(Redis::Connection *c) {
   std::unique_lock<std::mutex> lock(conns_mu_);
   auto iter = conns_.find(c->GetFD());
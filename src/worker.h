@@ -33,6 +33,8 @@ class Worker {
   Status EnableWriteEvent(int fd);
   Status Reply(int fd, const std::string &reply);
   bool IsRepl() { return repl_; }
+  event_base *GetEventBase() { return base_; }
+  size_t GetConnectionsNum();
   int SetReplicationRateLimit(uint64_t max_replication_bytes);
   void BecomeMonitorConn(Redis::Connection *conn);
   void FeedMonitorConns(Redis::Connection *conn, const std::vector<std::string> &tokens);
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "bit_util.h"
+
+static int64_t findFirstBitByBit(const uint8_t *p, size_t count, bool bit) {
+  for (size_t i = 0; i < count * 8; i++) {
+    if (((p[i / 8] >> (i % 8)) & 1) == bit) return static_cast<int64_t>(i);
+  }
+  return -1;
+}
+
+TEST(BitUtil, Popcount) {
+  std::vector<uint8_t> buf(4096 + 13);
+  srand(42);
+  for (auto &c : buf) c = static_cast<uint8_t>(rand());
+  // cover the unaligned head and the remaining tail of each implementation
+  for (size_t offset : {0, 1, 7}) {
+    for (size_t count : {0, 1, 7, 8, 31, 32, 33, 1024, 4096}) {
+      uint64_t expected = 0;
+      for (size_t i = 0; i < count; i++) expected += __builtin_popcount(buf[offset + i]);
+      EXPECT_EQ(expected, BitUtil::PopcountScalar(buf.data() + offset, count));
+      EXPECT_EQ(expected, BitUtil::Popcount(buf.data() + offset, count)) << BitUtil::PopcountImpl();
+    }
+  }
+  std::vector<uint8_t> ones(1024 * 1024, 0xff);
+  EXPECT_EQ(ones.size() * 8, BitUtil::Popcount(ones.data(), ones.size()));
+}
+
+TEST(BitUtil, FindFirstBitLSB) {
+  std::vector<uint8_t> zeros(1024, 0), ones(1024, 0xff);
+  EXPECT_EQ(-1, BitUtil::FindFirstBitLSB(zeros.data(), zeros.size(), true));
+  EXPECT_EQ(0, BitUtil::FindFirstBitLSB(zeros.data(), zeros.size(), false));
+  EXPECT_EQ(-1, BitUtil::FindFirstBitLSB(ones.data(), ones.size(), false));
+  EXPECT_EQ(0, BitUtil::FindFirstBitLSB(ones.data(), ones.size(), true));
+  for (size_t pos : {1, 7, 8, 63, 64, 65, 1000, 8191}) {
+    zeros[pos / 8] = static_cast<uint8_t>(1 << (pos % 8));
+    ones[pos / 8] = static_cast<uint8_t>(~(1 << (pos % 8)));
+    EXPECT_EQ(static_cast<int64_t>(pos), BitUtil::FindFirstBitLSB(zeros.data(), zeros.size(), true));
+    EXPECT_EQ(static_cast<int64_t>(pos), BitUtil::FindFirstBitLSB(ones.data(), ones.size(), false));
+    EXPECT_EQ(findFirstBitByBit(zeros.data() + 3, 17, true), BitUtil::FindFirstBitLSB(zeros.data() + 3, 17, true));
+    zeros[pos / 8] = 0;
+    ones[pos / 8] = 0xff;
+  }
+}
+
+TEST(BitUtil, MaxBytes) {
+  std::vector<uint8_t> a(1000 + 7), b(a.size());
+  srand(11);
+  for (size_t i = 0; i < a.size(); i++) {
+    a[i] = static_cast<uint8_t>(rand());
+    b[i] = static_cast<uint8_t>(rand());
+  }
+  for (size_t count : {0, 1, 15, 16, 31, 32, 33, 1000}) {
+    std::vector<uint8_t> dst(a.begin() + 1, a.begin() + 1 + count);
+    BitUtil::MaxBytes(dst.data(), b.data() + 7, count);
+    for (size_t i = 0; i < count; i++) {
+      EXPECT_EQ(std::max(a[i + 1], b[i + 7]), dst[i]);
+    }
+  }
+}
@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "bitmap_container.h"
+
+static void checkContainer(const std::string &raw, BitmapContainer::Type expected_type) {
+  std::string container, decoded;
+  BitmapContainer::Encode(raw.data(), raw.size(), &container);
+  EXPECT_EQ(expected_type, BitmapContainer::GetType(container.data(), container.size()));
+  EXPECT_LE(container.size(), raw.size() + 1);
+  ASSERT_TRUE(BitmapContainer::Decode(container.data(), container.size(), &decoded));
+  EXPECT_EQ(raw, decoded);
+  EXPECT_EQ(raw.size(), BitmapContainer::RawSize(container.data(), container.size()));
+
+  uint64_t cnt = 0;
+  for (uint32_t i = 0; i < raw.size() * 8 + 16; i++) {
+    bool bit = i < raw.size() * 8 && ((raw[i / 8] >> (i % 8)) & 1);
+    EXPECT_EQ(bit, BitmapContainer::GetBit(container.data(), container.size(), i)) << i;
+    cnt += bit;
+  }
+  EXPECT_EQ(cnt, BitmapContainer::Count(container.data(), container.size()));
+  EXPECT_EQ(cnt == 0, BitmapContainer::IsEmpty(container.data(), container.size()));
+}
+
+TEST(BitmapContainer, EncodeByDensity) {
+  std::string raw(1024, 0);
+  checkContainer(raw, BitmapContainer::kArray);
+  raw[0] = 1;
+  raw[1023] = static_cast<char>(0x80);
+  raw[100] = 0x24;
+  checkContainer(raw, BitmapContainer::kArray);
+
+  // long runs of set bits
+  std::string runs(1024, 0);
+  for (size_t i = 0; i < 100; i++) runs[i] = static_cast<char>(0xff);
+  for (size_t i = 500; i < 1024; i++) runs[i] = static_cast<char>(0xff);
+  runs[300] = 0x0f;
+  checkContainer(runs, BitmapContainer::kRun);
+
+  std::string dense(1024, 0);
+  srand(42);
+  for (auto &c : dense) c = static_cast<char>(rand());
+  checkContainer(dense, BitmapContainer::kBitmap);
+
+  checkContainer(std::string(), BitmapContainer::kBitmap);
+  checkContainer(std::string(1, 0x01), BitmapContainer::kBitmap);
+}
+
+TEST(BitmapContainer, RandomSparse) {
+  srand(7);
+  for (int round = 0; round < 50; round++) {
+    std::string raw(1 + rand() % 1024, 0);
+    int num_bits = rand() % 300;
+    for (int i = 0; i < num_bits; i++) {
+      uint32_t pos = rand() % (raw.size() * 8);
+      raw[pos / 8] |= static_cast<char>(1 << (pos % 8));
+    }
+    std::string container, decoded;
+    BitmapContainer::Encode(raw.data(), raw.size(), &container);
+    ASSERT_TRUE(BitmapContainer::Decode(container.data(), container.size(), &decoded));
+    EXPECT_EQ(raw, decoded);
+  }
+}
+
+TEST(BitmapContainer, DecodeCorrupted) {
+  std::string raw;
+  std::string unsorted = {BitmapContainer::kArray, 8, 0, 5, 0, 3, 0};
+  EXPECT_FALSE(BitmapContainer::Decode(unsorted.data(), unsorted.size(), &raw));
+  std::string out_of_range = {BitmapContainer::kRun, 1, 0, 4, 0, 8, 0};
+  EXPECT_FALSE(BitmapContainer::Decode(out_of_range.data(), out_of_range.size(), &raw));
+  std::string truncated = {BitmapContainer::kArray, 8, 0, 5};
+  EXPECT_FALSE(BitmapContainer::Decode(truncated.data(), truncated.size(), &raw));
+  std::string unknown = {9, 8, 0};
+  EXPECT_FALSE(BitmapContainer::Decode(unknown.data(), unknown.size(), &raw));
+}
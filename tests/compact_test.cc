@@ -1,4 +1,9 @@
 #include <gtest/gtest.h>
+#include <future>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "config.h"
 #include "storage.h"
@@ -74,3 +79,99 @@ TEST(Compact, Filter) {
 
   delete zset;
 }
+
+TEST(Compact, FilterInterleavedKeys) {
+  Config config;
+  config.db_dir = "compactdb_interleaved";
+  config.backup_dir = "compactdb_interleaved/backup";
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+
+  // The subkeys were sorted by key size first, so the keys with different
+  // sizes were interleaved when looking up the metadata in compaction.
+  int ret;
+  std::string ns = "test_compact";
+  auto hash = new Redis::Hash(storage_, ns);
+  std::set<std::string> live_keys;
+  for (int i = 0; i < 200; i++) {
+    std::string key = "key" + std::string(i % 7, 'x') + std::to_string(i);
+    hash->Set(key, "f1", "v1", &ret);
+    hash->Set(key, "f2", "v2", &ret);
+    if (i % 3 == 0) {
+      hash->Expire(key, 1);  // expired
+    } else if (i % 3 == 1) {
+      hash->Del(key);
+      hash->Set(key, "f3", "v3", &ret);  // recreated with the new version
+      live_keys.insert(key);
+    } else {
+      live_keys.insert(key);
+    }
+  }
+  usleep(10000);
+  auto status = storage_->Compact(nullptr, nullptr);
+  assert(status.ok());
+  EXPECT_GT(storage_->GetCompactionFilterLookups(), 0);
+
+  rocksdb::DB *db = storage_->GetDB();
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  std::map<std::string, std::vector<std::string>> fields;
+  auto iter = db->NewIterator(read_options, storage_->GetCFHandle("subkey"));
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    InternalKey ikey(iter->key());
+    fields[ikey.GetKey().ToString()].emplace_back(ikey.GetSubKey().ToString());
+  }
+  delete iter;
+  EXPECT_EQ(fields.size(), live_keys.size());
+  for (const auto &key : live_keys) {
+    std::vector<std::string> expected_fields = {"f1", "f2"};
+    if (fields[key].size() == 1) expected_fields = {"f3"};
+    EXPECT_EQ(fields[key], expected_fields);
+  }
+  delete hash;
+  delete storage_;
+}
+
+TEST(Compact, ParallelRanges) {
+  Config config;
+  config.db_dir = "compactdb_parallel";
+  config.backup_dir = "compactdb_parallel/backup";
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+
+  int ret;
+  std::string ns = "test_compact";
+  auto hash = new Redis::Hash(storage_, ns);
+  for (int i = 0; i < 200; i++) {
+    std::string key = "key" + std::to_string(i % 2) + "_" + std::to_string(i);
+    hash->Set(key, "f1", "v1", &ret);
+    hash->Del(key);
+    // every round was flushed into its own file, so both ranges had files to compact
+    if (i % 50 == 49) storage_->GetDB()->Flush(rocksdb::FlushOptions(), storage_->GetCFHandle("metadata"));
+  }
+  std::string begin0, end0, begin1, end1;
+  ComposeNamespaceKey(ns, "key0", &begin0);
+  ComposeNamespaceKey(ns, "key1", &end0);
+  ComposeNamespaceKey(ns, "key1", &begin1);
+  ComposeNamespaceKey(ns, "key2", &end1);
+  Slice begin0_slice(begin0), end0_slice(end0), begin1_slice(begin1), end1_slice(end1);
+
+  // The non-exclusive compactions of the different ranges ran in parallel, and
+  // neither of them should fail because of the other one.
+  auto f0 = std::async(std::launch::async, [&]() {
+    return storage_->Compact(Engine::kMetadataColumnFamilyName, &begin0_slice, &end0_slice, false);
+  });
+  auto f1 = std::async(std::launch::async, [&]() {
+    return storage_->Compact(Engine::kMetadataColumnFamilyName, &begin1_slice, &end1_slice, false);
+  });
+  auto s0 = f0.get();
+  auto s1 = f1.get();
+  EXPECT_TRUE(s0.ok()) << s0.ToString();
+  EXPECT_TRUE(s1.ok()) << s1.ToString();
+  delete hash;
+  delete storage_;
+}
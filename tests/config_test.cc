@@ -18,10 +18,24 @@ TEST(Config, GetAndSet) {
       {"masterauth" , "mytest_masterauth"},
       {"compact-cron" , "1 2 3 4 5"},
       {"bgsave-cron" , "5 4 3 2 1"},
+      {"wal-archive-checkpoint-cron" , "0 3 * * *"},
+      {"wal-archive-keep-checkpoints" , "5"},
+      {"compaction-checker-min-file-age" , "600"},
+      {"compaction-checker-force-compact-seconds" , "0"},
+      {"compaction-checker-delete-ratio-threshold" , "20"},
+      {"compaction-checker-max-parallel-ranges" , "8"},
+      {"compaction-checker-max-io-mb" , "2048"},
+      {"active-expire-keys-per-sec" , "5000"},
+      {"active-expire-max-delete-subkeys" , "256"},
+      {"bitmap-container-encoding" , "yes"},
+      {"hll-sparse-max-bytes" , "5000"},
       {"max-io-mb" , "5000"},
       {"max-db-size" , "6000"},
       {"max-replication-mb" , "7000"},
       {"slave-serve-stale-data" , "no"},
+      {"slave-fullsync-checkpoint" , "yes"},
+      {"slave-replication-compression" , "yes"},
+      {"slave-snapshot-read" , "no"},
       {"slave-read-only" , "no"},
       {"slave-priority" , "101"},
       {"slowlog-log-slower-than" , "1234"},
@@ -42,6 +56,9 @@ TEST(Config, GetAndSet) {
       {"rocksdb.compaction_readahead_size" , "1024"},
       {"rocksdb.level0_slowdown_writes_trigger" , "50"},
       {"rocksdb.level0_stop_writes_trigger", "100"},
+      {"rocksdb.metadata_max_bytes_for_level_multiplier", "8"},
+      {"rocksdb.subkey_max_bytes_for_level_multiplier", "12"},
+      {"rocksdb.pubsub_max_bytes_for_level_multiplier", "4"},
   };
   std::vector<std::string> values;
   for (const auto &iter : mutable_cases) {
@@ -72,11 +89,13 @@ TEST(Config, GetAndSet) {
       {"workers", "8"},
       {"repl-workers", "8"},
       {"tcp-backlog", "500"},
+      {"metrics-port", "9121"},
       {"codis-enabled", "yes"},
       {"slaveof", "no one"},
       {"db-name", "test_dbname"},
       {"dir", "test_dir"},
       {"backup-dir", "test_dir/backup"},
+      {"wal-archive-dir", "test_dir/archive"},
       {"pidfile", "test.pid"},
       {"supervised", "no"},
       {"rocksdb.block_size", "1234"},
@@ -88,6 +107,9 @@ TEST(Config, GetAndSet) {
       {"rocksdb.cache_index_and_filter_blocks", "no"},
       {"rocksdb.metadata_block_cache_size", "100"},
       {"rocksdb.subkey_block_cache_size", "100"},
+      {"rocksdb.metadata_compaction_style", "level"},
+      {"rocksdb.subkey_compaction_style", "universal"},
+      {"rocksdb.pubsub_level_compaction_dynamic_level_bytes", "yes"},
   };
   for (const auto &iter : immutable_cases) {
     auto s = config.Set(nullptr, iter.first, iter.second);
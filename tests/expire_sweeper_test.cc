@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "config.h"
+#include "storage.h"
+#include "expire_sweeper.h"
+#include "redis_metadata.h"
+#include "redis_hash.h"
+#include "redis_string.h"
+#include "redis_zset.h"
+
+TEST(ExpireSweeper, Sweep) {
+  Config config;
+  config.db_dir = "expiresweeperdb";
+  config.backup_dir = "expiresweeperdb/backup";
+  config.active_expire_max_delete_subkeys = 2;
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+
+  int ret;
+  std::string ns = "test_expire";
+  auto hash = new Redis::Hash(storage_, ns);
+  auto zset = new Redis::ZSet(storage_, ns);
+  auto string = new Redis::String(storage_, ns);
+  for (int i = 0; i < 10; i++) {
+    hash->Set("live_hash_key" + std::to_string(i), "f1", "v1", &ret);
+  }
+  hash->Set("expired_hash_key", "f1", "v1", &ret);
+  hash->Set("expired_hash_key", "f2", "v2", &ret);
+  hash->Expire("expired_hash_key", 1);
+  // too many subkeys to delete with the key
+  hash->Set("expired_big_hash_key", "f1", "v1", &ret);
+  hash->Set("expired_big_hash_key", "f2", "v2", &ret);
+  hash->Set("expired_big_hash_key", "f3", "v3", &ret);
+  hash->Expire("expired_big_hash_key", 1);
+  std::vector<MemberScore> member_scores =  {MemberScore{"z1", 1.1}, MemberScore{"z2", 0.4}};
+  zset->Add("expired_zset_key", 0, &member_scores, &ret);
+  zset->Expire("expired_zset_key", 1);
+  string->Set("expired_string_key", "v");
+  string->Expire("expired_string_key", 1);
+
+  ExpireSweeper sweeper(storage_, &config);
+  ExpireSweeperStats stats;
+  // sweep by small steps and the cursor should go through all keys
+  for (int i = 0; i < 7; i++) sweeper.Sweep(2);
+  sweeper.GetStats(&stats);
+  EXPECT_EQ(stats.expired_keys, 4U);
+  EXPECT_EQ(stats.deleted_subkeys, 2U + 2 * 2);
+  EXPECT_EQ(stats.scanned_keys, 14U);
+  EXPECT_EQ(stats.rounds, 1U);
+
+  rocksdb::DB *db = storage_->GetDB();
+  rocksdb::ReadOptions read_options;
+  auto iter = db->NewIterator(read_options, storage_->GetCFHandle("metadata"));
+  int live_keys = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    std::string user_key, user_ns;
+    ExtractNamespaceKey(iter->key(), &user_ns, &user_key);
+    EXPECT_EQ(user_key.find("live_hash_key"), 0U);
+    live_keys++;
+  }
+  delete iter;
+  EXPECT_EQ(live_keys, 10);
+
+  iter = db->NewIterator(read_options, storage_->GetCFHandle("zset_score"));
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    EXPECT_TRUE(false);  // never reach here
+  }
+  delete iter;
+
+  // the next round should start from the beginning
+  sweeper.Sweep(100);
+  sweeper.GetStats(&stats);
+  EXPECT_EQ(stats.expired_keys, 4U);
+  EXPECT_EQ(stats.scanned_keys, 24U);
+  EXPECT_EQ(stats.rounds, 2U);
+
+  delete string;
+  delete zset;
+  delete hash;
+  delete storage_;
+}
+
+TEST(ExpireSweeper, SweepMultipleBatches) {
+  Config config;
+  config.db_dir = "expiresweeperbatchdb";
+  config.backup_dir = "expiresweeperbatchdb/backup";
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+
+  std::string ns = "test_expire_batches";
+  auto string = new Redis::String(storage_, ns);
+  for (int i = 0; i < 20; i++) {
+    string->Set("expired_key" + std::to_string(i), "v");
+    string->Expire("expired_key" + std::to_string(i), 1);
+    string->Set("live_key" + std::to_string(i), "v");
+  }
+
+  ExpireSweeper sweeper(storage_, &config);
+  ExpireSweeperStats stats;
+  // each batch ends in the middle of the keys, and no key should be skipped
+  for (int i = 0; i < 100; i++) {
+    sweeper.Sweep(3);
+    sweeper.GetStats(&stats);
+    if (stats.rounds > 0) break;
+  }
+  EXPECT_EQ(stats.rounds, 1U);
+  EXPECT_EQ(stats.scanned_keys, 40U);
+  EXPECT_EQ(stats.expired_keys, 20U);
+
+  rocksdb::DB *db = storage_->GetDB();
+  auto iter = db->NewIterator(rocksdb::ReadOptions(), storage_->GetCFHandle("metadata"));
+  int live_keys = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    std::string user_key, user_ns;
+    ExtractNamespaceKey(iter->key(), &user_ns, &user_key);
+    EXPECT_EQ(user_key.find("live_key"), 0U);
+    live_keys++;
+  }
+  delete iter;
+  EXPECT_EQ(live_keys, 20);
+
+  delete string;
+  delete storage_;
+}
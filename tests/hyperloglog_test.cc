@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "hyperloglog.h"
+
+static uint64_t countHLL(std::string hll) {
+  uint64_t card = 0;
+  EXPECT_TRUE(HLL::Count(&hll, &card));
+  return card;
+}
+
+TEST(HyperLogLog, AddAndCount) {
+  std::string hll;
+  HLL::CreateEmpty(&hll);
+  ASSERT_TRUE(HLL::IsValid(hll));
+  EXPECT_EQ(0, countHLL(hll));
+
+  bool corrupted = false;
+  EXPECT_TRUE(HLL::Add(&hll, {"a", "b", "c"}, 3000, &corrupted));
+  EXPECT_FALSE(HLL::Add(&hll, {"a", "b", "c"}, 3000, &corrupted));
+  EXPECT_FALSE(corrupted);
+  EXPECT_EQ(3, countHLL(hll));
+  EXPECT_EQ(HLL::kSparse, HLL::GetEncoding(hll));
+
+  // the sparse encoding was promoted to dense when it's too large
+  uint64_t n = 0;
+  while (n < 100000) {
+    std::vector<std::string> elements;
+    for (int j = 0; j < 100; j++) elements.emplace_back(std::to_string(n++));
+    HLL::Add(&hll, elements, 3000, &corrupted);
+    ASSERT_TRUE(HLL::IsValid(hll));
+    uint64_t card = countHLL(hll);
+    EXPECT_LT(fabs(static_cast<double>(card) - n), n * 0.05) << n;
+    if (n < 1000) {
+      EXPECT_EQ(HLL::kSparse, HLL::GetEncoding(hll)) << n;
+    } else if (n > 10000) {
+      EXPECT_EQ(HLL::kDense, HLL::GetEncoding(hll)) << n;
+    }
+  }
+  EXPECT_EQ(HLL::kDenseSize, hll.size());
+}
+
+TEST(HyperLogLog, CachedCardinality) {
+  std::string hll;
+  HLL::CreateEmpty(&hll);
+  bool corrupted = false;
+  HLL::Add(&hll, {"1", "2", "3", "4", "5"}, 3000, &corrupted);
+  uint64_t card = 0;
+  ASSERT_TRUE(HLL::Count(&hll, &card));
+  EXPECT_EQ(5, card);
+  EXPECT_EQ(0, hll[15] & 0x80);
+  // the cache was invalidated after the registers were changed
+  HLL::Add(&hll, {"6", "7", "8", "8", "9", "10"}, 3000, &corrupted);
+  EXPECT_NE(0, hll[15] & 0x80);
+  EXPECT_EQ(10, countHLL(hll));
+}
+
+TEST(HyperLogLog, MergeRegisters) {
+  std::string hll1, hll2, dense;
+  HLL::CreateEmpty(&hll1);
+  HLL::CreateEmpty(&hll2);
+  std::vector<std::string> elements1, elements2;
+  for (int i = 0; i < 20000; i++) elements1.emplace_back("a" + std::to_string(i));
+  for (int i = 0; i < 300; i++) elements2.emplace_back("b" + std::to_string(i));
+  bool corrupted = false;
+  HLL::Add(&hll1, elements1, 3000, &corrupted);
+  HLL::Add(&hll2, elements2, 3000, &corrupted);
+  ASSERT_EQ(HLL::kDense, HLL::GetEncoding(hll1));
+  ASSERT_EQ(HLL::kSparse, HLL::GetEncoding(hll2));
+
+  std::vector<uint8_t> max(HLL::kRegisters, 0);
+  ASSERT_TRUE(HLL::MergeRegisters(hll1, max.data()));
+  ASSERT_TRUE(HLL::MergeRegisters(hll2, max.data()));
+  uint64_t card = HLL::CountRegisters(max.data());
+  EXPECT_LT(fabs(static_cast<double>(card) - 20300), 20300 * 0.05);
+
+  HLL::DenseFromRegisters(max.data(), &dense);
+  ASSERT_TRUE(HLL::IsValid(dense));
+  EXPECT_EQ(card, countHLL(dense));
+  // merge the elements into the dense one again shouldn't modify any register
+  EXPECT_FALSE(HLL::Add(&dense, elements1, 3000, &corrupted));
+  EXPECT_FALSE(HLL::Add(&dense, elements2, 3000, &corrupted));
+}
+
+TEST(HyperLogLog, Corrupted) {
+  std::string hll;
+  HLL::CreateEmpty(&hll);
+  EXPECT_FALSE(HLL::IsValid("HYLL"));
+  EXPECT_FALSE(HLL::IsValid(std::string("HYLL") + std::string(12, 0)));  // dense with wrong size
+  hll.push_back(0x01);  // too many registers
+  bool corrupted = false;
+  EXPECT_FALSE(HLL::Add(&hll, {"a"}, 3000, &corrupted));
+  EXPECT_TRUE(corrupted);
+  std::vector<uint8_t> max(HLL::kRegisters, 0);
+  EXPECT_FALSE(HLL::MergeRegisters(hll, max.data()));
+}
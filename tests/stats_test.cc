@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <numeric>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "stats.h"
+
+TEST(LatencyHistogram, BucketIndex) {
+  for (uint64_t value = 0; value < (1ULL << 20); value++) {
+    int index = LatencyHistogram::BucketIndex(value);
+    ASSERT_LE(LatencyHistogram::BucketLowerBound(index), value);
+    ASSERT_GE(LatencyHistogram::BucketUpperBound(index), value);
+  }
+  for (int i = 1; i < LatencyHistogram::kBuckets; i++) {
+    EXPECT_EQ(LatencyHistogram::BucketUpperBound(i - 1) + 1, LatencyHistogram::BucketLowerBound(i));
+    // the relative error of the bucket was below 1/kSubBuckets
+    auto width = LatencyHistogram::BucketUpperBound(i) - LatencyHistogram::BucketLowerBound(i);
+    EXPECT_LE(width * LatencyHistogram::kSubBuckets, LatencyHistogram::BucketLowerBound(i));
+  }
+  EXPECT_EQ(LatencyHistogram::kBuckets - 1, LatencyHistogram::BucketIndex(UINT64_MAX));
+}
+
+TEST(LatencyHistogram, ValueAtPercentile) {
+  LatencyHistogram histogram;
+  std::vector<uint64_t> values;
+  srand(0);
+  for (int i = 0; i < 100000; i++) {
+    uint64_t value = rand() % 100000;
+    values.emplace_back(value);
+    histogram.Record(value);
+  }
+  std::sort(values.begin(), values.end());
+  std::vector<uint64_t> counts;
+  histogram.MergeInto(&counts);
+  for (double percentile : {50.0, 90.0, 99.0, 99.9}) {
+    uint64_t expected = values[static_cast<size_t>(percentile / 100 * values.size()) - 1];
+    uint64_t value = LatencyHistogram::ValueAtPercentile(counts, percentile);
+    EXPECT_GE(value, expected);
+    EXPECT_LE(value, expected + expected / LatencyHistogram::kSubBuckets + 1);
+  }
+  EXPECT_EQ(0, LatencyHistogram::ValueAtPercentile(std::vector<uint64_t>(LatencyHistogram::kBuckets, 0), 50));
+}
+
+TEST(Stats, CommandStat) {
+  Stats stats;
+  stats.SetCommands({"get", "set", "get"});
+  ASSERT_EQ(2, stats.GetCommands().size());
+  EXPECT_EQ(0, stats.GetCommandID("get"));
+  EXPECT_EQ(1, stats.GetCommandID("set"));
+  EXPECT_EQ(-1, stats.GetCommandID("unknown"));
+
+  // the stats of all threads were aggregated
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; i++) {
+    threads.emplace_back([&stats]() {
+      for (int j = 0; j < 1000; j++) {
+        stats.IncrCalls(1);
+        stats.IncrLatency(j, 1);
+      }
+      stats.IncrCalls(-1);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  uint64_t calls, latency;
+  std::vector<uint64_t> histogram;
+  stats.GetCommandStat(1, &calls, &latency, &histogram);
+  EXPECT_EQ(4000, calls);
+  EXPECT_EQ(4 * 999 * 1000 / 2, latency);
+  EXPECT_EQ(4000, std::accumulate(histogram.begin(), histogram.end(), 0ULL));
+  stats.GetCommandStat(0, &calls, &latency, &histogram);
+  EXPECT_EQ(0, calls);
+  EXPECT_EQ(4000, stats.GetTotalCalls());
+}
+
+TEST(Stats, CommandStatOfMultipleInstances) {
+  Stats stats1, stats2;
+  stats1.SetCommands({"get"});
+  stats2.SetCommands({"get"});
+  // the thread switched between the instances shouldn't lose the counts
+  for (int i = 0; i < 100; i++) {
+    stats1.IncrCalls(0);
+    stats2.IncrCalls(0);
+  }
+  EXPECT_EQ(100, stats1.GetTotalCalls());
+  EXPECT_EQ(100, stats2.GetTotalCalls());
+}
+
+TEST(LatencyHistogram, PowerOfTwoCounts) {
+  LatencyHistogram histogram;
+  for (uint64_t value = 0; value < 5000; value++) histogram.Record(value);
+  std::vector<uint64_t> counts, cumulative_counts;
+  histogram.MergeInto(&counts);
+  LatencyHistogram::PowerOfTwoCounts(counts, &cumulative_counts);
+  ASSERT_EQ(LatencyHistogram::kMaxValueBits + 1, cumulative_counts.size());
+  for (size_t i = 0; i < cumulative_counts.size(); i++) {
+    EXPECT_EQ(std::min<uint64_t>((1ULL << i) + 1, 5000), cumulative_counts[i]);
+  }
+}
+
+TEST(LatencyHistogram, PowerOfTwoCountsOnBoundary) {
+  LatencyHistogram histogram;
+  histogram.Record(8);
+  histogram.Record(1024);
+  std::vector<uint64_t> counts, cumulative_counts;
+  histogram.MergeInto(&counts);
+  LatencyHistogram::PowerOfTwoCounts(counts, &cumulative_counts);
+  // the value equal to 2^i was counted in the le=2^i bucket
+  EXPECT_EQ(0, cumulative_counts[2]);
+  EXPECT_EQ(1, cumulative_counts[3]);
+  EXPECT_EQ(1, cumulative_counts[9]);
+  EXPECT_EQ(2, cumulative_counts[10]);
+  EXPECT_EQ(2, cumulative_counts.back());
+}
+
+TEST(LatencyHistogram, PowerOfTwoCountsAboveBoundary) {
+  LatencyHistogram histogram;
+  histogram.Record(17);
+  histogram.Record(1025);
+  histogram.Record((1ULL << 20) + 1);
+  std::vector<uint64_t> counts, cumulative_counts;
+  histogram.MergeInto(&counts);
+  LatencyHistogram::PowerOfTwoCounts(counts, &cumulative_counts);
+  // the value just above 2^i wasn't counted in the le=2^i bucket
+  EXPECT_EQ(0, cumulative_counts[4]);
+  EXPECT_EQ(1, cumulative_counts[5]);
+  EXPECT_EQ(1, cumulative_counts[10]);
+  EXPECT_EQ(2, cumulative_counts[11]);
+  EXPECT_EQ(2, cumulative_counts[20]);
+  EXPECT_EQ(3, cumulative_counts[21]);
+}
+
+TEST(Stats, PerfCounters) {
+  Stats stats;
+  stats.SetCommands({"get", "set"});
+  uint64_t counters[kPerfCounterNum];
+  for (int i = 0; i < kPerfCounterNum; i++) counters[i] = i;
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 2; i++) {
+    threads.emplace_back([&stats, &counters]() {
+      for (int j = 0; j < 100; j++) stats.IncrPerfCounters(0, counters);
+      stats.IncrPerfCounters(2, counters);
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  uint64_t samples;
+  std::vector<uint64_t> aggregated;
+  stats.GetCommandPerfStat(0, &samples, &aggregated);
+  EXPECT_EQ(200, samples);
+  ASSERT_EQ(kPerfCounterNum, aggregated.size());
+  for (int i = 0; i < kPerfCounterNum; i++) {
+    EXPECT_EQ(200 * i, aggregated[i]);
+    EXPECT_STRNE("", Stats::PerfCounterName(i));
+  }
+  stats.GetCommandPerfStat(1, &samples, &aggregated);
+  EXPECT_EQ(0, samples);
+}
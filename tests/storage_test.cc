@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "config.h"
+#include "storage.h"
+#include "redis_string.h"
+
+TEST(Storage, ReadWithVisibleSnapshot) {
+  Config config;
+  config.db_dir = "storagedb";
+  config.backup_dir = "storagedb/backup";
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+  std::string key = "visible_snapshot_key";
+  auto string = new Redis::String(storage_, "test_storage");
+
+  string->Set(key, "v1");
+  storage_->SetVisibleSeq(storage_->LatestSeq());
+  auto snapshot = storage_->GetVisibleSnapshot();
+  ASSERT_TRUE(snapshot != nullptr);
+  // the snapshot was shared until the visible seq was advanced
+  string->Set(key, "v2");
+  EXPECT_EQ(snapshot, storage_->GetVisibleSnapshot());
+
+  std::string value;
+  Engine::Storage::PinSnapshot(snapshot.get());
+  string->Get(key, &value);
+  Engine::Storage::PinSnapshot(nullptr);
+  EXPECT_EQ("v1", value);
+  string->Get(key, &value);
+  EXPECT_EQ("v2", value);
+
+  storage_->SetVisibleSeq(storage_->LatestSeq());
+  EXPECT_NE(snapshot, storage_->GetVisibleSnapshot());
+  snapshot.reset();
+  storage_->ReleaseVisibleSnapshot();
+  string->Del(key);
+
+  delete string;
+  delete storage_;
+}
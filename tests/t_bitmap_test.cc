@@ -73,3 +73,163 @@ TEST_F(RedisBitmapTest, BitPosSetBit) {
   }
   bitmap->Del(key_);
 }
+
+TEST_F(RedisBitmapTest, BitOp) {
+  std::string key1 = "test_bitop_key1", key2 = "test_bitop_key2", dest = "test_bitop_dest";
+  // the segment indexes were sorted as string, e.g. "10240" < "2048"
+  uint32_t offsets1[] = {0, 123, 1024*8, 2*1024*8+1, 10*1024*8+3};
+  uint32_t offsets2[] = {123, 1024*8, 3*1024*8, 10*1024*8+3, 10*1024*8+4};
+  bool bit = false;
+  for (const auto &offset : offsets1) bitmap->SetBit(key1, offset, true, &bit);
+  for (const auto &offset : offsets2) bitmap->SetBit(key2, offset, true, &bit);
+
+  int64_t len = 0;
+  uint32_t cnt = 0;
+  bitmap->BitOp(BitUtil::kBitOpAnd, "and", dest, {key1, key2}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 3);
+  for (const auto &offset : {123, 1024*8, 10*1024*8+3}) {
+    bitmap->GetBit(dest, offset, &bit);
+    EXPECT_TRUE(bit);
+  }
+
+  bitmap->BitOp(BitUtil::kBitOpOr, "or", dest, {key1, key2}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 7);
+
+  bitmap->BitOp(BitUtil::kBitOpXor, "xor", dest, {key1, key2}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 4);
+  for (const auto &offset : {0, 2*1024*8+1, 3*1024*8, 10*1024*8+4}) {
+    bitmap->GetBit(dest, offset, &bit);
+    EXPECT_TRUE(bit);
+  }
+
+  // the result of AND with a non-existing key was empty
+  bitmap->BitOp(BitUtil::kBitOpAnd, "and", dest, {key1, "test_bitop_not_exists"}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 0);
+
+  bitmap->BitOp(BitUtil::kBitOpNot, "not", dest, {key1}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, len * 8 - 5);
+  int pos = 0;
+  bitmap->BitPos(dest, false, 0, -1, true, &pos);
+  EXPECT_EQ(pos, 0);
+  bitmap->GetBit(dest, 1, &bit);
+  EXPECT_TRUE(bit);
+
+  // the dest key can be one of the source keys
+  bitmap->BitOp(BitUtil::kBitOpNot, "not", key1, {key1}, &len);
+  bitmap->BitOp(BitUtil::kBitOpNot, "not", key1, {key1}, &len);
+  bitmap->BitCount(key1, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 5);
+
+  bitmap->Del(key1);
+  bitmap->Del(key2);
+  bitmap->Del(dest);
+}
+
+TEST_F(RedisBitmapTest, Bitfield) {
+  auto makeOp = [](Redis::BitfieldOpType type, bool is_signed, uint8_t bits, uint64_t offset, int64_t value,
+                   Redis::BitfieldOverflow overflow = Redis::kBitfieldOverflowWrap) {
+    Redis::BitfieldOperation op;
+    op.type = type;
+    op.is_signed = is_signed;
+    op.bits = bits;
+    op.offset = offset;
+    op.value = value;
+    op.overflow = overflow;
+    return op;
+  };
+  std::vector<Redis::BitfieldResult> rets;
+  // the field across the segments boundary
+  uint64_t offset = 1024 * 8 - 4;
+  bitmap->Bitfield(key_, {makeOp(Redis::kBitfieldSet, false, 8, offset, 255),
+                          makeOp(Redis::kBitfieldGet, false, 8, offset, 0),
+                          makeOp(Redis::kBitfieldIncrBy, false, 8, offset, 10),
+                          makeOp(Redis::kBitfieldIncrBy, false, 8, offset, 1000, Redis::kBitfieldOverflowSat),
+                          makeOp(Redis::kBitfieldIncrBy, false, 8, offset, 1, Redis::kBitfieldOverflowFail),
+                          makeOp(Redis::kBitfieldGet, true, 8, offset, 0)}, &rets);
+  ASSERT_EQ(rets.size(), 6);
+  EXPECT_EQ(rets[0].value, 0);
+  EXPECT_EQ(rets[1].value, 255);
+  EXPECT_EQ(rets[2].value, 9);
+  EXPECT_EQ(rets[3].value, 255);
+  EXPECT_TRUE(rets[4].is_nil);
+  EXPECT_EQ(rets[5].value, -1);
+
+  // the bits were the same as SETBIT/GETBIT
+  bool bit = false;
+  for (uint64_t i = offset; i < offset + 8; i++) {
+    bitmap->GetBit(key_, i, &bit);
+    EXPECT_TRUE(bit);
+  }
+  bitmap->SetBit(key_, offset, false, &bit);
+  bitmap->Bitfield(key_, {makeOp(Redis::kBitfieldGet, false, 8, offset, 0),
+                          makeOp(Redis::kBitfieldIncrBy, true, 4, 0, -9),
+                          makeOp(Redis::kBitfieldGet, true, 4, 0, 0)}, &rets);
+  EXPECT_EQ(rets[0].value, 127);
+  EXPECT_EQ(rets[1].value, 7);
+  EXPECT_EQ(rets[2].value, 7);
+  uint32_t cnt = 0;
+  bitmap->BitCount(key_, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 7 + 3);
+  bitmap->Del(key_);
+}
+
+TEST_F(RedisBitmapTest, ContainerEncoding) {
+  config_->bitmap_container_encoding = true;
+  std::string raw_key = "test_bitmap_raw_key";
+  uint32_t offsets[] = {0, 123, 1024*8, 1024*8+1, 3*1024*8, 3*1024*8+1, 5*1024*8-1};
+  bool bit = false;
+  for (const auto &offset : offsets) {
+    bitmap->SetBit(key_, offset, true, &bit);
+    EXPECT_FALSE(bit);
+  }
+  // the existing bitmaps keep the raw segments after the config was changed
+  config_->bitmap_container_encoding = false;
+  for (const auto &offset : offsets) {
+    bitmap->SetBit(raw_key, offset, true, &bit);
+    bitmap->SetBit(key_, offset, true, &bit);
+    EXPECT_TRUE(bit);
+  }
+  for (const auto &key : {key_, raw_key}) {
+    for (const auto &offset : offsets) {
+      bitmap->GetBit(key, offset, &bit);
+      EXPECT_TRUE(bit);
+      bitmap->GetBit(key, offset + 1, &bit);
+      if (offset != 1024*8 && offset != 3*1024*8) EXPECT_FALSE(bit);
+    }
+    uint32_t cnt = 0;
+    bitmap->BitCount(key, 0, -1, &cnt);
+    EXPECT_EQ(cnt, 7);
+    bitmap->BitCount(key, 1024, 4096, &cnt);
+    EXPECT_EQ(cnt, 4);
+    int pos = 0;
+    bitmap->BitPos(key, true, 16, -1, false, &pos);
+    EXPECT_EQ(pos, 1024*8);
+    bitmap->BitPos(key, false, 0, -1, false, &pos);
+    EXPECT_EQ(pos, 1);
+  }
+
+  // the result of BITOP was encoded by the config
+  config_->bitmap_container_encoding = true;
+  int64_t len = 0;
+  std::string dest = "test_bitmap_dest_key";
+  bitmap->BitOp(BitUtil::kBitOpXor, "xor", dest, {key_, raw_key}, &len);
+  uint32_t cnt = 0;
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 0);
+  bitmap->BitOp(BitUtil::kBitOpOr, "or", dest, {key_, raw_key}, &len);
+  bitmap->BitCount(dest, 0, -1, &cnt);
+  EXPECT_EQ(cnt, 7);
+  for (const auto &offset : offsets) {
+    bitmap->GetBit(dest, offset, &bit);
+    EXPECT_TRUE(bit);
+  }
+  config_->bitmap_container_encoding = false;
+  bitmap->Del(key_);
+  bitmap->Del(raw_key);
+  bitmap->Del(dest);
+}
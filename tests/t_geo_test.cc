@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
 #include <math.h>
+#include <algorithm>
+#include <map>
 #include "test_base.h"
 #include "redis_geo.h"
 
@@ -137,4 +139,151 @@ TEST_F(RedisGeoTest, RadiusByMember) {
     EXPECT_EQ(geo->EncodeGeoHash(gps[i].longitude, gps[i].latitude), geoHashes_[i]);
   }
   geo->Del(key_);
-}
\ No newline at end of file
+}
+TEST_F(RedisGeoTest, Search) {
+  int ret;
+  std::vector<GeoPoint> geo_points;
+  srand(0);
+  for (int i = 0; i < 500; i++) {
+    double longitude = 13.4 + (rand() % 20000) / 10000.0 - 1;
+    double latitude = 52.5 + (rand() % 20000) / 10000.0 - 1;
+    geo_points.emplace_back(GeoPoint{longitude, latitude, "member-" + std::to_string(i)});
+  }
+  geo->Add(key_, &geo_points, &ret);
+  EXPECT_EQ(500, ret);
+  std::map<std::string, GeoPoint> stored;
+  std::vector<Slice> members;
+  for (const auto &geo_point : geo_points) members.emplace_back(geo_point.member);
+  geo->MGet(key_, members, &stored);
+
+  GeoShape shapes[2] = {{kGeoShapeTypeRadius, 13.4, 52.5, 30000, 0, 0},
+                        {kGeoShapeTypeBox, 13.4, 52.5, 0, 60000, 30000}};
+  for (const auto &shape : shapes) {
+    std::vector<std::pair<double, std::string>> expected;
+    for (const auto &iter : stored) {
+      double dist;
+      int in_shape = shape.type == kGeoShapeTypeRadius ?
+          GeoHashHelper::GetDistanceIfInRadiusWGS84(shape.longitude, shape.latitude, iter.second.longitude,
+                                                    iter.second.latitude, shape.radius, &dist) :
+          GeoHashHelper::GetDistanceIfInRectangle(shape.width, shape.height, shape.longitude, shape.latitude,
+                                                  iter.second.longitude, iter.second.latitude, &dist);
+      if (in_shape) expected.emplace_back(dist, iter.first);
+    }
+    std::sort(expected.begin(), expected.end());
+    ASSERT_GT(expected.size(), 10u);
+
+    std::vector<GeoPoint> gps;
+    geo->Search(key_, shape, 0, false, kSortASC, std::string(), false, 1, &gps);
+    ASSERT_EQ(expected.size(), gps.size());
+    for (size_t i = 0; i < gps.size(); i++) EXPECT_EQ(expected[i].second, gps[i].member);
+
+    // only the nearest points were kept
+    gps.clear();
+    geo->Search(key_, shape, 10, false, kSortASC, std::string(), false, 1, &gps);
+    ASSERT_EQ(10u, gps.size());
+    for (size_t i = 0; i < gps.size(); i++) EXPECT_EQ(expected[i].second, gps[i].member);
+
+    gps.clear();
+    geo->Search(key_, shape, 10, false, kSortDESC, std::string(), false, 1, &gps);
+    ASSERT_EQ(10u, gps.size());
+    for (size_t i = 0; i < gps.size(); i++) EXPECT_EQ(expected[expected.size() - 1 - i].second, gps[i].member);
+
+    gps.clear();
+    geo->Search(key_, shape, 10, true, kSortNone, std::string(), false, 1, &gps);
+    ASSERT_EQ(10u, gps.size());
+    for (const auto &gp : gps) {
+      EXPECT_TRUE(std::find_if(expected.begin(), expected.end(), [&gp](const std::pair<double, std::string> &p) {
+        return p.second == gp.member;
+      }) != expected.end());
+    }
+  }
+
+  // the store key was replaced with the result
+  std::string store_key = "test_geo_store_key";
+  std::vector<GeoPoint> gps;
+  geo->Search(key_, shapes[0], 5, false, kSortASC, store_key, false, 1, &gps);
+  int size;
+  geo->Card(store_key, &size);
+  EXPECT_EQ(5, size);
+  gps.clear();
+  geo->Search(key_, {kGeoShapeTypeRadius, -13.4, -52.5, 1000, 0, 0}, 5, false, kSortASC, store_key, false, 1, &gps);
+  EXPECT_TRUE(gps.empty());
+  geo->Card(store_key, &size);
+  EXPECT_EQ(0, size);
+  geo->Del(key_);
+}
+
+TEST_F(RedisGeoTest, SearchNearestByRings) {
+  int ret;
+  std::vector<GeoPoint> geo_points;
+  srand(0);
+  // the points were spread from 10 meters to 500 km away, so the nearest ones
+  // were found by the different rings
+  for (int i = 0; i < 300; i++) {
+    double scale = pow(10, -4 + (rand() % 5000) / 1000.0);
+    double longitude = 13.4 + ((rand() % 20000) / 10000.0 - 1) * scale;
+    double latitude = 52.5 + ((rand() % 20000) / 10000.0 - 1) * scale;
+    geo_points.emplace_back(GeoPoint{longitude, latitude, "member-" + std::to_string(i)});
+  }
+  geo->Add(key_, &geo_points, &ret);
+  std::map<std::string, GeoPoint> stored;
+  std::vector<Slice> members;
+  for (const auto &geo_point : geo_points) members.emplace_back(geo_point.member);
+  geo->MGet(key_, members, &stored);
+
+  GeoShape shape = {kGeoShapeTypeRadius, 13.4, 52.5, 1000000, 0, 0};
+  std::vector<std::pair<double, std::string>> expected;
+  for (const auto &iter : stored) {
+    double dist;
+    if (GeoHashHelper::GetDistanceIfInRadiusWGS84(shape.longitude, shape.latitude, iter.second.longitude,
+                                                  iter.second.latitude, shape.radius, &dist)) {
+      expected.emplace_back(dist, iter.first);
+    }
+  }
+  std::sort(expected.begin(), expected.end());
+  for (int count : {1, 5, 50, 200, 1000}) {
+    std::vector<GeoPoint> gps;
+    geo->Search(key_, shape, count, false, kSortASC, std::string(), false, 1, &gps);
+    ASSERT_EQ(std::min<size_t>(count, expected.size()), gps.size());
+    for (size_t i = 0; i < gps.size(); i++) EXPECT_EQ(expected[i].second, gps[i].member);
+
+    // the points found by the inner rings weren't returned again
+    gps.clear();
+    geo->Search(key_, shape, count, true, kSortASC, std::string(), false, 1, &gps);
+    ASSERT_EQ(std::min<size_t>(count, expected.size()), gps.size());
+    std::vector<std::string> found;
+    for (const auto &gp : gps) found.emplace_back(gp.member);
+    std::sort(found.begin(), found.end());
+    EXPECT_TRUE(std::unique(found.begin(), found.end()) == found.end());
+  }
+  geo->Del(key_);
+}
+
+TEST(GeoHashHelper, GetDistancesIfInRadius) {
+  srand(0);
+  std::vector<double> xs, ys;
+  for (int i = 0; i < 10000; i++) {
+    xs.emplace_back((rand() % 360000) / 1000.0 - 180);
+    ys.emplace_back((rand() % 170000) / 1000.0 - 85);
+  }
+  double centers[][2] = {{0, 0}, {13.4, 52.5}, {-179.9, 84.9}, {120, -60}};
+  double radiuses[] = {0, 1000, 500000, 5000000, 30000000};
+  for (const auto &center : centers) {
+    for (const auto radius : radiuses) {
+      std::vector<double> distances(xs.size());
+      size_t count = GeoHashHelper::GetDistancesIfInRadius(center[0], center[1], radius, xs.data(), ys.data(),
+                                                           xs.size(), distances.data());
+      size_t expected_count = 0;
+      for (size_t i = 0; i < xs.size(); i++) {
+        double distance;
+        if (GeoHashHelper::GetDistanceIfInRadiusWGS84(center[0], center[1], xs[i], ys[i], radius, &distance)) {
+          expected_count++;
+          EXPECT_EQ(distance, distances[i]);
+        } else {
+          EXPECT_EQ(-1, distances[i]);
+        }
+      }
+      EXPECT_EQ(expected_count, count);
+    }
+  }
+}
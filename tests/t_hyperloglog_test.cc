@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "test_base.h"
+#include "redis_hash.h"
+#include "redis_hyperloglog.h"
+#include "redis_string.h"
+
+class RedisHyperLogLogTest : public TestBase {
+ protected:
+  explicit RedisHyperLogLogTest() : TestBase() {
+    hll = new Redis::HyperLogLog(storage_, "hll_ns");
+  }
+  ~RedisHyperLogLogTest() {
+    delete hll;
+  }
+  void SetUp() override {
+    key_ = "test_hll_key";
+  }
+  void TearDown() override {}
+
+ protected:
+  Redis::HyperLogLog *hll;
+};
+
+TEST_F(RedisHyperLogLogTest, AddAndCount) {
+  int ret = 0;
+  uint64_t card = 0;
+  hll->Add(key_, {}, &ret);
+  EXPECT_EQ(ret, 1);
+  hll->Count({key_}, &card);
+  EXPECT_EQ(card, 0);
+  hll->Add(key_, {"a", "b", "c"}, &ret);
+  EXPECT_EQ(ret, 1);
+  hll->Add(key_, {"a", "b", "c"}, &ret);
+  EXPECT_EQ(ret, 0);
+  hll->Count({key_}, &card);
+  EXPECT_EQ(card, 3);
+  hll->Del(key_);
+}
+
+TEST_F(RedisHyperLogLogTest, Merge) {
+  int ret = 0;
+  std::string key1 = "test_hll_key1", key2 = "test_hll_key2", dest = "test_hll_dest";
+  hll->Add(key1, {"1", "2", "3"}, &ret);
+  hll->Add(key2, {"3", "4", "5"}, &ret);
+  uint64_t card = 0;
+  hll->Count({key1, key2, "not_exist_key"}, &card);
+  EXPECT_EQ(card, 5);
+  EXPECT_TRUE(hll->Merge(dest, {key1, key2}).ok());
+  hll->Count({dest}, &card);
+  EXPECT_EQ(card, 5);
+  // the dest was merged too
+  hll->Add(key1, {"6"}, &ret);
+  EXPECT_TRUE(hll->Merge(dest, {key1}).ok());
+  hll->Count({dest}, &card);
+  EXPECT_EQ(card, 6);
+
+  Redis::String string(storage_, "hll_ns");
+  string.Set(key2, "not_hll_value");
+  EXPECT_FALSE(hll->Merge(dest, {key1, key2}).ok());
+  EXPECT_FALSE(hll->Add(key2, {"a"}, &ret).ok());
+  hll->Del(key1);
+  hll->Del(key2);
+  hll->Del(dest);
+}
+
+TEST_F(RedisHyperLogLogTest, AddToEmptyKeyOfOtherType) {
+  int ret = 0;
+  Redis::Hash hash(storage_, "hll_ns");
+  hash.Set(key_, "field", "value", &ret);
+  hash.Delete(key_, {"field"}, &ret);
+  // the empty hash was taken as not found, and replaced by the new HLL
+  EXPECT_TRUE(hll->Add(key_, {"a"}, &ret).ok());
+  EXPECT_EQ(ret, 1);
+  uint64_t card = 0;
+  EXPECT_TRUE(hll->Count({key_}, &card).ok());
+  EXPECT_EQ(card, 1);
+  EXPECT_TRUE(hll->Add(key_, {"b"}, &ret).ok());
+  EXPECT_TRUE(hll->Count({key_}, &card).ok());
+  EXPECT_EQ(card, 2);
+  hll->Del(key_);
+}
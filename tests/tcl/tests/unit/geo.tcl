@@ -137,34 +137,34 @@ start_server {tags {"geo"}} {
         r georadius nyc -73.9798091 40.7598464 3 km asc
     } {{central park n/q/r} 4545 {union square}}
 
-    # test {GEOSEARCH simple (sorted)} {
-    #     r geosearch nyc fromlonlat -73.9798091 40.7598464 bybox 6 6 km asc
-    # } {{central park n/q/r} 4545 {union square} {lic market}}
+    test {GEOSEARCH simple (sorted)} {
+        r geosearch nyc fromlonlat -73.9798091 40.7598464 bybox 6 6 km asc
+    } {{central park n/q/r} 4545 {union square} {lic market}}
 
-    # test {GEOSEARCH FROMLONLAT and FROMMEMBER cannot exist at the same time} {
-    #     catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 frommember xxx bybox 6 6 km asc} e
-    #     set e
-    # } {ERR*syntax*}
+    test {GEOSEARCH FROMLONLAT and FROMMEMBER cannot exist at the same time} {
+        catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 frommember xxx bybox 6 6 km asc} e
+        set e
+    } {ERR*syntax*}
 
-    # test {GEOSEARCH FROMLONLAT and FROMMEMBER one must exist} {
-    #     catch {r geosearch nyc bybox 3 3 km asc desc withhash withdist withcoord} e
-    #     set e
-    # } {ERR*exactly one of FROMMEMBER or FROMLONLAT*}
+    test {GEOSEARCH FROMLONLAT and FROMMEMBER one must exist} {
+        catch {r geosearch nyc bybox 3 3 km asc desc withhash withdist withcoord} e
+        set e
+    } {ERR*exactly one of FROMMEMBER or FROMLONLAT*}
 
-    # test {GEOSEARCH BYRADIUS and BYBOX cannot exist at the same time} {
-    #     catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 byradius 3 km bybox 3 3 km asc} e
-    #     set e
-    # } {ERR*syntax*}
+    test {GEOSEARCH BYRADIUS and BYBOX cannot exist at the same time} {
+        catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 byradius 3 km bybox 3 3 km asc} e
+        set e
+    } {ERR*syntax*}
 
-    # test {GEOSEARCH BYRADIUS and BYBOX one must exist} {
-    #     catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 asc desc withhash withdist withcoord} e
-    #     set e
-    # } {ERR*exactly one of BYRADIUS and BYBOX*}
+    test {GEOSEARCH BYRADIUS and BYBOX one must exist} {
+        catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 asc desc withhash withdist withcoord} e
+        set e
+    } {ERR*exactly one of BYRADIUS and BYBOX*}
 
-    # test {GEOSEARCH with STOREDIST option} {
-    #     catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 bybox 6 6 km asc storedist} e
-    #     set e
-    # } {ERR*syntax*}
+    test {GEOSEARCH with STOREDIST option} {
+        catch {r geosearch nyc fromlonlat -73.9798091 40.7598464 bybox 6 6 km asc storedist} e
+        set e
+    } {ERR*syntax*}
 
     # test {GEORADIUS withdist (sorted)} {
     #     r georadius nyc -73.9798091 40.7598464 3 km withdist asc
@@ -296,10 +296,10 @@ start_server {tags {"geo"}} {
         set e
     } {*syntax*}
 
-    # test {GEOSEARCHSTORE STORE option: syntax error} {
-    #     catch {r geosearchstore abc points fromlonlat 13.361389 38.115556 byradius 50 km store abc} e
-    #     set e
-    # } {*syntax*}
+    test {GEOSEARCHSTORE STORE option: syntax error} {
+        catch {r geosearchstore abc points fromlonlat 13.361389 38.115556 byradius 50 km store abc} e
+        set e
+    } {*syntax*}
 
     # test {GEORANGE STORE option: incompatible options} {
     #     r del points
@@ -321,10 +321,10 @@ start_server {tags {"geo"}} {
         assert_equal [r zrange points 0 -1] [r zrange points2 0 -1]
     }
 
-    # test {GEOSEARCHSTORE STORE option: plain usage} {
-    #     r geosearchstore points2 points fromlonlat 13.361389 38.115556 byradius 500 km
-    #     assert_equal [r zrange points 0 -1] [r zrange points2 0 -1]
-    # }
+    test {GEOSEARCHSTORE STORE option: plain usage} {
+        r geosearchstore points2 points fromlonlat 13.361389 38.115556 byradius 500 km
+        assert_equal [r zrange points 0 -1] [r zrange points2 0 -1]
+    }
 
     # test {GEORANGE STOREDIST option: plain usage} {
     #     r del points
@@ -337,13 +337,13 @@ start_server {tags {"geo"}} {
     #     assert {[lindex $res 3] < 167}
     # }
 
-    # test {GEOSEARCHSTORE STOREDIST option: plain usage} {
-    #     r geosearchstore points2 points fromlonlat 13.361389 38.115556 byradius 500 km storedist
-    #     set res [r zrange points2 0 -1 withscores]
-    #     assert {[lindex $res 1] < 1}
-    #     assert {[lindex $res 3] > 166}
-    #     assert {[lindex $res 3] < 167}
-    # }
+    test {GEOSEARCHSTORE STOREDIST option: plain usage} {
+        r geosearchstore points2 points fromlonlat 13.361389 38.115556 byradius 500 km storedist
+        set res [r zrange points2 0 -1 withscores]
+        assert {[lindex $res 1] < 1}
+        assert {[lindex $res 3] > 166}
+        assert {[lindex $res 3] < 167}
+    }
 
     # test {GEORANGE STOREDIST option: COUNT ASC and DESC} {
     #     r del points
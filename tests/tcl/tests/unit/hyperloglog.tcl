@@ -1,8 +1,9 @@
 start_server {tags {"hll"}} {
-    test {HyperLogLog self test passes} {
-        catch {r pfselftest} e
-        set e
-    } {OK}
+    # PFSELFTEST isn't supported
+    # test {HyperLogLog self test passes} {
+    #     catch {r pfselftest} e
+    #     set e
+    # } {OK}
 
     test {PFADD without arguments creates an HLL value} {
         r pfadd hll
@@ -39,45 +40,47 @@ start_server {tags {"hll"}} {
         set res
     } {5 10}
 
-    test {HyperLogLogs are promote from sparse to dense} {
-        r del hll
-        r config set hll-sparse-max-bytes 3000
-        set n 0
-        while {$n < 100000} {
-            set elements {}
-            for {set j 0} {$j < 100} {incr j} {lappend elements [expr rand()]}
-            incr n 100
-            r pfadd hll {*}$elements
-            set card [r pfcount hll]
-            set err [expr {abs($card-$n)}]
-            assert {$err < (double($card)/100)*5}
-            if {$n < 1000} {
-                assert {[r pfdebug encoding hll] eq {sparse}}
-            } elseif {$n > 10000} {
-                assert {[r pfdebug encoding hll] eq {dense}}
-            }
-        }
-    }
-
-    test {HyperLogLog sparse encoding stress test} {
-        for {set x 0} {$x < 1000} {incr x} {
-            r del hll1 hll2
-            set numele [randomInt 100]
-            set elements {}
-            for {set j 0} {$j < $numele} {incr j} {
-                lappend elements [expr rand()]
-            }
-            # Force dense representation of hll2
-            r pfadd hll2
-            r pfdebug todense hll2
-            r pfadd hll1 {*}$elements
-            r pfadd hll2 {*}$elements
-            assert {[r pfdebug encoding hll1] eq {sparse}}
-            assert {[r pfdebug encoding hll2] eq {dense}}
-            # Cardinality estimated should match exactly.
-            assert {[r pfcount hll1] eq [r pfcount hll2]}
-        }
-    }
+    # PFDEBUG isn't supported
+    # test {HyperLogLogs are promote from sparse to dense} {
+    #     r del hll
+    #     r config set hll-sparse-max-bytes 3000
+    #     set n 0
+    #     while {$n < 100000} {
+    #         set elements {}
+    #         for {set j 0} {$j < 100} {incr j} {lappend elements [expr rand()]}
+    #         incr n 100
+    #         r pfadd hll {*}$elements
+    #         set card [r pfcount hll]
+    #         set err [expr {abs($card-$n)}]
+    #         assert {$err < (double($card)/100)*5}
+    #         if {$n < 1000} {
+    #             assert {[r pfdebug encoding hll] eq {sparse}}
+    #         } elseif {$n > 10000} {
+    #             assert {[r pfdebug encoding hll] eq {dense}}
+    #         }
+    #     }
+    # }
+
+    # PFDEBUG isn't supported
+    # test {HyperLogLog sparse encoding stress test} {
+    #     for {set x 0} {$x < 1000} {incr x} {
+    #         r del hll1 hll2
+    #         set numele [randomInt 100]
+    #         set elements {}
+    #         for {set j 0} {$j < $numele} {incr j} {
+    #             lappend elements [expr rand()]
+    #         }
+    #         # Force dense representation of hll2
+    #         r pfadd hll2
+    #         r pfdebug todense hll2
+    #         r pfadd hll1 {*}$elements
+    #         r pfadd hll2 {*}$elements
+    #         assert {[r pfdebug encoding hll1] eq {sparse}}
+    #         assert {[r pfdebug encoding hll2] eq {dense}}
+    #         # Cardinality estimated should match exactly.
+    #         assert {[r pfcount hll1] eq [r pfcount hll2]}
+    #     }
+    # }
 
     test {Corrupted sparse HyperLogLogs are detected: Additional at tail} {
         r del hll
@@ -194,20 +197,22 @@ start_server {tags {"hll"}} {
         assert {$err < (double($card)/100)*5}
     }
 
-    test {PFDEBUG GETREG returns the HyperLogLog raw registers} {
-        r del hll
-        r pfadd hll 1 2 3
-        llength [r pfdebug getreg hll]
-    } {16384}
-
-    test {PFADD / PFCOUNT cache invalidation works} {
-        r del hll
-        r pfadd hll a b c
-        r pfcount hll
-        assert {[r getrange hll 15 15] eq "\x00"}
-        r pfadd hll a b c
-        assert {[r getrange hll 15 15] eq "\x00"}
-        r pfadd hll 1 2 3
-        assert {[r getrange hll 15 15] eq "\x80"}
-    }
+    # PFDEBUG isn't supported
+    # test {PFDEBUG GETREG returns the HyperLogLog raw registers} {
+    #     r del hll
+    #     r pfadd hll 1 2 3
+    #     llength [r pfdebug getreg hll]
+    # } {16384}
+
+    # PFCOUNT is read-only and doesn't write the cached cardinality back
+    # test {PFADD / PFCOUNT cache invalidation works} {
+    #     r del hll
+    #     r pfadd hll a b c
+    #     r pfcount hll
+    #     assert {[r getrange hll 15 15] eq "\x00"}
+    #     r pfadd hll a b c
+    #     assert {[r getrange hll 15 15] eq "\x00"}
+    #     r pfadd hll 1 2 3
+    #     assert {[r getrange hll 15 15] eq "\x80"}
+    # }
 }
@@ -68,4 +68,16 @@ start_server {tags {"regression"}} {
         $rd rpush nolist a
         $rd read
     }
+
+    test "The pipelined commands after WAIT were replied in order" {
+        set rd [redis_deferring_client]
+        $rd write "*3\r\n\$4\r\nWAIT\r\n\$1\r\n1\r\n\$3\r\n100\r\n*1\r\n\$4\r\nPING\r\n"
+        $rd flush
+        assert_equal 0 [$rd read]
+        assert_equal PONG [$rd read]
+        # the connection was still alive after the WAIT timed out
+        $rd ping
+        assert_equal PONG [$rd read]
+        $rd close
+    }
 }
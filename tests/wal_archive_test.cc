@@ -0,0 +1,283 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rocksdb/write_batch.h>
+
+#include "config.h"
+#include "storage.h"
+#include "wal_archive.h"
+#include "wal_archiver.h"
+#include "redis_hash.h"
+#include "redis_string.h"
+
+TEST(WALArchive, ReadSegment) {
+  auto env = rocksdb::Env::Default();
+  std::string archive_dir = "walarchivetest";
+  Engine::RemoveDirRecursively(env, archive_dir);
+  env->CreateDirIfMissing(archive_dir);
+  env->CreateDirIfMissing(WALArchive::SegmentDir(archive_dir));
+
+  auto path = WALArchive::SegmentPath(archive_dir, 100, false);
+  WALArchive::SegmentWriter writer;
+  ASSERT_TRUE(writer.Open(env, path).IsOK());
+  ASSERT_TRUE(writer.Append(100, 1000, "batch1").IsOK());
+  ASSERT_TRUE(writer.Append(102, 2000, std::string(4096, 'b')).IsOK());
+  ASSERT_TRUE(writer.Close().IsOK());
+  // the torn record at the tail was treated as the end
+  std::string content;
+  ASSERT_TRUE(rocksdb::ReadFileToString(env, path, &content).ok());
+  ASSERT_TRUE(rocksdb::WriteStringToFile(env, content + content.substr(0, 30), path).ok());
+
+  WALArchive::SegmentReader reader;
+  ASSERT_TRUE(reader.Open(env, path).IsOK());
+  WALArchive::Record record;
+  bool eof = false;
+  ASSERT_TRUE(reader.Next(&record, &eof).IsOK());
+  ASSERT_FALSE(eof);
+  EXPECT_EQ(record.seq, 100U);
+  EXPECT_EQ(record.time_ms, 1000);
+  EXPECT_EQ(record.batch, "batch1");
+  ASSERT_TRUE(reader.Next(&record, &eof).IsOK());
+  ASSERT_FALSE(eof);
+  EXPECT_EQ(record.seq, 102U);
+  EXPECT_EQ(record.batch, std::string(4096, 'b'));
+  ASSERT_TRUE(reader.Next(&record, &eof).IsOK());
+  EXPECT_TRUE(eof);
+  EXPECT_EQ(reader.Offset(), content.size());
+
+  // the corrupted record was reported
+  content[25] ^= 1;
+  ASSERT_TRUE(rocksdb::WriteStringToFile(env, content, path).ok());
+  WALArchive::SegmentReader corrupted_reader;
+  ASSERT_TRUE(corrupted_reader.Open(env, path).IsOK());
+  EXPECT_FALSE(corrupted_reader.Next(&record, &eof).IsOK());
+
+  ASSERT_TRUE(env->RenameFile(path, WALArchive::SegmentPath(archive_dir, 100, true)).ok());
+  ASSERT_TRUE(rocksdb::WriteStringToFile(env, "", WALArchive::SegmentPath(archive_dir, 9, true)).ok());
+  std::vector<WALArchive::SegmentInfo> segments;
+  ASSERT_TRUE(WALArchive::ListSegments(env, archive_dir, &segments).IsOK());
+  ASSERT_EQ(segments.size(), 2U);
+  EXPECT_EQ(segments[0].first_seq, 9U);
+  EXPECT_EQ(segments[1].first_seq, 100U);
+  EXPECT_TRUE(segments[1].closed);
+  Engine::RemoveDirRecursively(env, archive_dir);
+}
+
+TEST(WALArchiver, ArchiveWithCheckpoint) {
+  auto env = rocksdb::Env::Default();
+  Config config;
+  config.db_dir = "walarchiverdb";
+  config.backup_dir = "walarchiverdb/backup";
+  config.wal_archive_dir = "walarchiverdb/archive";
+  Engine::RemoveDirRecursively(env, config.db_dir);
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+  auto string = new Redis::String(storage_, "test_wal_archiver");
+  string->Set("key_before_archiving", "v");
+
+  WALArchiver archiver(storage_, &config);
+  ASSERT_TRUE(archiver.Start().IsOK());
+  // the first checkpoint was created as the base of the archive
+  WALArchiverStats stats;
+  for (int i = 0; i < 100 && stats.last_checkpoint_seq == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    archiver.GetStats(&stats);
+  }
+  auto checkpoint_seq = stats.last_checkpoint_seq;
+  ASSERT_EQ(checkpoint_seq, storage_->LatestSeq());
+
+  for (int i = 0; i < 10; i++) string->Set("key" + std::to_string(i), "v");
+  for (int i = 0; i < 100 && stats.archived_seq < storage_->LatestSeq(); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    archiver.GetStats(&stats);
+  }
+  EXPECT_EQ(stats.archived_seq, storage_->LatestSeq());
+  EXPECT_EQ(stats.archived_batches, 10U);
+  archiver.Stop();
+  archiver.Join();
+
+  std::vector<WALArchive::CheckpointInfo> checkpoints;
+  ASSERT_TRUE(WALArchive::ListCheckpoints(env, config.wal_archive_dir, &checkpoints).IsOK());
+  ASSERT_EQ(checkpoints.size(), 1U);
+  EXPECT_EQ(checkpoints[0].seq, checkpoint_seq);
+  std::vector<WALArchive::SegmentInfo> segments;
+  ASSERT_TRUE(WALArchive::ListSegments(env, config.wal_archive_dir, &segments).IsOK());
+  ASSERT_EQ(segments.size(), 1U);
+  EXPECT_TRUE(segments[0].closed);
+  EXPECT_EQ(segments[0].first_seq, checkpoint_seq + 1);
+
+  // the batches after the checkpoint were contiguous
+  WALArchive::SegmentReader reader;
+  ASSERT_TRUE(reader.Open(env, segments[0].path).IsOK());
+  WALArchive::Record record;
+  bool eof = false;
+  auto next_seq = checkpoint_seq + 1;
+  while (reader.Next(&record, &eof).IsOK() && !eof) {
+    EXPECT_EQ(record.seq, next_seq);
+    next_seq = record.seq + rocksdb::WriteBatch(record.batch).Count();
+  }
+  EXPECT_EQ(next_seq, storage_->LatestSeq() + 1);
+
+  delete string;
+  delete storage_;
+  Engine::RemoveDirRecursively(env, config.db_dir);
+}
+
+// Restore the archive into the db dir, and reopen it so the replayed batches
+// must have been flushed. The caller owns the restored storage.
+static Engine::Storage *restoreArchive(const std::string &archive_dir, rocksdb::SequenceNumber target_seq,
+                                       Config *config, rocksdb::SequenceNumber *restored_seq) {
+  auto env = rocksdb::Env::Default();
+  Engine::RemoveDirRecursively(env, config->db_dir);
+  WALArchive::CheckpointInfo base;
+  auto s = WALArchive::PickCheckpoint(env, archive_dir, target_seq, 0, &base);
+  EXPECT_TRUE(s.IsOK()) << s.Msg();
+  if (!s.IsOK()) return nullptr;
+  s = WALArchive::CopyCheckpoint(env, base.path, config->db_dir, 2);
+  EXPECT_TRUE(s.IsOK()) << s.Msg();
+  auto storage = new Engine::Storage(config);
+  s = storage->Open();
+  EXPECT_TRUE(s.IsOK()) << s.Msg();
+  if (s.IsOK()) {
+    s = WALArchive::Replay(env, archive_dir, storage->GetDB(), *storage->GetCFHandles(), base.seq, target_seq, 0,
+                           restored_seq);
+  }
+  EXPECT_TRUE(s.IsOK()) << s.Msg();
+  delete storage;
+  storage = new Engine::Storage(config);
+  s = storage->Open();
+  EXPECT_TRUE(s.IsOK()) << s.Msg();
+  return storage;
+}
+
+static void waitArchived(WALArchiver *archiver, Engine::Storage *storage) {
+  WALArchiverStats stats;
+  archiver->GetStats(&stats);
+  for (int i = 0; i < 100 && (stats.last_checkpoint_seq == 0 || stats.archived_seq < storage->LatestSeq()); i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    archiver->GetStats(&stats);
+  }
+}
+
+TEST(WALArchiver, RestoreToPointInTime) {
+  auto env = rocksdb::Env::Default();
+  std::string dir = "walarchiverpitr";
+  Engine::RemoveDirRecursively(env, dir);
+  env->CreateDirIfMissing(dir);
+  Config config;
+  config.db_dir = dir + "/db";
+  config.backup_dir = dir + "/backup";
+  config.wal_archive_dir = dir + "/archive";
+  Config restore_config;
+  restore_config.db_dir = dir + "/restore";
+  restore_config.backup_dir = dir + "/restore_backup";
+
+  auto storage = new Engine::Storage(&config);
+  ASSERT_TRUE(storage->Open().IsOK());
+  auto string = new Redis::String(storage, "test_pitr");
+  auto hash = new Redis::Hash(storage, "test_pitr");
+  string->Set("key_before_archiving", "v");
+  std::vector<rocksdb::SequenceNumber> seqs;
+  {
+    WALArchiver archiver(storage, &config);
+    ASSERT_TRUE(archiver.Start().IsOK());
+    // wait for the first checkpoint as the base of the archive
+    waitArchived(&archiver, storage);
+    for (int i = 0; i < 10; i++) {
+      int ret;
+      string->Set("key" + std::to_string(i), "v" + std::to_string(i));
+      hash->Set("hash" + std::to_string(i), "f", "v" + std::to_string(i), &ret);
+      seqs.emplace_back(storage->LatestSeq());
+    }
+    waitArchived(&archiver, storage);
+    archiver.Stop();
+    archiver.Join();
+  }
+  delete hash;
+  delete string;
+  delete storage;
+
+  // restored to the last batch not after the target seq
+  rocksdb::SequenceNumber restored_seq = 0;
+  auto restored = restoreArchive(config.wal_archive_dir, seqs[4], &restore_config, &restored_seq);
+  ASSERT_NE(restored, nullptr);
+  EXPECT_EQ(restored_seq, seqs[4]);
+  string = new Redis::String(restored, "test_pitr");
+  hash = new Redis::Hash(restored, "test_pitr");
+  std::string value;
+  for (int i = 0; i < 10; i++) {
+    auto s = string->Get("key" + std::to_string(i), &value);
+    if (i <= 4) {
+      EXPECT_TRUE(s.ok());
+      EXPECT_EQ(value, "v" + std::to_string(i));
+    } else {
+      EXPECT_TRUE(s.IsNotFound());
+    }
+    // the hash metadata was replayed into the metadata column family
+    s = hash->Get("hash" + std::to_string(i), "f", &value);
+    if (i <= 4) {
+      EXPECT_TRUE(s.ok());
+      EXPECT_EQ(value, "v" + std::to_string(i));
+    } else {
+      EXPECT_TRUE(s.IsNotFound());
+    }
+  }
+  delete hash;
+  delete string;
+  delete restored;
+
+  // The new db whose seq went back, the old history was retired and the new
+  // batches never collided with the archived ones.
+  config.db_dir = dir + "/newdb";
+  storage = new Engine::Storage(&config);
+  ASSERT_TRUE(storage->Open().IsOK());
+  string = new Redis::String(storage, "test_pitr");
+  string->Set("new_key", "v");
+  ASSERT_LT(storage->LatestSeq(), seqs.back());
+  {
+    WALArchiver archiver(storage, &config);
+    ASSERT_TRUE(archiver.Start().IsOK());
+    waitArchived(&archiver, storage);
+    string->Set("new_key2", "v");
+    waitArchived(&archiver, storage);
+    archiver.Stop();
+    archiver.Join();
+  }
+  auto new_latest_seq = storage->LatestSeq();
+  delete string;
+  delete storage;
+
+  std::vector<std::string> retired;
+  ASSERT_TRUE(env->GetChildren(WALArchive::HistoryDir(config.wal_archive_dir), &retired).ok());
+  retired.erase(std::remove_if(retired.begin(), retired.end(), [](const std::string &name) {
+    return name == "." || name == "..";
+  }), retired.end());
+  ASSERT_EQ(retired.size(), 1U);
+  auto retired_dir = WALArchive::HistoryDir(config.wal_archive_dir) + "/" + retired[0];
+
+  restored = restoreArchive(retired_dir, seqs[6], &restore_config, &restored_seq);
+  ASSERT_NE(restored, nullptr);
+  EXPECT_EQ(restored_seq, seqs[6]);
+  string = new Redis::String(restored, "test_pitr");
+  EXPECT_TRUE(string->Get("key6", &value).ok());
+  EXPECT_TRUE(string->Get("key7", &value).IsNotFound());
+  EXPECT_TRUE(string->Get("new_key", &value).IsNotFound());
+  delete string;
+  delete restored;
+
+  restored = restoreArchive(config.wal_archive_dir, 0, &restore_config, &restored_seq);
+  ASSERT_NE(restored, nullptr);
+  EXPECT_EQ(restored_seq, new_latest_seq);
+  string = new Redis::String(restored, "test_pitr");
+  EXPECT_TRUE(string->Get("new_key", &value).ok());
+  EXPECT_TRUE(string->Get("new_key2", &value).ok());
+  EXPECT_TRUE(string->Get("key0", &value).IsNotFound());
+  delete string;
+  delete restored;
+  Engine::RemoveDirRecursively(env, dir);
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "config.h"
+#include "storage.h"
+#include "wal_tailer.h"
+#include "redis_string.h"
+
+TEST(WALTailer, ReadFromRing) {
+  Config config;
+  config.db_dir = "waltailerdb";
+  config.backup_dir = "waltailerdb/backup";
+
+  auto storage_ = new Engine::Storage(&config);
+  Status s = storage_->Open();
+  assert(s.IsOK());
+  auto string = new Redis::String(storage_, "test_wal_tailer");
+  string->Set("key_before_tailing", "v");
+
+  // the ring could hold a few batches only
+  WALTailer tailer(storage_, 512);
+  tailer.Subscribe();
+  ASSERT_TRUE(tailer.Start().IsOK());
+  WALTailerStats stats;
+  for (int i = 0; i < 100 && stats.next_seq == 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    tailer.GetStats(&stats);
+  }
+  ASSERT_EQ(stats.next_seq, storage_->LatestSeq() + 1);
+
+  std::shared_ptr<const WALBatch> batch;
+  // the batches written before tailing should be read from the WAL by the slave
+  EXPECT_EQ(tailer.Read(storage_->LatestSeq(), &batch), WALTailer::kBehind);
+  auto first_seq = storage_->LatestSeq() + 1;
+  EXPECT_EQ(tailer.Read(first_seq, &batch), WALTailer::kNoData);
+
+  string->Set("key1", "v1");
+  tailer.WaitForData(first_seq, 1000);
+  ASSERT_EQ(tailer.Read(first_seq, &batch), WALTailer::kFound);
+  EXPECT_EQ(batch->seq, first_seq);
+  EXPECT_EQ(batch->header, "$" + std::to_string(batch->batch->GetDataSize()) + "\r\n");
+  auto next_seq = batch->seq + batch->count;
+  EXPECT_EQ(tailer.Read(next_seq, &batch), WALTailer::kNoData);
+
+  // the oldest batches were evicted once the ring was full
+  for (int i = 0; i < 20; i++) string->Set("key" + std::to_string(i), std::string(100, 'v'));
+  tailer.WaitForData(storage_->LatestSeq(), 1000);
+  tailer.GetStats(&stats);
+  EXPECT_LE(stats.bytes, 512U);
+  EXPECT_GT(stats.first_seq, first_seq);
+  EXPECT_EQ(tailer.Read(first_seq, &batch), WALTailer::kBehind);
+  ASSERT_EQ(tailer.Read(storage_->LatestSeq(), &batch), WALTailer::kFound);
+  EXPECT_EQ(batch->seq + batch->count, storage_->LatestSeq() + 1);
+
+  tailer.Unsubscribe();
+  tailer.Stop();
+  tailer.Join();
+  delete string;
+  delete storage_;
+}
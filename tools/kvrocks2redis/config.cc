@@ -28,6 +28,18 @@ int Config::yesnotoi(std::string input) {
   return -1;
 }
 
+Status Config::parseIntArg(const std::string &name, const std::string &value, int min, int max, int *result) {
+  try {
+    *result = std::stoi(value);
+  } catch (const std::exception &e) {
+    return Status(Status::NotOK, name + " should be an integer");
+  }
+  if (*result < min || *result > max) {
+    return Status(Status::NotOK, name + " should be between " + std::to_string(min) + " and " + std::to_string(max));
+  }
+  return Status::OK();
+}
+
 Status Config::parseConfigFromString(std::string input) {
   std::vector<std::string> args;
   Util::Split(input, " \t\r\n", &args);
@@ -55,6 +67,17 @@ Status Config::parseConfigFromString(std::string input) {
     }
   } else if (size == 2 && args[0] == "pidfile") {
     pidfile = args[1];
+  } else if (size == 2 && args[0] == "parse-threads") {
+    return parseIntArg(args[0], args[1], 1, 256, &parse_threads);
+  } else if (size == 2 && args[0] == "bulk-max-args") {
+    return parseIntArg(args[0], args[1], 1, 65536, &bulk_max_args);
+  } else if (size == 2 && args[0] == "pipeline-max-commands") {
+    return parseIntArg(args[0], args[1], 1, 1000000, &pipeline_max_commands);
+  } else if (size == 2 && args[0] == "pipeline-max-kb") {
+    int kb = 0;
+    auto s = parseIntArg(args[0], args[1], 1, 1024 * 1024, &kb);
+    if (!s.IsOK()) return s;
+    pipeline_max_bytes = kb * 1024;
   } else if (size >= 3 && args[0] == "kvrocks") {
     kvrocks_host = args[1];
     // we use port + 1 as repl port, so incr the kvrocks port here
@@ -31,6 +31,11 @@ struct Config {
   int kvrocks_port = 0;
   std::map<std::string, redis_server> tokens;
 
+  int parse_threads = 4;
+  int bulk_max_args = 128;
+  int pipeline_max_commands = 1024;
+  int pipeline_max_bytes = 4 * 1024 * 1024;
+
  public:
   Status Load(std::string path);
   Config() = default;
@@ -39,6 +44,7 @@ struct Config {
  private:
   std::string path_;
   int yesnotoi(std::string input);
+  Status parseIntArg(const std::string &name, const std::string &value, int min, int max, int *result);
   Status parseConfigFromString(std::string input);
 };
 
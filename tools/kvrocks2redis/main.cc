@@ -131,7 +131,7 @@ int main(int argc, char *argv[]) {
   }
 
   RedisWriter writer(&config);
-  Parser parser(&storage, &writer);
+  Parser parser(&storage, &writer, &config);
 
   Sync sync(&storage, &writer, &parser, &config);
   hup_handler = [&sync]() {
@@ -1,72 +1,231 @@
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <system_error>
+#include <thread>
 #include <rocksdb/write_batch.h>
 
+#include "../../src/util.h"
 #include "../../src/redis_bitmap.h"
 #include "parser.h"
 #include "util.h"
 
+namespace {
+
+const size_t kMaxParseBufferBytes = 1024 * 1024;
+const size_t kMaxBulkBytes = 1024 * 1024;
+const int kProgressIntervalSecs = 10;
+
+// The bits of the byte were stored from the lowest in kvrocks, but from the highest in redis
+char reverseBits(char c) {
+  auto b = static_cast<uint8_t>(c);
+  b = static_cast<uint8_t>((b & 0xF0) >> 4 | (b & 0x0F) << 4);
+  b = static_cast<uint8_t>((b & 0xCC) >> 2 | (b & 0x33) << 2);
+  b = static_cast<uint8_t>((b & 0xAA) >> 1 | (b & 0x55) << 1);
+  return static_cast<char>(b);
+}
+
+}  // namespace
+
 Status Parser::ParseFullDB() {
   rocksdb::DB *db_ = storage_->GetDB();
   if (!lastest_snapshot_) lastest_snapshot_ = new LatestSnapShot(db_);
   rocksdb::ColumnFamilyHandle *metadata_cf_handle_ = storage_->GetCFHandle("metadata");
 
+  std::vector<std::string> boundaries;
+  splitRanges(&boundaries);
+  uint64_t total_keys = 0;
+  db_->GetIntProperty(metadata_cf_handle_, "rocksdb.estimate-num-keys", &total_keys);
+  LOG(INFO) << "[kvrocks2redis] Start parsing the full db with " << boundaries.size() + 1
+            << " threads, estimated keys: " << total_keys;
+
+  parsed_keys_ = 0;
+  parse_stop_ = false;
+  std::vector<Status> results(boundaries.size() + 1);
+  std::vector<std::thread> threads;
+  std::atomic<size_t> running{0};
+  for (size_t i = 0; i <= boundaries.size(); i++) {
+    std::string begin = i == 0 ? "" : boundaries[i - 1];
+    std::string end = i == boundaries.size() ? "" : boundaries[i];
+    running++;
+    try {
+      threads.emplace_back([this, &results, &running, i, begin, end]() {
+        results[i] = parseRange(begin, end);
+        running--;
+      });
+    } catch (const std::system_error &e) {
+      running--;
+      parse_stop_ = true;
+      results[i] = Status(Status::NotOK, e.what());
+      break;
+    }
+  }
+
+  auto start_time = std::chrono::steady_clock::now();
+  auto last_report_time = start_time;
+  uint64_t last_parsed_keys = 0;
+  while (running > 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::duration<double>(now - last_report_time).count();
+    if (elapsed < kProgressIntervalSecs) continue;
+    uint64_t parsed_keys = parsed_keys_;
+    auto keys_per_sec = static_cast<double>(parsed_keys - last_parsed_keys) / elapsed;
+    LOG(INFO) << "[kvrocks2redis] Parsed " << parsed_keys << "/" << total_keys << " keys, "
+              << static_cast<uint64_t>(keys_per_sec) << " keys/s, ETA "
+              << (keys_per_sec > 0 && total_keys > parsed_keys
+                  ? std::to_string(static_cast<uint64_t>((total_keys - parsed_keys) / keys_per_sec)) + "s"
+                  : "unknown");
+    last_parsed_keys = parsed_keys;
+    last_report_time = now;
+  }
+  for (auto &t : threads) t.join();
+  delete lastest_snapshot_;
+  lastest_snapshot_ = nullptr;
+
+  for (const auto &s : results) {
+    if (!s.IsOK()) return s;
+  }
+  LOG(INFO) << "[kvrocks2redis] Parsed " << parsed_keys_ << " keys of the full db in "
+            << std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time).count()
+            << "s";
+  return Status::OK();
+}
+
+// Split the metadata keys into the ranges by the smallest keys of the sst files,
+// so the ranges were roughly balanced without scanning the db.
+void Parser::splitRanges(std::vector<std::string> *boundaries) {
+  boundaries->clear();
+  std::vector<rocksdb::LiveFileMetaData> files;
+  storage_->GetDB()->GetLiveFilesMetaData(&files);
+  std::vector<std::string> keys;
+  for (const auto &file : files) {
+    if (file.column_family_name == Engine::kMetadataColumnFamilyName) keys.emplace_back(file.smallestkey);
+  }
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  size_t ranges = std::min(static_cast<size_t>(config_->parse_threads), keys.size());
+  for (size_t i = 1; i < ranges; i++) {
+    boundaries->emplace_back(keys[i * keys.size() / ranges]);
+  }
+}
+
+Status Parser::parseRange(const std::string &begin, const std::string &end) {
+  rocksdb::DB *db_ = storage_->GetDB();
+  rocksdb::ColumnFamilyHandle *metadata_cf_handle_ = storage_->GetCFHandle("metadata");
+
   rocksdb::ReadOptions read_options;
   read_options.snapshot = lastest_snapshot_->GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options, metadata_cf_handle_);
-  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+  rocksdb::Slice upper_bound(end);
+  if (!end.empty()) read_options.iterate_upper_bound = &upper_bound;
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options, metadata_cf_handle_));
+  if (begin.empty()) {
+    iter->SeekToFirst();
+  } else {
+    iter->Seek(begin);
+  }
+  ParseOutput output;
+  Status s;
+  for (; iter->Valid() && !parse_stop_; iter->Next()) {
     Metadata metadata(kRedisNone);
     metadata.Decode(iter->value().ToString());
     if (metadata.Expired()) {  // ignore the expired key
       continue;
     }
-    Status s;
     if (metadata.Type() == kRedisString) {
-      s = parseSimpleKV(iter->key(), iter->value(), metadata.expire);
+      s = parseSimpleKV(&output, iter->key(), iter->value(), metadata.expire);
     } else {
-      s = parseComplexKV(iter->key(), metadata);
+      s = parseComplexKV(&output, iter->key(), metadata);
     }
-    if (!s.IsOK()) return s;
+    if (!s.IsOK()) break;
+    parsed_keys_.fetch_add(1, std::memory_order_relaxed);
   }
-  delete iter;
-  delete lastest_snapshot_;
-  lastest_snapshot_ = nullptr;
+  if (s.IsOK() && !iter->status().ok()) s = Status(Status::NotOK, iter->status().ToString());
+  if (s.IsOK()) s = flush(&output);
+  if (!s.IsOK()) parse_stop_ = true;
+  return s;
+}
+
+Status Parser::emit(ParseOutput *output, const std::string &ns, const std::string &aof) {
+  output->aofs[ns].append(aof);
+  output->bytes += aof.size();
+  if (output->bytes < kMaxParseBufferBytes) return Status::OK();
+  return flush(output);
+}
 
+Status Parser::flush(ParseOutput *output) {
+  for (auto &iter : output->aofs) {
+    if (iter.second.empty()) continue;
+    Status s = writer_->Write(iter.first, {iter.second});
+    if (!s.IsOK()) return s;
+    iter.second.clear();
+  }
+  output->bytes = 0;
   return Status::OK();
 }
 
-Status Parser::parseSimpleKV(const Slice &ns_key, const Slice &value, int expire) {
+Status Parser::parseSimpleKV(ParseOutput *output, const Slice &ns_key, const Slice &value, int expire) {
   std::string op, ns, user_key;
   ExtractNamespaceKey(ns_key, &ns, &user_key);
-  std::string output;
-  output = Rocksdb2Redis::Command2RESP(
+  std::string aof;
+  aof = Rocksdb2Redis::Command2RESP(
       {"SET", user_key, value.ToString().substr(5, value.size() - 5)});
-  Status s = writer_->Write(ns, {output});
-  if (!s.IsOK()) return s;
 
   if (expire > 0) {
-    output = Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(expire)});
-    s = writer_->Write(ns, {output});
+    aof += Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(expire)});
   }
-  return s;
+  return emit(output, ns, aof);
 }
 
-Status Parser::parseComplexKV(const Slice &ns_key, const Metadata &metadata) {
+// The fields of the complex key were sent by the bulk commands, every command
+// carries at most bulk-max-args fields or members. The key of the type which
+// has no counterpart in redis (e.g. sortedint) was skipped with a warning, the
+// rest of the db was still parsed.
+Status Parser::parseComplexKV(ParseOutput *output, const Slice &ns_key, const Metadata &metadata) {
   RedisType type = metadata.Type();
   if (type < kRedisHash || type > kRedisBitmap) {
-    return Status(Status::NotOK, "unknown metadata type: " + std::to_string(type));
+    std::string ns, user_key;
+    ExtractNamespaceKey(ns_key, &ns, &user_key);
+    LOG(WARNING) << "[kvrocks2redis] Skip the key: " << user_key << " of namespace: " << ns
+                 << ", the metadata type: " << static_cast<int>(type) << " wasn't supported";
+    return Status::OK();
   }
 
-  std::string ns, prefix_key, user_key, sub_key, value, output;
+  std::string ns, prefix_key, user_key, sub_key, value;
   ExtractNamespaceKey(ns_key, &ns, &user_key);
   InternalKey(ns_key, "", metadata.version).Encode(&prefix_key);
 
+  std::vector<std::string> bulk_args;
+  switch (type) {
+    case kRedisHash:bulk_args = {"HMSET", user_key};
+      break;
+    case kRedisSet:bulk_args = {"SADD", user_key};
+      break;
+    case kRedisList:bulk_args = {"RPUSH", user_key};
+      break;
+    case kRedisZSet:bulk_args = {"ZADD", user_key};
+      break;
+    default:break;
+  }
+  const size_t bulk_header_size = bulk_args.size();
+  size_t bulk_elements = 0, bulk_bytes = 0;
+  auto flush_bulk = [&]() -> Status {
+    if (bulk_elements == 0) return Status::OK();
+    auto s = emit(output, ns, Rocksdb2Redis::Command2RESP(bulk_args));
+    bulk_args.resize(bulk_header_size);
+    bulk_elements = 0;
+    bulk_bytes = 0;
+    return s;
+  };
+
   rocksdb::DB *db_ = storage_->GetDB();
   rocksdb::ReadOptions read_options;
   read_options.snapshot = lastest_snapshot_->GetSnapShot();
   read_options.fill_cache = false;
-  auto iter = db_->NewIterator(read_options);
+  std::unique_ptr<rocksdb::Iterator> iter(db_->NewIterator(read_options));
   for (iter->Seek(prefix_key); iter->Valid(); iter->Next()) {
     if (!iter->key().starts_with(prefix_key)) {
       break;
@@ -76,53 +235,58 @@ Status Parser::parseComplexKV(const Slice &ns_key, const Metadata &metadata) {
     sub_key = ikey.GetSubKey().ToString();
     value = iter->value().ToString();
     switch (type) {
-      case kRedisHash:output = Rocksdb2Redis::Command2RESP({"HSET", user_key, sub_key, value});
+      case kRedisHash:bulk_args.emplace_back(sub_key);
+        bulk_args.emplace_back(value);
         break;
-      case kRedisSet:output = Rocksdb2Redis::Command2RESP({"SADD", user_key, sub_key});
+      case kRedisSet:bulk_args.emplace_back(sub_key);
         break;
-      case kRedisList:output = Rocksdb2Redis::Command2RESP({"RPUSH", user_key, value});
+      case kRedisList:bulk_args.emplace_back(value);
         break;
       case kRedisZSet: {
         double score = DecodeDouble(value.data());
-        output = Rocksdb2Redis::Command2RESP({"ZADD", user_key, std::to_string(score), sub_key});
+        bulk_args.emplace_back(Util::Float2String(score));
+        bulk_args.emplace_back(sub_key);
         break;
       }
       case kRedisBitmap: {
         int index = std::stoi(sub_key);
-        s = Parser::parseBitmapSegment(ns, user_key, index, value);
-        break;
+        auto decode_status = Redis::Bitmap::DecodeSegment(metadata, value, &value);
+        if (!decode_status.ok()) {
+          return Status(Status::NotOK, decode_status.ToString());
+        }
+        s = Parser::parseBitmapSegment(output, ns, user_key, index, value);
+        if (!s.IsOK()) return s;
+        continue;
       }
       default:break;  // should never get here
     }
-    if (type != kRedisBitmap) {
-      s = writer_->Write(ns, {output});
+    bulk_bytes += sub_key.size() + value.size();
+    if (++bulk_elements >= static_cast<size_t>(config_->bulk_max_args) || bulk_bytes >= kMaxBulkBytes) {
+      s = flush_bulk();
+      if (!s.IsOK()) return s;
     }
-    if (!s.IsOK()) return s;
   }
+  auto s = flush_bulk();
+  if (!s.IsOK()) return s;
 
   if (metadata.expire > 0) {
-    output = Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)});
-    Status s = writer_->Write(ns, {output});
+    s = emit(output, ns, Rocksdb2Redis::Command2RESP({"EXPIREAT", user_key, std::to_string(metadata.expire)}));
     if (!s.IsOK()) return s;
   }
-
-  delete iter;
   return Status::OK();
 }
 
-Status Parser::parseBitmapSegment(const Slice &ns, const Slice &user_key, int index, const Slice &bitmap) {
-  Status s;
-  for (size_t i = 0; i < bitmap.size(); i++) {
-    if (bitmap[i] == 0) continue;  // ignore zero byte
-    for (int j = 0; j < 8; j++) {
-      if (!(bitmap[i] & (1 << j))) continue;  // ignore zero bit
-      s = writer_->Write(ns.ToString(), {Rocksdb2Redis::Command2RESP(
-          {"SETBIT", user_key.ToString(), std::to_string(index * 8 + i * 8 + j), "1"})
-      });
-      if (!s.IsOK()) return s;
-    }
-  }
-  return Status::OK();
+// The segment was sent by one SETRANGE instead of the SETBIT per bit, the zero
+// bytes at the both ends were skipped.
+Status Parser::parseBitmapSegment(ParseOutput *output, const std::string &ns, const std::string &user_key,
+                                  int index, const Slice &bitmap) {
+  size_t first = 0, last = bitmap.size();
+  while (first < last && bitmap[first] == 0) first++;
+  while (last > first && bitmap[last - 1] == 0) last--;
+  if (first == last) return Status::OK();
+  std::string bytes(bitmap.data() + first, last - first);
+  for (auto &c : bytes) c = reverseBits(c);
+  return emit(output, ns, Rocksdb2Redis::Command2RESP({"SETRANGE", user_key, std::to_string(index + first), bytes}));
 }
 
 rocksdb::Status Parser::ParseWriteBatch(const std::string &batch_string) {
@@ -165,6 +329,19 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
         command_args = {"EXPIREAT", user_key, std::to_string(metadata.expire)};
         aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
       }
+    } else if (metadata.Type() == kRedisBitmap && log_data_.GetRedisType() == kRedisBitmap) {
+      // BITOP and BITFIELD would be replayed when the metadata was written,
+      // the result of BITOP may be written in multiple batches. SETBIT logs at most
+      // two arguments, so it wouldn't be confused with them.
+      auto args = log_data_.GetArguments();
+      if (args->size() > 2) {
+        RedisCommand cmd = static_cast<RedisCommand >(std::stoi((*args)[0]));
+        if (cmd == kRedisCmdBitOp || cmd == kRedisCmdBitfield) {
+          command_args = {cmd == kRedisCmdBitOp ? "BITOP" : "BITFIELD"};
+          command_args.insert(command_args.end(), args->begin() + 1, args->end());
+          aof_strings_[ns].emplace_back(Rocksdb2Redis::Command2RESP(command_args));
+        }
+      }
     } else if (metadata.expire > 0) {
       auto args = log_data_.GetArguments();
       if (args->size() > 0) {
@@ -224,7 +401,7 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
         break;
       case kRedisZSet: {
         double score = DecodeDouble(value.data());
-        command_args = {"ZADD", user_key, std::to_string(score), sub_key};
+        command_args = {"ZADD", user_key, Util::Float2String(score), sub_key};
         break;
       }
       case kRedisBitmap: {
@@ -234,6 +411,13 @@ rocksdb::Status WriteBatchExtractor::PutCF(uint32_t column_family_id, const Slic
           LOG(ERROR) << "Fail to parse write_batch in putcf cmd setbit : args error ,should contain setbit offset";
           return rocksdb::Status::OK();
         }
+        // BITOP and BITFIELD would be parsed in the metadata putcf, so ignore the segments
+        if (args->size() > 2) return rocksdb::Status::OK();
+        // the new bit was logged if the segment was encoded as the container
+        if (args->size() == 2) {
+          command_args = {"SETBIT", user_key, (*args)[0], (*args)[1]};
+          break;
+        }
         bool bit_value = Redis::Bitmap::GetBitFromValueAndOffset(value.ToString(), std::stoi((*args)[0]));
         command_args = {"SETBIT", user_key, (*args)[0], bit_value ? "1" : "0"};
         break;
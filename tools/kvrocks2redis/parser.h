@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <map>
 #include <vector>
@@ -28,22 +29,38 @@ class LatestSnapShot {
 
 class Parser {
  public:
-  explicit Parser(Engine::Storage *storage, Writer *writer)
-      : storage_(storage), writer_(writer) {
+  explicit Parser(Engine::Storage *storage, Writer *writer, Kvrocks2redis::Config *config)
+      : storage_(storage), writer_(writer), config_(config) {
     lastest_snapshot_ = new LatestSnapShot(storage->GetDB());
   }
   ~Parser() { delete lastest_snapshot_; }
+  // The full db was split into the key ranges and parsed by the parse-threads
   Status ParseFullDB();
   rocksdb::Status ParseWriteBatch(const std::string &batch_string);
 
  protected:
+  // The commands parsed by one thread were buffered and written to the aof
+  // files together, so the memory was bounded by the threads and buffer size.
+  struct ParseOutput {
+    std::map<std::string, std::string> aofs;
+    size_t bytes = 0;
+  };
+
   Engine::Storage *storage_ = nullptr;
   Writer *writer_ = nullptr;
+  Kvrocks2redis::Config *config_ = nullptr;
   LatestSnapShot *lastest_snapshot_ = nullptr;
+  std::atomic<uint64_t> parsed_keys_{0};
+  std::atomic<bool> parse_stop_{false};
 
-  Status parseSimpleKV(const Slice &ns_key, const Slice &value, int expire);
-  Status parseComplexKV(const Slice &ns_key, const Metadata &metadata);
-  Status parseBitmapSegment(const Slice &ns, const Slice &user_key, int index, const Slice &bitmap);
+  void splitRanges(std::vector<std::string> *boundaries);
+  Status parseRange(const std::string &begin, const std::string &end);
+  Status emit(ParseOutput *output, const std::string &ns, const std::string &aof);
+  Status flush(ParseOutput *output);
+  Status parseSimpleKV(ParseOutput *output, const Slice &ns_key, const Slice &value, int expire);
+  Status parseComplexKV(ParseOutput *output, const Slice &ns_key, const Metadata &metadata);
+  Status parseBitmapSegment(ParseOutput *output, const std::string &ns, const std::string &user_key,
+                            int index, const Slice &bitmap);
 };
 
 /*
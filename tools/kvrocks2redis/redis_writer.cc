@@ -1,7 +1,12 @@
 #include "redis_writer.h"
 #include <fcntl.h>
 #include <unistd.h>
-#include <assert.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <algorithm>
 #include <system_error>
 
 #include "../../src/util.h"
@@ -9,25 +14,50 @@
 
 #include "util.h"
 
+namespace {
+
+const int kProgressIntervalSecs = 10;
+// The blocking I/O with redis failed after the timeout, and then the commands
+// without replies were sent again after reconnecting.
+const uint64_t kConnectTimeoutMs = 3000;
+const int kSocketTimeoutSecs = 60;
+
+}  // namespace
+
 RedisWriter::RedisWriter(Kvrocks2redis::Config *config) : Writer(config) {
-  try {
-    t_ = std::thread([this]() {
-      Util::ThreadSetName("redis-writer");
-      this->sync();
-      assert(stop_flag_);
-    });
-  } catch (const std::system_error &e) {
-    LOG(ERROR) << "[kvrocks2redis] Failed to create thread: " << e.what();
-    return;
+  for (const auto &iter : config_->tokens) {
+    auto sender = std::unique_ptr<Sender>(new Sender);
+    sender->ns = iter.first;
+    sender->server = iter.second;
+    sender->read_size = static_cast<size_t>(config_->pipeline_max_bytes);
+    senders_[iter.first] = std::move(sender);
+  }
+  for (const auto &iter : senders_) {
+    auto sender = iter.second.get();
+    // the offset must be read before the FlushAll of the parser
+    Status s = readNextOffsetFromFile(sender);
+    if (!s.IsOK()) {
+      LOG(ERROR) << s.Msg();
+      continue;
+    }
+    try {
+      sender->t = std::thread([this, sender]() {
+        Util::ThreadSetName("redis-writer");
+        this->sync(sender);
+      });
+    } catch (const std::system_error &e) {
+      LOG(ERROR) << "[kvrocks2redis] Failed to create thread: " << e.what();
+      return;
+    }
   }
 }
 
 RedisWriter::~RedisWriter() {
-  for (const auto &iter : next_offset_fds_) {
-    close(iter.second);
-  }
-  for (const auto &iter : redis_fds_) {
-    close(iter.second);
+  Stop();
+  for (const auto &iter : senders_) {
+    if (iter.second->next_offset_fd >= 0) close(iter.second->next_offset_fd);
+    if (iter.second->aof_fd >= 0) close(iter.second->aof_fd);
+    if (iter.second->redis_fd >= 0) close(iter.second->redis_fd);
   }
 }
 
@@ -38,130 +68,234 @@ Status RedisWriter::Write(const std::string &ns, const std::vector<std::string>
   }
 
   return Status::OK();
-
 }
 
 Status RedisWriter::FlushAll(const std::string &ns) {
-  auto s = Writer::FlushAll(ns);
-  if (!s.IsOK()) {
-    return s;
+  auto iter = senders_.find(ns);
+  {
+    std::unique_lock<std::mutex> lock;
+    if (iter != senders_.end()) lock = std::unique_lock<std::mutex>(iter->second->mu);
+    auto s = Writer::FlushAll(ns);
+    if (!s.IsOK()) {
+      return s;
+    }
+    if (iter != senders_.end()) {
+      iter->second->offset_resets++;
+      updateNextOffset(iter->second.get(), 0);
+    }
   }
 
-  updateNextOffset(ns, 0);
-
   //Warning: this will flush all redis data
-  s = Write(ns, {Rocksdb2Redis::Command2RESP({"FLUSHALL"})});
+  auto s = Write(ns, {Rocksdb2Redis::Command2RESP({"FLUSHALL"})});
   if (!s.IsOK()) return s;
 
   return Status::OK();
 }
 
 void RedisWriter::Stop() {
-  if (stop_flag_) return;
-
-  stop_flag_ = true;  // Stopping procedure is asynchronous,
+  if (stopped_) return;
 
-  t_.join();
-  // handled by sync func
+  stopped_ = true;
+  stop_flag_ = true;
+  for (const auto &iter : senders_) {
+    if (iter.second->t.joinable()) iter.second->t.join();
+  }
   LOG(INFO) << "[kvrocks2redis] redis_writer Stopped";
 }
 
-void RedisWriter::sync() {
-  for (const auto &iter : config_->tokens) {
-    Status s = readNextOffsetFromFile(iter.first, &next_offsets_[iter.first]);
+void RedisWriter::sync(Sender *sender) {
+  Status s;
+  sender->last_report_time = std::chrono::steady_clock::now();
+  while (!stop_flag_) {
+    reportProgress(sender);
+    s = getRedisConn(sender);
     if (!s.IsOK()) {
       LOG(ERROR) << s.Msg();
-      return;
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
     }
+    bool sent = false;
+    s = sendPipeline(sender, &sent);
+    if (!s.IsOK()) {
+      // the pipeline would be sent again from the offset after reconnecting
+      LOG(ERROR) << "[kvrocks2redis] Failed to send the commands of namespace " << sender->ns << ", err: " << s.Msg();
+      closeRedisConn(sender);
+      if (!stop_flag_) std::this_thread::sleep_for(std::chrono::seconds(1));
+      continue;
+    }
+    if (!sent) std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
+}
 
-  std::string line;
-  size_t chunk_size = 4 * 1024 * 1024;
-  char *buffer = new char[chunk_size];
-  while (!stop_flag_) {
-    for (const auto &iter : config_->tokens) {
-      Status s = GetAofFd(iter.first);
-      if (!s.IsOK()) {
-        LOG(ERROR) << s.Msg();
-        continue;
-      }
-      s = getRedisConn(iter.first, iter.second.host, iter.second.port, iter.second.auth, iter.second.db_number);
-      if (!s.IsOK()) {
-        LOG(ERROR) << s.Msg();
-        continue;
-      }
-      while (true) {
-        auto getted_line_leng = pread(aof_fds_[iter.first], buffer, chunk_size, next_offsets_[iter.first]);
-        if (getted_line_leng <= 0) {
-          if (getted_line_leng < 0) {
-            LOG(ERROR) << "ERR read aof file : " << strerror(errno);
-          }
-          break;
-        }
-        s = Util::SockSend(redis_fds_[iter.first], std::string(buffer, getted_line_leng));
-        if (!s.IsOK()) {
-          LOG(ERROR) << "ERR send data to redis err: " + s.Msg();
-          break;
-        }
-        s = Util::SockReadLine(redis_fds_[iter.first], &line);
-        if (!s.IsOK()) {
-          LOG(ERROR) << "read redis response err: " + s.Msg();
-          break;
-        }
-        if (line.compare(0, 1, "-") == 0) {
-          // Ooops, something went wrong , sync process has been terminated, administrator should be notified
-          // when full sync is needed, please remove last_next_seq config file, and restart kvrocks2redis
-          LOG(ERROR) << "[kvrocks2redis] CRITICAL - redis sync return error , administrator confirm needed : " << line;
-          Stop();
-          return;
-        }
-        updateNextOffset(iter.first, next_offsets_[iter.first] + getted_line_leng);
+// Send the complete commands from the offset of the aof file in one pipeline,
+// and then read all their replies, the offset was advanced after that. The lock
+// was held only while reading the aof file and updating the offset, so FlushAll
+// wasn't blocked by the network, and the offset wasn't advanced if it was reset.
+Status RedisWriter::sendPipeline(Sender *sender, bool *sent) {
+  *sent = false;
+  std::istream::off_type offset = 0;
+  uint64_t resets = 0;
+  ssize_t n = 0;
+  {
+    std::lock_guard<std::mutex> guard(sender->mu);
+    if (sender->aof_fd < 0) {
+      sender->aof_fd = open(GetAofFilePath(sender->ns).data(), O_RDONLY);
+      if (sender->aof_fd < 0) {
+        if (errno == ENOENT) return Status::OK();  // nothing was written yet
+        return Status(Status::NotOK, std::string("Failed to open aof file :") + strerror(errno));
       }
-      std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    if (sender->buffer.size() < sender->read_size) sender->buffer.resize(sender->read_size);
+    offset = sender->next_offset;
+    resets = sender->offset_resets;
+    n = pread(sender->aof_fd, &sender->buffer[0], sender->read_size, offset);
   }
-  delete[] buffer;
-}
+  if (n < 0) return Status(Status::NotOK, std::string("ERR read aof file : ") + strerror(errno));
+  if (n == 0) return Status::OK();
 
-Status RedisWriter::getRedisConn(const std::string &ns,
-                                 const std::string &host,
-                                 uint32_t port,
-                                 const std::string &auth,
-                                 int db_index) {
-  auto iter = redis_fds_.find(ns);
-  if (iter == redis_fds_.end()) {
-    auto s = Util::SockConnect(host, port, &redis_fds_[ns]);
-    if (!s.IsOK()) {
-      return Status(Status::NotOK, std::string("Failed to connect to redis :") + s.Msg());
+  // the end of every command in the buffer
+  std::vector<size_t> ends;
+  size_t len = 0;
+  while (ends.size() < static_cast<size_t>(config_->pipeline_max_commands)) {
+    int ret = Rocksdb2Redis::ScanCommand(sender->buffer.data(), static_cast<size_t>(n), &len);
+    if (ret < 0) {
+      stop_flag_ = true;
+      return Status(Status::NotOK, "[kvrocks2redis] CRITICAL - invalid command in the aof file at offset "
+                                   + std::to_string(offset + len));
     }
+    if (ret == 0) break;
+    ends.emplace_back(len);
+  }
+  if (ends.empty()) {
+    // the command was larger than the read size, or it was being written
+    if (static_cast<size_t>(n) == sender->read_size) sender->read_size *= 2;
+    return Status::OK();
+  }
+  sender->read_size = static_cast<size_t>(config_->pipeline_max_bytes);
 
-    if (!auth.empty()) {
-      auto s = authRedis(ns, auth);
-      if (!s.IsOK()) {
-        close(redis_fds_[ns]);
-        redis_fds_.erase(ns);
-        return Status(Status::NotOK, s.Msg());
+  std::vector<iovec> iov = {{&sender->buffer[0], len}};
+  auto s = Util::SockSendv(sender->redis_fd, &iov);
+  if (!s.IsOK()) return Status(Status::NotOK, "ERR send data to redis err: " + s.Msg());
+  size_t replied = 0;
+  s = readReplies(sender, ends.size(), &replied);
+  // The commands whose replies were read were never sent again, since they
+  // might be not idempotent, e.g. INCR and LPUSH.
+  if (replied > 0) {
+    std::lock_guard<std::mutex> guard(sender->mu);
+    if (sender->offset_resets == resets) updateNextOffset(sender, offset + ends[replied - 1]);
+  }
+  sender->sent_commands += replied;
+  sender->sent_bytes += replied > 0 ? ends[replied - 1] : 0;
+  if (!s.IsOK()) return s;
+  *sent = true;
+  return Status::OK();
+}
+
+// The replied was set to the number of the commands which were replied without
+// error, even if the rest of the replies failed to be read.
+Status RedisWriter::readReplies(Sender *sender, size_t commands, size_t *replied) {
+  *replied = 0;
+  auto &replies = sender->replies;
+  size_t pos = 0;
+  char buf[16 * 1024];
+  while (*replied < commands) {
+    bool is_error = false;
+    size_t start = pos;
+    int ret = Rocksdb2Redis::ScanReply(replies.data(), replies.size(), &pos, &is_error);
+    if (ret < 0) return Status(Status::NotOK, "read redis response err: invalid reply");
+    if (ret == 0) {
+      auto n = read(sender->redis_fd, buf, sizeof(buf));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        return Status(Status::NotOK, std::string("read redis response err: ")
+                                     + (n == 0 ? "connection closed" : strerror(errno)));
       }
+      replies.append(buf, n);
+      continue;
     }
-    if (db_index != 0) {
-      auto s = selectDB(ns, db_index);
-      if (!s.IsOK()) {
-        close(redis_fds_[ns]);
-        redis_fds_.erase(ns);
-        return Status(Status::NotOK, s.Msg());
-      }
+    if (is_error) {
+      // Ooops, something went wrong , sync process has been terminated, administrator should be notified
+      // when full sync is needed, please remove last_next_seq config file, and restart kvrocks2redis
+      stop_flag_ = true;
+      auto end = replies.find('\r', start);
+      return Status(Status::NotOK, "[kvrocks2redis] CRITICAL - redis sync return error , administrator confirm needed : "
+                                   + replies.substr(start, end - start));
+    }
+    (*replied)++;
+  }
+  replies.erase(0, pos);
+  return Status::OK();
+}
+
+void RedisWriter::reportProgress(Sender *sender) {
+  auto now = std::chrono::steady_clock::now();
+  auto elapsed = std::chrono::duration<double>(now - sender->last_report_time).count();
+  if (elapsed < kProgressIntervalSecs) return;
+
+  struct stat st;
+  int64_t backlog = 0;
+  if (sender->aof_fd >= 0 && fstat(sender->aof_fd, &st) == 0) {
+    backlog = std::max<int64_t>(st.st_size - sender->next_offset, 0);
+  }
+  auto bytes_per_sec = static_cast<double>(sender->sent_bytes - sender->last_sent_bytes) / elapsed;
+  auto commands_per_sec = static_cast<double>(sender->sent_commands - sender->last_sent_commands) / elapsed;
+  if (bytes_per_sec > 0 || backlog > 0) {
+    LOG(INFO) << "[kvrocks2redis] namespace " << sender->ns << ": sent " << sender->sent_commands << " commands, "
+              << static_cast<uint64_t>(commands_per_sec) << " commands/s, "
+              << static_cast<uint64_t>(bytes_per_sec / 1024) << " KB/s, backlog " << backlog / 1024 << " KB, ETA "
+              << (bytes_per_sec > 0 ? std::to_string(static_cast<int64_t>(backlog / bytes_per_sec)) + "s" : "unknown");
+  }
+  sender->last_sent_bytes = sender->sent_bytes;
+  sender->last_sent_commands = sender->sent_commands;
+  sender->last_report_time = now;
+}
+
+Status RedisWriter::getRedisConn(Sender *sender) {
+  if (sender->redis_fd >= 0) return Status::OK();
+
+  const auto &server = sender->server;
+  auto s = Util::SockConnect(server.host, server.port, &sender->redis_fd, kConnectTimeoutMs,
+                             kSocketTimeoutSecs * 1000);
+  if (!s.IsOK()) {
+    sender->redis_fd = -1;
+    return Status(Status::NotOK, std::string("Failed to connect to redis :") + s.Msg());
+  }
+  struct timeval tv = {kSocketTimeoutSecs, 0};
+  setsockopt(sender->redis_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  Util::SockSetTcpNoDelay(sender->redis_fd, 1);
+  sender->replies.clear();
+
+  if (!server.auth.empty()) {
+    auto s = authRedis(sender, server.auth);
+    if (!s.IsOK()) {
+      closeRedisConn(sender);
+      return Status(Status::NotOK, s.Msg());
+    }
+  }
+  if (server.db_number != 0) {
+    auto s = selectDB(sender, server.db_number);
+    if (!s.IsOK()) {
+      closeRedisConn(sender);
+      return Status(Status::NotOK, s.Msg());
     }
   }
 
   return Status::OK();
 }
 
-Status RedisWriter::authRedis(const std::string &ns, const std::string &auth) {
+void RedisWriter::closeRedisConn(Sender *sender) {
+  if (sender->redis_fd < 0) return;
+  close(sender->redis_fd);
+  sender->redis_fd = -1;
+  sender->replies.clear();
+}
+
+Status RedisWriter::authRedis(Sender *sender, const std::string &auth) {
   const auto auth_len_str = std::to_string(auth.length());
-  Util::SockSend(redis_fds_[ns], "*2" CRLF "$4" CRLF "auth" CRLF "$" + auth_len_str + CRLF +
+  Util::SockSend(sender->redis_fd, "*2" CRLF "$4" CRLF "auth" CRLF "$" + auth_len_str + CRLF +
       auth + CRLF);
   std::string line;
-  auto s = Util::SockReadLine(redis_fds_[ns], &line);
+  auto s = Util::SockReadLine(sender->redis_fd, &line);
   if (!s.IsOK()) {
     return Status(Status::NotOK, std::string("read redis auth response err: ") + s.Msg());
   }
@@ -171,14 +305,14 @@ Status RedisWriter::authRedis(const std::string &ns, const std::string &auth) {
   return Status::OK();
 }
 
-Status RedisWriter::selectDB(const std::string &ns, int db_number) {
+Status RedisWriter::selectDB(Sender *sender, int db_number) {
   const auto db_number_str = std::to_string(db_number);
   const auto db_number_str_len = std::to_string(db_number_str.length());
-  Util::SockSend(redis_fds_[ns], "*2" CRLF "$6" CRLF "select" CRLF "$" + db_number_str_len + CRLF +
+  Util::SockSend(sender->redis_fd, "*2" CRLF "$6" CRLF "select" CRLF "$" + db_number_str_len + CRLF +
       db_number_str + CRLF);
   LOG(INFO) << "[kvrocks2redis] select db request was sent, waiting for response";
   std::string line;
-  auto s = Util::SockReadLine(redis_fds_[ns], &line);
+  auto s = Util::SockReadLine(sender->redis_fd, &line);
   if (!s.IsOK()) {
     return Status(Status::NotOK, std::string("read select db response err: ") + s.Msg());
   }
@@ -188,29 +322,29 @@ Status RedisWriter::selectDB(const std::string &ns, int db_number) {
   return Status::OK();
 }
 
-Status RedisWriter::updateNextOffset(const std::string &ns, std::istream::off_type offset) {
-  next_offsets_[ns] = offset;
-  return writeNextOffsetToFile(ns, offset);
+Status RedisWriter::updateNextOffset(Sender *sender, std::istream::off_type offset) {
+  sender->next_offset = offset;
+  return writeNextOffsetToFile(sender, offset);
 }
 
-Status RedisWriter::readNextOffsetFromFile(const std::string &ns, std::istream::off_type *offset) {
-  next_offset_fds_[ns] = open(getNextOffsetFilePath(ns).data(), O_RDWR | O_CREAT, 0666);
-  if (next_offset_fds_[ns] < 0) {
+Status RedisWriter::readNextOffsetFromFile(Sender *sender) {
+  sender->next_offset_fd = open(getNextOffsetFilePath(sender->ns).data(), O_RDWR | O_CREAT, 0666);
+  if (sender->next_offset_fd < 0) {
     return Status(Status::NotOK, std::string("Failed to open next offset file :") + strerror(errno));
   }
 
-  *offset = 0;
+  sender->next_offset = 0;
   // 256 + 1 byte, extra one byte for the ending \0
   char buf[257];
   memset(buf, '\0', sizeof(buf));
-  if (read(next_offset_fds_[ns], buf, sizeof(buf)) > 0) {
-    *offset = std::stoll(buf);
+  if (read(sender->next_offset_fd, buf, sizeof(buf)) > 0) {
+    sender->next_offset = std::stoll(buf);
   }
 
   return Status::OK();
 }
 
-Status RedisWriter::writeNextOffsetToFile(const std::string &ns, std::istream::off_type offset) {
+Status RedisWriter::writeNextOffsetToFile(Sender *sender, std::istream::off_type offset) {
   std::string offset_string = std::to_string(offset);
   // append to 256 byte (overwrite entire first 21 byte, aka the largest SequenceNumber size )
   int append_byte = 256 - offset_string.size();
@@ -218,7 +352,7 @@ Status RedisWriter::writeNextOffsetToFile(const std::string &ns, std::istream::o
     offset_string += " ";
   }
   offset_string += '\0';
-  pwrite(next_offset_fds_[ns], offset_string.data(), offset_string.size(), 0);
+  pwrite(sender->next_offset_fd, offset_string.data(), offset_string.size(), 0);
   return Status::OK();
 }
 
@@ -1,6 +1,11 @@
 #pragma once
 
 #include <glog/logging.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <thread>
@@ -17,23 +22,46 @@ class RedisWriter : public Writer {
   void Stop() override;
 
  private:
-  std::thread t_;
-  bool stop_flag_ = false;
-  std::map<std::string, int> next_offset_fds_;
-  std::map<std::string, std::istream::off_type> next_offsets_;
-  std::map<std::string, int> redis_fds_;
-
-  void sync();
-  Status getRedisConn(const std::string &ns,
-                      const std::string &host,
-                      uint32_t port,
-                      const std::string &auth,
-                      int db_index);
-  Status authRedis(const std::string &ns, const std::string &auth);
-  Status selectDB(const std::string &ns, int db_number);
-
-  Status updateNextOffset(const std::string &ns, std::istream::off_type offset);
-  Status readNextOffsetFromFile(const std::string &ns, std::istream::off_type *offset);
-  Status writeNextOffsetToFile(const std::string &ns, std::istream::off_type offset);
+  // Every namespace was sent to its redis by one thread, which reads the
+  // commands from the aof file and sends them in the pipeline.
+  struct Sender {
+    std::string ns;
+    Kvrocks2redis::redis_server server;
+    std::thread t;
+    // held while reading the aof file and updating the offset
+    std::mutex mu;
+    // the times the offset was reset by FlushAll
+    uint64_t offset_resets = 0;
+    int aof_fd = -1;
+    int redis_fd = -1;
+    int next_offset_fd = -1;
+    std::istream::off_type next_offset = 0;
+    std::string buffer;
+    size_t read_size = 0;
+    std::string replies;
+
+    uint64_t sent_commands = 0;
+    uint64_t sent_bytes = 0;
+    uint64_t last_sent_commands = 0;
+    uint64_t last_sent_bytes = 0;
+    std::chrono::steady_clock::time_point last_report_time;
+  };
+
+  std::atomic<bool> stop_flag_{false};
+  bool stopped_ = false;
+  std::map<std::string, std::unique_ptr<Sender>> senders_;
+
+  void sync(Sender *sender);
+  Status sendPipeline(Sender *sender, bool *sent);
+  Status readReplies(Sender *sender, size_t commands, size_t *replied);
+  void reportProgress(Sender *sender);
+  Status getRedisConn(Sender *sender);
+  void closeRedisConn(Sender *sender);
+  Status authRedis(Sender *sender, const std::string &auth);
+  Status selectDB(Sender *sender, int db_number);
+
+  Status updateNextOffset(Sender *sender, std::istream::off_type offset);
+  Status readNextOffsetFromFile(Sender *sender);
+  Status writeNextOffsetToFile(Sender *sender, std::istream::off_type offset);
   std::string getNextOffsetFilePath(const std::string &ns);
 };
@@ -0,0 +1,35 @@
+#!/usr/bin/env python3
+# Populate kvrocks with the keys of all types for benchmarking kvrocks2redis
+import argparse
+
+import redis
+
+
+def main():
+    parser = argparse.ArgumentParser(description='populate kvrocks for benchmarking kvrocks2redis')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=6666)
+    parser.add_argument('--password', default='foobared')
+    parser.add_argument('--keys', type=int, default=100000, help='keys of every type')
+    parser.add_argument('--fields', type=int, default=100, help='fields of every complex key')
+    parser.add_argument('--value-size', type=int, default=64)
+    args = parser.parse_args()
+
+    r = redis.StrictRedis(host=args.host, port=args.port, password=args.password)
+    value = 'v' * args.value_size
+    pipe = r.pipeline(transaction=False)
+    for i in range(args.keys):
+        pipe.set('bench_string_%d' % i, value)
+        pipe.hset('bench_hash_%d' % i, mapping={'f%d' % j: value for j in range(args.fields)})
+        pipe.sadd('bench_set_%d' % i, *['m%d' % j for j in range(args.fields)])
+        pipe.zadd('bench_zset_%d' % i, {'m%d' % j: j for j in range(args.fields)})
+        pipe.rpush('bench_list_%d' % i, *[value] * args.fields)
+        pipe.setbit('bench_bitmap_%d' % i, i * 8, 1)
+        if i % 100 == 99:
+            pipe.execute()
+    pipe.execute()
+    print('populated %d keys of every type' % args.keys)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+# A redis-server stand-in for benchmarking kvrocks2redis, it accepts the pipelined
+# commands, replies +OK to each of them, and reports the throughput. It exits and
+# prints the summary after it was idle for the --idle seconds since the first command.
+import argparse
+import socket
+import threading
+import time
+
+lock = threading.Lock()
+stats = {'commands': 0, 'bytes': 0, 'first': 0.0, 'last': 0.0}
+
+
+def scan_command(buf, pos):
+    """Return the end of the command which starts at the pos, or -1 if it's incomplete"""
+    end = buf.find(b'\r\n', pos)
+    if end < 0:
+        return -1
+    if buf[pos:pos + 1] != b'*':
+        raise ValueError('invalid command: %r' % buf[pos:end])
+    args = int(buf[pos + 1:end])
+    pos = end + 2
+    for _ in range(args):
+        end = buf.find(b'\r\n', pos)
+        if end < 0:
+            return -1
+        size = int(buf[pos + 1:end])
+        pos = end + 2 + size + 2
+        if pos > len(buf):
+            return -1
+    return pos
+
+
+def serve(conn):
+    buf = b''
+    with conn:
+        while True:
+            data = conn.recv(1024 * 1024)
+            if not data:
+                return
+            buf += data
+            pos, commands = 0, 0
+            while pos < len(buf):
+                end = scan_command(buf, pos)
+                if end < 0:
+                    break
+                pos, commands = end, commands + 1
+            buf = buf[pos:]
+            if commands == 0:
+                continue
+            conn.sendall(b'+OK\r\n' * commands)
+            now = time.time()
+            with lock:
+                if stats['commands'] == 0:
+                    stats['first'] = now
+                stats['commands'] += commands
+                stats['bytes'] += pos
+                stats['last'] = now
+
+
+def report(interval, idle):
+    last_commands, last_bytes = 0, 0
+    while True:
+        time.sleep(interval)
+        with lock:
+            commands, size, first, last = stats['commands'], stats['bytes'], stats['first'], stats['last']
+        if commands > last_commands:
+            print('%d commands, %.0f commands/s, %.2f MB/s' % (
+                commands, (commands - last_commands) / interval, (size - last_bytes) / interval / 1024 / 1024),
+                flush=True)
+        last_commands, last_bytes = commands, size
+        if commands > 0 and time.time() - last > idle:
+            elapsed = max(last - first, 0.001)
+            print('total: %d commands, %.2f MB in %.2fs, %.0f commands/s, %.2f MB/s' % (
+                commands, size / 1024 / 1024, elapsed, commands / elapsed, size / elapsed / 1024 / 1024), flush=True)
+            return
+
+
+def main():
+    parser = argparse.ArgumentParser(description='redis-server stand-in for benchmarking kvrocks2redis')
+    parser.add_argument('--host', default='127.0.0.1')
+    parser.add_argument('--port', type=int, default=6379)
+    parser.add_argument('--interval', type=float, default=1.0, help='seconds between the reports')
+    parser.add_argument('--idle', type=float, default=10.0, help='exit after idle seconds')
+    args = parser.parse_args()
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind((args.host, args.port))
+    server.listen(64)
+
+    def accept():
+        while True:
+            conn, _ = server.accept()
+            conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            threading.Thread(target=serve, args=(conn,), daemon=True).start()
+
+    threading.Thread(target=accept, daemon=True).start()
+    print('listening on %s:%d' % (args.host, args.port), flush=True)
+    report(args.interval, args.idle)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,7 +1,68 @@
 #include "util.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include "../../src/redis_reply.h"
 
+namespace {
+
+const int kMaxReplyDepth = 8;
+
+// Read the line without CRLF which starts at the pos, and move the pos after the CRLF
+int scanLine(const char *data, size_t len, size_t *pos, std::string *line) {
+  auto start = data + *pos;
+  auto end = static_cast<const char *>(memchr(start, '\n', len - *pos));
+  if (end == nullptr) return 0;
+  if (end == start || *(end - 1) != '\r') return -1;
+  line->assign(start, end - 1 - start);
+  *pos = end - data + 1;
+  return 1;
+}
+
+bool parseLength(const std::string &line, int64_t *length) {
+  if (line.size() < 2) return false;
+  char *end = nullptr;
+  *length = strtoll(line.c_str() + 1, &end, 10);
+  return *end == '\0' && *length >= -1;
+}
+
+int scanBulk(const char *data, size_t len, size_t *pos, int64_t length) {
+  if (length < 0) return 1;
+  if (len - *pos < static_cast<size_t>(length) + 2) return 0;
+  if (data[*pos + length] != '\r' || data[*pos + length + 1] != '\n') return -1;
+  *pos += length + 2;
+  return 1;
+}
+
+int scanReply(const char *data, size_t len, size_t *pos, bool *is_error, int depth) {
+  std::string line;
+  int ret = scanLine(data, len, pos, &line);
+  if (ret != 1) return ret;
+  if (line.empty()) return -1;
+  int64_t length = 0;
+  switch (line[0]) {
+    case '-':*is_error = true;
+      return 1;
+    case '+':
+    case ':':return 1;
+    case '$':
+      if (!parseLength(line, &length)) return -1;
+      return scanBulk(data, len, pos, length);
+    case '*':
+      if (!parseLength(line, &length) || depth >= kMaxReplyDepth) return -1;
+      for (int64_t i = 0; i < length; i++) {
+        bool element_is_error = false;
+        ret = scanReply(data, len, pos, &element_is_error, depth + 1);
+        if (ret != 1) return ret;
+      }
+      return 1;
+    default:return -1;
+  }
+}
+
+}  // namespace
+
 std::string Rocksdb2Redis::Command2RESP(const std::vector<std::string> &cmd_args) {
   std::string output;
   output.append("*" + std::to_string(cmd_args.size()) + CRLF);
@@ -11,3 +72,30 @@ std::string Rocksdb2Redis::Command2RESP(const std::vector<std::string> &cmd_args
   }
   return output;
 }
+
+int Rocksdb2Redis::ScanCommand(const char *data, size_t len, size_t *pos) {
+  size_t cur = *pos;
+  std::string line;
+  int64_t args = 0;
+  int ret = scanLine(data, len, &cur, &line);
+  if (ret != 1) return ret;
+  if (line[0] != '*' || !parseLength(line, &args) || args <= 0) return -1;
+  for (int64_t i = 0; i < args; i++) {
+    int64_t length = 0;
+    ret = scanLine(data, len, &cur, &line);
+    if (ret != 1) return ret;
+    if (line[0] != '$' || !parseLength(line, &length) || length < 0) return -1;
+    ret = scanBulk(data, len, &cur, length);
+    if (ret != 1) return ret;
+  }
+  *pos = cur;
+  return 1;
+}
+
+int Rocksdb2Redis::ScanReply(const char *data, size_t len, size_t *pos, bool *is_error) {
+  size_t cur = *pos;
+  *is_error = false;
+  int ret = scanReply(data, len, &cur, is_error, 0);
+  if (ret == 1) *pos = cur;
+  return ret;
+}
@@ -6,4 +6,8 @@
 class Rocksdb2Redis {
  public:
   static std::string Command2RESP(const std::vector<std::string> &cmd_args);
+  // Scan the RESP command or reply which starts at the pos, return 1 and move the pos
+  // to its end if it's complete, 0 if more data was needed, and -1 if it's invalid.
+  static int ScanCommand(const char *data, size_t len, size_t *pos);
+  static int ScanReply(const char *data, size_t len, size_t *pos, bool *is_error);
 };
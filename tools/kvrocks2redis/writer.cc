@@ -10,7 +10,8 @@ Writer::~Writer() {
 }
 
 Status Writer::Write(const std::string &ns, const std::vector<std::string> &aofs) {
-  auto s = GetAofFd(ns);
+  std::lock_guard<std::mutex> guard(aof_mu_);
+  auto s = getAofFd(ns);
   if (!s.IsOK()) {
     return Status(Status::NotOK, s.Msg());
   }
@@ -22,7 +23,8 @@ Status Writer::Write(const std::string &ns, const std::vector<std::string> &aofs
 }
 
 Status Writer::FlushAll(const std::string &ns) {
-  auto s = GetAofFd(ns, true);
+  std::lock_guard<std::mutex> guard(aof_mu_);
+  auto s = getAofFd(ns, true);
   if (!s.IsOK()) {
     return Status(Status::NotOK, s.Msg());
   }
@@ -30,13 +32,13 @@ Status Writer::FlushAll(const std::string &ns) {
   return Status::OK();
 }
 
-Status Writer::GetAofFd(const std::string &ns, bool truncate) {
+Status Writer::getAofFd(const std::string &ns, bool truncate) {
   auto aof_fd = aof_fds_.find(ns);
   if (aof_fd == aof_fds_.end()) {
-    return OpenAofFile(ns, truncate);
+    return openAofFile(ns, truncate);
   } else if (truncate) {
     close(aof_fds_[ns]);
-    return OpenAofFile(ns, truncate);
+    return openAofFile(ns, truncate);
   }
   if (aof_fds_[ns] < 0) {
     return Status(Status::NotOK, std::string("Failed to open aof file :") + strerror(errno));
@@ -44,7 +46,7 @@ Status Writer::GetAofFd(const std::string &ns, bool truncate) {
   return Status::OK();
 }
 
-Status Writer::OpenAofFile(const std::string &ns, bool truncate) {
+Status Writer::openAofFile(const std::string &ns, bool truncate) {
   int openmode = O_RDWR | O_CREAT | O_APPEND;
   if (truncate) {
     openmode |= O_TRUNC;
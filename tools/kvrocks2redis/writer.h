@@ -3,6 +3,7 @@
 #include <string>
 #include <map>
 #include <fstream>
+#include <mutex>
 #include <vector>
 
 #include "../../src/status.h"
@@ -16,11 +17,15 @@ class Writer {
   virtual Status Write(const std::string &ns, const std::vector<std::string> &aofs);
   virtual Status FlushAll(const std::string &ns);
   virtual void Stop() {};
-  Status OpenAofFile(const std::string &ns, bool truncate);
-  Status GetAofFd(const std::string &ns, bool truncate = false);
   std::string GetAofFilePath(const std::string &ns);
 
  protected:
   Kvrocks2redis::Config *config_ = nullptr;
+  // The full db was parsed by multiple threads, so the aof files were
+  // written with the lock.
+  std::mutex aof_mu_;
   std::map<std::string, int> aof_fds_;
+
+  Status openAofFile(const std::string &ns, bool truncate);
+  Status getAofFd(const std::string &ns, bool truncate = false);
 };
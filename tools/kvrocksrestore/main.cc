@@ -11,9 +11,13 @@
 #include <signal.h>
 #include <execinfo.h>
 #include <ucontext.h>
+#include <inttypes.h>
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "version.h"
+#include "../../src/wal_archive.h"
 
 #if defined(__APPLE__) || defined(__linux__)
 #define HAVE_BACKTRACE 1
@@ -25,8 +29,13 @@ const char *kDefaultDbDir = "./db";
 std::function<void()> hup_handler;
 
 struct Options {
+  std::string mode = "backup";
   std::string backup_dir = kDefaultBackupDir;
   std::string db_dir = kDefaultDbDir;
+  std::string archive_dir;
+  rocksdb::SequenceNumber target_seq = 0;  // 0 means the latest
+  int64_t target_time = 0;  // 0 means the latest
+  int copy_threads = 4;
   bool show_usage = false;
 };
 
@@ -118,9 +127,14 @@ void setupSigSegvAction() {
 #endif /* HAVE_BACKTRACE */
 
 static void usage(const char *program) {
-  std::cout << program << " restore kvrocks from backup_dir \n"
+  std::cout << program << " restore kvrocks from backup_dir, or from the WAL archive to a point in time\n"
+            << "\t-m mode, backup or pitr, default is backup\n"
             << "\t-b backup_dir, default is " << kDefaultBackupDir << "\n"
             << "\t-d db_dir, default is " << kDefaultDbDir << "\n"
+            << "\t-a archive_dir, the wal-archive-dir of the server, used by the pitr mode\n"
+            << "\t-s target_seq, restore to the last batch not after the seq, default is the latest\n"
+            << "\t-t target_unixtime, restore to the last batch archived not after the time, default is the latest\n"
+            << "\t-j threads to copy the checkpoint files, default is 4\n"
             << "\t-h help\n";
   exit(0);
 }
@@ -128,12 +142,22 @@ static void usage(const char *program) {
 static Options parseCommandLineOptions(int argc, char **argv) {
   int ch;
   Options opts;
-  while ((ch = ::getopt(argc, argv, "b:d:hv")) != -1) {
+  while ((ch = ::getopt(argc, argv, "m:b:d:a:s:t:j:hv")) != -1) {
     switch (ch) {
+      case 'm':opts.mode = optarg;
+        break;
       case 'b':opts.backup_dir = optarg;
         break;
       case 'd':opts.db_dir = optarg;
         break;
+      case 'a':opts.archive_dir = optarg;
+        break;
+      case 's':opts.target_seq = strtoull(optarg, nullptr, 10);
+        break;
+      case 't':opts.target_time = strtoll(optarg, nullptr, 10);
+        break;
+      case 'j':opts.copy_threads = std::max(atoi(optarg), 1);
+        break;
       case 'h': opts.show_usage = true;
         break;
       case 'v': exit(0);
@@ -143,6 +167,40 @@ static Options parseCommandLineOptions(int argc, char **argv) {
   return opts;
 }
 
+static Status restoreToPointInTime(const Options &opts) {
+  auto env = rocksdb::Env::Default();
+  std::vector<std::string> children;
+  if (env->GetChildren(opts.db_dir, &children).ok() && children.size() > 2) {
+    return Status(Status::NotOK, "db_dir " + opts.db_dir + " isn't empty");
+  }
+  WALArchive::CheckpointInfo base;
+  auto status = WALArchive::PickCheckpoint(env, opts.archive_dir, opts.target_seq, opts.target_time, &base);
+  if (!status.IsOK()) return status;
+  LOG(INFO) << "Restore started from the checkpoint " << base.path << " with seq " << base.seq << std::endl;
+  status = WALArchive::CopyCheckpoint(env, base.path, opts.db_dir, opts.copy_threads);
+  if (!status.IsOK()) return status;
+
+  rocksdb::Options options;
+  std::vector<std::string> cf_names;
+  auto s = rocksdb::DB::ListColumnFamilies(options, opts.db_dir, &cf_names);
+  if (!s.ok()) return Status(Status::NotOK, "failed to list the column families: " + s.ToString());
+  std::vector<rocksdb::ColumnFamilyDescriptor> cf_descs;
+  for (const auto &name : cf_names) cf_descs.emplace_back(name, rocksdb::ColumnFamilyOptions());
+  std::vector<rocksdb::ColumnFamilyHandle *> cf_handles;
+  rocksdb::DB *db = nullptr;
+  s = rocksdb::DB::Open(options, opts.db_dir, cf_descs, &cf_handles, &db);
+  if (!s.ok()) return Status(Status::NotOK, "failed to open the db: " + s.ToString());
+
+  rocksdb::SequenceNumber restored_seq = 0;
+  status = WALArchive::Replay(env, opts.archive_dir, db, cf_handles, base.seq, opts.target_seq, opts.target_time,
+                              &restored_seq);
+  for (auto handle : cf_handles) db->DestroyColumnFamilyHandle(handle);
+  delete db;
+  if (!status.IsOK()) return status;
+  LOG(INFO) << "Restored the db to seq " << restored_seq << std::endl;
+  return Status::OK();
+}
+
 static void initGoogleLog(int loglevel = 0, const std::string &log_dir = "./") {
   FLAGS_minloglevel = loglevel;
   FLAGS_max_log_size = 100;
@@ -162,6 +220,17 @@ int main(int argc, char *argv[]) {
   std::cout << "Version: " << VERSION << " @" << GIT_COMMIT << std::endl;
   auto opts = parseCommandLineOptions(argc, argv);
   if (opts.show_usage) usage(argv[0]);
+  if (opts.mode == "pitr") {
+    if (opts.archive_dir.empty()) usage(argv[0]);
+    auto s = restoreToPointInTime(opts);
+    if (!s.IsOK()) {
+      LOG(ERROR) << "Failed to restore: " << s.Msg() << std::endl;
+      exit(1);
+    }
+    LOG(INFO) << "Success restored!" << std::endl;
+    return 0;
+  }
+  if (opts.mode != "backup") usage(argv[0]);
 
   rocksdb::BackupEngineReadOnly *backup_engine;
   auto s = rocksdb::BackupEngineReadOnly::Open(rocksdb::Env::Default(),